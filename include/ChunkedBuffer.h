@@ -0,0 +1,38 @@
+#pragma once
+#include "ggl.h"
+
+// 可以超过单个存储缓冲区绑定上限（maxStorageBufferBindingSize / maxBufferSize）的只读存储缓冲区：
+// 按元素拆成最多 kMaxChunks 块，每块是独立的缓冲区，在着色器中各占一个绑定。
+// 除最后一块外每块都是 chunkElements() 个元素，着色器用 arrayLength(第0块) 作为块大小，
+// 元素 i 在第 i / chunkElements 块的 i % chunkElements 处；只有一块时第0块正好是全部元素
+class ChunkedStorageBuffer
+{
+public:
+    static constexpr uint32_t kMaxChunks = 4;
+
+    // 创建能容纳 numElements 个元素的缓冲区（先释放旧的）。maxChunkBytes 为0时每块按设备限制取最大，
+    // 非0时再额外限制每块的大小（用于在普通数据上验证分块寻址）。需要的块数超过 kMaxChunks 时返回false
+    bool Create(wgpu::Device device, const char* label, size_t numElements, size_t elementSize, size_t maxChunkBytes = 0);
+    void Release();
+
+    // 写入元素 [firstElement, firstElement + numElements)，可以跨块
+    void Write(wgpu::Queue queue, size_t firstElement, const void* data, size_t numElements) const;
+
+    // 填写第 chunk 块的绑定（entry.binding 由调用方设置）；没有用到的块绑定第0块的第一个元素，着色器不会访问
+    void FillBinding(uint32_t chunk, wgpu::BindGroupEntry& entry) const;
+
+    // 按设备限制单块最多能放的元素数
+    static size_t MaxChunkElements(wgpu::Device device, size_t elementSize);
+
+    size_t capacity() const { return m_capacity; }
+    size_t chunkElements() const { return m_chunkElements; }
+    uint32_t numChunks() const { return static_cast<uint32_t>(m_chunks.size()); }
+    bool isValid() const { return !m_chunks.empty(); }
+
+private:
+    std::vector<wgpu::Buffer> m_chunks;
+    std::vector<size_t> m_chunkSizes;   // 每块的元素数
+    size_t m_chunkElements = 0;
+    size_t m_elementSize = 0;
+    size_t m_capacity = 0;
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// 只读内存映射文件（Windows 用 MapViewOfFile，其它平台用 mmap）
+class MappedFile
+{
+public:
+    // 映射整个文件，失败时返回nullptr
+    static std::shared_ptr<const MappedFile> open(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    MappedFile() = default;
+
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
+
+// 预构建KDTree的缓存文件：文件头 + 节点数组（GPU上传格式，含值） + 原始索引数组。
+// 节点和索引都按64字节对齐，映射后可以直接交给 writeBuffer
+class KDTreeCache
+{
+public:
+    // 格式、节点布局或构建算法变化时递增，旧缓存会自动失效
+    static constexpr uint32_t kVersion = 2;   // 2：3D节点的 padding[1] 记录分割维度
+
+    struct Header
+    {
+        char     magic[8];         // "KDTCACHE"
+        uint32_t version;
+        uint32_t dims;             // 2 或 3
+        uint32_t nodeStride;       // 每个节点的字节数（sizeof(GPUPoint2D/3D)）
+        uint32_t numLevels;
+        uint64_t numNodes;
+        uint64_t nodesOffset;
+        uint64_t idsOffset;
+        uint64_t sourceSize;       // 源数据文件大小
+        uint64_t sourceChecksum;   // 源数据文件的FNV-1a校验和
+        uint64_t contentChecksum;  // 节点和索引数组的FNV-1a校验和，检测截断或损坏
+        float    worldLower[3];
+        float    worldUpper[3];
+    };
+
+    // 映射后的缓存内容，指针在 file 存活期间有效
+    struct View
+    {
+        std::shared_ptr<const MappedFile> file;
+        const void* nodes = nullptr;
+        const uint32_t* ids = nullptr;   // 每个节点在原始输入中的索引
+        size_t numNodes = 0;
+        uint32_t numLevels = 0;
+        float worldLower[3] = {};
+        float worldUpper[3] = {};
+    };
+
+    // 64位FNV-1a，可以分段累加（把上一次的结果作为 seed 传入）
+    static uint64_t checksum(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+    // 计算源数据文件的校验和与大小
+    static bool checksumFile(const std::string& path, uint64_t& checksum, uint64_t& size);
+
+    // 写缓存文件：先写临时文件再改名，避免留下半个文件
+    static bool save(const std::string& path, uint32_t dims, uint32_t nodeStride,
+                     const void* nodes, const uint32_t* ids, size_t numNodes, uint32_t numLevels,
+                     const float worldLower[3], const float worldUpper[3],
+                     uint64_t sourceChecksum, uint64_t sourceSize);
+
+    // 映射缓存文件；文件不存在、版本/维度/节点布局/源数据不符或内容校验失败时返回false
+    static bool load(const std::string& path, uint32_t dims, uint32_t nodeStride,
+                     uint64_t sourceChecksum, uint64_t sourceSize, View& out);
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include "ggl.h"
 #include "kdtree.h"
+#include "KDTreeCache.h"
 
 struct SparsePoint2D 
 {
@@ -26,38 +27,88 @@ struct GPUPoint2D {
     float padding;  // 保持16字节对齐
 };
 
+// padding[0]：删除标记（DynamicKDTree3D::kDeadNode），padding[1]：该节点的分割维度（0/1/2，按float存放），
+// 着色器从节点读取分割维度，所以轮流分割和最宽维分割的树用同一套遍历代码
 struct GPUPoint3D {
     float x, y, z;
     float value;
     float padding[4];  // 保持32字节对齐
 };
 
+// 压缩节点（8字节）：坐标相对世界边界按轴量化为16位，xy = x | y<<16，zFlags = z | 标志<<16。
+// 标志第0位为删除标记，第1-2位为分割维度。值不在节点里，仍在单独的值缓冲区中（float，精确值）
+struct GPUCompactPoint3D {
+    uint32_t xy;
+    uint32_t zFlags;
+};
+
 class KDTreeBuilder2D 
 {
 public:
     KDTreeBuilder2D();
     ~KDTreeBuilder2D();
+    // KDTree节点：坐标、值和原始索引一起参与构建
+    using TreeNode = kdTree::payload_point<kdTree::float2>;
+    using TreeTraits = kdTree::payload_data_traits<kdTree::float2>;
     struct TreeData2D 
     {
         std::vector<GPUPoint2D> points;
         size_t numLevels;
+        // 从缓存文件加载时，节点直接指向映射的文件内容，points 为空
+        std::shared_ptr<const MappedFile> mapping;
+        const GPUPoint2D* mappedNodes = nullptr;
+        size_t numMappedNodes = 0;
+        // 每个节点对应的原始输入下标（树节点顺序）；位置不变时可以直接用它更新值
+        std::vector<uint32_t> ids;
+        const uint32_t* mappedIds = nullptr;
+
+        const GPUPoint2D* nodes() const { return mapping ? mappedNodes : points.data(); }
+        size_t numNodes() const { return mapping ? numMappedNodes : points.size(); }
+        const uint32_t* slotToOriginal() const { return mapping ? mappedIds : ids.data(); }
+
+        // 把按原始输入顺序排列的值（numValues 必须等于节点数）重排成树节点顺序，即GPU值缓冲区的内容
+        bool valuesInTreeOrder(const float* values, size_t numValues, std::vector<float>& out) const;
     };
-    // 构建KDTree
-    bool buildTree(const std::vector<SparsePoint2D>& inputPoints);
-    bool buildTree(const SparsePoint2D* points, size_t numPoints);
+    // 构建KDTree（numThreads <= 0 表示使用全部硬件线程，1 为单线程）
+    bool buildTree(const std::vector<SparsePoint2D>& inputPoints, int numThreads = 0);
+    bool buildTree(const SparsePoint2D* points, size_t numPoints, int numThreads = 0);
     
-    // K近邻查询
+    // K近邻查询。eps > 0 时为近似查询：返回的每个距离最多是精确距离的 sqrt(1+eps) 倍，换取更快的查询
     template<int K>
     bool knnSearch(const SparsePoint2D& queryPoint, float searchRadius, 
-                   std::vector<GPUPoint2D>& results, std::vector<float>& distances) const;
+                   std::vector<GPUPoint2D>& results, std::vector<float>& distances,
+                   float eps = 0.0f) const;
     
-    // 重载版本，直接返回索引和距离
+    // 重载版本，直接返回索引和距离。索引是树节点下标（与 getGPUPoints() 的顺序一致），
+    // 不是原始输入下标，用 getSlotToOriginal()[index] 转换；radiusSearch 同样
     template<int K>
     bool knnSearch(const SparsePoint2D& queryPoint, float searchRadius,
-                   std::vector<int>& indices, std::vector<float>& distances) const;
+                   std::vector<int>& indices, std::vector<float>& distances,
+                   float eps = 0.0f) const;
+
+    // 运行时K版本：K 必须是 kdTree::supportedK 中的值（1/3/5/8/16/32/64），否则返回false
+    bool knnSearch(const SparsePoint2D& queryPoint, int k, float searchRadius,
+                   std::vector<int>& indices, std::vector<float>& distances,
+                   float eps = 0.0f) const;
+
+    // 固定半径查询：返回距离严格小于 radius 的所有点（索引和距离，按遍历顺序）。
+    // 传入的vector先清空再追加，容量保留，反复查询时不再分配内存
+    bool radiusSearch(const SparsePoint2D& queryPoint, float radius,
+                      std::vector<int>& indices, std::vector<float>& distances) const;
+
+    // Wendland C2 紧支撑插值，与 sparse_data.comp.wgsl 中的插值方法3一致；半径内没有点时返回-1
+    float wendlandInterpolate(const SparsePoint2D& queryPoint, float radius) const;
     
     // 获取构建的点数据（转换为GPUPoint2D格式）
     std::vector<GPUPoint2D> getGPUPoints() const;
+
+    // 只更新值（点的位置不变）：values 按原始输入顺序，共 getPointCount() 个。
+    // 按构建时记录的 树节点->原始下标 排列直接写入节点，O(N)并行，不重建树
+    bool updateValues(const float* values, size_t numValues, int numThreads = 0);
+
+    // 树节点顺序的值（与 getGPUPoints() 中的 value 相同），以及每个节点对应的原始下标
+    std::vector<float> getGPUValues() const;
+    const std::vector<uint32_t>& getSlotToOriginal() const { return m_slotToOriginal; }
     
     // 获取世界边界
     bool getWorldBounds(float& minX, float& maxX, float& minY, float& maxY) const;
@@ -70,14 +121,22 @@ public:
         return kdTree::BinaryTree::numLevelsFor(m_pointCount);
     }
     
+    // 把构建好的树写成缓存文件：节点（含值）、原始索引、世界边界、层数和源数据校验和
+    bool saveCache(const std::string& path, uint64_t sourceChecksum, uint64_t sourceSize) const;
+
+    // 映射缓存文件到 out（不复制节点）；缓存不存在或与源数据不符时返回false，此时应重新构建
+    static bool loadCache(const std::string& path, uint64_t sourceChecksum, uint64_t sourceSize, TreeData2D& out);
+
     // 清理资源
     void clear();
 
 private:
     // 内部数据
-    std::vector<kdTree::float2> m_kdtreePoints;  // KDTree使用的点格式
+    std::vector<TreeNode> m_kdtreePoints;  // KDTree节点（已按树的布局排列）
     std::vector<SparsePoint2D> m_originalPoints;   // 原始输入点
+    std::vector<uint32_t> m_slotToOriginal;        // 树节点 -> 原始下标
     kdTree::box_t<kdTree::float2> m_worldBounds; // 世界边界
+    kdTree::BuildScratch<TreeNode> m_buildScratch; // 构建用的临时缓冲，重建时复用
     size_t m_pointCount;
     bool m_isBuilt;
     
@@ -92,27 +151,128 @@ class KDTreeBuilder3D
 public:
     KDTreeBuilder3D();
     ~KDTreeBuilder3D();
+    // KDTree节点：坐标、值和原始索引一起参与构建，节点同时记录自己的分割维度，
+    // 查询总是按节点中的维度遍历（两种分割方式共用同一套查询代码）
+    using TreeNode = kdTree::payload_dim_point<kdTree::float3>;
+    using TreeTraits = kdTree::payload_dim_traits<kdTree::float3>;
+
+    // 分割维度的选择方式：RoundRobin 按层轮流使用 x/y/z；WidestDimension 每个子树沿其包围盒最宽的维度分割，
+    // 适合各向异性的数据（薄板、细长管道），代价是构建时每个子树多算一次包围盒
+    enum class SplitMode { RoundRobin, WidestDimension };
     struct TreeData3D 
     {
         std::vector<GPUPoint3D> points;
         size_t numLevels;
+        // 从缓存文件加载时，节点直接指向映射的文件内容，points 为空
+        std::shared_ptr<const MappedFile> mapping;
+        const GPUPoint3D* mappedNodes = nullptr;
+        size_t numMappedNodes = 0;
+        // 每个节点对应的原始输入下标（树节点顺序）；位置不变时可以直接用它更新值
+        std::vector<uint32_t> ids;
+        const uint32_t* mappedIds = nullptr;
+
+        const GPUPoint3D* nodes() const { return mapping ? mappedNodes : points.data(); }
+        size_t numNodes() const { return mapping ? numMappedNodes : points.size(); }
+        const uint32_t* slotToOriginal() const { return mapping ? mappedIds : ids.data(); }
+
+        // 把按原始输入顺序排列的值（numValues 必须等于节点数）重排成树节点顺序，即GPU值缓冲区的内容
+        bool valuesInTreeOrder(const float* values, size_t numValues, std::vector<float>& out) const;
+
+        // 按节点的包围盒量化成压缩节点（顺序不变）；quant 为解码参数，坐标 = lower + q * step，每轴误差不超过 maxErr。
+        // 量化是单调的，所以压缩节点仍是一棵合法的KDTree，只用它们查询时结果在解码坐标上精确。
+        // 要与完整节点结果相同，调用方还要上传各节点的精确坐标（VIS3D 把它们接在压缩节点后面，见 kdExactPoint）：
+        // GPU查询把分割平面的距离放宽 maxErr 来剪枝，解码距离通过接受界的候选点再用精确坐标重新打分
+        void compactNodes(std::vector<GPUCompactPoint3D>& out, kdTree::Quantizer<kdTree::float3>& quant) const;
     };
-    // 构建KDTree
-    bool buildTree(const std::vector<SparsePoint3D>& inputPoints);
-    bool buildTree(const SparsePoint3D* points, size_t numPoints);
+    // 构建KDTree（numThreads <= 0 表示使用全部硬件线程，1 为单线程）
+    bool buildTree(const std::vector<SparsePoint3D>& inputPoints, int numThreads = 0);
+    bool buildTree(const SparsePoint3D* points, size_t numPoints, int numThreads = 0);
+
+    // 设置分割维度的选择方式，下次 buildTree 时生效（默认 RoundRobin）
+    void setSplitMode(SplitMode mode) { m_splitMode = mode; }
+    SplitMode getSplitMode() const { return m_splitMode; }
     
-    // K近邻查询
+    // K近邻查询。eps > 0 时为近似查询：返回的每个距离最多是精确距离的 sqrt(1+eps) 倍，换取更快的查询。
+    // 注意：下面所有 knnSearch* / radiusSearch 返回的索引都是树节点下标（与 getGPUPoints()、GPU缓冲区的顺序一致），
+    // 不是原始输入下标；需要原始下标时用 getSlotToOriginal()[index] 转换（buildKnnGraph 已经转换好）
     template<int K>
     bool knnSearch(const SparsePoint3D& queryPoint, float searchRadius,
-                   std::vector<GPUPoint3D>& results, std::vector<float>& distances) const;
+                   std::vector<GPUPoint3D>& results, std::vector<float>& distances,
+                   float eps = 0.0f) const;
 
-    // 重载版本，直接返回索引和距离
+    // 重载版本，直接返回索引（树节点下标）和距离
     template<int K>
     bool knnSearch(const SparsePoint3D& queryPoint, float searchRadius,
-                   std::vector<int>& indices, std::vector<float>& distances) const;
+                   std::vector<int>& indices, std::vector<float>& distances,
+                   float eps = 0.0f) const;
+
+    // 固定半径查询：返回距离严格小于 radius 的所有点（索引和距离，按遍历顺序）。
+    // 传入的vector先清空再追加，容量保留，反复查询时不再分配内存
+    bool radiusSearch(const SparsePoint3D& queryPoint, float radius,
+                      std::vector<int>& indices, std::vector<float>& distances) const;
+
+    // 批量K近邻查询：结果按SoA写入调用方提供的数组（各需 numQueries*K 个元素），
+    // 第q个查询的结果位于 [q*K, q*K+K)，按距离从近到远；没有找到的位置索引为-1、距离为INFINITY，其余为树节点下标。
+    // 查询分布在内部线程池上执行，每个查询不做堆分配、不抛异常。
+    // 普通树上每8个相邻查询作为一个packet同时遍历，查询按空间块排列（如2x2x2体素块）时最快
+    template<int K>
+    bool knnSearchBatch(const kdTree::float3* queryPoints, size_t numQueries, float searchRadius,
+                        int* outIndices, float* outDistances, float eps = 0.0f) const;
+
+    // 运行时K版本：K 必须是 kdTree::supportedK 中的值（1/3/5/8/16/32/64），否则返回false
+    bool knnSearch(const SparsePoint3D& queryPoint, int k, float searchRadius,
+                   std::vector<int>& indices, std::vector<float>& distances,
+                   float eps = 0.0f) const;
+    bool knnSearchBatch(const kdTree::float3* queryPoints, size_t numQueries, int k, float searchRadius,
+                        int* outIndices, float* outDistances, float eps = 0.0f) const;
+
+    // 整个规则网格的K近邻（离线重采样高分辨率体数据用）：体素 (x,y,z) 位于 origin + spacing*(x,y,z)，
+    // 结果按体素下标 x + res[0]*(y + res[1]*z) 写入，格式同 knnSearchBatch（各需 numVoxels*k 个元素）。
+    // 相邻体素按块一起遍历树（kdTree::knnGrid），blockSize 为0时按点的密度自动选择。总在普通树上查询
+    bool knnSearchGrid(const kdTree::QueryGrid3D& grid, int k, float searchRadius,
+                       int* outIndices, float* outDistances, int blockSize = 0) const;
+
+    // 所有点的K近邻图（CSR）：第 i 行是原始输入第 i 个点的近邻，位于 indices/distances 的
+    // [offsets[i], offsets[i+1])，按距离从近到远，索引为原始输入下标
+    struct KnnGraph
+    {
+        std::vector<int64_t> offsets;   // getPointCount() + 1 个
+        std::vector<int> indices;
+        std::vector<float> distances;
+    };
+
+    // 构建所有点的K近邻图（梯度估计、离群点剔除、平滑等用）：每个点在普通树上查询一次，
+    // 在内部线程池上并行，每个任务复用一个候选列表。点自身不算近邻，位置相同的其他点算。
+    // K 必须是 kdTree::supportedK 中的值；searchRadius 内不足K个点的行更短
+    bool buildKnnGraph(int k, float searchRadius, KnnGraph& out) const;
+
+    // 设置批量查询使用的线程数（<= 0 表示使用全部硬件线程）
+    void setNumQueryThreads(int numThreads);
+
+    // 启用桶式叶子KDTree（每个叶子最多 leafSize 个点，叶子用SIMD扫描），0 表示关闭。
+    // 启用后 knnSearch / knnSearchBatch 都在桶式树上查询，返回的索引与普通树相同
+    void setBucketLeafSize(int leafSize);
+
+    // 设置暴力扫描/KDTree的切换阈值（一般由 kdTree::calibrateKnnCrossover() 在本机测一次后保存、加载）。
+    // 批量查询时按点数、K和半径判断：点少或半径相对K很大时改用SIMD暴力扫描，结果与树查询相同。
+    // 默认阈值全为0，即总用树
+    void setKnnCrossover(const kdTree::KnnCrossover& crossover);
+
+    // 连贯查询序列（如按行排列的重采样网格体素）：启用后 knnSearchBatch 逐个查询，每个查询以
+    // 上一个查询的第K近距离加两者间距作为初始剔除半径（kdTree::knnSweepBatchWith），结果不变。
+    // 默认关闭；暴力扫描时不起作用。knnSearchGrid 按体素块遍历，不受影响
+    void setSweepQueries(bool enable) { m_sweepQueries = enable; }
 
     // 获取构建的点数据（转换为GPUPoint3D格式）
     std::vector<GPUPoint3D> getGPUPoints() const;
+
+    // 只更新值（点的位置不变）：values 按原始输入顺序，共 getPointCount() 个。
+    // 按构建时记录的 树节点->原始下标 排列直接写入节点，O(N)并行，不重建树
+    bool updateValues(const float* values, size_t numValues, int numThreads = 0);
+
+    // 树节点顺序的值（与 getGPUPoints() 中的 value 相同），以及每个节点对应的原始下标
+    std::vector<float> getGPUValues() const;
+    const std::vector<uint32_t>& getSlotToOriginal() const { return m_slotToOriginal; }
     
     // 获取世界边界
     bool getWorldBounds(float& minX, float& maxX, float& minY, float& maxY, float& minZ, float& maxZ) const;
@@ -125,19 +285,170 @@ public:
         return kdTree::BinaryTree::numLevelsFor(m_pointCount);
     }
     
+    // 把构建好的树写成缓存文件：节点（含值）、原始索引、世界边界、层数和源数据校验和
+    bool saveCache(const std::string& path, uint64_t sourceChecksum, uint64_t sourceSize) const;
+
+    // 映射缓存文件到 out（不复制节点）；缓存不存在或与源数据不符时返回false，此时应重新构建
+    static bool loadCache(const std::string& path, uint64_t sourceChecksum, uint64_t sourceSize, TreeData3D& out);
+
+    // 分块树文件的读取端：按需把块读入内存，超过缓存大小时按LRU淘汰，节点编号在所有块中连续
+    using ChunkedTree = kdTree::ChunkedTree<TreeNode, TreeTraits>;
+
+    // 外存构建：pointsPath 是连续存放的 SparsePoint3D 数组（可以比内存大），点被分到若干分区，
+    // 每个分区单独在 memoryBudget 字节内构建，写成分块树文件 treePath，用 ChunkedTree 按需读入查询。
+    // 节点的 id 为点在 pointsPath 中的下标；各分区总按最宽维度分割（与 SplitMode 无关）
+    static bool buildTreeOutOfCore(const std::string& pointsPath, const std::string& treePath,
+                                   size_t memoryBudget, int numThreads = 0);
+
     // 清理资源
     void clear();
 
 private:
     // 内部数据
-    std::vector<kdTree::float3> m_kdtreePoints;  // KDTree使用的点格式
+    std::vector<TreeNode> m_kdtreePoints;  // KDTree节点（已按树的布局排列）
     std::vector<SparsePoint3D> m_originalPoints;   // 原始输入点
+    std::vector<uint32_t> m_slotToOriginal;        // 树节点 -> 原始下标
     kdTree::box_t<kdTree::float3> m_worldBounds; // 世界边界
+    kdTree::BuildScratch<TreeNode> m_buildScratch; // 构建用的临时缓冲，重建时复用
+    std::unique_ptr<kdTree::ThreadPool> m_queryPool; // 批量查询线程池
+    kdTree::BucketTree3D m_bucketTree;           // 桶式叶子KDTree（可选）
+    kdTree::KnnCrossover m_knnCrossover;         // 暴力扫描/KDTree切换阈值
+    kdTree::BruteForcePoints<kdTree::float3> m_bruteForcePoints; // 按树节点顺序的SoA点，只在可能用暴力扫描时保留
+    int m_bucketLeafSize;
+    SplitMode m_splitMode;
     size_t m_pointCount;
     bool m_isBuilt;
+    bool m_sweepQueries;
     
     // 辅助函数
+    template<typename CandidateList>
+    void query(CandidateList& result, const kdTree::float3& queryPoint, float eps) const;
+    bool buildBucketTree();
+    void buildBruteForcePoints();
     kdTree::float3 sparseToKDTree(const SparsePoint3D& point) const;
     GPUPoint3D sparseToGPU(const SparsePoint3D& point) const;
     SparsePoint3D kdtreeToSparse(const kdTree::float3& point, int originalIndex) const;
-};
\ No newline at end of file
+};
+
+// N维KDTree（N = 2..8，在 KDTreeWrapper.cpp 中显式实例化），用于时空 (x, y, z, t) 或属性空间查询。
+// 点类型为 kdTree::vec_float<N>，距离计算在编译期按维度展开；节点同样携带值和原始下标。
+// 没有GPU端，查询返回的索引直接是原始输入下标
+template<int N>
+class KDTreeBuilderND
+{
+public:
+    using Point = kdTree::vec_float<N>;
+    using TreeNode = kdTree::payload_point<Point>;
+    using TreeTraits = kdTree::payload_data_traits<Point>;
+
+    KDTreeBuilderND();
+    ~KDTreeBuilderND();
+
+    // 构建KDTree：values 可以为空（值全为0）；numThreads <= 0 表示使用全部硬件线程
+    bool buildTree(const std::vector<Point>& points, const std::vector<float>& values, int numThreads = 0);
+    bool buildTree(const Point* points, const float* values, size_t numPoints, int numThreads = 0);
+
+    // K近邻查询（K 必须是 kdTree::supportedK 中的值），结果按距离从近到远，eps 含义同3D版本
+    bool knnSearch(const Point& queryPoint, int k, float searchRadius,
+                   std::vector<int>& indices, std::vector<float>& distances,
+                   float eps = 0.0f) const;
+
+    // 批量K近邻查询，输出布局与 KDTreeBuilder3D::knnSearchBatch 相同（索引为原始下标）
+    template<int K>
+    bool knnSearchBatch(const Point* queryPoints, size_t numQueries, float searchRadius,
+                        int* outIndices, float* outDistances, float eps = 0.0f) const;
+    bool knnSearchBatch(const Point* queryPoints, size_t numQueries, int k, float searchRadius,
+                        int* outIndices, float* outDistances, float eps = 0.0f) const;
+
+    // 固定半径查询：返回距离严格小于 radius 的所有点（原始下标和距离，按遍历顺序）
+    bool radiusSearch(const Point& queryPoint, float radius,
+                      std::vector<int>& indices, std::vector<float>& distances) const;
+
+    // 只更新值（点的位置不变）：values 按原始输入顺序，共 getPointCount() 个
+    bool updateValues(const float* values, size_t numValues, int numThreads = 0);
+
+    // 第 index 个原始输入点的值
+    float getValue(size_t index) const { return m_kdtreePoints[m_originalToSlot[index]].value; }
+
+    // 按树布局排列的节点（坐标、值、原始下标）
+    const std::vector<TreeNode>& getNodes() const { return m_kdtreePoints; }
+
+    // 设置批量查询使用的线程数（<= 0 表示使用全部硬件线程）
+    void setNumQueryThreads(int numThreads);
+
+    bool getWorldBounds(Point& lower, Point& upper) const;
+
+    size_t getPointCount() const { return m_pointCount; }
+    bool isBuilt() const { return m_isBuilt; }
+    size_t getNumLevels() const
+    {
+        return kdTree::BinaryTree::numLevelsFor(m_pointCount);
+    }
+
+    void clear();
+
+private:
+    std::vector<TreeNode> m_kdtreePoints;           // KDTree节点（已按树的布局排列）
+    std::vector<uint32_t> m_originalToSlot;         // 原始下标 -> 树节点
+    kdTree::box_t<Point> m_worldBounds;             // 世界边界
+    kdTree::BuildScratch<TreeNode> m_buildScratch;  // 构建用的临时缓冲，重建时复用
+    std::unique_ptr<kdTree::ThreadPool> m_queryPool; // 批量查询线程池
+    size_t m_pointCount;
+    bool m_isBuilt;
+};
+
+// 动态KDTree：由多棵静态隐式KDTree组成的对数森林（第l棵树最多 leafCapacity<<l 个点），
+// 插入时合并小树（均摊 O(log^2 n)），删除只打墓碑标记，死点过半的树会被压缩重建。
+// 查询在所有树上共享一个候选列表，返回的索引是插入时分配的点ID。
+// GPU端把各棵树按固定偏移放在同一个节点数组里（第l棵树从 leafCapacity*(2^l-1) 开始），
+// 修改后只需重新上传变化的节点区间，通常只是几棵小树
+class DynamicKDTree3D
+{
+public:
+    // 与着色器中的 KDTreeRange 对应：一棵树在节点数组中的起始位置和节点数
+    struct GPUTreeRange
+    {
+        uint32_t firstNode;
+        uint32_t numNodes;
+    };
+
+    // GPUPoint3D::padding[0] 为该值时表示节点已删除（仍作为分割平面参与遍历）
+    static constexpr float kDeadNode = 1.0f;
+
+    explicit DynamicKDTree3D(int leafCapacity = 256);
+
+    // 清空后批量加载，点ID为 0..numPoints-1（与输入下标相同）
+    bool build(const std::vector<SparsePoint3D>& points);
+
+    // 插入一个或一批点，返回（第一个）新点的ID；一批点的ID连续
+    uint32_t insert(const SparsePoint3D& point);
+    uint32_t insert(const std::vector<SparsePoint3D>& points);
+
+    // 删除点，ID不存在或已删除时返回false
+    bool remove(uint32_t id);
+
+    // K近邻查询（K 必须是 kdTree::supportedK 中的值），indices 为点ID
+    bool knnSearch(const SparsePoint3D& queryPoint, int k, float searchRadius,
+                   std::vector<int>& indices, std::vector<float>& distances,
+                   float eps = 0.0f) const;
+
+    size_t size() const { return m_forest.size(); }
+
+    // GPU节点数组（按容量排列，未使用和已删除的节点标记为 kDeadNode）、值数组和各棵树的范围
+    const std::vector<GPUPoint3D>& getGPUNodes() const { return m_gpuNodes; }
+    const std::vector<float>& getGPUValues() const { return m_gpuValues; }   // 与 getGPUNodes() 一一对应
+    std::vector<GPUTreeRange> getGPUTrees() const;
+
+    // 把上次调用以来 getGPUNodes()/getGPUValues() 中变化的区间 [first, last) 追加到 ranges 并清空记录
+    void takeDirtyRanges(std::vector<std::pair<size_t, size_t>>& ranges);
+
+private:
+    void syncGPUNodes();
+
+    kdTree::DynamicForest<kdTree::float3> m_forest;
+    std::vector<GPUPoint3D> m_gpuNodes;
+    std::vector<float> m_gpuValues;
+    std::vector<std::pair<size_t, size_t>> m_dirtyRanges;
+    std::vector<kdTree::DynamicForest<kdTree::float3>::Change> m_changes;
+    const int m_leafCapacity;
+};
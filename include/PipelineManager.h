@@ -251,6 +251,8 @@ public:
     ComputePipelineBuilder& setEntry(const std::string& entry);
     ComputePipelineBuilder& setExplicitLayout(bool useExplicit);
     ComputePipelineBuilder& addBindGroupLayout(const wgpu::BindGroupLayout& layout);
+    // 设置着色器中 override 常量的值（bool 用 0/1），创建管线时生效
+    ComputePipelineBuilder& setConstant(const std::string& key, double value);
     wgpu::ComputePipeline build();
 
 private:
@@ -260,6 +262,7 @@ private:
     std::string m_shaderSource;
     std::string m_entry = "main";
     std::vector<wgpu::BindGroupLayout> m_bindGroupLayouts;
+    std::vector<std::pair<std::string, double>> m_constants;
     bool m_useShaderPath = true;
     bool m_useExplicitLayout = false;
 };
@@ -2,6 +2,7 @@
 #include "ggl.h"
 #include "PipelineManager.h"
 #include "KDTreeWrapper.h"
+#include "ChunkedBuffer.h"
 
 class VIS2D 
 {
@@ -31,10 +32,10 @@ public:
         uint32_t numLevels;
         uint32_t interpolationMethod;
         
-        // 第三组：16字节对齐，包含searchRadius和padding
+        // 第三组：16字节对齐，包含searchRadius、numNeighbors、eps和padding
         float searchRadius;
-        float padding1;
-        float padding2;
+        uint32_t numNeighbors;  // 插值方法4（任意K的IDW）使用的K
+        float eps;              // 近似KNN：远端子树按 d^2*(1+eps) 剔除，0 为精确查询
         float padding3;
     };
 
@@ -56,7 +57,8 @@ public:
         wgpu::BindGroup KDTree_bindGroup = nullptr;
         wgpu::Buffer uniformBuffer = nullptr;
         wgpu::Buffer storageBuffer = nullptr;
-        wgpu::Buffer kdNodesBuffer = nullptr;
+        ChunkedStorageBuffer kdNodes;           // 节点，超过单个绑定上限时分块
+        wgpu::Buffer kdValuesBuffer = nullptr;  // 节点的值（树节点顺序），只更新值时单独上传
 
         bool Init(wgpu::Device device, wgpu::Queue queue, 
             const std::vector<SparsePoint2D>& sparsePoints, 
@@ -106,6 +108,12 @@ public:
     void UpdateUniforms(glm::mat4 viewMatrix, glm::mat4 projMatrix);
     void SetInterpolationMethod(int kValue);
     void SetSearchRadius(float radius);
+    void SetNumNeighbors(int k);
+    void SetEps(float eps);
+
+    // 只更新值（点的位置不变，如时变数据的下一帧）：values 按原始点顺序，
+    // 按树节点顺序重排后一次 writeBuffer 上传值缓冲区，不重建树、不重新上传坐标
+    bool UpdateValues(const std::vector<float>& values);
 protected:
     std::vector<SparsePoint2D> m_sparsePoints;
     DataHeader m_header;
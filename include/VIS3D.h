@@ -1,6 +1,7 @@
 #pragma once
 #include "ggl.h"
 #include "KDTreeWrapper.h"
+#include "ChunkedBuffer.h"
 
 class VIS3D 
 {
@@ -30,19 +31,49 @@ public:
 
         float gridDepth = 1.0f;
         float searchRadius = 1.0f;
-        float padding1 = 0.0f;
-        float padding2 = 0.0f;
+        float eps = 0.0f;       // 近似KNN：远端子树按 d^2*(1+eps) 剔除，0 为精确查询
+        uint32_t numTrees = 1;  // kdTreesBuffer 中的树数（静态树为1，动态森林为森林中的树数）
 
         uint32_t totalNodes = 0;
         uint32_t totalPoints = 0;
         uint32_t numLevels = 0;
         uint32_t interpolationMethod = 0;
 
+        // 压缩节点的解码参数（nodeFormat 为 kCompactNodes 时）：坐标 = quantLower + q * quantStep
+        float quantLower[3] = {0.0f, 0.0f, 0.0f};
+        uint32_t nodeFormat = 0;    // kFullNodes 或 kCompactNodes
+        float quantStep[3] = {1.0f, 1.0f, 1.0f};
+        uint32_t blockHeight = 0;   // 节点数组的分块布局（kdTree::BlockedLayout 的块高度），0 为广度优先
+        // 压缩节点的误差界（Quantizer::maxErr 和 maxPointError()）：着色器按它放宽分割面、筛选要用精确坐标打分的候选点
+        float quantMaxErr[3] = {0.0f, 0.0f, 0.0f};
+        float quantMaxPointError = 0.0f;
+
+        uint32_t warmStart = 1;     // 非0时同一次调用的后续体素用上一个体素的第k近距离加步长作为初始剔除半径
+        uint32_t compactExact = 1;  // 压缩节点时非0：精确坐标接在压缩节点之后，候选点用它重新打分（见 SetCompactNodes）
+        uint32_t padding[2] = {0, 0};
     };
 
+    // 每次着色器调用沿x方向连续处理的体素数，与着色器中的 VOXELS_PER_INVOCATION 对应
+    static constexpr uint32_t kVoxelsPerInvocation = 4;
+
+    // 节点缓冲区的格式，与着色器中的 NODE_FORMAT_* 对应
+    static constexpr uint32_t kFullNodes = 0;       // GPUPoint3D，32字节
+    static constexpr uint32_t kCompactNodes = 1;    // GPUCompactPoint3D，8字节
+
     // 确保结构体大小是16的倍数
     static_assert(sizeof(VIS3D::CS_Uniforms) % 16 == 0, "CS_Uniforms must be 16-byte aligned");
-    static_assert(sizeof(VIS3D::CS_Uniforms) == 48, "CS_Uniforms should be exactly 64 bytes");
+    static_assert(sizeof(VIS3D::CS_Uniforms) == 112, "CS_Uniforms should be exactly 112 bytes");
+
+    // TRAVERSAL_STATS 着色器变体的计数（与着色器中的 STAT_* 对应），含义同 kdTree::TraversalStats，
+    // 是最近一次计算的全部KDTree查询之和
+    struct GPUTraversalStats 
+    {
+        uint32_t numQueries = 0;
+        uint32_t nodesVisited = 0;
+        uint32_t distanceEvals = 0;
+        uint32_t farChildDescents = 0;
+        uint32_t candidatePushes = 0;
+    };
 
     struct DataHeader {
         uint32_t width;
@@ -59,7 +90,14 @@ public:
         wgpu::BindGroup KDTree_bindGroup = nullptr;
         wgpu::Buffer uniformBuffer = nullptr;
         wgpu::Buffer storageBuffer = nullptr;
-        wgpu::Buffer kdNodesBuffer = nullptr;
+        ChunkedStorageBuffer kdNodes;           // 节点，超过单个绑定上限时分块（kdNodes.capacity() 也是值缓冲区能容纳的节点数）
+        wgpu::Buffer kdValuesBuffer = nullptr;  // 节点的值（树节点顺序），只更新值时单独上传
+        wgpu::Buffer kdTreesBuffer = nullptr;   // 每棵树在 kdNodes 中的范围（DynamicKDTree3D::GPUTreeRange）
+        wgpu::Buffer traversalStatsBuffer = nullptr;    // GPUTraversalStats，只有 TRAVERSAL_STATS 变体写入
+        bool traversalStats = false;                    // 管线是否为 TRAVERSAL_STATS 变体
+        static constexpr uint32_t kMaxTrees = 32;
+        // 计算着色器用到的存储缓冲区数：稀疏点 + 节点各块 + 树的范围 + 值 + 遍历统计（WebGPU 默认上限为8）
+        static constexpr uint32_t kStorageBuffersPerStage = 1 + ChunkedStorageBuffer::kMaxChunks + 3;
 
         bool Init(wgpu::Device device, wgpu::Queue queue, 
             const std::vector<SparsePoint3D>& sparsePoints, 
@@ -69,6 +107,8 @@ public:
         bool UpdateBindGroup(wgpu::Device device, wgpu::TextureView inputTF, wgpu::TextureView outputTexture);
         void RunCompute(wgpu::Device device, wgpu::Queue queue, wgpu::Texture outputTexture);
         void Release();
+        // 按新节点数重新创建节点和值缓冲区（内容需要重新上传，绑定组需要重新创建）
+        bool CreateKDNodesBuffer(wgpu::Device device, size_t numNodes);
     private:
         bool InitKDTreeBuffers(wgpu::Device device, wgpu::Queue queue, 
             const KDTreeBuilder3D::TreeData3D& kdTreeData);
@@ -113,7 +153,45 @@ public:
     void UpdateUniforms(glm::mat4 viewMatrix, glm::mat4 projMatrix);
     void SetInterpolationMethod(int kValue);
     void SetSearchRadius(float radius);
+    void SetEps(float eps);
+    // 暖启动：一次调用处理的相邻体素中，后一个的第k近距离不超过前一个的第k近距离加两者的距离，
+    // 用它代替 searchRadius 作为初始剔除半径，结果不变，只是少遍历节点。默认开启
+    void SetWarmStart(bool enable);
+
+    // 调试：换成统计遍历代价的着色器变体（每次计算前清零计数），用 ReadTraversalStats 读回，
+    // 可以与CPU端 kdTree::TraversalStats 在同一数据上比较。关闭时着色器中的计数代码在编译时去掉
+    bool SetTraversalStats(bool enable);
+    bool ReadTraversalStats(GPUTraversalStats& stats);
+
+    // 只更新值（点的位置不变，如时变数据的下一帧）：values 按原始点顺序，
+    // 按树节点顺序重排后一次 writeBuffer 上传值缓冲区，不重建树、不重新上传坐标
+    bool UpdateValues(const std::vector<float>& values);
     void SetModelMatrix(glm::mat4 modelMatrix);
+
+    // 压缩节点：KD节点的坐标按世界边界量化为16位上传（8字节/节点，完整节点为32字节），值仍在值缓冲区中。
+    // exactRescoring 为 true（默认）时各节点的精确坐标（12字节/节点）接在压缩节点之后放进同一个分块的节点缓冲区，
+    // 合计20字节/节点。着色器与CPU端 kdTree::knn(..., exactNodes) 相同：遍历只读压缩节点，分割面按每轴的 maxErr
+    // 向查询点放宽，解码距离不小于 (sqrt(剔除距离) + maxPointError)^2 的点直接跳过，其余的才读精确坐标重新打分，
+    // 所以结果与完整节点相同。为 false 时只上传压缩节点（8字节/节点），按解码坐标查询，
+    // 结果是解码点集上的精确KNN，与完整节点的距离最多差 Quantizer::maxPointError()。
+    // 节点缓冲区放不下时（超过 kMaxChunks 块）返回false并保持完整节点。只用于静态树，插入/删除点时自动换回完整节点
+    bool SetCompactNodes(bool enable, bool exactRescoring = true);
+
+    // 分块布局：树的完整层每 blockHeight 层切成一个子树连续存放（kdTree::BlockedLayout），
+    // 向下遍历时连续几层落在同一块内存中。0 为原来的广度优先顺序，最大 kMaxBlockHeight。
+    // 与压缩节点可以同时使用；只用于静态树，插入/删除点时自动换回广度优先
+    bool SetBlockedLayout(uint32_t blockHeight);
+    static constexpr uint32_t kMaxBlockHeight = 4;
+
+    // 最宽维分割（KDTreeBuilder3D::SplitMode::WidestDimension）：每个子树沿其包围盒最宽的维度分割，
+    // 薄板、细长管道这类各向异性数据剪枝更好。分割维度存在节点中，着色器不用区分两种树。
+    // 数据加载前调用时只记录设置；加载后调用会重新构建并上传静态树。插入/删除点后不支持
+    bool SetWidestDimSplits(bool enable);
+
+    // 增量更新稀疏点：第一次调用时把当前数据转为动态KDTree（已有点的ID为原始下标），
+    // 之后每次只上传变化的节点。传统（暴力）插值方法仍只使用初始数据
+    bool InsertPoints(const std::vector<SparsePoint3D>& points, uint32_t* firstID = nullptr);
+    bool RemovePoints(const std::vector<uint32_t>& ids);
 protected:
     std::vector<SparsePoint3D> m_sparsePoints;
     DataHeader m_header;
@@ -130,4 +208,11 @@ private:
     ComputeStage m_computeStage;
     RenderStage m_renderStage;
     bool m_needsUpdate = false;
+    bool m_widestDimSplits = false;
+    std::unique_ptr<DynamicKDTree3D> m_dynamicTree;
+
+    bool EnableDynamicTree();
+    // 按当前的节点格式和布局重新创建并上传静态树的节点和值
+    bool UploadStaticTree();
+    bool UploadDynamicTree();
 };
\ No newline at end of file
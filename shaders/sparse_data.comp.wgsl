@@ -19,10 +19,10 @@ struct Uniforms {
     numLevels: u32,
     interpolationMethod: u32,
     
-    // 第三组：16字节对齐，包含searchRadius和padding
+    // 第三组：16字节对齐，包含searchRadius、numNeighbors、eps和padding
     searchRadius: f32,
-    padding1: f32,
-    padding2: f32,
+    numNeighbors: u32,    // 插值方法4使用的K（1..64）
+    eps: f32,             // 近似KNN参数，0 为精确查询
     padding3: f32,
 };
 
@@ -37,7 +37,31 @@ struct GPUPoint {
 @group(0) @binding(1) var<uniform> uniforms: Uniforms;
 @group(0) @binding(2) var<storage, read> sparsePoints: array<SparsePoint>;
 @group(1) @binding(0) var inputTF: texture_2d<f32>;
-@group(2) @binding(0) var<storage, read> kdTreePoints: array<GPUPoint>;
+// 节点数组超过单个绑定上限时分成最多4块（ChunkedStorageBuffer），除最后一块外每块的节点数相同；
+// 只有一块时 kdTreePoints0 就是全部节点。统一通过 kdNode() 按全局下标读取
+@group(2) @binding(0) var<storage, read> kdTreePoints0: array<GPUPoint>;
+@group(2) @binding(2) var<storage, read> kdTreePoints1: array<GPUPoint>;
+@group(2) @binding(3) var<storage, read> kdTreePoints2: array<GPUPoint>;
+@group(2) @binding(4) var<storage, read> kdTreePoints3: array<GPUPoint>;
+// 节点的值，与 kdNode() 的下标一一对应；单独存放，只更新值时不用重新上传坐标
+@group(2) @binding(1) var<storage, read> kdValues: array<f32>;
+
+// 按全局下标读取节点，块的边界对调用方透明
+fn kdNode(i: u32) -> GPUPoint {
+    let chunkNodes = arrayLength(&kdTreePoints0);
+    if (i < chunkNodes) {
+        return kdTreePoints0[i];
+    }
+    let chunk = i / chunkNodes;
+    let j = i - chunk * chunkNodes;
+    if (chunk == 1u) {
+        return kdTreePoints1[j];
+    }
+    if (chunk == 2u) {
+        return kdTreePoints2[j];
+    }
+    return kdTreePoints3[j];
+}
 
 fn getColorFromTF(normalizedValue: f32) -> vec4<f32> {
     let tfWidth = textureDimensions(inputTF).x;
@@ -205,11 +229,11 @@ fn bruteNearestKD(query: vec2<f32>) -> f32 {
     var minDist = 1e30;
     var bestValue = 0.0;
     for (var i = 0u; i < uniforms.totalNodes; i = i + 1u) {
-        let p = kdTreePoints[i];
+        let p = kdNode(i);
         let d = distance2D(query.x, query.y, p.x, p.y);
         if (d < minDist) {
             minDist = d;
-            bestValue = p.value;
+            bestValue = kdValues[i];
         }
     }
     return bestValue;
@@ -380,7 +404,7 @@ fn kdTreeTraverseStackFree(
             continue;
         }
         
-        let currNode = kdTreePoints[curr];
+        let currNode = kdNode(u32(curr));
         let child = 2 * curr + 1;
         let fromChild = (prev >= child);
         
@@ -441,7 +465,7 @@ fn kdTreeKNNSearch(queryPoint: vec2<f32>, k: i32, searchRadius: f32) -> FixedCan
     
     // 确保有节点可以搜索
     if (uniforms.totalNodes > 0u) {
-        kdTreeTraverseStackFree(&result, queryPoint, i32(uniforms.totalNodes), 0.0);
+        kdTreeTraverseStackFree(&result, queryPoint, i32(uniforms.totalNodes), uniforms.eps);
     }
     
     return result;
@@ -454,10 +478,7 @@ fn kdTreeNearestNeighborInterpolation(dataPos: vec2<f32>) -> f32 {
     let pointID = getPointID(&knnResult, 0);
     if (pointID >= 0 && pointID < i32(uniforms.totalNodes)) 
     {
-        let value = kdTreePoints[pointID].value;
-        let val2 = bruteNearestKD(dataPos);
-        let err = abs(value - val2);
-        return val2;
+        return kdValues[pointID];
     }
     
     return -1.0;
@@ -473,7 +494,7 @@ fn kdTreeIDWWithPower(dataPos: vec2<f32>, k: i32, power: f32) -> f32 {
     
     let firstDist2 = getDist2(&knnResult, 0);
     if (firstDist2 < 0.0001) {
-        return kdTreePoints[firstPointID].value;
+        return kdValues[firstPointID];
     }
     
     var weightedSum = 0.0;
@@ -486,7 +507,7 @@ fn kdTreeIDWWithPower(dataPos: vec2<f32>, k: i32, power: f32) -> f32 {
             if (dist2 > 0.0001) {
                 let dist = sqrt(dist2);
                 let weight = 1.0 / pow(dist, power);  // 可调整的幂次
-                weightedSum += kdTreePoints[pointID].value * weight;
+                weightedSum += kdValues[pointID] * weight;
                 weightSum += weight;
             }
         }
@@ -500,6 +521,273 @@ fn kdTreeIDWWithPower(dataPos: vec2<f32>, k: i32, power: f32) -> f32 {
 }
 
 
+// ============ 大K的堆式候选列表（对应CPU的HeapCandidateList） ============
+
+const MAX_HEAP_K: i32 = 64;
+
+// entry[0..k) 组成最大堆，堆顶是当前第k近的点
+struct HeapCandidateList {
+    entry: array<EncodedEntry, 64>,
+    k: i32,
+};
+
+fn initHeapCandidateList(cutOffRadius: f32, k: i32) -> HeapCandidateList {
+    var list: HeapCandidateList;
+    list.k = clamp(k, 1, MAX_HEAP_K);
+    
+    let initEntry = encode(cutOffRadius * cutOffRadius, -1);
+    for (var i = 0; i < list.k; i++) {
+        list.entry[i] = initEntry;
+    }
+    
+    return list;
+}
+
+fn heapMaxRadius2(list: ptr<function, HeapCandidateList>) -> f32 {
+    return decodeDist2((*list).entry[0]);
+}
+
+// 对应CPU的HeapCandidateList::push：不比堆顶近的候选直接丢弃，否则替换堆顶并下沉
+fn heapPush(list: ptr<function, HeapCandidateList>, dist: f32, pointID: i32) {
+    let v = encode(dist, pointID);
+    if (!compareEntries(v, (*list).entry[0])) {
+        return;
+    }
+    
+    var pos = 0;
+    loop {
+        var child = 2 * pos + 1;
+        if (child >= (*list).k) {
+            break;
+        }
+        if (child + 1 < (*list).k && compareEntries((*list).entry[child], (*list).entry[child + 1])) {
+            child = child + 1;
+        }
+        if (!compareEntries(v, (*list).entry[child])) {
+            break;
+        }
+        (*list).entry[pos] = (*list).entry[child];
+        pos = child;
+    }
+    (*list).entry[pos] = v;
+}
+
+fn processHeapCandidate(list: ptr<function, HeapCandidateList>, candPrimID: i32, candDist2: f32) -> f32 {
+    heapPush(list, candDist2, candPrimID);
+    return heapMaxRadius2(list);
+}
+
+// 与 kdTreeTraverseStackFree 相同的无栈遍历，候选列表换成堆
+fn kdTreeTraverseStackFreeHeap(
+    result: ptr<function, HeapCandidateList>,
+    queryPoint: vec2<f32>,
+    N: i32,
+    eps: f32
+) {
+    let epsErr = 1.0 + eps;
+    let numDims = 2;
+    var cullDist = heapMaxRadius2(result);
+    
+    var prev = -1;
+    var curr = 0;
+    
+    loop {
+        let parent = (curr + 1) / 2 - 1;
+        
+        if (curr >= N) {
+            prev = curr;
+            curr = parent;
+            continue;
+        }
+        
+        let currNode = kdNode(u32(curr));
+        let child = 2 * curr + 1;
+        let fromChild = (prev >= child);
+        
+        if (!fromChild) {
+            let currPoint = vec2<f32>(currNode.x, currNode.y);
+            let sqrDist = sqrDistance2D(queryPoint, currPoint);
+            cullDist = processHeapCandidate(result, curr, sqrDist);
+        }
+        
+        let currDim = levelOf(curr) % numDims;
+        let currDimDist = getCoord(queryPoint, currDim) - getCoord(vec2<f32>(currNode.x, currNode.y), currDim);
+        
+        let currSide = select(0, 1, currDimDist > 0.0);
+        let currCloseChild = 2 * curr + 1 + currSide;
+        let currFarChild = 2 * curr + 2 - currSide;
+        
+        var next = -1;
+        
+        if (prev == currCloseChild) {
+            if ((currFarChild < N) && (currDimDist * currDimDist * epsErr < cullDist)) {
+                next = currFarChild;
+            } else {
+                next = parent;
+            }
+        } else if (prev == currFarChild) {
+            next = parent;
+        } else {
+            if (child < N) {
+                next = currCloseChild;
+            } else {
+                next = parent;
+            }
+        }
+        
+        if (next == -1) {
+            return;
+        }
+        
+        prev = curr;
+        curr = next;
+    }
+}
+
+// 任意K（最多64）的反距离权重插值；堆中的条目无序，所以逐个判断是否与查询点重合
+fn kdTreeIDWLargeK(dataPos: vec2<f32>, k: i32, power: f32) -> f32 {
+    var result = initHeapCandidateList(uniforms.searchRadius, k);
+    if (uniforms.totalNodes > 0u) {
+        kdTreeTraverseStackFreeHeap(&result, dataPos, i32(uniforms.totalNodes), uniforms.eps);
+    }
+    
+    var weightedSum = 0.0;
+    var weightSum = 0.0;
+    
+    for (var i = 0; i < result.k; i++) {
+        let pointID = decodePointID(result.entry[i]);
+        if (pointID >= 0 && pointID < i32(uniforms.totalNodes)) {
+            let dist2 = decodeDist2(result.entry[i]);
+            if (dist2 < 0.0001) {
+                return kdValues[pointID];
+            }
+            let weight = 1.0 / pow(sqrt(dist2), power);
+            weightedSum += kdValues[pointID] * weight;
+            weightSum += weight;
+        }
+    }
+    
+    if (weightSum > 0.0) {
+        return weightedSum / weightSum;
+    }
+    
+    return -1.0;
+}
+
+// ============ 固定半径查询（对应CPU的 kdTree::rangeQuery） ============
+
+// 半径内点的Wendland加权累加，对应CPU的 RangeResult 加上访问回调
+struct RangeAccumulator {
+    radius: f32,
+    radius2: f32,
+    weightedSum: f32,
+    weightSum: f32,
+};
+
+// Wendland C2 核函数，对应CPU的 kdTree::wendlandC2
+fn wendlandC2(dist: f32, h: f32) -> f32 {
+    let q = dist / h;
+    if (q >= 1.0) {
+        return 0.0;
+    }
+    let t = 1.0 - q;
+    return t * t * t * t * (4.0 * q + 1.0);
+}
+
+// 与CPU一致：只接受严格小于半径的点，剔除距离始终是半径本身
+fn processRangeCandidate(acc: ptr<function, RangeAccumulator>, candPrimID: i32, candDist2: f32) -> f32 {
+    if (candDist2 < (*acc).radius2) {
+        let weight = wendlandC2(sqrt(candDist2), (*acc).radius);
+        (*acc).weightedSum += weight * kdValues[candPrimID];
+        (*acc).weightSum += weight;
+    }
+    return (*acc).radius2;
+}
+
+// 与 kdTreeTraverseStackFree 相同的无栈遍历，只是剔除距离固定为查询半径
+fn kdTreeRangeTraverseStackFree(
+    acc: ptr<function, RangeAccumulator>,
+    queryPoint: vec2<f32>,
+    N: i32
+) {
+    let numDims = 2;
+    var cullDist = (*acc).radius2;
+    
+    var prev = -1;
+    var curr = 0;
+    
+    loop {
+        let parent = (curr + 1) / 2 - 1;
+        
+        if (curr >= N) {
+            prev = curr;
+            curr = parent;
+            continue;
+        }
+        
+        let currNode = kdNode(u32(curr));
+        let child = 2 * curr + 1;
+        let fromChild = (prev >= child);
+        
+        if (!fromChild) {
+            let currPoint = vec2<f32>(currNode.x, currNode.y);
+            let sqrDist = sqrDistance2D(queryPoint, currPoint);
+            cullDist = processRangeCandidate(acc, curr, sqrDist);
+        }
+        
+        let currDim = levelOf(curr) % numDims;
+        let currDimDist = getCoord(queryPoint, currDim) - getCoord(vec2<f32>(currNode.x, currNode.y), currDim);
+        
+        let currSide = select(0, 1, currDimDist > 0.0);
+        let currCloseChild = 2 * curr + 1 + currSide;
+        let currFarChild = 2 * curr + 2 - currSide;
+        
+        var next = -1;
+        
+        if (prev == currCloseChild) {
+            if ((currFarChild < N) && (currDimDist * currDimDist < cullDist)) {
+                next = currFarChild;
+            } else {
+                next = parent;
+            }
+        } else if (prev == currFarChild) {
+            next = parent;
+        } else {
+            if (child < N) {
+                next = currCloseChild;
+            } else {
+                next = parent;
+            }
+        }
+        
+        if (next == -1) {
+            return;
+        }
+        
+        prev = curr;
+        curr = next;
+    }
+}
+
+// Wendland紧支撑插值：半径内所有点按核函数加权，对应CPU的 KDTreeBuilder2D::wendlandInterpolate
+fn kdTreeWendlandInterpolation(dataPos: vec2<f32>, radius: f32) -> f32 {
+    var acc: RangeAccumulator;
+    acc.radius = radius;
+    acc.radius2 = radius * radius;
+    acc.weightedSum = 0.0;
+    acc.weightSum = 0.0;
+    
+    if (uniforms.totalNodes > 0u && radius > 0.0) {
+        kdTreeRangeTraverseStackFree(&acc, dataPos, i32(uniforms.totalNodes));
+    }
+    
+    if (acc.weightSum > 0.0) {
+        return acc.weightedSum / acc.weightSum;
+    }
+    return -1.0;
+}
+
+
 fn interpolateValue(dataPos: vec2<f32>) -> f32 {
     if (uniforms.interpolationMethod == 0u) {
         return kdTreeNearestNeighborInterpolation(dataPos);
@@ -510,6 +798,12 @@ fn interpolateValue(dataPos: vec2<f32>) -> f32 {
     else if (uniforms.interpolationMethod == 2u) {
         return kdTreeIDWWithPower(dataPos, 5, 2.0);
     }
+    else if (uniforms.interpolationMethod == 3u) {
+        return kdTreeWendlandInterpolation(dataPos, uniforms.searchRadius);
+    }
+    else if (uniforms.interpolationMethod == 4u) {
+        return kdTreeIDWLargeK(dataPos, i32(uniforms.numNeighbors), 2.0);
+    }
     return 0.0;
 }
 
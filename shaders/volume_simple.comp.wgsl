@@ -20,14 +20,28 @@ struct Uniforms {
     // 第二组：16字节对齐的float4 (新增gridDepth)
     gridDepth: f32,
     searchRadius: f32,
-    padding1: f32,
-    padding2: f32,
+    eps: f32,             // 近似KNN参数，0 为精确查询
+    numTrees: u32,        // kdTrees 中的树数（静态树为1，动态森林为森林中的树数）
     
     // 第三组：16字节对齐的uint4
     totalNodes: u32,
     totalPoints: u32,
     numLevels: u32,
     interpolationMethod: u32,
+
+    // 压缩节点的解码参数（nodeFormat 为 NODE_FORMAT_COMPACT 时）：坐标 = quantLower + q * quantStep
+    quantLower: vec3<f32>,
+    nodeFormat: u32,
+    quantStep: vec3<f32>,
+    blockHeight: u32,     // 节点数组的分块布局高度（见 nodeSlot），0 为广度优先
+    // 压缩节点的误差界：每轴 |精确 - 解码| <= quantMaxErr，点的位置误差 <= quantMaxPointError（见 kdTreeTraverseStackFree3D）
+    quantMaxErr: vec3<f32>,
+    quantMaxPointError: f32,
+
+    warmStart: u32,       // 非0时查询用上一个体素的结果给出初始剔除半径（见 kdTreeKNNSearch3D）
+    compactExact: u32,    // 压缩节点时非0：节点缓冲区中有精确坐标（见 kdExactPoint），候选点用它重新打分
+    padding2: u32,
+    padding3: u32,
 };
 
 struct GPUPoint3D {
@@ -45,7 +59,100 @@ struct GPUPoint3D {
 @group(0) @binding(1) var<uniform> uniforms: Uniforms;
 @group(0) @binding(2) var<storage, read> sparsePoints: array<SparsePoint>;
 @group(1) @binding(0) var inputTF: texture_2d<f32>;
-@group(2) @binding(0) var<storage, read> kdTreePoints: array<GPUPoint3D>;
+// 一棵树在节点数组中的范围（动态森林的每棵树各占一段）
+struct KDTreeRange {
+    firstNode: u32,
+    numNodes: u32,
+};
+
+// 节点数组超过单个绑定上限时分成最多4块（ChunkedStorageBuffer），除最后一块外每块的节点数相同；
+// 只有一块时 kdTreePoints0 就是全部节点。节点有两种格式（uniforms.nodeFormat），所以按u32读取，
+// 统一通过 kdNode() 按全局下标读取并解码
+@group(2) @binding(0) var<storage, read> kdTreePoints0: array<u32>;
+@group(2) @binding(3) var<storage, read> kdTreePoints1: array<u32>;
+@group(2) @binding(4) var<storage, read> kdTreePoints2: array<u32>;
+@group(2) @binding(5) var<storage, read> kdTreePoints3: array<u32>;
+@group(2) @binding(1) var<storage, read> kdTrees: array<KDTreeRange>;
+// 节点的值，与 kdNode() 的下标一一对应；单独存放，只更新值时不用重新上传坐标
+@group(2) @binding(2) var<storage, read> kdValues: array<f32>;
+
+// 调试变体：VIS3D::SetTraversalStats 创建管线时通过管线常量把它设为 true，每个KDTree查询把自己的计数
+// 累加到 traversalStats（VIS3D::GPUTraversalStats，含义同 kdTree::TraversalStats）。
+// 为 false 时计数代码在创建管线时去掉
+override TRAVERSAL_STATS: bool = false;
+const STAT_QUERIES: u32 = 0u;
+const STAT_NODES: u32 = 1u;
+const STAT_DISTANCES: u32 = 2u;
+const STAT_FAR_DESCENTS: u32 = 3u;
+const STAT_PUSHES: u32 = 4u;
+@group(2) @binding(6) var<storage, read_write> traversalStats: array<atomic<u32>, 5>;
+// 当前查询的计数，查询结束时一次性累加，避免每个节点都做原子操作
+var<private> queryStats: array<u32, 5>;
+
+// GPUPoint3D：x, y, z, value, padding1..4，共8个字（padding1 为删除标记，padding2 为分割维度）
+const NODE_FORMAT_FULL: u32 = 0u;
+const FULL_NODE_WORDS: u32 = 8u;
+// GPUCompactPoint3D：x | y<<16, z | 标志<<16（标志第0位为删除标记，第1-2位为分割维度），共2个字
+const NODE_FORMAT_COMPACT: u32 = 1u;
+const COMPACT_NODE_WORDS: u32 = 2u;
+
+fn kdWord(chunk: u32, i: u32) -> u32 {
+    switch chunk {
+        case 0u: { return kdTreePoints0[i]; }
+        case 1u: { return kdTreePoints1[i]; }
+        case 2u: { return kdTreePoints2[i]; }
+        default: { return kdTreePoints3[i]; }
+    }
+}
+
+// 按全局下标读取节点，块的边界和节点格式对调用方透明；压缩节点的 value 为0（值在 kdValues 中），
+// 坐标为解码坐标（精确坐标见 kdExactPoint）。两种格式都解码出 padding1（删除标记）和 padding2（分割维度）
+fn kdNode(i: u32) -> GPUPoint3D {
+    let compact = uniforms.nodeFormat == NODE_FORMAT_COMPACT;
+    let stride = select(FULL_NODE_WORDS, COMPACT_NODE_WORDS, compact);
+    let chunkNodes = arrayLength(&kdTreePoints0) / stride;
+    let chunk = i / chunkNodes;
+    let w = (i - chunk * chunkNodes) * stride;
+
+    var node: GPUPoint3D;
+    if (compact) {
+        let xy = kdWord(chunk, w);
+        let zFlags = kdWord(chunk, w + 1u);
+        let q = vec3<f32>(f32(xy & 0xffffu), f32(xy >> 16u), f32(zFlags & 0xffffu));
+        let p = uniforms.quantLower + q * uniforms.quantStep;
+        node.x = p.x;
+        node.y = p.y;
+        node.z = p.z;
+        node.value = 0.0;
+        node.padding1 = select(0.0, DEAD_NODE, ((zFlags >> 16u) & 1u) != 0u);
+        node.padding2 = f32((zFlags >> 17u) & 3u);
+    } else {
+        node.x = bitcast<f32>(kdWord(chunk, w));
+        node.y = bitcast<f32>(kdWord(chunk, w + 1u));
+        node.z = bitcast<f32>(kdWord(chunk, w + 2u));
+        node.value = bitcast<f32>(kdWord(chunk, w + 3u));
+        node.padding1 = bitcast<f32>(kdWord(chunk, w + 4u));
+        node.padding2 = bitcast<f32>(kdWord(chunk, w + 5u));
+    }
+    return node;
+}
+
+// 按节点缓冲区的全局字下标读取（块大小按字计算，一个值可以落在任意块）
+fn kdGlobalWord(g: u32) -> u32 {
+    let chunkWords = arrayLength(&kdTreePoints0);
+    let chunk = g / chunkWords;
+    return kdWord(chunk, g - chunk * chunkWords);
+}
+
+// 压缩节点 i 的精确坐标：接在 totalNodes 个压缩节点之后，每个节点 x, y, z 三个f32，
+// 只有通过接受界的候选点才读取；uniforms.compactExact 为0时没有上传
+fn kdExactPoint(i: u32) -> vec3<f32> {
+    let w = COMPACT_NODE_WORDS * uniforms.totalNodes + 3u * i;
+    return vec3<f32>(bitcast<f32>(kdGlobalWord(w)), bitcast<f32>(kdGlobalWord(w + 1u)), bitcast<f32>(kdGlobalWord(w + 2u)));
+}
+
+// padding1 为该值的节点已被删除：仍作为分割平面，但不再是候选点
+const DEAD_NODE: f32 = 1.0;
 
 // ============ Transfer Function ============
 
@@ -79,6 +186,24 @@ fn levelOf(nodeID: i32) -> i32 {
     return k;
 }
 
+// 逻辑节点 curr（广度优先编号）在节点数组中的位置，对应CPU的 kdTree::BlockedLayout：
+// 完整的层每 blockHeight 层切成一个子树连续存放，最后一个不完整的层保持广度优先顺序。
+// completeLevels 为 levelOf(N)，每次遍历算一次
+fn nodeSlot(curr: i32, completeLevels: i32) -> i32 {
+    let h = i32(uniforms.blockHeight);
+    let L = levelOf(curr);
+    if (h <= 1 || L >= completeLevels) {
+        return curr;
+    }
+    let rootLevel = L - L % h;
+    let l = L - rootLevel;
+    let hb = min(h, completeLevels - rootLevel);
+    let root = ((curr + 1) >> u32(l)) - 1;
+    let firstInRootLevel = (1 << u32(rootLevel)) - 1;
+    let block = root - firstInRootLevel;
+    return firstInRootLevel + block * ((1 << u32(hb)) - 1) + ((1 << u32(l)) - 1) + (curr + 1 - ((root + 1) << u32(l)));
+}
+
 // 编码和解码函数（保持与2D版本一致）
 struct EncodedEntry {
     distBits: u32,    // 高32位：距离
@@ -115,7 +240,8 @@ fn compareEntries(a: EncodedEntry, b: EncodedEntry) -> bool {
     return a.pointIDBits < b.pointIDBits;
 }
 
-// 3D KDTree候选列表结构
+// 3D KDTree候选列表结构：插入排序，k 最多为5。大K的堆式候选列表（最多64）只在2D的 sparse_data.comp.wgsl 中，
+// 这里的体渲染只做最近邻（见 interpolateValue），界面上的K选择不作用于3D
 struct FixedCandidateList3D {
     entry: array<EncodedEntry, 5>,
     cutOffRadius2: f32,
@@ -198,16 +324,26 @@ fn getCoord3D(point: vec3<f32>, dim: i32) -> f32 {
     }
 }
 
-// 3D KDTree遍历函数
+// 3D KDTree遍历函数：遍历从 base 开始的 N 个节点组成的树，候选点ID为节点的全局下标（见 kdNode）。
+// curr 是广度优先编号，节点在数组中的位置由 nodeSlot() 给出。
+// 压缩节点与CPU端 kdTree::knn(..., exactNodes) 相同：远端子树只在分割面向查询点移动 quantMaxErr 后
+// 仍超出范围时跳过；解码距离不小于 (sqrt(cullDist) + quantMaxPointError)^2 的点不可能在范围内，
+// 不读精确坐标直接跳过，其余的按精确距离打分，所以结果与完整节点相同
 fn kdTreeTraverseStackFree3D(
     result: ptr<function, FixedCandidateList3D>, 
     queryPoint: vec3<f32>, 
+    base: u32,
     N: i32,
     eps: f32
 ) {
     let epsErr = 1.0 + eps;
-    let numDims = 3;  // 3D的维度数
-    var cullDist = uniforms.searchRadius * uniforms.searchRadius;
+    var cullDist = maxRadius2_3D(result);
+    let completeLevels = levelOf(N);
+    // 压缩节点且有精确坐标时才放宽剪枝并重新打分；只有压缩节点时按解码坐标查询
+    let exact = uniforms.nodeFormat == NODE_FORMAT_COMPACT && uniforms.compactExact != 0u;
+    // 解码距离的接受界，cullDist 变小时随之更新
+    var acceptRadius = sqrt(cullDist) + uniforms.quantMaxPointError;
+    var acceptDist2 = acceptRadius * acceptRadius;
     
     var prev = -1;
     var curr = 0;
@@ -221,29 +357,51 @@ fn kdTreeTraverseStackFree3D(
             continue;
         }
         
-        let currNode = kdTreePoints[curr];
+        let currSlot = i32(base) + nodeSlot(curr, completeLevels);
+        let currNode = kdNode(u32(currSlot));
         let child = 2 * curr + 1;
         let fromChild = (prev >= child);
+        if (TRAVERSAL_STATS) {
+            queryStats[STAT_NODES] += 1u;
+        }
         
-        if (!fromChild) {
+        if (!fromChild && currNode.padding1 != DEAD_NODE) {
             let currPoint = vec3<f32>(currNode.x, currNode.y, currNode.z);
-            let sqrDist = sqrDistance3D(queryPoint, currPoint);
-            cullDist = processCandidate3D(result, curr, sqrDist);
+            var sqrDist = sqrDistance3D(queryPoint, currPoint);
+            let accepted = !exact || sqrDist < acceptDist2;
+            if (exact && accepted) {
+                sqrDist = sqrDistance3D(queryPoint, kdExactPoint(u32(currSlot)));
+            }
+            if (TRAVERSAL_STATS) {
+                queryStats[STAT_DISTANCES] += 1u;
+                if (accepted && sqrDist < cullDist) {
+                    queryStats[STAT_PUSHES] += 1u;
+                }
+            }
+            if (accepted) {
+                cullDist = processCandidate3D(result, currSlot, sqrDist);
+                if (exact) {
+                    acceptRadius = sqrt(cullDist) + uniforms.quantMaxPointError;
+                    acceptDist2 = acceptRadius * acceptRadius;
+                }
+            }
         }
         
-        // 计算当前维度：3D中在x,y,z之间循环
-        let currDim = levelOf(curr) % numDims;
+        // 当前维度由构建时写进节点（轮流分割时为 levelOf(curr) % 3，最宽维分割时为子树包围盒最宽的维度）
+        let currDim = i32(currNode.padding2);
         
         let currDimDist = getCoord3D(queryPoint, currDim) - getCoord3D(vec3<f32>(currNode.x, currNode.y, currNode.z), currDim);
         
         let currSide = select(0, 1, currDimDist > 0.0);
         let currCloseChild = 2 * curr + 1 + currSide;
         let currFarChild = 2 * curr + 2 - currSide;
+        // 压缩节点的精确分割面最多比解码的近 quantMaxErr
+        let planeDist = max(0.0, abs(currDimDist) - select(0.0, getCoord3D(uniforms.quantMaxErr, currDim), exact));
         
         var next = -1;
         
         if (prev == currCloseChild) {
-            if ((currFarChild < N) && (currDimDist * currDimDist * epsErr < cullDist)) {
+            if ((currFarChild < N) && (planeDist * planeDist * epsErr < cullDist)) {
                 next = currFarChild;
             } else {
                 next = parent;
@@ -261,19 +419,52 @@ fn kdTreeTraverseStackFree3D(
         if (next == -1) {
             return;
         }
+        if (TRAVERSAL_STATS && next == currFarChild) {
+            queryStats[STAT_FAR_DESCENTS] += 1u;
+        }
         
         prev = curr;
         curr = next;
     }
 }
 
+// 暖启动：本次调用上一个查询的位置、k 和第k近距离（<0 表示还没有）。上一个查询的k个近邻都在
+// 它的第k近距离 r 内，所以这次查询的第k近距离不超过 r + 两次查询点的距离（三角不等式）
+var<private> warmQuery: vec3<f32>;
+var<private> warmK: i32 = 0;
+var<private> warmRadius: f32 = -1.0;
+// 暖启动半径的相对余量，覆盖浮点舍入
+const WARM_START_SLACK: f32 = 1.00001;
+
 // 3D KDTree KNN搜索函数
 fn kdTreeKNNSearch3D(queryPoint: vec3<f32>, k: i32, searchRadius: f32) -> FixedCandidateList3D {
-    var result = initCandidateList3D(searchRadius, k);
+    var radius = searchRadius;
+    if (uniforms.warmStart != 0u && warmK == k && warmRadius >= 0.0) {
+        radius = min(searchRadius, (warmRadius + distance(queryPoint, warmQuery)) * WARM_START_SLACK);
+    }
+    var result = initCandidateList3D(radius, k);
+    if (TRAVERSAL_STATS) {
+        queryStats = array<u32, 5>(1u, 0u, 0u, 0u, 0u);
+    }
     
-    if (uniforms.totalNodes > 0u) {
-        kdTreeTraverseStackFree3D(&result, queryPoint, i32(uniforms.totalNodes), 0.0);
+    // 所有树共享一个候选列表，前面的树找到的距离直接用于后面的剪枝
+    for (var t = 0u; t < uniforms.numTrees; t++) {
+        let tree = kdTrees[t];
+        if (tree.numNodes > 0u) {
+            kdTreeTraverseStackFree3D(&result, queryPoint, tree.firstNode, i32(tree.numNodes), uniforms.eps);
+        }
+    }
+
+    if (TRAVERSAL_STATS) {
+        for (var i = 0u; i < 5u; i++) {
+            atomicAdd(&traversalStats[i], queryStats[i]);
+        }
     }
+
+    // 找到的不足k个时这是 radius，仍是上界
+    warmQuery = queryPoint;
+    warmK = k;
+    warmRadius = sqrt(maxRadius2_3D(&result));
     
     return result;
 }
@@ -284,7 +475,7 @@ fn kdTreeNearestNeighborInterpolation3D(dataPos: vec3<f32>) -> f32 {
     
     let pointID = getPointID_3D(&knnResult, 0);
     if (pointID >= 0 && pointID < i32(uniforms.totalNodes)) {
-        return kdTreePoints[pointID].value;
+        return kdValues[pointID];
     }
 
     
@@ -302,7 +493,7 @@ fn kdTreeIDWWithPower3D(dataPos: vec3<f32>, k: i32, power: f32) -> f32 {
     
     let firstDist2 = getDist2_3D(&knnResult, 0);
     if (firstDist2 < 0.0001) {
-        return kdTreePoints[firstPointID].value;
+        return kdValues[firstPointID];
     }
     
     var weightedSum = 0.0;
@@ -315,7 +506,7 @@ fn kdTreeIDWWithPower3D(dataPos: vec3<f32>, k: i32, power: f32) -> f32 {
             if (dist2 > 0.0001) {
                 let dist = sqrt(dist2);
                 let weight = 1.0 / pow(dist, power);
-                weightedSum += kdTreePoints[pointID].value * weight;
+                weightedSum += kdValues[pointID] * weight;
                 weightSum += weight;
             }
         }
@@ -333,11 +524,16 @@ fn bruteNearestKD3D(query: vec3<f32>) -> f32 {
     var minDist = 1e30;
     var bestValue = 0.0;
     for (var i = 0u; i < uniforms.totalNodes; i = i + 1u) {
-        let p = kdTreePoints[i];
-        let d = distance3D(query.x, query.y, query.z, p.x, p.y, p.z);
+        let node = kdNode(i);
+        // 压缩节点有精确坐标时用精确坐标，与 kdTreeTraverseStackFree3D 的结果可比
+        var p = vec3<f32>(node.x, node.y, node.z);
+        if (uniforms.nodeFormat == NODE_FORMAT_COMPACT && uniforms.compactExact != 0u) {
+            p = kdExactPoint(i);
+        }
+        let d = distanceVec3(query, p);
         if (d < minDist) {
             minDist = d;
-            bestValue = p.value;
+            bestValue = kdValues[i];
         }
     }
     return bestValue;
@@ -403,52 +599,60 @@ fn inverseDistanceWeighting3D(dataPos: vec3<f32>) -> f32 {
     return valueSum / weightSum;
 }
 
-// 主插值函数
+// 主插值函数：走KDTree（结果与暴力最近邻相同），这样值更新和动态插入/删除都会反映到输出
 fn interpolateValue(dataPos: vec3<f32>) -> f32 {
-    return nearestNeighborInterpolation3D(dataPos);
+    return kdTreeNearestNeighborInterpolation3D(dataPos);
 }
 
 
 // ============ Main Compute Shader ============
 
+// 每次调用沿x方向连续处理的体素数（VIS3D::kVoxelsPerInvocation），相邻体素之间可以暖启动查询
+const VOXELS_PER_INVOCATION: u32 = 4u;
+
 @compute @workgroup_size(4, 4, 4)
 fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {
     let dims = textureDimensions(outputTexture);
     
     // 边界检查
-    if (global_id.x >= dims.x || global_id.y >= dims.y || global_id.z >= dims.z) {
+    if (global_id.y >= dims.y || global_id.z >= dims.z) {
         return;
     }
     
-    // 当前像素在纹理空间
-    let pixelCoord = vec3<f32>(f32(global_id.x), f32(global_id.y), f32(global_id.z));
-    let uvw = pixelCoord / vec3<f32>(f32(dims.x), f32(dims.y), f32(dims.z));
-    
-    // 映射到数据空间
-    let dataPos = vec3<f32>(
-        uvw.x * uniforms.gridWidth,
-        uvw.y * uniforms.gridHeight,
-        uvw.z * uniforms.gridDepth
-    );
-    
-    // 使用真实数据插值
-    let interpolatedValue = interpolateValue(dataPos);
-
-    var color = vec4<f32>(1.0, 1.0, 1.0, 1.0); 
-    if (interpolatedValue != -1.0) {
-        // 标准化值到[0,1]
-        var epsilon = 10.0 / 256.0;
+    for (var i = 0u; i < VOXELS_PER_INVOCATION; i++) {
+        let voxel = vec3<u32>(global_id.x * VOXELS_PER_INVOCATION + i, global_id.y, global_id.z);
+        if (voxel.x >= dims.x) {
+            break;
+        }
 
-        let normalized = clamp(
-            (interpolatedValue - (-1.0)) / (1.0 - (-1.0)),
-            0.0 + epsilon, 1.0 - epsilon
-        );
+        // 当前像素在纹理空间
+        let pixelCoord = vec3<f32>(voxel);
+        let uvw = pixelCoord / vec3<f32>(f32(dims.x), f32(dims.y), f32(dims.z));
         
-        color = getColorFromTF(normalized);
+        // 映射到数据空间
+        let dataPos = vec3<f32>(
+            uvw.x * uniforms.gridWidth,
+            uvw.y * uniforms.gridHeight,
+            uvw.z * uniforms.gridDepth
+        );
         
-    }
-
-    textureStore(outputTexture, vec3<i32>(global_id.xyz), color);
+        // 使用真实数据插值
+        let interpolatedValue = interpolateValue(dataPos);
+
+        var color = vec4<f32>(1.0, 1.0, 1.0, 1.0); 
+        if (interpolatedValue != -1.0) {
+            // 标准化值到[0,1]
+            var epsilon = 10.0 / 256.0;
+
+            let normalized = clamp(
+                (interpolatedValue - (-1.0)) / (1.0 - (-1.0)),
+                0.0 + epsilon, 1.0 - epsilon
+            );
+            
+            color = getColorFromTF(normalized);
+            
+        }
 
-    
-}
\ No newline at end of file
+        textureStore(outputTexture, vec3<i32>(voxel), color);
+    }
+}
@@ -463,6 +463,12 @@ void Application::UpdateGui(wgpu::RenderPassEncoder renderPass)
         // 插值方法选择
         ImGui::Text("Interpolation Method");
         static int interpolation_method = 0; // 0 = KNN=1, 1 = KNN=3
+        // 插值方法和K只作用于2D视图；3D体渲染（volume_simple.comp.wgsl）固定用最近邻，候选列表最多5个
+        const bool interpolation_2d_only = m_visStyle != visStyle::k2D;
+        if (interpolation_2d_only) {
+            ImGui::TextDisabled("2D view only: the 3D volume uses nearest neighbor");
+        }
+        ImGui::BeginDisabled(interpolation_2d_only);
         
         // 横向排列 radio buttons
         if (ImGui::RadioButton("KNN = 1", interpolation_method == 0)) {
@@ -479,11 +485,49 @@ void Application::UpdateGui(wgpu::RenderPassEncoder renderPass)
             interpolation_method = 2;
             if (m_tfTest && m_visStyle == visStyle::k2D) m_tfTest->SetInterpolationMethod(interpolation_method);
         }
+        ImGui::SameLine(); // 同一行显示下一个控件
+        if (ImGui::RadioButton("Wendland", interpolation_method == 3)) {
+            interpolation_method = 3;
+            if (m_tfTest && m_visStyle == visStyle::k2D) m_tfTest->SetInterpolationMethod(interpolation_method);
+        }
+        ImGui::SameLine(); // 同一行显示下一个控件
+        if (ImGui::RadioButton("IDW, K =", interpolation_method == 4)) {
+            interpolation_method = 4;
+            if (m_tfTest && m_visStyle == visStyle::k2D) m_tfTest->SetInterpolationMethod(interpolation_method);
+        }
+
+        // 任意K的IDW：K 从CPU端编译好的取值中选择，2D着色器的堆式候选列表最多支持64
+        static int num_neighbors_index = 3; // kdTree::supportedK[3] == 8
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(60);
+        const int num_k = IM_ARRAYSIZE(kdTree::supportedK);
+        if (ImGui::BeginCombo("##NumNeighbors", std::to_string(kdTree::supportedK[num_neighbors_index]).c_str())) {
+            for (int i = 0; i < num_k; ++i) {
+                if (ImGui::Selectable(std::to_string(kdTree::supportedK[i]).c_str(), i == num_neighbors_index)) {
+                    num_neighbors_index = i;
+                    if (m_tfTest && m_visStyle == visStyle::k2D) m_tfTest->SetNumNeighbors(kdTree::supportedK[i]);
+                }
+            }
+            ImGui::EndCombo();
+        }
+        ImGui::EndDisabled();
 
 
-        ImGui::Text("Current K value: %d", interpolation_method == 0 ? 1 : interpolation_method == 1 ? 3 : 5);
-        if (ImGui::IsItemHovered()) {
-            ImGui::SetTooltip("Number of nearest neighbors used for interpolation");
+        if (interpolation_method == 3) {
+            ImGui::Text("All points within the search radius");
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Wendland C2 weights over a fixed-radius range query");
+            }
+        } else if (interpolation_method == 4) {
+            ImGui::Text("Current K value: %d", kdTree::supportedK[num_neighbors_index]);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Number of nearest neighbors used for interpolation");
+            }
+        } else {
+            ImGui::Text("Current K value: %d", interpolation_method == 0 ? 1 : interpolation_method == 1 ? 3 : 5);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Number of nearest neighbors used for interpolation");
+            }
         }
         
         ImGui::Spacing();
@@ -519,6 +563,24 @@ void Application::UpdateGui(wgpu::RenderPassEncoder renderPass)
         ImGui::Spacing();
         ImGui::Separator();
 
+        // 近似KNN：eps 越大越快，返回的距离最多是精确值的 sqrt(1+eps) 倍
+        ImGui::Text("Approximate KNN (eps)");
+        static float knn_eps = 0.0f;
+        if (ImGui::SliderFloat("##KnnEps", &knn_eps, 0.0f, 4.0f, "%.2f")) {
+            if (m_tfTest && m_visStyle == visStyle::k2D) {
+                m_tfTest->SetEps(knn_eps);
+            }
+            else if (m_volumeRenderingTest && m_visStyle == visStyle::k3D) {
+                m_volumeRenderingTest->SetEps(knn_eps);
+            }
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("0 = exact. Larger values skip more far subtrees; distances are at most sqrt(1+eps) times the exact ones");
+        }
+        
+        ImGui::Spacing();
+        ImGui::Separator();
+
         // 可选：显示当前设置和帮助信息
         ImGui::Text("Current K value: %d", interpolation_method == 0 ? 1 : 3);
         if (ImGui::IsItemHovered()) {
@@ -661,12 +723,30 @@ bool Application::InitWindowAndDevice(int width, int height, const char* title)
 
     wgpu::SupportedLimits supportedLimits;
     adapter.getLimits(&supportedLimits);
+    if (supportedLimits.limits.maxStorageBuffersPerShaderStage < VIS3D::ComputeStage::kStorageBuffersPerStage) {
+        std::cerr << "[ERROR]::InitWindowAndDevice() adapter supports " << supportedLimits.limits.maxStorageBuffersPerShaderStage
+                  << " storage buffers per shader stage, the 3D compute stage needs " << VIS3D::ComputeStage::kStorageBuffersPerStage << std::endl;
+        glfwDestroyWindow(m_window);
+        glfwTerminate();
+        return false;
+    }
+
+    // 默认限制下单个存储缓冲区绑定只有128MiB，大数据集的KDTree节点放不下：
+    // 存储缓冲区相关的上限直接要适配器支持的最大值，其余保持默认
+    wgpu::RequiredLimits requiredLimits = wgpu::Default;
+    requiredLimits.limits.maxBufferSize = supportedLimits.limits.maxBufferSize;
+    requiredLimits.limits.maxStorageBufferBindingSize = supportedLimits.limits.maxStorageBufferBindingSize;
+    requiredLimits.limits.maxStorageBuffersPerShaderStage = supportedLimits.limits.maxStorageBuffersPerShaderStage;
+    std::cout << "=== Requested Limits ===" << std::endl;
+    std::cout << "== maxBufferSize: " << requiredLimits.limits.maxBufferSize << std::endl;
+    std::cout << "== maxStorageBufferBindingSize: " << requiredLimits.limits.maxStorageBufferBindingSize << std::endl;
+    std::cout << "== maxStorageBuffersPerShaderStage: " << requiredLimits.limits.maxStorageBuffersPerShaderStage << std::endl;
 
 	std::cout << "Requesting device..." << std::endl;
 	wgpu::DeviceDescriptor deviceDesc = {};
 	deviceDesc.label = "My Device";
 	deviceDesc.requiredFeatureCount = 0;
-	deviceDesc.requiredLimits = nullptr;
+	deviceDesc.requiredLimits = &requiredLimits;
 	deviceDesc.defaultQueue.nextInChain = nullptr;
 	deviceDesc.defaultQueue.label = "The default queue";
 	deviceDesc.deviceLostCallback = [](WGPUDeviceLostReason reason, char const* message, void* /* pUserData */) {
@@ -0,0 +1,93 @@
+#include "ChunkedBuffer.h"
+
+size_t ChunkedStorageBuffer::MaxChunkElements(wgpu::Device device, size_t elementSize)
+{
+    wgpu::SupportedLimits limits;
+    device.getLimits(&limits);
+    const uint64_t maxBytes = std::min<uint64_t>(limits.limits.maxStorageBufferBindingSize, limits.limits.maxBufferSize);
+    return static_cast<size_t>(maxBytes / elementSize);
+}
+
+bool ChunkedStorageBuffer::Create(wgpu::Device device, const char* label, size_t numElements, size_t elementSize, size_t maxChunkBytes)
+{
+    Release();
+    if (numElements == 0 || elementSize == 0) return false;
+
+    size_t maxElements = MaxChunkElements(device, elementSize);
+    if (maxChunkBytes > 0) maxElements = std::min(maxElements, maxChunkBytes / elementSize);
+    if (maxElements == 0) {
+        std::cout << "[ERROR]::ChunkedStorageBuffer " << label << ": element larger than the binding limit" << std::endl;
+        return false;
+    }
+
+    const size_t numChunks = (numElements + maxElements - 1) / maxElements;
+    if (numChunks > kMaxChunks) {
+        std::cout << "[ERROR]::ChunkedStorageBuffer " << label << ": " << numElements << " elements need " << numChunks
+                  << " chunks of " << maxElements << ", at most " << kMaxChunks << " are supported" << std::endl;
+        return false;
+    }
+
+    // 只有一块时按实际大小分配；多块时除最后一块外都取满，着色器才能用第0块的长度作为块大小
+    m_chunkElements = numChunks == 1 ? numElements : maxElements;
+    m_elementSize = elementSize;
+    for (size_t c = 0; c < numChunks; ++c) {
+        const size_t n = std::min(m_chunkElements, numElements - c * m_chunkElements);
+
+        const std::string chunkLabel = std::string(label) + " #" + std::to_string(c);
+        wgpu::BufferDescriptor desc = {};
+        desc.label = chunkLabel.c_str();
+        desc.size = n * elementSize;
+        desc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
+        desc.mappedAtCreation = false;
+
+        wgpu::Buffer buffer = device.createBuffer(desc);
+        if (!buffer) {
+            std::cout << "[ERROR]::ChunkedStorageBuffer Failed to create " << chunkLabel << std::endl;
+            Release();
+            return false;
+        }
+        m_chunks.push_back(buffer);
+        m_chunkSizes.push_back(n);
+    }
+    m_capacity = numElements;
+    return true;
+}
+
+void ChunkedStorageBuffer::Release()
+{
+    for (auto& buffer : m_chunks) {
+        buffer.release();
+    }
+    m_chunks.clear();
+    m_chunkSizes.clear();
+    m_chunkElements = 0;
+    m_elementSize = 0;
+    m_capacity = 0;
+}
+
+void ChunkedStorageBuffer::Write(wgpu::Queue queue, size_t firstElement, const void* data, size_t numElements) const
+{
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    while (numElements > 0 && firstElement < m_capacity) {
+        const size_t chunk = firstElement / m_chunkElements;
+        const size_t offset = firstElement - chunk * m_chunkElements;
+        const size_t n = std::min(numElements, m_chunkSizes[chunk] - offset);
+        queue.writeBuffer(m_chunks[chunk], offset * m_elementSize, src, n * m_elementSize);
+        src += n * m_elementSize;
+        firstElement += n;
+        numElements -= n;
+    }
+}
+
+void ChunkedStorageBuffer::FillBinding(uint32_t chunk, wgpu::BindGroupEntry& entry) const
+{
+    if (chunk < m_chunks.size()) {
+        entry.buffer = m_chunks[chunk];
+        entry.offset = 0;
+        entry.size = m_chunkSizes[chunk] * m_elementSize;
+    } else {
+        entry.buffer = m_chunks[0];
+        entry.offset = 0;
+        entry.size = m_elementSize;
+    }
+}
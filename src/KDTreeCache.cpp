@@ -0,0 +1,202 @@
+#include "KDTreeCache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char kMagic[8] = { 'K', 'D', 'T', 'C', 'A', 'C', 'H', 'E' };
+    const uint64_t kAlignment = 64;
+
+    uint64_t alignUp(uint64_t offset)
+    {
+        return (offset + kAlignment - 1) / kAlignment * kAlignment;
+    }
+}
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path)
+{
+    std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    file->m_file = handle;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+        return nullptr;
+    }
+    file->m_mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!file->m_mapping) {
+        return nullptr;
+    }
+    file->m_data = static_cast<const uint8_t*>(MapViewOfFile(file->m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!file->m_data) {
+        return nullptr;
+    }
+    file->m_size = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    file->m_data = static_cast<const uint8_t*>(data);
+    file->m_size = static_cast<size_t>(st.st_size);
+#endif
+    return file;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file) CloseHandle(m_file);
+#else
+    if (m_data) munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+}
+
+uint64_t KDTreeCache::checksum(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool KDTreeCache::checksumFile(const std::string& path, uint64_t& checksum, uint64_t& size)
+{
+    auto file = MappedFile::open(path);
+    if (!file) {
+        return false;
+    }
+    checksum = KDTreeCache::checksum(file->data(), file->size());
+    size = file->size();
+    return true;
+}
+
+bool KDTreeCache::save(const std::string& path, uint32_t dims, uint32_t nodeStride,
+                       const void* nodes, const uint32_t* ids, size_t numNodes, uint32_t numLevels,
+                       const float worldLower[3], const float worldUpper[3],
+                       uint64_t sourceChecksum, uint64_t sourceSize)
+{
+    Header header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.dims = dims;
+    header.nodeStride = nodeStride;
+    header.numLevels = numLevels;
+    header.numNodes = numNodes;
+    header.nodesOffset = alignUp(sizeof(Header));
+    header.idsOffset = alignUp(header.nodesOffset + numNodes * nodeStride);
+    header.sourceSize = sourceSize;
+    header.sourceChecksum = sourceChecksum;
+    header.contentChecksum = checksum(ids, numNodes * sizeof(uint32_t), checksum(nodes, numNodes * nodeStride));
+    for (int d = 0; d < 3; ++d) {
+        header.worldLower[d] = worldLower[d];
+        header.worldUpper[d] = worldUpper[d];
+    }
+
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "KDTreeCache: Failed to create " << tmpPath << std::endl;
+            return false;
+        }
+        const std::vector<char> zeros(kAlignment, 0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        file.write(zeros.data(), header.nodesOffset - sizeof(Header));
+        file.write(static_cast<const char*>(nodes), numNodes * nodeStride);
+        file.write(zeros.data(), header.idsOffset - (header.nodesOffset + numNodes * nodeStride));
+        file.write(reinterpret_cast<const char*>(ids), numNodes * sizeof(uint32_t));
+        if (!file) {
+            std::cerr << "KDTreeCache: Failed to write " << tmpPath << std::endl;
+            file.close();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+
+    std::remove(path.c_str());
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "KDTreeCache: Failed to rename " << tmpPath << " to " << path << std::endl;
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool KDTreeCache::load(const std::string& path, uint32_t dims, uint32_t nodeStride,
+                       uint64_t sourceChecksum, uint64_t sourceSize, View& out)
+{
+    auto file = MappedFile::open(path);
+    if (!file || file->size() < sizeof(Header)) {
+        return false;
+    }
+
+    Header header;
+    std::memcpy(&header, file->data(), sizeof(Header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+        header.dims != dims || header.nodeStride != nodeStride ||
+        header.sourceChecksum != sourceChecksum || header.sourceSize != sourceSize) {
+        return false;
+    }
+    if (header.numNodes > file->size() || header.nodesOffset < sizeof(Header) || header.nodesOffset % kAlignment != 0 || header.idsOffset % kAlignment != 0 ||
+        header.idsOffset < header.nodesOffset + header.numNodes * nodeStride ||
+        header.idsOffset + header.numNodes * sizeof(uint32_t) > file->size()) {
+        std::cerr << "KDTreeCache: " << path << " is truncated" << std::endl;
+        return false;
+    }
+
+    const uint8_t* nodes = file->data() + header.nodesOffset;
+    const uint8_t* ids = file->data() + header.idsOffset;
+    const uint64_t content = checksum(ids, header.numNodes * sizeof(uint32_t), checksum(nodes, header.numNodes * nodeStride));
+    if (content != header.contentChecksum) {
+        std::cerr << "KDTreeCache: " << path << " is corrupted" << std::endl;
+        return false;
+    }
+
+    out.file = file;
+    out.nodes = nodes;
+    out.ids = reinterpret_cast<const uint32_t*>(ids);
+    out.numNodes = static_cast<size_t>(header.numNodes);
+    out.numLevels = header.numLevels;
+    for (int d = 0; d < 3; ++d) {
+        out.worldLower[d] = header.worldLower[d];
+        out.worldUpper[d] = header.worldUpper[d];
+    }
+    return true;
+}
@@ -11,17 +11,22 @@ KDTreeBuilder2D::~KDTreeBuilder2D()
     clear();
 }
 
-bool KDTreeBuilder2D::buildTree(const std::vector<SparsePoint2D>& inputPoints)
+bool KDTreeBuilder2D::buildTree(const std::vector<SparsePoint2D>& inputPoints, int numThreads)
 {
-    return buildTree(inputPoints.data(), inputPoints.size());
+    return buildTree(inputPoints.data(), inputPoints.size(), numThreads);
 }
 
-bool KDTreeBuilder2D::buildTree(const SparsePoint2D* points, size_t numPoints)
+bool KDTreeBuilder2D::buildTree(const SparsePoint2D* points, size_t numPoints, int numThreads)
 {
     if (!points || numPoints == 0) {
         std::cerr << "KDTreeBuilder2D: Invalid input points" << std::endl;
         return false;
     }
+    // 查询接口的索引是int，GPU端也按32位下标寻址；更大的点集只能直接用 kdTree 库（64位下标）
+    if (numPoints > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        std::cerr << "KDTreeBuilder2D: Too many points (" << numPoints << "), at most " << std::numeric_limits<int>::max() << std::endl;
+        return false;
+    }
     
     clear();
     
@@ -30,20 +35,24 @@ bool KDTreeBuilder2D::buildTree(const SparsePoint2D* points, size_t numPoints)
     m_kdtreePoints.reserve(numPoints);
     
     for (size_t i = 0; i < numPoints; ++i) {
-        m_kdtreePoints.push_back(sparseToKDTree(points[i]));
+        m_kdtreePoints.push_back({sparseToKDTree(points[i]), points[i].value, static_cast<uint32_t>(i)});
     }
     
     try {
         // 构建KDTree
         auto start = std::chrono::high_resolution_clock::now();
-        kdTree::buildTree_host<kdTree::float2, kdTree::default_data_traits<kdTree::float2>>(
-            m_kdtreePoints.data(), numPoints, &m_worldBounds);
+        kdTree::buildTree_partition<TreeNode, TreeTraits>(
+            m_kdtreePoints.data(), numPoints, &m_worldBounds, m_buildScratch, numThreads);
         auto end = std::chrono::high_resolution_clock::now();
         
         auto duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
         std::cout << "[KDTree] KDTree built successfully in " << duration_ms.count() << " ms" << std::endl;
         
         m_pointCount = numPoints;
+        m_slotToOriginal.resize(numPoints);
+        for (size_t i = 0; i < numPoints; ++i) {
+            m_slotToOriginal[i] = m_kdtreePoints[i].id;
+        }
         m_isBuilt = true;
         return true;
     }
@@ -56,7 +65,8 @@ bool KDTreeBuilder2D::buildTree(const SparsePoint2D* points, size_t numPoints)
 
 template<int K>
 bool KDTreeBuilder2D::knnSearch(const SparsePoint2D& queryPoint, float searchRadius, 
-                             std::vector<GPUPoint2D>& results, std::vector<float>& distances) const
+                             std::vector<GPUPoint2D>& results, std::vector<float>& distances,
+                             float eps) const
 {
     if (!m_isBuilt) {
         std::cerr << "KDTreeBuilder2D: Tree not built" << std::endl;
@@ -67,12 +77,13 @@ bool KDTreeBuilder2D::knnSearch(const SparsePoint2D& queryPoint, float searchRad
     kdTree::float2 queryKDTree = sparseToKDTree(queryPoint);
     
     // 创建候选列表
-    kdTree::FixedCandidateList<K> candidateList(searchRadius);
+    kdTree::KnnCandidateList<K> candidateList(searchRadius);
     
     try {
         // 执行KNN查询
-        kdTree::knn<kdTree::FixedCandidateList<K>, kdTree::float2, kdTree::default_data_traits<kdTree::float2>>(
-            candidateList, queryKDTree, m_kdtreePoints.data(), m_pointCount);
+        kdTree::knn<kdTree::KnnCandidateList<K>, TreeNode, TreeTraits>(
+            candidateList, queryKDTree, m_kdtreePoints.data(), m_pointCount, eps);
+        candidateList.sort();
         
         // 转换结果
         results.clear();
@@ -87,19 +98,8 @@ bool KDTreeBuilder2D::knnSearch(const SparsePoint2D& queryPoint, float searchRad
             
             if (pointID >= 0 && pointID < static_cast<int>(m_pointCount)) 
             {
-                float x = m_kdtreePoints[pointID].x;
-                float y = m_kdtreePoints[pointID].y;
-                float value;
-                for (auto & originalPoint : m_originalPoints) 
-                {
-                    if (originalPoint.x == x && originalPoint.y == y) 
-                    {
-                        value = originalPoint.value;
-                        break;
-                    }
-                }
-                
-                results.push_back({x, y, value, 0.0f});
+                const TreeNode& node = m_kdtreePoints[pointID];
+                results.push_back({node.point.x, node.point.y, node.value, 0.0f});
                 distances.push_back(std::sqrt(dist2));
             }
         }
@@ -114,7 +114,8 @@ bool KDTreeBuilder2D::knnSearch(const SparsePoint2D& queryPoint, float searchRad
 
 template<int K>
 bool KDTreeBuilder2D::knnSearch(const SparsePoint2D& queryPoint, float searchRadius,
-                             std::vector<int>& indices, std::vector<float>& distances) const
+                             std::vector<int>& indices, std::vector<float>& distances,
+                             float eps) const
 {
     if (!m_isBuilt) {
         std::cerr << "KDTreeBuilder2D: Tree not built" << std::endl;
@@ -125,12 +126,13 @@ bool KDTreeBuilder2D::knnSearch(const SparsePoint2D& queryPoint, float searchRad
     kdTree::float2 queryKDTree = sparseToKDTree(queryPoint);
     
     // 创建候选列表
-    kdTree::FixedCandidateList<K> candidateList(searchRadius);
+    kdTree::KnnCandidateList<K> candidateList(searchRadius);
     
     try {
         // 执行KNN查询
-        kdTree::knn<kdTree::FixedCandidateList<K>, kdTree::float2, kdTree::default_data_traits<kdTree::float2>>(
-            candidateList, queryKDTree, m_kdtreePoints.data(), m_pointCount);
+        kdTree::knn<kdTree::KnnCandidateList<K>, TreeNode, TreeTraits>(
+            candidateList, queryKDTree, m_kdtreePoints.data(), m_pointCount, eps);
+        candidateList.sort();
         
         // 转换结果
         indices.clear();
@@ -156,6 +158,53 @@ bool KDTreeBuilder2D::knnSearch(const SparsePoint2D& queryPoint, float searchRad
     }
 }
 
+bool KDTreeBuilder2D::knnSearch(const SparsePoint2D& queryPoint, int k, float searchRadius,
+                                std::vector<int>& indices, std::vector<float>& distances,
+                             float eps) const
+{
+    bool success = false;
+    if (!kdTree::dispatchK(k, [&](auto K) { success = knnSearch<K>(queryPoint, searchRadius, indices, distances, eps); })) {
+        std::cerr << "KDTreeBuilder2D: Unsupported K = " << k << std::endl;
+        return false;
+    }
+    return success;
+}
+
+bool KDTreeBuilder2D::radiusSearch(const SparsePoint2D& queryPoint, float radius,
+                                   std::vector<int>& indices, std::vector<float>& distances) const
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilder2D: Tree not built" << std::endl;
+        return false;
+    }
+
+    indices.clear();
+    distances.clear();
+    kdTree::rangeQuery<TreeNode, TreeTraits>(sparseToKDTree(queryPoint), radius, m_kdtreePoints.data(),
+                                             static_cast<int>(m_pointCount), [&](int pointID, float dist2) {
+        indices.push_back(pointID);
+        distances.push_back(std::sqrt(dist2));
+    });
+    return true;
+}
+
+float KDTreeBuilder2D::wendlandInterpolate(const SparsePoint2D& queryPoint, float radius) const
+{
+    if (!m_isBuilt || radius <= 0.0f) {
+        return -1.0f;
+    }
+
+    float weightedSum = 0.0f;
+    float weightSum = 0.0f;
+    kdTree::rangeQuery<TreeNode, TreeTraits>(sparseToKDTree(queryPoint), radius, m_kdtreePoints.data(),
+                                             static_cast<int>(m_pointCount), [&](int pointID, float dist2) {
+        const float weight = kdTree::wendlandC2(std::sqrt(dist2), radius);
+        weightedSum += weight * m_kdtreePoints[pointID].value;
+        weightSum += weight;
+    });
+    return weightSum > 0.0f ? weightedSum / weightSum : -1.0f;
+}
+
 std::vector<GPUPoint2D> KDTreeBuilder2D::getGPUPoints() const
 {
     std::vector<GPUPoint2D> gpuPoints;
@@ -164,24 +213,62 @@ std::vector<GPUPoint2D> KDTreeBuilder2D::getGPUPoints() const
     }
     
     gpuPoints.reserve(m_pointCount);
-    for (const auto& point : m_kdtreePoints) 
+    for (const auto& node : m_kdtreePoints) 
     {
-        float x = point.x; float y = point.y;
-        float value = 0.0f;
-        for (const auto& originalPoint : m_originalPoints)
-        {
-            if (originalPoint.x == x && originalPoint.y == y) 
-            {
-                value = originalPoint.value;
-                break;
-            }
-        }
-        gpuPoints.push_back({x, y, value, 0.0f});
+        gpuPoints.push_back({node.point.x, node.point.y, node.value, 0.0f});
     }
     
     return gpuPoints;
 }
 
+bool KDTreeBuilder2D::updateValues(const float* values, size_t numValues, int numThreads)
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilder2D: Tree not built" << std::endl;
+        return false;
+    }
+    if (!values || numValues != m_pointCount) {
+        std::cerr << "KDTreeBuilder2D: Expected " << m_pointCount << " values, got " << numValues << std::endl;
+        return false;
+    }
+
+    kdTree::parallel_for_range<int64_t>(0, static_cast<int64_t>(m_pointCount), numThreads, [&](int64_t begin, int64_t end) {
+        for (int64_t slot = begin; slot < end; ++slot) {
+            m_kdtreePoints[slot].value = values[m_slotToOriginal[slot]];
+        }
+        for (int64_t i = begin; i < end; ++i) {
+            m_originalPoints[i].value = values[i];
+        }
+    }, 1 << 16);
+    return true;
+}
+
+std::vector<float> KDTreeBuilder2D::getGPUValues() const
+{
+    std::vector<float> values;
+    if (!m_isBuilt) {
+        return values;
+    }
+
+    values.reserve(m_pointCount);
+    for (const auto& node : m_kdtreePoints) {
+        values.push_back(node.value);
+    }
+    return values;
+}
+
+bool KDTreeBuilder2D::TreeData2D::valuesInTreeOrder(const float* values, size_t numValues, std::vector<float>& out) const
+{
+    if (!values || numValues != numNodes() || !slotToOriginal()) {
+        std::cerr << "KDTreeBuilder2D: Expected " << numNodes() << " values, got " << numValues << std::endl;
+        return false;
+    }
+
+    out.resize(numValues);
+    kdTree::gatherToTreeOrder(out.data(), values, slotToOriginal(), static_cast<int64_t>(numValues), 0);
+    return true;
+}
+
 bool KDTreeBuilder2D::getWorldBounds(float& minX, float& maxX, float& minY, float& maxY) const
 {
     if (!m_isBuilt) {
@@ -196,9 +283,45 @@ bool KDTreeBuilder2D::getWorldBounds(float& minX, float& maxX, float& minY, floa
     return true;
 }
 
+bool KDTreeBuilder2D::saveCache(const std::string& path, uint64_t sourceChecksum, uint64_t sourceSize) const
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilder2D: Tree not built" << std::endl;
+        return false;
+    }
+
+    const std::vector<GPUPoint2D> nodes = getGPUPoints();
+    std::vector<uint32_t> ids(m_pointCount);
+    for (size_t i = 0; i < m_pointCount; ++i) {
+        ids[i] = m_kdtreePoints[i].id;
+    }
+    const float lower[3] = {m_worldBounds.lower.x, m_worldBounds.lower.y, 0.0f};
+    const float upper[3] = {m_worldBounds.upper.x, m_worldBounds.upper.y, 0.0f};
+    return KDTreeCache::save(path, 2, sizeof(GPUPoint2D), nodes.data(), ids.data(), m_pointCount,
+                             static_cast<uint32_t>(getNumLevels()), lower, upper, sourceChecksum, sourceSize);
+}
+
+bool KDTreeBuilder2D::loadCache(const std::string& path, uint64_t sourceChecksum, uint64_t sourceSize, TreeData2D& out)
+{
+    KDTreeCache::View view;
+    if (!KDTreeCache::load(path, 2, sizeof(GPUPoint2D), sourceChecksum, sourceSize, view)) {
+        return false;
+    }
+
+    out.points.clear();
+    out.numLevels = view.numLevels;
+    out.mapping = view.file;
+    out.mappedNodes = static_cast<const GPUPoint2D*>(view.nodes);
+    out.numMappedNodes = view.numNodes;
+    out.ids.clear();
+    out.mappedIds = view.ids;
+    return true;
+}
+
 void KDTreeBuilder2D::clear()
 {
     m_kdtreePoints.clear();
+    m_slotToOriginal.clear();
     m_originalPoints.clear();
     m_pointCount = 0;
     m_isBuilt = false;
@@ -235,18 +358,27 @@ SparsePoint2D KDTreeBuilder2D::kdtreeToSparse(const kdTree::float2& point, int o
     return sparse;
 }
 
-template bool KDTreeBuilder2D::knnSearch<1>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&) const;
-template bool KDTreeBuilder2D::knnSearch<3>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&) const;
-template bool KDTreeBuilder2D::knnSearch<5>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&) const;
+template bool KDTreeBuilder2D::knnSearch<1>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<3>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<5>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<8>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<16>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<32>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<64>(const SparsePoint2D&, float, std::vector<int>&, std::vector<float>&, float) const;
 
-template bool KDTreeBuilder2D::knnSearch<1>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&) const;
-template bool KDTreeBuilder2D::knnSearch<3>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&) const;
-template bool KDTreeBuilder2D::knnSearch<5>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&) const;
+template bool KDTreeBuilder2D::knnSearch<1>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<3>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<5>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<8>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<16>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<32>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder2D::knnSearch<64>(const SparsePoint2D&, float, std::vector<GPUPoint2D>&, std::vector<float>&, float) const;
 
 //// 3D KDTreeBuilder Implementation
 
 KDTreeBuilder3D::KDTreeBuilder3D() 
-    : m_pointCount(0), m_isBuilt(false)
+    : m_queryPool(std::make_unique<kdTree::ThreadPool>()), m_bucketLeafSize(0), m_splitMode(SplitMode::RoundRobin),
+      m_pointCount(0), m_isBuilt(false), m_sweepQueries(false)
 {
 }
 
@@ -255,17 +387,22 @@ KDTreeBuilder3D::~KDTreeBuilder3D()
     clear();
 }
 
-bool KDTreeBuilder3D::buildTree(const std::vector<SparsePoint3D>& inputPoints)
+bool KDTreeBuilder3D::buildTree(const std::vector<SparsePoint3D>& inputPoints, int numThreads)
 {
-    return buildTree(inputPoints.data(), inputPoints.size());
+    return buildTree(inputPoints.data(), inputPoints.size(), numThreads);
 }
 
-bool KDTreeBuilder3D::buildTree(const SparsePoint3D* points, size_t numPoints)
+bool KDTreeBuilder3D::buildTree(const SparsePoint3D* points, size_t numPoints, int numThreads)
 {
     if (!points || numPoints == 0) {
         std::cerr << "KDTreeBuilder2D: Invalid input points" << std::endl;
         return false;
     }
+    // 查询接口的索引是int，GPU端也按32位下标寻址；更大的点集只能直接用 kdTree 库（64位下标）
+    if (numPoints > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        std::cerr << "KDTreeBuilder3D: Too many points (" << numPoints << "), at most " << std::numeric_limits<int>::max() << std::endl;
+        return false;
+    }
     
     clear();
     
@@ -274,22 +411,36 @@ bool KDTreeBuilder3D::buildTree(const SparsePoint3D* points, size_t numPoints)
     m_kdtreePoints.reserve(numPoints);
     
     for (size_t i = 0; i < numPoints; ++i) {
-        m_kdtreePoints.push_back(sparseToKDTree(points[i]));
+        m_kdtreePoints.push_back({sparseToKDTree(points[i]), points[i].value, static_cast<uint32_t>(i), 0});
     }
     
     try {
         // 构建KDTree
         auto start = std::chrono::high_resolution_clock::now();
-        kdTree::buildTree_host<kdTree::float3, kdTree::default_data_traits<kdTree::float3>>(
-            m_kdtreePoints.data(), numPoints, &m_worldBounds);
+        if (m_splitMode == SplitMode::WidestDimension) {
+            kdTree::buildTree_partition<TreeNode, TreeTraits>(
+                m_kdtreePoints.data(), numPoints, &m_worldBounds, m_buildScratch, numThreads);
+        } else {
+            // 按层轮流分割，之后把每层的维度写进节点，查询统一按节点中的维度遍历
+            using RoundRobinTraits = kdTree::payload_dim_traits<kdTree::float3, false>;
+            kdTree::buildTree_partition<TreeNode, RoundRobinTraits>(
+                m_kdtreePoints.data(), numPoints, &m_worldBounds, m_buildScratch, numThreads);
+            kdTree::setRoundRobinDims<TreeNode, RoundRobinTraits>(m_kdtreePoints.data(), numPoints, numThreads);
+        }
         auto end = std::chrono::high_resolution_clock::now();
         
         auto duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-        std::cout << "[KDTree] KDTree built successfully in " << duration_ms.count() << " ms" << std::endl;
+        std::cout << "[KDTree] KDTree built successfully in " << duration_ms.count() << " ms"
+                  << (m_splitMode == SplitMode::WidestDimension ? " (widest-dimension splits)" : "") << std::endl;
         
         m_pointCount = numPoints;
+        m_slotToOriginal.resize(numPoints);
+        for (size_t i = 0; i < numPoints; ++i) {
+            m_slotToOriginal[i] = m_kdtreePoints[i].id;
+        }
         m_isBuilt = true;
-        return true;
+        buildBruteForcePoints();
+        return buildBucketTree();
     }
     catch (const std::exception& e) {
         std::cerr << "KDTreeBuilder3D: Failed to build tree - " << e.what() << std::endl;
@@ -300,7 +451,8 @@ bool KDTreeBuilder3D::buildTree(const SparsePoint3D* points, size_t numPoints)
 
 template<int K>
 bool KDTreeBuilder3D::knnSearch(const SparsePoint3D& queryPoint, float searchRadius,
-                             std::vector<GPUPoint3D>& results, std::vector<float>& distances) const
+                             std::vector<GPUPoint3D>& results, std::vector<float>& distances,
+                             float eps) const
 {
     if (!m_isBuilt) {
         std::cerr << "KDTreeBuilder3D: Tree not built" << std::endl;
@@ -311,12 +463,12 @@ bool KDTreeBuilder3D::knnSearch(const SparsePoint3D& queryPoint, float searchRad
     kdTree::float3 queryKDTree = sparseToKDTree(queryPoint);
     
     // 创建候选列表
-    kdTree::FixedCandidateList<K> candidateList(searchRadius);
+    kdTree::KnnCandidateList<K> candidateList(searchRadius);
     
     try {
         // 执行KNN查询
-        kdTree::knn<kdTree::FixedCandidateList<K>, kdTree::float3, kdTree::default_data_traits<kdTree::float3>>(
-            candidateList, queryKDTree, m_kdtreePoints.data(), m_pointCount);
+        query(candidateList, queryKDTree, eps);
+        candidateList.sort();
         
         // 转换结果
         results.clear();
@@ -331,20 +483,8 @@ bool KDTreeBuilder3D::knnSearch(const SparsePoint3D& queryPoint, float searchRad
             
             if (pointID >= 0 && pointID < static_cast<int>(m_pointCount)) 
             {
-                float x = m_kdtreePoints[pointID].x;
-                float y = m_kdtreePoints[pointID].y;
-                float z = m_kdtreePoints[pointID].z;
-                float value;
-                for (auto & originalPoint : m_originalPoints) 
-                {
-                    if (originalPoint.x == x && originalPoint.y == y && originalPoint.z == z) 
-                    {
-                        value = originalPoint.value;
-                        break;
-                    }
-                }
-
-                results.push_back({x, y, z, value, {}});
+                const TreeNode& node = m_kdtreePoints[pointID];
+                results.push_back({node.point.x, node.point.y, node.point.z, node.value, {}});
                 distances.push_back(std::sqrt(dist2));
             }
         }
@@ -359,7 +499,8 @@ bool KDTreeBuilder3D::knnSearch(const SparsePoint3D& queryPoint, float searchRad
 
 template<int K>
 bool KDTreeBuilder3D::knnSearch(const SparsePoint3D& queryPoint, float searchRadius,
-                             std::vector<int>& indices, std::vector<float>& distances) const
+                             std::vector<int>& indices, std::vector<float>& distances,
+                             float eps) const
 {
     if (!m_isBuilt) {
         std::cerr << "KDTreeBuilder3D: Tree not built" << std::endl;
@@ -370,12 +511,12 @@ bool KDTreeBuilder3D::knnSearch(const SparsePoint3D& queryPoint, float searchRad
     kdTree::float3 queryKDTree = sparseToKDTree(queryPoint);
     
     // 创建候选列表
-    kdTree::FixedCandidateList<K> candidateList(searchRadius);
+    kdTree::KnnCandidateList<K> candidateList(searchRadius);
     
     try {
         // 执行KNN查询
-        kdTree::knn<kdTree::FixedCandidateList<K>, kdTree::float3, kdTree::default_data_traits<kdTree::float3>>(
-            candidateList, queryKDTree, m_kdtreePoints.data(), m_pointCount);
+        query(candidateList, queryKDTree, eps);
+        candidateList.sort();
         
         // 转换结果
         indices.clear();
@@ -401,6 +542,224 @@ bool KDTreeBuilder3D::knnSearch(const SparsePoint3D& queryPoint, float searchRad
     }
 }
 
+bool KDTreeBuilder3D::knnSearch(const SparsePoint3D& queryPoint, int k, float searchRadius,
+                                std::vector<int>& indices, std::vector<float>& distances,
+                             float eps) const
+{
+    bool success = false;
+    if (!kdTree::dispatchK(k, [&](auto K) { success = knnSearch<K>(queryPoint, searchRadius, indices, distances, eps); })) {
+        std::cerr << "KDTreeBuilder3D: Unsupported K = " << k << std::endl;
+        return false;
+    }
+    return success;
+}
+
+bool KDTreeBuilder3D::knnSearchBatch(const kdTree::float3* queryPoints, size_t numQueries, int k, float searchRadius,
+                                     int* outIndices, float* outDistances, float eps) const
+{
+    bool success = false;
+    if (!kdTree::dispatchK(k, [&](auto K) {
+            success = knnSearchBatch<K>(queryPoints, numQueries, searchRadius, outIndices, outDistances, eps);
+        })) {
+        std::cerr << "KDTreeBuilder3D: Unsupported K = " << k << std::endl;
+        return false;
+    }
+    return success;
+}
+
+bool KDTreeBuilder3D::radiusSearch(const SparsePoint3D& queryPoint, float radius,
+                                   std::vector<int>& indices, std::vector<float>& distances) const
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilder3D: Tree not built" << std::endl;
+        return false;
+    }
+
+    indices.clear();
+    distances.clear();
+    kdTree::rangeQuery<TreeNode, TreeTraits>(sparseToKDTree(queryPoint), radius, m_kdtreePoints.data(),
+                                             static_cast<int>(m_pointCount), [&](int pointID, float dist2) {
+        indices.push_back(pointID);
+        distances.push_back(std::sqrt(dist2));
+    });
+    return true;
+}
+
+template<int K>
+bool KDTreeBuilder3D::knnSearchBatch(const kdTree::float3* queryPoints, size_t numQueries, float searchRadius,
+                                     int* outIndices, float* outDistances, float eps) const
+{
+    if (!m_isBuilt || !queryPoints || !outIndices || !outDistances) {
+        return false;
+    }
+
+    using CandidateList = kdTree::KnnCandidateList<K>;
+    if (m_bruteForcePoints.numPoints == static_cast<int64_t>(m_pointCount) &&
+        m_knnCrossover.useBruteForce(static_cast<int64_t>(m_pointCount), K, searchRadius, m_worldBounds)) {
+        // 暴力扫描按树节点顺序的点进行，返回的索引与树查询相同；结果总是精确的，eps 不起作用
+        kdTree::bruteForceKnnBatch<CandidateList>(*m_queryPool, queryPoints, static_cast<int64_t>(numQueries), searchRadius,
+                                                  m_bruteForcePoints, outIndices, outDistances);
+    } else if (m_sweepQueries) {
+        // 连贯查询：每个查询从上一个查询的结果得到初始剔除半径（普通树或桶式树上都可以）
+        kdTree::knnSweepBatchWith<CandidateList>(
+            *m_queryPool, queryPoints, static_cast<int64_t>(numQueries), searchRadius,
+            [this, eps](CandidateList& result, const kdTree::float3& queryPoint) { query(result, queryPoint, eps); },
+            outIndices, outDistances);
+    } else if (m_bucketLeafSize > 0) {
+        kdTree::knnBatchWith<CandidateList>(
+            *m_queryPool, queryPoints, static_cast<int64_t>(numQueries), searchRadius,
+            [this, eps](CandidateList& result, const kdTree::float3& queryPoint) { query(result, queryPoint, eps); },
+            outIndices, outDistances);
+    } else {
+        // 相邻的8个查询作为一个packet一起遍历；分散的packet内部自动退回逐个查询
+        kdTree::knnPacketBatch<CandidateList, 8, TreeNode, TreeTraits>(
+            *m_queryPool, queryPoints, static_cast<int64_t>(numQueries), searchRadius,
+            m_kdtreePoints.data(), static_cast<int64_t>(m_pointCount), outIndices, outDistances, 128, eps);
+    }
+
+    // 平方距离 -> 距离，与单点查询的返回值保持一致
+    const int64_t numResults = static_cast<int64_t>(numQueries) * K;
+    const int64_t resultsPerTask = 1 << 16;
+    m_queryPool->run((numResults + resultsPerTask - 1) / resultsPerTask, [&](int64_t task)
+    {
+        const int64_t end = std::min(numResults, (task + 1) * resultsPerTask);
+        for (int64_t i = task * resultsPerTask; i < end; ++i)
+            outDistances[i] = outIndices[i] >= 0 ? std::sqrt(outDistances[i]) : INFINITY;
+    });
+    return true;
+}
+
+bool KDTreeBuilder3D::knnSearchGrid(const kdTree::QueryGrid3D& grid, int k, float searchRadius,
+                                    int* outIndices, float* outDistances, int blockSize) const
+{
+    if (!m_isBuilt || !outIndices || !outDistances) {
+        return false;
+    }
+
+    const bool supported = kdTree::dispatchK(k, [&](auto K) {
+        kdTree::knnGrid<kdTree::KnnCandidateList<K>, TreeNode, TreeTraits>(
+            *m_queryPool, grid, searchRadius, m_worldBounds, m_kdtreePoints.data(), static_cast<int64_t>(m_pointCount),
+            outIndices, outDistances, blockSize);
+    });
+    if (!supported) {
+        std::cerr << "KDTreeBuilder3D: Unsupported K = " << k << std::endl;
+        return false;
+    }
+
+    // 平方距离 -> 距离，与其他查询的返回值保持一致
+    const int64_t numResults = grid.numVoxels() * k;
+    const int64_t resultsPerTask = 1 << 16;
+    m_queryPool->run((numResults + resultsPerTask - 1) / resultsPerTask, [&](int64_t task)
+    {
+        const int64_t end = std::min(numResults, (task + 1) * resultsPerTask);
+        for (int64_t i = task * resultsPerTask; i < end; ++i)
+            outDistances[i] = outIndices[i] >= 0 ? std::sqrt(outDistances[i]) : INFINITY;
+    });
+    return true;
+}
+
+bool KDTreeBuilder3D::buildKnnGraph(int k, float searchRadius, KnnGraph& out) const
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilder3D: Tree not built" << std::endl;
+        return false;
+    }
+
+    // 先按树节点顺序建图（行和近邻都是节点下标），再换成原始输入顺序
+    std::vector<int64_t> nodeOffsets;
+    std::vector<int> nodeNeighbors;
+    std::vector<float> nodeDist2;
+    const bool supported = kdTree::dispatchK(k, [&](auto K) {
+        kdTree::knnGraph<kdTree::KnnCandidateList<K>, TreeNode, TreeTraits>(
+            *m_queryPool, m_kdtreePoints.data(), static_cast<int64_t>(m_pointCount), searchRadius,
+            nodeOffsets, nodeNeighbors, nodeDist2);
+    });
+    if (!supported) {
+        std::cerr << "KDTreeBuilder3D: Unsupported K = " << k << std::endl;
+        return false;
+    }
+
+    const int64_t numPoints = static_cast<int64_t>(m_pointCount);
+    out.offsets.assign(numPoints + 1, 0);
+    for (int64_t slot = 0; slot < numPoints; ++slot) {
+        out.offsets[m_slotToOriginal[slot] + 1] = nodeOffsets[slot + 1] - nodeOffsets[slot];
+    }
+    for (int64_t i = 0; i < numPoints; ++i) {
+        out.offsets[i + 1] += out.offsets[i];
+    }
+    out.indices.resize(nodeNeighbors.size());
+    out.distances.resize(nodeDist2.size());
+    const int64_t slotsPerTask = 1 << 14;
+    m_queryPool->run((numPoints + slotsPerTask - 1) / slotsPerTask, [&](int64_t task)
+    {
+        const int64_t end = std::min(numPoints, (task + 1) * slotsPerTask);
+        for (int64_t slot = task * slotsPerTask; slot < end; ++slot) {
+            int64_t dst = out.offsets[m_slotToOriginal[slot]];
+            for (int64_t i = nodeOffsets[slot]; i < nodeOffsets[slot + 1]; ++i, ++dst) {
+                out.indices[dst] = static_cast<int>(m_slotToOriginal[nodeNeighbors[i]]);
+                out.distances[dst] = std::sqrt(nodeDist2[i]);
+            }
+        }
+    });
+    return true;
+}
+
+void KDTreeBuilder3D::setNumQueryThreads(int numThreads)
+{
+    m_queryPool = std::make_unique<kdTree::ThreadPool>(numThreads);
+}
+
+void KDTreeBuilder3D::setBucketLeafSize(int leafSize)
+{
+    m_bucketLeafSize = std::max(0, leafSize);
+    buildBucketTree();
+}
+
+void KDTreeBuilder3D::setKnnCrossover(const kdTree::KnnCrossover& crossover)
+{
+    m_knnCrossover = crossover;
+    buildBruteForcePoints();
+}
+
+void KDTreeBuilder3D::buildBruteForcePoints()
+{
+    // 点数超过所有阈值时永远不会用暴力扫描，不保留这份拷贝
+    if (!m_isBuilt || static_cast<int64_t>(m_pointCount) > m_knnCrossover.maxN()) {
+        m_bruteForcePoints = kdTree::BruteForcePoints<kdTree::float3>();
+        return;
+    }
+    kdTree::makeBruteForcePoints<kdTree::float3, TreeNode, TreeTraits>(
+        m_bruteForcePoints, m_kdtreePoints.data(), static_cast<int64_t>(m_pointCount));
+}
+
+bool KDTreeBuilder3D::buildBucketTree()
+{
+    m_bucketTree = kdTree::BucketTree3D();
+    if (!m_isBuilt || m_bucketLeafSize <= 0) {
+        return true;
+    }
+
+    // 从已构建好的节点数组建桶式树，这样桶中记录的ID就是普通树中的节点索引
+    auto start = std::chrono::high_resolution_clock::now();
+    kdTree::buildBucketTree<TreeNode, TreeTraits>(m_bucketTree, m_kdtreePoints.data(),
+                                                   static_cast<int>(m_pointCount), m_bucketLeafSize);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    std::cout << "[KDTree] Bucket tree (" << m_bucketLeafSize << " points/leaf) built in "
+              << duration_ms.count() << " ms" << std::endl;
+    return true;
+}
+
+template<typename CandidateList>
+void KDTreeBuilder3D::query(CandidateList& result, const kdTree::float3& queryPoint, float eps) const
+{
+    if (m_bucketLeafSize > 0) {
+        kdTree::knn(result, queryPoint, m_bucketTree, eps);
+    } else {
+        kdTree::knn<CandidateList, TreeNode, TreeTraits>(result, queryPoint, m_kdtreePoints.data(), m_pointCount, eps);
+    }
+}
+
 std::vector<GPUPoint3D> KDTreeBuilder3D::getGPUPoints() const
 {
     std::vector<GPUPoint3D> gpuPoints;
@@ -409,24 +768,82 @@ std::vector<GPUPoint3D> KDTreeBuilder3D::getGPUPoints() const
     }
     
     gpuPoints.reserve(m_pointCount);
-    for (const auto& point : m_kdtreePoints) 
+    for (const auto& node : m_kdtreePoints) 
     {
-        float x = point.x; float y = point.y;
-        float value = 0.0f;
-        for (const auto& originalPoint : m_originalPoints)
-        {
-            if (originalPoint.x == x && originalPoint.y == y) 
-            {
-                value = originalPoint.value;
-                break;
-            }
-        }
-        gpuPoints.push_back({x, y, value, 0.0f});
+        gpuPoints.push_back({node.point.x, node.point.y, node.point.z, node.value, {0.0f, static_cast<float>(node.dim)}});
     }
     
     return gpuPoints;
 }
 
+bool KDTreeBuilder3D::updateValues(const float* values, size_t numValues, int numThreads)
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilder3D: Tree not built" << std::endl;
+        return false;
+    }
+    if (!values || numValues != m_pointCount) {
+        std::cerr << "KDTreeBuilder3D: Expected " << m_pointCount << " values, got " << numValues << std::endl;
+        return false;
+    }
+
+    kdTree::parallel_for_range<int64_t>(0, static_cast<int64_t>(m_pointCount), numThreads, [&](int64_t begin, int64_t end) {
+        for (int64_t slot = begin; slot < end; ++slot) {
+            m_kdtreePoints[slot].value = values[m_slotToOriginal[slot]];
+        }
+        for (int64_t i = begin; i < end; ++i) {
+            m_originalPoints[i].value = values[i];
+        }
+    }, 1 << 16);
+    return true;
+}
+
+std::vector<float> KDTreeBuilder3D::getGPUValues() const
+{
+    std::vector<float> values;
+    if (!m_isBuilt) {
+        return values;
+    }
+
+    values.reserve(m_pointCount);
+    for (const auto& node : m_kdtreePoints) {
+        values.push_back(node.value);
+    }
+    return values;
+}
+
+bool KDTreeBuilder3D::TreeData3D::valuesInTreeOrder(const float* values, size_t numValues, std::vector<float>& out) const
+{
+    if (!values || numValues != numNodes() || !slotToOriginal()) {
+        std::cerr << "KDTreeBuilder3D: Expected " << numNodes() << " values, got " << numValues << std::endl;
+        return false;
+    }
+
+    out.resize(numValues);
+    kdTree::gatherToTreeOrder(out.data(), values, slotToOriginal(), static_cast<int64_t>(numValues), 0);
+    return true;
+}
+
+void KDTreeBuilder3D::TreeData3D::compactNodes(std::vector<GPUCompactPoint3D>& out, kdTree::Quantizer<kdTree::float3>& quant) const
+{
+    const GPUPoint3D* src = nodes();
+    const size_t n = numNodes();
+    kdTree::box_t<kdTree::float3> bounds;
+    bounds.setEmpty();
+    for (size_t i = 0; i < n; ++i) {
+        bounds.grow(kdTree::make_float3(src[i].x, src[i].y, src[i].z));
+    }
+    // 值仍走单独的值缓冲区，这里只用到坐标的量化
+    quant = kdTree::Quantizer<kdTree::float3>::make(bounds, 0.0f, 1.0f);
+
+    out.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        out[i].xy = quant.encodeCoord(src[i].x, 0) | (uint32_t(quant.encodeCoord(src[i].y, 1)) << 16);
+        // 标志：第1-2位为分割维度（静态树没有删除的节点）
+        out[i].zFlags = quant.encodeCoord(src[i].z, 2) | (static_cast<uint32_t>(src[i].padding[1]) << 17);
+    }
+}
+
 bool KDTreeBuilder3D::getWorldBounds(float& minX, float& maxX, float& minY, float& maxY, float& minZ, float& maxZ) const
 {
     if (!m_isBuilt) {
@@ -443,9 +860,78 @@ bool KDTreeBuilder3D::getWorldBounds(float& minX, float& maxX, float& minY, floa
     return true;
 }
 
+bool KDTreeBuilder3D::saveCache(const std::string& path, uint64_t sourceChecksum, uint64_t sourceSize) const
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilder3D: Tree not built" << std::endl;
+        return false;
+    }
+
+    const std::vector<GPUPoint3D> nodes = getGPUPoints();
+    std::vector<uint32_t> ids(m_pointCount);
+    for (size_t i = 0; i < m_pointCount; ++i) {
+        ids[i] = m_kdtreePoints[i].id;
+    }
+    const float lower[3] = {m_worldBounds.lower.x, m_worldBounds.lower.y, m_worldBounds.lower.z};
+    const float upper[3] = {m_worldBounds.upper.x, m_worldBounds.upper.y, m_worldBounds.upper.z};
+    return KDTreeCache::save(path, 3, sizeof(GPUPoint3D), nodes.data(), ids.data(), m_pointCount,
+                             static_cast<uint32_t>(getNumLevels()), lower, upper, sourceChecksum, sourceSize);
+}
+
+bool KDTreeBuilder3D::loadCache(const std::string& path, uint64_t sourceChecksum, uint64_t sourceSize, TreeData3D& out)
+{
+    KDTreeCache::View view;
+    if (!KDTreeCache::load(path, 3, sizeof(GPUPoint3D), sourceChecksum, sourceSize, view)) {
+        return false;
+    }
+
+    out.points.clear();
+    out.numLevels = view.numLevels;
+    out.mapping = view.file;
+    out.mappedNodes = static_cast<const GPUPoint3D*>(view.nodes);
+    out.numMappedNodes = view.numNodes;
+    out.ids.clear();
+    out.mappedIds = view.ids;
+    return true;
+}
+
+bool KDTreeBuilder3D::buildTreeOutOfCore(const std::string& pointsPath, const std::string& treePath,
+                                         size_t memoryBudget, int numThreads)
+{
+    try {
+        kdTree::OutOfCoreConfig config;
+        config.memoryBudget = memoryBudget;
+        config.numThreads = numThreads;
+        const auto toNode = [](const SparsePoint3D& p, int64_t index) {
+            TreeNode node;
+            node.point = kdTree::make_float3(p.x, p.y, p.z);
+            node.value = p.value;
+            node.id = static_cast<uint32_t>(index);
+            node.dim = 0;
+            return node;
+        };
+        // 节点 id 是32位的
+        std::ifstream input(pointsPath, std::ios::binary | std::ios::ate);
+        if (input && static_cast<uint64_t>(input.tellg()) / sizeof(SparsePoint3D) > UINT32_MAX) {
+            std::cerr << "KDTreeBuilder3D: " << pointsPath << " has more points than 32-bit node ids can address" << std::endl;
+            return false;
+        }
+        input.close();
+        kdTree::buildTreeOutOfCore<TreeNode, TreeTraits, SparsePoint3D>(pointsPath, 0, toNode, treePath, config);
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "KDTreeBuilder3D: Out-of-core build failed - " << e.what() << std::endl;
+        return false;
+    }
+}
+
 void KDTreeBuilder3D::clear()
 {
     m_kdtreePoints.clear();
+    m_slotToOriginal.clear();
+    m_bucketTree = kdTree::BucketTree3D();
+    m_bruteForcePoints = kdTree::BruteForcePoints<kdTree::float3>();
     m_originalPoints.clear();
     m_pointCount = 0;
     m_isBuilt = false;
@@ -488,10 +974,429 @@ SparsePoint3D KDTreeBuilder3D::kdtreeToSparse(const kdTree::float3& point, int o
     return sparse;
 }
 
-template bool KDTreeBuilder3D::knnSearch<1>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&) const;
-template bool KDTreeBuilder3D::knnSearch<3>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&) const;
-template bool KDTreeBuilder3D::knnSearch<5>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&) const;
+template bool KDTreeBuilder3D::knnSearch<1>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<3>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<5>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<8>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<16>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<32>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<64>(const SparsePoint3D&, float, std::vector<int>&, std::vector<float>&, float) const;
+
+template bool KDTreeBuilder3D::knnSearch<1>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<3>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<5>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<8>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<16>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<32>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&, float) const;
+template bool KDTreeBuilder3D::knnSearch<64>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&, float) const;
+
+template bool KDTreeBuilder3D::knnSearchBatch<1>(const kdTree::float3*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilder3D::knnSearchBatch<3>(const kdTree::float3*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilder3D::knnSearchBatch<5>(const kdTree::float3*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilder3D::knnSearchBatch<8>(const kdTree::float3*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilder3D::knnSearchBatch<16>(const kdTree::float3*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilder3D::knnSearchBatch<32>(const kdTree::float3*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilder3D::knnSearchBatch<64>(const kdTree::float3*, size_t, float, int*, float*, float) const;
+// ============ KDTreeBuilderND ============
+
+template<int N>
+KDTreeBuilderND<N>::KDTreeBuilderND()
+    : m_queryPool(std::make_unique<kdTree::ThreadPool>()), m_pointCount(0), m_isBuilt(false)
+{
+}
+
+template<int N>
+KDTreeBuilderND<N>::~KDTreeBuilderND()
+{
+    clear();
+}
+
+template<int N>
+bool KDTreeBuilderND<N>::buildTree(const std::vector<Point>& points, const std::vector<float>& values, int numThreads)
+{
+    if (!values.empty() && values.size() != points.size()) {
+        std::cerr << "KDTreeBuilderND: Expected " << points.size() << " values, got " << values.size() << std::endl;
+        return false;
+    }
+    return buildTree(points.data(), values.empty() ? nullptr : values.data(), points.size(), numThreads);
+}
+
+template<int N>
+bool KDTreeBuilderND<N>::buildTree(const Point* points, const float* values, size_t numPoints, int numThreads)
+{
+    if (!points || numPoints == 0) {
+        std::cerr << "KDTreeBuilderND: Invalid input points" << std::endl;
+        return false;
+    }
+    if (numPoints > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        std::cerr << "KDTreeBuilderND: Too many points (" << numPoints << "), at most " << std::numeric_limits<int>::max() << std::endl;
+        return false;
+    }
+
+    clear();
+
+    m_kdtreePoints.reserve(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) {
+        m_kdtreePoints.push_back({points[i], values ? values[i] : 0.0f, static_cast<uint32_t>(i)});
+    }
+
+    try {
+        auto start = std::chrono::high_resolution_clock::now();
+        kdTree::buildTree_partition<TreeNode, TreeTraits>(
+            m_kdtreePoints.data(), numPoints, &m_worldBounds, m_buildScratch, numThreads);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        auto duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        std::cout << "[KDTree] " << N << "D KDTree built successfully in " << duration_ms.count() << " ms" << std::endl;
+
+        m_pointCount = numPoints;
+        m_originalToSlot.resize(numPoints);
+        for (size_t i = 0; i < numPoints; ++i) {
+            m_originalToSlot[m_kdtreePoints[i].id] = static_cast<uint32_t>(i);
+        }
+        m_isBuilt = true;
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "KDTreeBuilderND: Failed to build tree - " << e.what() << std::endl;
+        clear();
+        return false;
+    }
+}
+
+template<int N>
+bool KDTreeBuilderND<N>::knnSearch(const Point& queryPoint, int k, float searchRadius,
+                                   std::vector<int>& indices, std::vector<float>& distances,
+                                   float eps) const
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilderND: Tree not built" << std::endl;
+        return false;
+    }
+
+    const bool supported = kdTree::dispatchK(k, [&](auto K) {
+        kdTree::KnnCandidateList<K> candidateList(searchRadius);
+        kdTree::knn<kdTree::KnnCandidateList<K>, TreeNode, TreeTraits>(
+            candidateList, queryPoint, m_kdtreePoints.data(), static_cast<int>(m_pointCount), eps);
+        candidateList.sort();
+
+        indices.clear();
+        distances.clear();
+        for (int i = 0; i < K; ++i) {
+            const int pointID = candidateList.get_pointID(i);
+            if (pointID >= 0 && pointID < static_cast<int>(m_pointCount)) {
+                indices.push_back(static_cast<int>(m_kdtreePoints[pointID].id));
+                distances.push_back(std::sqrt(candidateList.get_dist2(i)));
+            }
+        }
+    });
+    if (!supported) {
+        std::cerr << "KDTreeBuilderND: Unsupported K = " << k << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template<int N>
+template<int K>
+bool KDTreeBuilderND<N>::knnSearchBatch(const Point* queryPoints, size_t numQueries, float searchRadius,
+                                        int* outIndices, float* outDistances, float eps) const
+{
+    if (!m_isBuilt || !queryPoints || !outIndices || !outDistances) {
+        return false;
+    }
+
+    using CandidateList = kdTree::KnnCandidateList<K>;
+    kdTree::knnPacketBatch<CandidateList, 8, TreeNode, TreeTraits>(
+        *m_queryPool, queryPoints, static_cast<int64_t>(numQueries), searchRadius,
+        m_kdtreePoints.data(), static_cast<int64_t>(m_pointCount), outIndices, outDistances, 128, eps);
+
+    // 节点索引 -> 原始下标，平方距离 -> 距离
+    const int64_t numResults = static_cast<int64_t>(numQueries) * K;
+    const int64_t resultsPerTask = 1 << 16;
+    m_queryPool->run((numResults + resultsPerTask - 1) / resultsPerTask, [&](int64_t task)
+    {
+        const int64_t end = std::min(numResults, (task + 1) * resultsPerTask);
+        for (int64_t i = task * resultsPerTask; i < end; ++i) {
+            const int pointID = outIndices[i];
+            outIndices[i] = pointID >= 0 ? static_cast<int>(m_kdtreePoints[pointID].id) : -1;
+            outDistances[i] = pointID >= 0 ? std::sqrt(outDistances[i]) : INFINITY;
+        }
+    });
+    return true;
+}
+
+template<int N>
+bool KDTreeBuilderND<N>::knnSearchBatch(const Point* queryPoints, size_t numQueries, int k, float searchRadius,
+                                        int* outIndices, float* outDistances, float eps) const
+{
+    bool success = false;
+    if (!kdTree::dispatchK(k, [&](auto K) {
+            success = knnSearchBatch<K>(queryPoints, numQueries, searchRadius, outIndices, outDistances, eps);
+        })) {
+        std::cerr << "KDTreeBuilderND: Unsupported K = " << k << std::endl;
+        return false;
+    }
+    return success;
+}
+
+template<int N>
+bool KDTreeBuilderND<N>::radiusSearch(const Point& queryPoint, float radius,
+                                      std::vector<int>& indices, std::vector<float>& distances) const
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilderND: Tree not built" << std::endl;
+        return false;
+    }
+
+    indices.clear();
+    distances.clear();
+    kdTree::rangeQuery<TreeNode, TreeTraits>(queryPoint, radius, m_kdtreePoints.data(),
+                                             static_cast<int>(m_pointCount), [&](int pointID, float dist2) {
+        indices.push_back(static_cast<int>(m_kdtreePoints[pointID].id));
+        distances.push_back(std::sqrt(dist2));
+    });
+    return true;
+}
+
+template<int N>
+bool KDTreeBuilderND<N>::updateValues(const float* values, size_t numValues, int numThreads)
+{
+    if (!m_isBuilt) {
+        std::cerr << "KDTreeBuilderND: Tree not built" << std::endl;
+        return false;
+    }
+    if (!values || numValues != m_pointCount) {
+        std::cerr << "KDTreeBuilderND: Expected " << m_pointCount << " values, got " << numValues << std::endl;
+        return false;
+    }
+
+    kdTree::parallel_for_range<int64_t>(0, static_cast<int64_t>(m_pointCount), numThreads, [&](int64_t begin, int64_t end) {
+        for (int64_t slot = begin; slot < end; ++slot) {
+            m_kdtreePoints[slot].value = values[m_kdtreePoints[slot].id];
+        }
+    }, 1 << 16);
+    return true;
+}
+
+template<int N>
+void KDTreeBuilderND<N>::setNumQueryThreads(int numThreads)
+{
+    m_queryPool = std::make_unique<kdTree::ThreadPool>(numThreads);
+}
+
+template<int N>
+bool KDTreeBuilderND<N>::getWorldBounds(Point& lower, Point& upper) const
+{
+    if (!m_isBuilt) {
+        return false;
+    }
+
+    lower = m_worldBounds.lower;
+    upper = m_worldBounds.upper;
+    return true;
+}
+
+template<int N>
+void KDTreeBuilderND<N>::clear()
+{
+    m_kdtreePoints.clear();
+    m_originalToSlot.clear();
+    m_pointCount = 0;
+    m_isBuilt = false;
+}
+
+template class KDTreeBuilderND<2>;
+template class KDTreeBuilderND<3>;
+template class KDTreeBuilderND<4>;
+template class KDTreeBuilderND<5>;
+template class KDTreeBuilderND<6>;
+template class KDTreeBuilderND<7>;
+template class KDTreeBuilderND<8>;
+
+template bool KDTreeBuilderND<2>::knnSearchBatch<1>(const kdTree::vec_float<2>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<2>::knnSearchBatch<3>(const kdTree::vec_float<2>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<2>::knnSearchBatch<5>(const kdTree::vec_float<2>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<2>::knnSearchBatch<8>(const kdTree::vec_float<2>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<2>::knnSearchBatch<16>(const kdTree::vec_float<2>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<2>::knnSearchBatch<32>(const kdTree::vec_float<2>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<2>::knnSearchBatch<64>(const kdTree::vec_float<2>*, size_t, float, int*, float*, float) const;
+
+template bool KDTreeBuilderND<3>::knnSearchBatch<1>(const kdTree::vec_float<3>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<3>::knnSearchBatch<3>(const kdTree::vec_float<3>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<3>::knnSearchBatch<5>(const kdTree::vec_float<3>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<3>::knnSearchBatch<8>(const kdTree::vec_float<3>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<3>::knnSearchBatch<16>(const kdTree::vec_float<3>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<3>::knnSearchBatch<32>(const kdTree::vec_float<3>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<3>::knnSearchBatch<64>(const kdTree::vec_float<3>*, size_t, float, int*, float*, float) const;
+
+template bool KDTreeBuilderND<4>::knnSearchBatch<1>(const kdTree::vec_float<4>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<4>::knnSearchBatch<3>(const kdTree::vec_float<4>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<4>::knnSearchBatch<5>(const kdTree::vec_float<4>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<4>::knnSearchBatch<8>(const kdTree::vec_float<4>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<4>::knnSearchBatch<16>(const kdTree::vec_float<4>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<4>::knnSearchBatch<32>(const kdTree::vec_float<4>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<4>::knnSearchBatch<64>(const kdTree::vec_float<4>*, size_t, float, int*, float*, float) const;
+
+template bool KDTreeBuilderND<5>::knnSearchBatch<1>(const kdTree::vec_float<5>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<5>::knnSearchBatch<3>(const kdTree::vec_float<5>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<5>::knnSearchBatch<5>(const kdTree::vec_float<5>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<5>::knnSearchBatch<8>(const kdTree::vec_float<5>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<5>::knnSearchBatch<16>(const kdTree::vec_float<5>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<5>::knnSearchBatch<32>(const kdTree::vec_float<5>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<5>::knnSearchBatch<64>(const kdTree::vec_float<5>*, size_t, float, int*, float*, float) const;
+
+template bool KDTreeBuilderND<6>::knnSearchBatch<1>(const kdTree::vec_float<6>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<6>::knnSearchBatch<3>(const kdTree::vec_float<6>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<6>::knnSearchBatch<5>(const kdTree::vec_float<6>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<6>::knnSearchBatch<8>(const kdTree::vec_float<6>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<6>::knnSearchBatch<16>(const kdTree::vec_float<6>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<6>::knnSearchBatch<32>(const kdTree::vec_float<6>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<6>::knnSearchBatch<64>(const kdTree::vec_float<6>*, size_t, float, int*, float*, float) const;
+
+template bool KDTreeBuilderND<7>::knnSearchBatch<1>(const kdTree::vec_float<7>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<7>::knnSearchBatch<3>(const kdTree::vec_float<7>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<7>::knnSearchBatch<5>(const kdTree::vec_float<7>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<7>::knnSearchBatch<8>(const kdTree::vec_float<7>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<7>::knnSearchBatch<16>(const kdTree::vec_float<7>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<7>::knnSearchBatch<32>(const kdTree::vec_float<7>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<7>::knnSearchBatch<64>(const kdTree::vec_float<7>*, size_t, float, int*, float*, float) const;
+
+template bool KDTreeBuilderND<8>::knnSearchBatch<1>(const kdTree::vec_float<8>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<8>::knnSearchBatch<3>(const kdTree::vec_float<8>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<8>::knnSearchBatch<5>(const kdTree::vec_float<8>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<8>::knnSearchBatch<8>(const kdTree::vec_float<8>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<8>::knnSearchBatch<16>(const kdTree::vec_float<8>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<8>::knnSearchBatch<32>(const kdTree::vec_float<8>*, size_t, float, int*, float*, float) const;
+template bool KDTreeBuilderND<8>::knnSearchBatch<64>(const kdTree::vec_float<8>*, size_t, float, int*, float*, float) const;
+
+// ============ DynamicKDTree3D ============
+
+DynamicKDTree3D::DynamicKDTree3D(int leafCapacity)
+    : m_forest(leafCapacity)
+    , m_leafCapacity(leafCapacity)
+{
+}
+
+bool DynamicKDTree3D::build(const std::vector<SparsePoint3D>& points)
+{
+    m_forest = kdTree::DynamicForest<kdTree::float3>(m_leafCapacity);
+    m_gpuNodes.clear();
+    m_gpuValues.clear();
+    m_dirtyRanges.clear();
+    m_changes.clear();
+    if (points.empty()) {
+        return true;
+    }
+    insert(points);
+    return true;
+}
+
+uint32_t DynamicKDTree3D::insert(const SparsePoint3D& point)
+{
+    const uint32_t id = m_forest.insert(kdTree::make_float3(point.x, point.y, point.z), point.value);
+    syncGPUNodes();
+    return id;
+}
 
-template bool KDTreeBuilder3D::knnSearch<1>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&) const;
-template bool KDTreeBuilder3D::knnSearch<3>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&) const;
-template bool KDTreeBuilder3D::knnSearch<5>(const SparsePoint3D&, float, std::vector<GPUPoint3D>&, std::vector<float>&) const;
\ No newline at end of file
+uint32_t DynamicKDTree3D::insert(const std::vector<SparsePoint3D>& points)
+{
+    std::vector<kdTree::float3> positions(points.size());
+    std::vector<float> values(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        positions[i] = kdTree::make_float3(points[i].x, points[i].y, points[i].z);
+        values[i] = points[i].value;
+    }
+    const uint32_t firstID = m_forest.insertBatch(positions.data(), values.data(), static_cast<int>(points.size()));
+    syncGPUNodes();
+    return firstID;
+}
+
+bool DynamicKDTree3D::remove(uint32_t id)
+{
+    if (!m_forest.erase(id)) {
+        return false;
+    }
+    syncGPUNodes();
+    return true;
+}
+
+bool DynamicKDTree3D::knnSearch(const SparsePoint3D& queryPoint, int k, float searchRadius,
+                                std::vector<int>& indices, std::vector<float>& distances,
+                                float eps) const
+{
+    const kdTree::float3 q = kdTree::make_float3(queryPoint.x, queryPoint.y, queryPoint.z);
+    const bool supported = kdTree::dispatchK(k, [&](auto K) {
+        kdTree::KnnCandidateList<K> candidateList(searchRadius);
+        m_forest.knn(candidateList, q, eps);
+        candidateList.sort();
+
+        indices.clear();
+        distances.clear();
+        for (int i = 0; i < K; ++i) {
+            const int pointID = candidateList.get_pointID(i);
+            if (pointID >= 0) {
+                indices.push_back(pointID);
+                distances.push_back(std::sqrt(candidateList.get_dist2(i)));
+            }
+        }
+    });
+    if (!supported) {
+        std::cerr << "DynamicKDTree3D: Unsupported K = " << k << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::vector<DynamicKDTree3D::GPUTreeRange> DynamicKDTree3D::getGPUTrees() const
+{
+    std::vector<GPUTreeRange> trees;
+    for (int l = 0; l < m_forest.numTrees(); ++l) {
+        const auto& tree = m_forest.tree(l);
+        if (tree.numLive() > 0) {
+            trees.push_back({static_cast<uint32_t>(m_forest.firstNodeOf(l)), static_cast<uint32_t>(tree.nodes.size())});
+        }
+    }
+    return trees;
+}
+
+void DynamicKDTree3D::takeDirtyRanges(std::vector<std::pair<size_t, size_t>>& ranges)
+{
+    ranges.insert(ranges.end(), m_dirtyRanges.begin(), m_dirtyRanges.end());
+    m_dirtyRanges.clear();
+}
+
+void DynamicKDTree3D::syncGPUNodes()
+{
+    // 森林多了一层时数组按新容量扩展，多出的部分先标记为已删除
+    const size_t capacity = static_cast<size_t>(m_forest.firstNodeOf(m_forest.numTrees()));
+    if (m_gpuNodes.size() < capacity) {
+        GPUPoint3D unused = {};
+        unused.padding[0] = kDeadNode;
+        m_dirtyRanges.push_back({m_gpuNodes.size(), capacity});
+        m_gpuNodes.resize(capacity, unused);
+        m_gpuValues.resize(capacity, 0.0f);
+    }
+
+    m_changes.clear();
+    m_forest.takeChanges(m_changes);
+    for (const auto& change : m_changes) {
+        const auto& tree = m_forest.tree(change.tree);
+        const size_t base = static_cast<size_t>(m_forest.firstNodeOf(change.tree));
+        for (int64_t i = change.begin; i < change.end; ++i) {
+            const auto& node = tree.nodes[i];
+            GPUPoint3D& gpuNode = m_gpuNodes[base + i];
+            gpuNode = {};
+            gpuNode.x = node.point.x;
+            gpuNode.y = node.point.y;
+            gpuNode.z = node.point.z;
+            gpuNode.value = node.value;
+            gpuNode.padding[0] = tree.dead[i] ? kDeadNode : 0.0f;
+            gpuNode.padding[1] = static_cast<float>(kdTree::BinaryTree::levelOf(i) % 3);
+            m_gpuValues[base + i] = node.value;
+        }
+        if (change.end > change.begin) {
+            m_dirtyRanges.push_back({base + change.begin, base + change.end});
+        }
+    }
+}
@@ -287,6 +287,17 @@ ComputePipelineBuilder& ComputePipelineBuilder::setShaderSource(const std::strin
     return *this;
 }
 
+ComputePipelineBuilder& ComputePipelineBuilder::setConstant(const std::string& key, double value) {
+    for (auto& constant : m_constants) {
+        if (constant.first == key) {
+            constant.second = value;
+            return *this;
+        }
+    }
+    m_constants.emplace_back(key, value);
+    return *this;
+}
+
 wgpu::ComputePipeline ComputePipelineBuilder::build() {
     if (!m_device) {
         std::cerr << "[ERROR] ComputePipelineBuilder: Device not set!" << std::endl;
@@ -314,6 +325,16 @@ wgpu::ComputePipeline ComputePipelineBuilder::build() {
     desc.compute.module = shader;
     desc.compute.entryPoint = m_entry.c_str();
 
+    // override 常量
+    std::vector<wgpu::ConstantEntry> constants(m_constants.size());
+    for (size_t i = 0; i < m_constants.size(); ++i) {
+        constants[i] = {};
+        constants[i].key = m_constants[i].first.c_str();
+        constants[i].value = m_constants[i].second;
+    }
+    desc.compute.constantCount = constants.size();
+    desc.compute.constants = constants.empty() ? nullptr : constants.data();
+
     wgpu::PipelineLayout pipelineLayout = nullptr;
     
     if (m_useExplicitLayout && !m_bindGroupLayouts.empty()) {
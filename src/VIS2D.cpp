@@ -40,6 +40,13 @@ bool VIS2D::Initialize(glm::mat4 vMat, glm::mat4 pMat)
     m_RS_Uniforms.projMatrix = pMat;
 
     if (!InitOutputTexture()) return false;
+    // 暴力插值方法的稀疏点只占一个绑定，超过绑定上限的点不上传（KDTree方法不受影响）
+    const size_t maxSparsePoints = ChunkedStorageBuffer::MaxChunkElements(m_device, sizeof(SparsePoint2D));
+    if (m_sparsePoints.size() > maxSparsePoints) 
+    {
+        std::cerr << "[WARNING]::VIS2D: brute-force interpolation only uses the first " << maxSparsePoints << " points" << std::endl;
+        m_CS_Uniforms.totalPoints = static_cast<uint32_t>(maxSparsePoints);
+    }
     if (!m_computeStage.Init(m_device, m_queue, m_sparsePoints, m_KDTreeData, m_CS_Uniforms)) return false;
     if (!m_renderStage.Init(m_device, m_queue, m_RS_Uniforms, m_header.width, m_header.height)) return false;
     if (!m_renderStage.CreatePipeline(m_device, m_swapChainFormat)) return false;
@@ -109,24 +116,44 @@ bool VIS2D::InitDataFromBinary(const std::string& filename)
     ComputeValueRange();
 
     // TEST FOR KD-Tree
-    KDTreeBuilder2D builder;
-    if (builder.buildTree(m_sparsePoints)) 
+    // 数据文件没有变化时直接映射缓存的树，跳过构建
+    const std::string cachePath = filename + ".kdtree";
+    uint64_t sourceChecksum = 0;
+    uint64_t sourceSize = 0;
+    const bool hasChecksum = KDTreeCache::checksumFile(filename, sourceChecksum, sourceSize);
+    if (hasChecksum && KDTreeBuilder2D::loadCache(cachePath, sourceChecksum, sourceSize, m_KDTreeData)) 
     {
-        m_KDTreeData.points = builder.getGPUPoints();
-        m_KDTreeData.numLevels = builder.getNumLevels();
+        std::cout << "[VIS2D]   KD-Tree loaded from cache: " << cachePath << std::endl;
     }
     else 
     {
-        std::cerr << "[ERROR]::VIS2D: Failed to build KD-Tree" << std::endl;
-        return false;
+        KDTreeBuilder2D builder;
+        if (builder.buildTree(m_sparsePoints)) 
+        {
+            m_KDTreeData = {};
+            m_KDTreeData.points = builder.getGPUPoints();
+            m_KDTreeData.numLevels = builder.getNumLevels();
+            m_KDTreeData.ids = builder.getSlotToOriginal();
+            if (hasChecksum && !builder.saveCache(cachePath, sourceChecksum, sourceSize)) 
+            {
+                std::cerr << "[WARNING]::VIS2D: Failed to write KD-Tree cache " << cachePath << std::endl;
+            }
+        }
+        else 
+        {
+            std::cerr << "[ERROR]::VIS2D: Failed to build KD-Tree" << std::endl;
+            return false;
+        }
     }
  
-    std::cout << "[VIS2D]   Total points: " << m_KDTreeData.points.size() << std::endl;
+    std::cout << "[VIS2D]   Total points: " << m_KDTreeData.numNodes() << std::endl;
     std::cout << "[VIS2D]   Number of levels: " << m_KDTreeData.numLevels << std::endl;
 
-    m_CS_Uniforms.totalNodes = m_KDTreeData.points.size();
+    m_CS_Uniforms.totalNodes = m_KDTreeData.numNodes();
     m_CS_Uniforms.numLevels = m_KDTreeData.numLevels;
     m_CS_Uniforms.interpolationMethod = 0; 
+    m_CS_Uniforms.numNeighbors = 8;
+    m_CS_Uniforms.eps = 0.0f;
 
     // int test_w = 150 * 1;
     // int test_h = 450 * 1;
@@ -289,6 +316,49 @@ void VIS2D::SetSearchRadius(float radius)
     }
 }
 
+void VIS2D::SetEps(float eps)
+{
+    if (m_CS_Uniforms.eps != eps) 
+    {
+        m_CS_Uniforms.eps = eps;
+        m_queue.writeBuffer(m_computeStage.uniformBuffer, 0, &m_CS_Uniforms, sizeof(CS_Uniforms));
+        m_needsUpdate = true;
+    }
+}
+
+bool VIS2D::UpdateValues(const std::vector<float>& values)
+{
+    if (values.size() != m_sparsePoints.size()) 
+    {
+        std::cerr << "[ERROR]::VIS2D: Expected " << m_sparsePoints.size() << " values, got " << values.size() << std::endl;
+        return false;
+    }
+
+    std::vector<float> treeValues;
+    if (!m_KDTreeData.valuesInTreeOrder(values.data(), values.size(), treeValues)) return false;
+    m_queue.writeBuffer(m_computeStage.kdValuesBuffer, 0, treeValues.data(), treeValues.size() * sizeof(float));
+
+    // CPU端的原始点只用于值域；storageBuffer 中的稀疏点（暴力插值方法）不重新上传
+    for (size_t i = 0; i < values.size(); ++i) 
+    {
+        m_sparsePoints[i].value = values[i];
+    }
+    ComputeValueRange();
+    m_queue.writeBuffer(m_computeStage.uniformBuffer, 0, &m_CS_Uniforms, sizeof(CS_Uniforms));
+    m_needsUpdate = true;
+    return true;
+}
+
+void VIS2D::SetNumNeighbors(int k)
+{
+    if (m_CS_Uniforms.numNeighbors != (uint32_t)k) 
+    {
+        m_CS_Uniforms.numNeighbors = k;
+        m_queue.writeBuffer(m_computeStage.uniformBuffer, 0, &m_CS_Uniforms, sizeof(CS_Uniforms));
+        m_needsUpdate = true;
+    }
+}
+
 bool VIS2D::ComputeStage::Init(wgpu::Device device, wgpu::Queue queue, 
     const std::vector<SparsePoint2D>& sparsePoints, 
     const KDTreeBuilder2D::TreeData2D& kdTreeData,
@@ -330,7 +400,8 @@ bool VIS2D::ComputeStage::InitSSBO(wgpu::Device device, wgpu::Queue queue, const
     // 1. 创建稀疏点数据的存储缓冲区
     wgpu::BufferDescriptor storageBufferDesc = {};
     storageBufferDesc.label = "Sparse Points Buffer";
-    storageBufferDesc.size = sparsePoints.size() * sizeof(SparsePoint2D);
+    const size_t numPoints = std::min(sparsePoints.size(), ChunkedStorageBuffer::MaxChunkElements(device, sizeof(SparsePoint2D)));
+    storageBufferDesc.size = numPoints * sizeof(SparsePoint2D);
     storageBufferDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
     storageBufferDesc.mappedAtCreation = false;
     
@@ -342,7 +413,7 @@ bool VIS2D::ComputeStage::InitSSBO(wgpu::Device device, wgpu::Queue queue, const
     }
     
     // 将稀疏点数据写入缓冲区
-    queue.writeBuffer(storageBuffer, 0, sparsePoints.data(), sparsePoints.size() * sizeof(SparsePoint2D));
+    queue.writeBuffer(storageBuffer, 0, sparsePoints.data(), numPoints * sizeof(SparsePoint2D));
     
     return true;
 }
@@ -350,29 +421,43 @@ bool VIS2D::ComputeStage::InitSSBO(wgpu::Device device, wgpu::Queue queue, const
 bool VIS2D::ComputeStage::InitKDTreeBuffers(wgpu::Device device, wgpu::Queue queue, 
     const KDTreeBuilder2D::TreeData2D& kdTreeData)
 {
-   if (kdTreeData.points.empty()) {
+   if (kdTreeData.numNodes() == 0) {
         std::cout << "[ERROR]::InitKDTreeBuffers KD-Tree data is empty" << std::endl;
         return false;
     }
 
     // 1. 创建KD-Tree节点缓冲区
-    wgpu::BufferDescriptor kdNodesBufferDesc = {};
-    kdNodesBufferDesc.label = "KD-Tree Points Buffer";
-    kdNodesBufferDesc.size = kdTreeData.points.size() * sizeof(GPUPoint2D);
-    kdNodesBufferDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
-    kdNodesBufferDesc.mappedAtCreation = false;
-    
-    kdNodesBuffer = device.createBuffer(kdNodesBufferDesc);
-    
-    if (!kdNodesBuffer) {
+    //    超过单个绑定上限时分成多块（着色器中的 kdNode() 透明地按块寻址）
+    if (!kdNodes.Create(device, "KD-Tree Points Buffer", kdTreeData.numNodes(), sizeof(GPUPoint2D))) {
         std::cout << "[ERROR]::InitKDTreeBuffers Failed to create KD-Tree nodes buffer" << std::endl;
         return false;
     }
     
     // 将KD-Tree节点数据写入缓冲区
-    queue.writeBuffer(kdNodesBuffer, 0, kdTreeData.points.data(), kdTreeData.points.size() * sizeof(GPUPoint2D));
+    kdNodes.Write(queue, 0, kdTreeData.nodes(), kdTreeData.numNodes());
+
+    // 2. 创建值缓冲区：着色器从这里读值，更新值时只需重写这一个缓冲区。
+    //    每个节点的值是节点大小的1/4，节点最多 kMaxChunks 块时值仍能放进一个绑定
+    wgpu::BufferDescriptor kdValuesBufferDesc = {};
+    kdValuesBufferDesc.label = "KD-Tree Values Buffer";
+    kdValuesBufferDesc.size = kdTreeData.numNodes() * sizeof(float);
+    kdValuesBufferDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
+    kdValuesBufferDesc.mappedAtCreation = false;
 
-    return kdNodesBuffer != nullptr;
+    kdValuesBuffer = device.createBuffer(kdValuesBufferDesc);
+
+    if (!kdValuesBuffer) {
+        std::cout << "[ERROR]::InitKDTreeBuffers Failed to create KD-Tree values buffer" << std::endl;
+        return false;
+    }
+
+    std::vector<float> values(kdTreeData.numNodes());
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = kdTreeData.nodes()[i].value;
+    }
+    queue.writeBuffer(kdValuesBuffer, 0, values.data(), values.size() * sizeof(float));
+
+    return kdNodes.isValid();
 }
 
 bool VIS2D::ComputeStage::CreatePipeline(wgpu::Device device) {
@@ -412,15 +497,18 @@ bool VIS2D::ComputeStage::CreatePipeline(wgpu::Device device) {
     group1Desc.entries = group1Entries;
     auto group1Layout = device.createBindGroupLayout(group1Desc);
     
-    // Group 2: KD-Tree data
-    wgpu::BindGroupLayoutEntry group2Entries[1] = {};
-    group2Entries[0].binding = 0;
-    group2Entries[0].visibility = wgpu::ShaderStage::Compute;
-    group2Entries[0].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
-    group2Entries[0].buffer.hasDynamicOffset = false;
+    // Group 2: KD-Tree data（节点第0块 + 值 + 节点第1~3块）
+    const uint32_t numGroup2Entries = 2 + ChunkedStorageBuffer::kMaxChunks - 1;
+    wgpu::BindGroupLayoutEntry group2Entries[numGroup2Entries] = {};
+    for (uint32_t i = 0; i < numGroup2Entries; ++i) {
+        group2Entries[i].binding = i;
+        group2Entries[i].visibility = wgpu::ShaderStage::Compute;
+        group2Entries[i].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+        group2Entries[i].buffer.hasDynamicOffset = false;
+    }
     wgpu::BindGroupLayoutDescriptor group2Desc = {};
     group2Desc.label = "Group 2 Layout";
-    group2Desc.entryCount = 1;
+    group2Desc.entryCount = numGroup2Entries;
     group2Desc.entries = group2Entries;
     auto group2Layout = device.createBindGroupLayout(group2Desc);
     
@@ -512,16 +600,23 @@ bool VIS2D::ComputeStage::UpdateBindGroup(wgpu::Device device, wgpu::TextureView
     }
 
     {
-        wgpu::BindGroupEntry entries[2] = {};
+        const uint32_t numEntries = 2 + ChunkedStorageBuffer::kMaxChunks - 1;
+        wgpu::BindGroupEntry entries[numEntries] = {};
         entries[0].binding = 0;
-        entries[0].buffer = kdNodesBuffer;
-        entries[0].offset = 0;
-        entries[0].size = WGPU_WHOLE_SIZE;
+        kdNodes.FillBinding(0, entries[0]);
+        entries[1].binding = 1;
+        entries[1].buffer = kdValuesBuffer;
+        entries[1].offset = 0;
+        entries[1].size = WGPU_WHOLE_SIZE;
+        for (uint32_t c = 1; c < ChunkedStorageBuffer::kMaxChunks; ++c) {
+            entries[1 + c].binding = 1 + c;
+            kdNodes.FillBinding(c, entries[1 + c]);
+        }
 
         wgpu::BindGroupDescriptor desc = {};
         desc.label = "Compute KDTree Bind Group";
         desc.layout = pipeline.getBindGroupLayout(2);
-        desc.entryCount = 1;
+        desc.entryCount = numEntries;
         desc.entries = entries;
         
         KDTree_bindGroup = device.createBindGroup(desc);
@@ -583,6 +678,11 @@ void VIS2D::ComputeStage::Release()
         KDTree_bindGroup.release();
         KDTree_bindGroup = nullptr;
     }
+    kdNodes.Release();
+    if (kdValuesBuffer) {
+        kdValuesBuffer.release();
+        kdValuesBuffer = nullptr;
+    }
 }
 
 bool VIS2D::RenderStage::Init(wgpu::Device device, wgpu::Queue queue, RS_Uniforms uniforms, float data_width, float data_height)
@@ -5,6 +5,25 @@
 #include <future>
 #include <thread>
 
+namespace 
+{
+    // 把按广度优先顺序排列的节点数据（节点、值）换成着色器使用的布局，与 nodeSlot() 对应
+    template<typename T>
+    std::vector<T> ToGPULayout(std::vector<T> in, uint32_t blockHeight)
+    {
+        if (blockHeight <= 1) return in;
+        std::vector<T> out(in.size());
+        const int64_t N = static_cast<int64_t>(in.size());
+        switch (blockHeight) 
+        {
+            case 2: kdTree::relayout<kdTree::BlockedLayout<2>>(out.data(), in.data(), N); break;
+            case 3: kdTree::relayout<kdTree::BlockedLayout<3>>(out.data(), in.data(), N); break;
+            default: kdTree::relayout<kdTree::BlockedLayout<4>>(out.data(), in.data(), N); break;
+        }
+        return out;
+    }
+}
+
 VIS3D::VIS3D(wgpu::Device device, wgpu::Queue queue, wgpu::TextureFormat swapChainFormat)
     : m_device(device), m_queue(queue), m_swapChainFormat(swapChainFormat) {
     
@@ -38,6 +57,13 @@ bool VIS3D::Initialize(glm::mat4 vMat, glm::mat4 pMat)
     m_RS_Uniforms.modelMatrix = glm::mat4(1.0f);
 
     if (!InitOutputTexture(16, 16, 16, wgpu::TextureFormat::RGBA16Float)) return false;
+    // 暴力插值方法的稀疏点只占一个绑定，超过绑定上限的点不上传（KDTree方法不受影响）
+    const size_t maxSparsePoints = ChunkedStorageBuffer::MaxChunkElements(m_device, sizeof(SparsePoint3D));
+    if (m_sparsePoints.size() > maxSparsePoints) 
+    {
+        std::cerr << "[WARNING]::VIS3D: brute-force interpolation only uses the first " << maxSparsePoints << " points" << std::endl;
+        m_CS_Uniforms.totalPoints = static_cast<uint32_t>(maxSparsePoints);
+    }
     if (!m_computeStage.Init(m_device, m_queue, m_sparsePoints, m_KDTreeData, m_CS_Uniforms)) return false;
     if (!m_renderStage.Init(m_device, m_queue, m_RS_Uniforms, m_header.width, m_header.height, m_header.depth)) return false;
     if (!m_renderStage.CreatePipeline(m_device, m_swapChainFormat)) return false;
@@ -112,22 +138,41 @@ bool VIS3D::InitDataFromBinary(const std::string& filename)
     ComputeValueRange();
 
     // 构建KD-Tree
-    KDTreeBuilder3D builder;
-    if (builder.buildTree(m_sparsePoints)) 
+    // 数据文件没有变化时直接映射缓存的树，跳过构建；两种分割方式的树分别缓存
+    const std::string cachePath = filename + (m_widestDimSplits ? ".widest.kdtree" : ".kdtree");
+    uint64_t sourceChecksum = 0;
+    uint64_t sourceSize = 0;
+    const bool hasChecksum = KDTreeCache::checksumFile(filename, sourceChecksum, sourceSize);
+    if (hasChecksum && KDTreeBuilder3D::loadCache(cachePath, sourceChecksum, sourceSize, m_KDTreeData)) 
     {
-        m_KDTreeData.points = builder.getGPUPoints();
-        m_KDTreeData.numLevels = builder.getNumLevels();
+        std::cout << "[VIS3D]   KD-Tree loaded from cache: " << cachePath << std::endl;
     }
     else 
     {
-        std::cerr << "[ERROR]::VIS3D: Failed to build KD-Tree" << std::endl;
-        return false;
+        KDTreeBuilder3D builder;
+        builder.setSplitMode(m_widestDimSplits ? KDTreeBuilder3D::SplitMode::WidestDimension : KDTreeBuilder3D::SplitMode::RoundRobin);
+        if (builder.buildTree(m_sparsePoints)) 
+        {
+            m_KDTreeData = {};
+            m_KDTreeData.points = builder.getGPUPoints();
+            m_KDTreeData.numLevels = builder.getNumLevels();
+            m_KDTreeData.ids = builder.getSlotToOriginal();
+            if (hasChecksum && !builder.saveCache(cachePath, sourceChecksum, sourceSize)) 
+            {
+                std::cerr << "[WARNING]::VIS3D: Failed to write KD-Tree cache " << cachePath << std::endl;
+            }
+        }
+        else 
+        {
+            std::cerr << "[ERROR]::VIS3D: Failed to build KD-Tree" << std::endl;
+            return false;
+        }
     }
  
-    std::cout << "[VIS3D]   Total points: " << m_KDTreeData.points.size() << std::endl;
+    std::cout << "[VIS3D]   Total points: " << m_KDTreeData.numNodes() << std::endl;
     std::cout << "[VIS3D]   Number of levels: " << m_KDTreeData.numLevels << std::endl;
 
-    m_CS_Uniforms.totalNodes = m_KDTreeData.points.size();
+    m_CS_Uniforms.totalNodes = m_KDTreeData.numNodes();
     m_CS_Uniforms.numLevels = m_KDTreeData.numLevels;
     m_CS_Uniforms.interpolationMethod = 0; 
 
@@ -334,6 +379,361 @@ void VIS3D::SetSearchRadius(float radius)
     }
 }
 
+void VIS3D::SetEps(float eps)
+{
+    if (m_CS_Uniforms.eps != eps) 
+    {
+        m_CS_Uniforms.eps = eps;
+        m_queue.writeBuffer(m_computeStage.uniformBuffer, 0, &m_CS_Uniforms, sizeof(CS_Uniforms));
+        m_needsUpdate = true;
+    }
+}
+
+void VIS3D::SetWarmStart(bool enable)
+{
+    const uint32_t warmStart = enable ? 1u : 0u;
+    if (m_CS_Uniforms.warmStart != warmStart) 
+    {
+        m_CS_Uniforms.warmStart = warmStart;
+        m_queue.writeBuffer(m_computeStage.uniformBuffer, 0, &m_CS_Uniforms, sizeof(CS_Uniforms));
+        m_needsUpdate = true;
+    }
+}
+
+bool VIS3D::SetTraversalStats(bool enable)
+{
+    if (enable == m_computeStage.traversalStats) return true;
+    m_computeStage.traversalStats = enable;
+    if (m_computeStage.pipeline) 
+    {
+        m_computeStage.pipeline.release();
+        m_computeStage.pipeline = nullptr;
+    }
+    if (!m_computeStage.CreatePipeline(m_device)) return false;
+    if (m_tfTextureView) 
+    {
+        m_computeStage.UpdateBindGroup(m_device, m_tfTextureView, m_outputTextureView);
+    }
+    m_needsUpdate = true;
+    return true;
+}
+
+bool VIS3D::ReadTraversalStats(GPUTraversalStats& stats)
+{
+    if (!m_computeStage.traversalStats) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Traversal stats are not enabled" << std::endl;
+        return false;
+    }
+
+    wgpu::BufferDescriptor desc = {};
+    desc.label = "Traversal Stats Readback Buffer";
+    desc.size = sizeof(GPUTraversalStats);
+    desc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+    desc.mappedAtCreation = false;
+    wgpu::Buffer readBuffer = m_device.createBuffer(desc);
+    if (!readBuffer) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Failed to create traversal stats readback buffer" << std::endl;
+        return false;
+    }
+
+    wgpu::CommandEncoderDescriptor encoderDesc = {};
+    encoderDesc.label = "Traversal Stats Copy Encoder";
+    wgpu::CommandEncoder encoder = m_device.createCommandEncoder(encoderDesc);
+    encoder.copyBufferToBuffer(m_computeStage.traversalStatsBuffer, 0, readBuffer, 0, sizeof(GPUTraversalStats));
+    wgpu::CommandBufferDescriptor commandsDesc = {};
+    commandsDesc.label = "Traversal Stats Copy Commands";
+    wgpu::CommandBuffer commands = encoder.finish(commandsDesc);
+    m_queue.submit(1, &commands);
+    commands.release();
+    encoder.release();
+
+    bool done = false;
+    bool mapped = false;
+    auto callback = readBuffer.mapAsync(wgpu::MapMode::Read, 0, sizeof(GPUTraversalStats), [&](wgpu::BufferMapAsyncStatus status) 
+    {
+        mapped = status == wgpu::BufferMapAsyncStatus::Success;
+        done = true;
+    });
+    while (!done) 
+    {
+        #if defined(WEBGPU_BACKEND_DAWN)
+        m_device.tick();
+        #elif defined(WEBGPU_BACKEND_WGPU)
+        m_device.poll(true);
+        #endif
+    }
+
+    if (mapped) 
+    {
+        std::memcpy(&stats, readBuffer.getConstMappedRange(0, sizeof(GPUTraversalStats)), sizeof(GPUTraversalStats));
+        readBuffer.unmap();
+    }
+    else 
+    {
+        std::cerr << "[ERROR]::VIS3D: Failed to map traversal stats readback buffer" << std::endl;
+    }
+    readBuffer.release();
+    return mapped;
+}
+
+bool VIS3D::UpdateValues(const std::vector<float>& values)
+{
+    if (m_dynamicTree) 
+    {
+        std::cerr << "[ERROR]::VIS3D: UpdateValues is not supported after points were inserted or removed" << std::endl;
+        return false;
+    }
+    if (values.size() != m_sparsePoints.size()) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Expected " << m_sparsePoints.size() << " values, got " << values.size() << std::endl;
+        return false;
+    }
+
+    std::vector<float> treeValues;
+    if (!m_KDTreeData.valuesInTreeOrder(values.data(), values.size(), treeValues)) return false;
+    treeValues = ToGPULayout(std::move(treeValues), m_CS_Uniforms.blockHeight);
+    m_queue.writeBuffer(m_computeStage.kdValuesBuffer, 0, treeValues.data(), treeValues.size() * sizeof(float));
+
+    // CPU端的原始点只用于值域；storageBuffer 中的稀疏点（暴力插值方法）不重新上传
+    for (size_t i = 0; i < values.size(); ++i) 
+    {
+        m_sparsePoints[i].value = values[i];
+    }
+    ComputeValueRange();
+    m_queue.writeBuffer(m_computeStage.uniformBuffer, 0, &m_CS_Uniforms, sizeof(CS_Uniforms));
+    m_needsUpdate = true;
+    return true;
+}
+
+bool VIS3D::SetCompactNodes(bool enable, bool exactRescoring)
+{
+    if (enable && m_dynamicTree) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Compact nodes are not supported after points were inserted or removed" << std::endl;
+        return false;
+    }
+    const uint32_t compactExact = exactRescoring ? 1u : 0u;
+    if (enable == (m_CS_Uniforms.nodeFormat == kCompactNodes) && (!enable || compactExact == m_CS_Uniforms.compactExact)) return true;
+    if (m_KDTreeData.numNodes() == 0) return false;
+
+    m_CS_Uniforms.nodeFormat = enable ? kCompactNodes : kFullNodes;
+    if (enable) m_CS_Uniforms.compactExact = compactExact;
+    if (UploadStaticTree()) return true;
+    // 压缩节点放不下时（如超过 kMaxChunks 块）退回完整节点
+    if (enable) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Failed to upload compact nodes, keeping full nodes" << std::endl;
+        m_CS_Uniforms.nodeFormat = kFullNodes;
+        UploadStaticTree();
+    }
+    return false;
+}
+
+bool VIS3D::SetBlockedLayout(uint32_t blockHeight)
+{
+    if (blockHeight > kMaxBlockHeight) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Block height " << blockHeight << " is larger than " << kMaxBlockHeight << std::endl;
+        return false;
+    }
+    if (blockHeight != 0 && m_dynamicTree) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Blocked layout is not supported after points were inserted or removed" << std::endl;
+        return false;
+    }
+    if (blockHeight == m_CS_Uniforms.blockHeight) return true;
+    if (m_KDTreeData.numNodes() == 0) return false;
+
+    m_CS_Uniforms.blockHeight = blockHeight;
+    return UploadStaticTree();
+}
+
+bool VIS3D::SetWidestDimSplits(bool enable)
+{
+    if (enable && m_dynamicTree) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Widest-dimension splits are not supported after points were inserted or removed" << std::endl;
+        return false;
+    }
+    if (enable == m_widestDimSplits) return true;
+    m_widestDimSplits = enable;
+    // 数据还没加载时只记录下来，加载时按此构建
+    if (m_KDTreeData.numNodes() == 0) return true;
+
+    KDTreeBuilder3D builder;
+    builder.setSplitMode(enable ? KDTreeBuilder3D::SplitMode::WidestDimension : KDTreeBuilder3D::SplitMode::RoundRobin);
+    if (!builder.buildTree(m_sparsePoints)) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Failed to rebuild KD-Tree" << std::endl;
+        return false;
+    }
+    m_KDTreeData = {};
+    m_KDTreeData.points = builder.getGPUPoints();
+    m_KDTreeData.numLevels = builder.getNumLevels();
+    m_KDTreeData.ids = builder.getSlotToOriginal();
+    return UploadStaticTree();
+}
+
+bool VIS3D::UploadStaticTree()
+{
+    const size_t numNodes = m_KDTreeData.numNodes();
+    const uint32_t blockHeight = m_CS_Uniforms.blockHeight;
+    if (m_CS_Uniforms.nodeFormat == kCompactNodes) 
+    {
+        std::vector<GPUCompactPoint3D> compact;
+        kdTree::Quantizer<kdTree::float3> quant;
+        m_KDTreeData.compactNodes(compact, quant);
+        compact = ToGPULayout(std::move(compact), blockHeight);
+        for (int d = 0; d < 3; ++d) 
+        {
+            m_CS_Uniforms.quantLower[d] = kdTree::get_coord(quant.lower, d);
+            m_CS_Uniforms.quantStep[d] = kdTree::get_coord(quant.step, d);
+            m_CS_Uniforms.quantMaxErr[d] = kdTree::get_coord(quant.maxErr, d);
+        }
+        m_CS_Uniforms.quantMaxPointError = quant.maxPointError();
+
+        // 精确坐标接在压缩节点后面放进同一个节点缓冲区（从第 2 * numNodes 个字开始，每个节点 x, y, z 三个f32），
+        // 不占额外的存储缓冲区绑定；着色器只为解码距离通过接受界的候选点读取，用来重新打分。
+        // 只用解码坐标时不上传
+        const size_t exactBytes = m_CS_Uniforms.compactExact ? numNodes * sizeof(kdTree::float3) : 0;
+        std::vector<kdTree::float3> exact(exactBytes ? numNodes : 0);
+        for (size_t i = 0; i < exact.size(); ++i) 
+        {
+            const GPUPoint3D& node = m_KDTreeData.nodes()[i];
+            exact[i] = kdTree::make_float3(node.x, node.y, node.z);
+        }
+        exact = ToGPULayout(std::move(exact), blockHeight);
+        static_assert(sizeof(kdTree::float3) == 3 * sizeof(float), "exact coordinates are read as 3 floats per node");
+        compact.resize(numNodes + (exactBytes + sizeof(GPUCompactPoint3D) - 1) / sizeof(GPUCompactPoint3D));
+        if (exactBytes) std::memcpy(compact.data() + numNodes, exact.data(), exactBytes);
+        if (!m_computeStage.kdNodes.Create(m_device, "KD-Tree 3D Compact Points Buffer", compact.size(), sizeof(GPUCompactPoint3D))) return false;
+        m_computeStage.kdNodes.Write(m_queue, 0, compact.data(), compact.size());
+        std::cout << "[VIS3D] Compact KD-Tree nodes: " << numNodes * sizeof(GPUCompactPoint3D) / 1024 << " KiB + exact coordinates "
+                  << exactBytes / 1024 << " KiB (full nodes: " << numNodes * sizeof(GPUPoint3D) / 1024
+                  << " KiB), position error <= " << quant.maxPointError() << std::endl;
+    }
+    else 
+    {
+        std::vector<GPUPoint3D> nodes(m_KDTreeData.nodes(), m_KDTreeData.nodes() + numNodes);
+        if (!m_computeStage.kdNodes.Create(m_device, "KD-Tree 3D Points Buffer", numNodes, sizeof(GPUPoint3D))) return false;
+        m_computeStage.kdNodes.Write(m_queue, 0, ToGPULayout(std::move(nodes), blockHeight).data(), numNodes);
+    }
+
+    // 值缓冲区大小不变，只按新布局重排（值可能已被 UpdateValues 更新，所以从原始点取）
+    std::vector<float> values(m_sparsePoints.size());
+    for (size_t i = 0; i < m_sparsePoints.size(); ++i) 
+    {
+        values[i] = m_sparsePoints[i].value;
+    }
+    std::vector<float> treeValues;
+    if (!m_KDTreeData.valuesInTreeOrder(values.data(), values.size(), treeValues)) return false;
+    treeValues = ToGPULayout(std::move(treeValues), blockHeight);
+    m_queue.writeBuffer(m_computeStage.kdValuesBuffer, 0, treeValues.data(), treeValues.size() * sizeof(float));
+
+    m_queue.writeBuffer(m_computeStage.uniformBuffer, 0, &m_CS_Uniforms, sizeof(CS_Uniforms));
+    if (m_tfTextureView) 
+    {
+        m_computeStage.UpdateBindGroup(m_device, m_tfTextureView, m_outputTextureView);
+    }
+    m_needsUpdate = true;
+    return true;
+}
+
+bool VIS3D::InsertPoints(const std::vector<SparsePoint3D>& points, uint32_t* firstID)
+{
+    if (!m_dynamicTree && !EnableDynamicTree()) return false;
+
+    const uint32_t id = m_dynamicTree->insert(points);
+    if (firstID) *firstID = id;
+    return UploadDynamicTree();
+}
+
+bool VIS3D::RemovePoints(const std::vector<uint32_t>& ids)
+{
+    if (!m_dynamicTree && !EnableDynamicTree()) return false;
+
+    bool allRemoved = true;
+    for (uint32_t id : ids) 
+    {
+        allRemoved = m_dynamicTree->remove(id) && allRemoved;
+    }
+    if (!allRemoved) 
+    {
+        std::cerr << "[WARNING]::VIS3D: Some points to remove do not exist" << std::endl;
+    }
+    return UploadDynamicTree();
+}
+
+bool VIS3D::EnableDynamicTree()
+{
+    m_dynamicTree = std::make_unique<DynamicKDTree3D>();
+    if (!m_dynamicTree->build(m_sparsePoints)) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Failed to build dynamic KD-Tree" << std::endl;
+        m_dynamicTree.reset();
+        return false;
+    }
+    // 静态树（包括映射的缓存）不再使用；森林中的树总是轮流分割
+    m_KDTreeData = {};
+    m_widestDimSplits = false;
+    // 动态森林只用广度优先的完整节点：释放其他格式的节点，UploadDynamicTree 会按森林容量重建缓冲区
+    if (m_CS_Uniforms.nodeFormat != kFullNodes || m_CS_Uniforms.blockHeight != 0) 
+    {
+        m_computeStage.kdNodes.Release();
+        m_CS_Uniforms.nodeFormat = kFullNodes;
+        m_CS_Uniforms.blockHeight = 0;
+    }
+    std::cout << "[VIS3D] Switched to dynamic KD-Tree (" << m_dynamicTree->size() << " points)" << std::endl;
+    return true;
+}
+
+bool VIS3D::UploadDynamicTree()
+{
+    const auto& nodes = m_dynamicTree->getGPUNodes();
+    const auto trees = m_dynamicTree->getGPUTrees();
+    std::vector<std::pair<size_t, size_t>> dirtyRanges;
+    m_dynamicTree->takeDirtyRanges(dirtyRanges);
+    if (trees.size() > ComputeStage::kMaxTrees) 
+    {
+        std::cerr << "[ERROR]::VIS3D: Dynamic KD-Tree has too many trees (" << trees.size() << ")" << std::endl;
+        return false;
+    }
+
+    const auto& values = m_dynamicTree->getGPUValues();
+    if (nodes.size() > m_computeStage.kdNodes.capacity()) 
+    {
+        // 森林多了一层：按新容量重建缓冲区，整体上传一次
+        if (!m_computeStage.CreateKDNodesBuffer(m_device, nodes.size())) return false;
+        m_computeStage.kdNodes.Write(m_queue, 0, nodes.data(), nodes.size());
+        m_queue.writeBuffer(m_computeStage.kdValuesBuffer, 0, values.data(), values.size() * sizeof(float));
+        if (m_tfTextureView) 
+        {
+            m_computeStage.UpdateBindGroup(m_device, m_tfTextureView, m_outputTextureView);
+        }
+    }
+    else 
+    {
+        for (const auto& range : dirtyRanges) 
+        {
+            m_computeStage.kdNodes.Write(m_queue, range.first, nodes.data() + range.first, range.second - range.first);
+            m_queue.writeBuffer(m_computeStage.kdValuesBuffer, range.first * sizeof(float), 
+                                values.data() + range.first, (range.second - range.first) * sizeof(float));
+        }
+    }
+    if (!trees.empty()) 
+    {
+        m_queue.writeBuffer(m_computeStage.kdTreesBuffer, 0, trees.data(), trees.size() * sizeof(DynamicKDTree3D::GPUTreeRange));
+    }
+
+    m_CS_Uniforms.totalNodes = static_cast<uint32_t>(nodes.size());
+    m_CS_Uniforms.numTrees = static_cast<uint32_t>(trees.size());
+    m_queue.writeBuffer(m_computeStage.uniformBuffer, 0, &m_CS_Uniforms, sizeof(CS_Uniforms));
+    m_needsUpdate = true;
+    return true;
+}
+
 // ComputeStage 实现
 bool VIS3D::ComputeStage::Init(wgpu::Device device, wgpu::Queue queue, 
     const std::vector<SparsePoint3D>& sparsePoints, 
@@ -372,7 +772,8 @@ bool VIS3D::ComputeStage::InitSSBO(wgpu::Device device, wgpu::Queue queue, const
 
     wgpu::BufferDescriptor storageBufferDesc = {};
     storageBufferDesc.label = "Sparse Points 3D Buffer";
-    storageBufferDesc.size = sparsePoints.size() * sizeof(SparsePoint3D);
+    const size_t numPoints = std::min(sparsePoints.size(), ChunkedStorageBuffer::MaxChunkElements(device, sizeof(SparsePoint3D)));
+    storageBufferDesc.size = numPoints * sizeof(SparsePoint3D);
     storageBufferDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
     storageBufferDesc.mappedAtCreation = false;
     
@@ -383,33 +784,88 @@ bool VIS3D::ComputeStage::InitSSBO(wgpu::Device device, wgpu::Queue queue, const
         return false;
     }
     
-    queue.writeBuffer(storageBuffer, 0, sparsePoints.data(), sparsePoints.size() * sizeof(SparsePoint3D));
+    queue.writeBuffer(storageBuffer, 0, sparsePoints.data(), numPoints * sizeof(SparsePoint3D));
     return true;
 }
 
 bool VIS3D::ComputeStage::InitKDTreeBuffers(wgpu::Device device, wgpu::Queue queue, 
     const KDTreeBuilder3D::TreeData3D& kdTreeData)
 {
-    if (kdTreeData.points.empty()) {
+    if (kdTreeData.numNodes() == 0) {
         std::cout << "[ERROR]::InitKDTreeBuffers KD-Tree data is empty" << std::endl;
         return false;
     }
 
-    wgpu::BufferDescriptor kdNodesBufferDesc = {};
-    kdNodesBufferDesc.label = "KD-Tree 3D Points Buffer";
-    kdNodesBufferDesc.size = kdTreeData.points.size() * sizeof(GPUPoint3D);
-    kdNodesBufferDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
-    kdNodesBufferDesc.mappedAtCreation = false;
-    
-    kdNodesBuffer = device.createBuffer(kdNodesBufferDesc);
-    
-    if (!kdNodesBuffer) {
-        std::cout << "[ERROR]::InitKDTreeBuffers Failed to create KD-Tree nodes buffer" << std::endl;
+    if (!CreateKDNodesBuffer(device, kdTreeData.numNodes())) return false;
+    kdNodes.Write(queue, 0, kdTreeData.nodes(), kdTreeData.numNodes());
+
+    std::vector<float> values(kdTreeData.numNodes());
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = kdTreeData.nodes()[i].value;
+    }
+    queue.writeBuffer(kdValuesBuffer, 0, values.data(), values.size() * sizeof(float));
+
+    // 静态树：只有一棵树，覆盖全部节点
+    wgpu::BufferDescriptor kdTreesBufferDesc = {};
+    kdTreesBufferDesc.label = "KD-Tree 3D Ranges Buffer";
+    kdTreesBufferDesc.size = kMaxTrees * sizeof(DynamicKDTree3D::GPUTreeRange);
+    kdTreesBufferDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
+    kdTreesBufferDesc.mappedAtCreation = false;
+
+    kdTreesBuffer = device.createBuffer(kdTreesBufferDesc);
+
+    if (!kdTreesBuffer) {
+        std::cout << "[ERROR]::InitKDTreeBuffers Failed to create KD-Tree ranges buffer" << std::endl;
         return false;
     }
-    
-    queue.writeBuffer(kdNodesBuffer, 0, kdTreeData.points.data(), kdTreeData.points.size() * sizeof(GPUPoint3D));
-    return kdNodesBuffer != nullptr;
+
+    const DynamicKDTree3D::GPUTreeRange wholeTree = {0, static_cast<uint32_t>(kdTreeData.numNodes())};
+    queue.writeBuffer(kdTreesBuffer, 0, &wholeTree, sizeof(wholeTree));
+
+    wgpu::BufferDescriptor statsBufferDesc = {};
+    statsBufferDesc.label = "KD-Tree 3D Traversal Stats Buffer";
+    statsBufferDesc.size = sizeof(GPUTraversalStats);
+    statsBufferDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::CopySrc;
+    statsBufferDesc.mappedAtCreation = false;
+
+    traversalStatsBuffer = device.createBuffer(statsBufferDesc);
+
+    if (!traversalStatsBuffer) {
+        std::cout << "[ERROR]::InitKDTreeBuffers Failed to create traversal stats buffer" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool VIS3D::ComputeStage::CreateKDNodesBuffer(wgpu::Device device, size_t numNodes)
+{
+    if (kdValuesBuffer) {
+        kdValuesBuffer.release();
+        kdValuesBuffer = nullptr;
+    }
+
+    // 节点超过单个绑定上限时分成多块（着色器中的 kdNode() 透明地按块寻址）
+    if (!kdNodes.Create(device, "KD-Tree 3D Points Buffer", numNodes, sizeof(GPUPoint3D))) {
+        std::cout << "[ERROR]::CreateKDNodesBuffer Failed to create KD-Tree nodes buffer" << std::endl;
+        return false;
+    }
+
+    // 值单独放一个缓冲区，只更新值时不需要重新上传坐标。
+    // 每个节点只有4字节（节点的1/8），节点最多 kMaxChunks 块时值仍能放进一个绑定
+    wgpu::BufferDescriptor kdValuesBufferDesc = {};
+    kdValuesBufferDesc.label = "KD-Tree 3D Values Buffer";
+    kdValuesBufferDesc.size = numNodes * sizeof(float);
+    kdValuesBufferDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
+    kdValuesBufferDesc.mappedAtCreation = false;
+
+    kdValuesBuffer = device.createBuffer(kdValuesBufferDesc);
+
+    if (!kdValuesBuffer) {
+        std::cout << "[ERROR]::CreateKDNodesBuffer Failed to create KD-Tree values buffer" << std::endl;
+        kdNodes.Release();
+        return false;
+    }
+    return true;
 }
 
 bool VIS3D::ComputeStage::CreatePipeline(wgpu::Device device) {
@@ -448,24 +904,32 @@ bool VIS3D::ComputeStage::CreatePipeline(wgpu::Device device) {
     group1Desc.entries = group1Entries;
     auto group1Layout = device.createBindGroupLayout(group1Desc);
     
-    // Group 2: KD-Tree data
-    wgpu::BindGroupLayoutEntry group2Entries[1] = {};
-    group2Entries[0].binding = 0;
-    group2Entries[0].visibility = wgpu::ShaderStage::Compute;
-    group2Entries[0].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
-    group2Entries[0].buffer.hasDynamicOffset = false;
+    // Group 2: KD-Tree data（节点第0块 + 每棵树的范围 + 值 + 节点第1~3块 + 遍历统计）
+    const uint32_t numGroup2Entries = 3 + ChunkedStorageBuffer::kMaxChunks - 1 + 1;
+    const uint32_t statsBinding = numGroup2Entries - 1;
+    wgpu::BindGroupLayoutEntry group2Entries[numGroup2Entries] = {};
+    for (uint32_t i = 0; i < numGroup2Entries; ++i) {
+        group2Entries[i].binding = i;
+        group2Entries[i].visibility = wgpu::ShaderStage::Compute;
+        group2Entries[i].buffer.type = i == statsBinding ? wgpu::BufferBindingType::Storage : wgpu::BufferBindingType::ReadOnlyStorage;
+        group2Entries[i].buffer.hasDynamicOffset = false;
+    }
     
     wgpu::BindGroupLayoutDescriptor group2Desc = {};
     group2Desc.label = "Group 2 3D Layout";
-    group2Desc.entryCount = 1;
+    group2Desc.entryCount = numGroup2Entries;
     group2Desc.entries = group2Entries;
     auto group2Layout = device.createBindGroupLayout(group2Desc);
     
+    const std::string shaderPath = "../shaders/volume_simple.comp.wgsl";
     auto& mgr = PipelineManager::getInstance();
-    pipeline = mgr.createComputePipeline()
-        .setDevice(device)
-        .setLabel("Transfer Function 3D Compute Pipeline")
-        .setShader("../shaders/volume_simple.comp.wgsl", "main")
+    auto builder = mgr.createComputePipeline();
+    builder.setDevice(device)
+        .setLabel(traversalStats ? "Transfer Function 3D Compute Pipeline (traversal stats)" : "Transfer Function 3D Compute Pipeline");
+    // 统计变体：同一个着色器，创建管线时打开 override 常量 TRAVERSAL_STATS
+    builder.setShader(shaderPath, "main")
+        .setConstant("TRAVERSAL_STATS", traversalStats ? 1.0 : 0.0);
+    pipeline = builder
         .setExplicitLayout(true)
         .addBindGroupLayout(group0Layout)
         .addBindGroupLayout(group1Layout)
@@ -549,16 +1013,31 @@ bool VIS3D::ComputeStage::UpdateBindGroup(wgpu::Device device, wgpu::TextureView
     }
 
     {
-        wgpu::BindGroupEntry entries[1] = {};
+        const uint32_t numEntries = 3 + ChunkedStorageBuffer::kMaxChunks - 1 + 1;
+        wgpu::BindGroupEntry entries[numEntries] = {};
         entries[0].binding = 0;
-        entries[0].buffer = kdNodesBuffer;
-        entries[0].offset = 0;
-        entries[0].size = WGPU_WHOLE_SIZE;
+        kdNodes.FillBinding(0, entries[0]);
+        entries[1].binding = 1;
+        entries[1].buffer = kdTreesBuffer;
+        entries[1].offset = 0;
+        entries[1].size = WGPU_WHOLE_SIZE;
+        entries[2].binding = 2;
+        entries[2].buffer = kdValuesBuffer;
+        entries[2].offset = 0;
+        entries[2].size = WGPU_WHOLE_SIZE;
+        for (uint32_t c = 1; c < ChunkedStorageBuffer::kMaxChunks; ++c) {
+            entries[2 + c].binding = 2 + c;
+            kdNodes.FillBinding(c, entries[2 + c]);
+        }
+        entries[numEntries - 1].binding = numEntries - 1;
+        entries[numEntries - 1].buffer = traversalStatsBuffer;
+        entries[numEntries - 1].offset = 0;
+        entries[numEntries - 1].size = WGPU_WHOLE_SIZE;
 
         wgpu::BindGroupDescriptor desc = {};
         desc.label = "Compute 3D KDTree Bind Group";
         desc.layout = pipeline.getBindGroupLayout(2);
-        desc.entryCount = 1;
+        desc.entryCount = numEntries;
         desc.entries = entries;
         
         KDTree_bindGroup = device.createBindGroup(desc);
@@ -575,6 +1054,11 @@ void VIS3D::ComputeStage::RunCompute(wgpu::Device device, wgpu::Queue queue, wgp
 {
     if (!data_bindGroup || !TF_bindGroup || !KDTree_bindGroup || !pipeline) return;
 
+    if (traversalStats) {
+        const GPUTraversalStats zero = {};
+        queue.writeBuffer(traversalStatsBuffer, 0, &zero, sizeof(zero));
+    }
+
     wgpu::CommandEncoderDescriptor encoderDesc = {};
     encoderDesc.label = "Compute 3D Command Encoder";
     wgpu::CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
@@ -587,7 +1071,9 @@ void VIS3D::ComputeStage::RunCompute(wgpu::Device device, wgpu::Queue queue, wgp
     computePass.setBindGroup(0, data_bindGroup, 0, nullptr);
     computePass.setBindGroup(1, TF_bindGroup, 0, nullptr); 
     computePass.setBindGroup(2, KDTree_bindGroup, 0, nullptr);
-    computePass.dispatchWorkgroups(4, 4, 4);
+    // 工作组为4x4x4，每次调用沿x方向处理 kVoxelsPerInvocation 个体素
+    const uint32_t groupsX = (outputTexture.getWidth() + 4 * kVoxelsPerInvocation - 1) / (4 * kVoxelsPerInvocation);
+    computePass.dispatchWorkgroups(groupsX, (outputTexture.getHeight() + 3) / 4, (outputTexture.getDepthOrArrayLayers() + 3) / 4);
     
     computePass.end();
     computePass.release();
@@ -719,9 +1205,18 @@ void VIS3D::ComputeStage::Release()
         storageBuffer.release();
         storageBuffer = nullptr;
     }
-    if (kdNodesBuffer) {
-        kdNodesBuffer.release();
-        kdNodesBuffer = nullptr;
+    kdNodes.Release();
+    if (kdValuesBuffer) {
+        kdValuesBuffer.release();
+        kdValuesBuffer = nullptr;
+    }
+    if (kdTreesBuffer) {
+        kdTreesBuffer.release();
+        kdTreesBuffer = nullptr;
+    }
+    if (traversalStatsBuffer) {
+        traversalStatsBuffer.release();
+        traversalStatsBuffer = nullptr;
     }
 }
 
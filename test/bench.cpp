@@ -0,0 +1,493 @@
+// kd-tree benchmark suite: build time and KNN queries/s over dimension,
+// point count, distribution, K and search radius, written as JSON and/or
+// CSV so runs on the same machine can be compared across commits.
+//
+//   kdtree_bench [--min-n N] [--max-n N] [--queries Q] [--threads T]
+//                [--repeat R] [--dims 2,3] [--dist uniform,clustered,lattice,anisotropic]
+//                [--brute-max-n N] [--json file] [--csv file] [--label text] [--revision text]
+//
+// N runs over the powers of ten from --min-n to --max-n (10^3 .. 10^8 are
+// supported; the default stops at 10^6, the largest sizes need several
+// GiB). Every timing is the best of --repeat runs. Results are tagged with
+// the git revision of the build; --revision overrides it.
+//
+// Up to --brute-max-n points (default 100000) the SIMD brute force of
+// bruteforce.hpp is timed next to knnBatch(), and every result records
+// whether a crossover table calibrated at startup would have picked it.
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <ctime>
+#include <cmath>
+#include <thread>
+
+#include "kdtree.h"
+
+#if __has_include("bench_revision.h")
+#include "bench_revision.h"
+#endif
+#ifndef KDTREE_BENCH_REVISION
+#define KDTREE_BENCH_REVISION "unknown"
+#endif
+
+struct BenchOptions
+{
+    int64_t minN = 1000;
+    int64_t maxN = 1000000;
+    int64_t numQueries = 10000;
+    int numThreads = 0;
+    int repeat = 1;
+    std::vector<int> dims = { 2, 3 };
+    std::vector<std::string> distributions = { "uniform", "clustered", "lattice", "anisotropic" };
+    int64_t bruteMaxN = 100000;
+    std::string jsonPath;
+    std::string csvPath;
+    std::string label;
+    std::string revision = KDTREE_BENCH_REVISION;
+};
+
+struct BenchResult
+{
+    int dims;
+    std::string distribution;
+    int64_t numPoints;
+    double buildMs;
+    int k;
+    std::string radiusLabel;
+    float radius;
+    int64_t numQueries;
+    double queriesPerSecond;       // one thread, one knn() per query
+    double batchQueriesPerSecond;  // knnBatch() on the thread pool
+    double bruteQueriesPerSecond;  // bruteForceKnnBatch() on the thread pool, 0 above --brute-max-n
+    bool autoPicksBrute;           // what knnBatchAuto() would run with the calibrated crossover
+    int numThreads;
+    double meanFound;              // neighbours found per query
+};
+
+static const float kExtent = 100.0f;
+
+// Points of one distribution, in [0,kExtent]^D unless noted:
+// - uniform: uniform random
+// - clustered: 32 Gaussian blobs, sigma 2% of the extent
+// - lattice: a regular grid of round(N^(1/D)) points per axis, like data.raw (N is rounded)
+// - anisotropic: uniform random, last axis squeezed to 1/100 of the extent (a slab in 3D, a strip in 2D)
+template<typename point_t>
+std::vector<point_t> MakePoints(const std::string& distribution, int64_t numPoints, unsigned seed)
+{
+    enum { D = kdTree::num_dims_of<point_t>::value };
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, kExtent);
+    std::vector<point_t> points;
+    if (distribution == "lattice")
+    {
+        const int side = std::max(1, int(std::lround(std::pow(double(numPoints), 1.0 / D))));
+        int64_t total = 1;
+        for (int d = 0; d < D; d++)
+            total *= side;
+        points.resize(total);
+        const float spacing = kExtent / side;
+        for (int64_t i = 0; i < total; i++)
+        {
+            int64_t rest = i;
+            for (int d = 0; d < D; d++)
+            {
+                kdTree::set_coord(points[i], d, (rest % side) * spacing);
+                rest /= side;
+            }
+        }
+        return points;
+    }
+    points.resize(numPoints);
+    if (distribution == "clustered")
+    {
+        // the blobs do not depend on the seed, so queries drawn with another seed land in the same blobs
+        std::mt19937 centerGen(7);
+        std::uniform_real_distribution<float> centerDis(0.1f * kExtent, 0.9f * kExtent);
+        std::vector<point_t> centers(32);
+        for (auto& c : centers)
+            for (int d = 0; d < D; d++)
+                kdTree::set_coord(c, d, centerDis(centerGen));
+        std::uniform_int_distribution<int> pick(0, int(centers.size()) - 1);
+        std::normal_distribution<float> blob(0.0f, 0.02f * kExtent);
+        for (auto& p : points)
+        {
+            const point_t& c = centers[pick(gen)];
+            for (int d = 0; d < D; d++)
+                kdTree::set_coord(p, d, kdTree::get_coord(c, d) + blob(gen));
+        }
+        return points;
+    }
+    const float lastScale = distribution == "anisotropic" ? 0.01f : 1.0f;
+    for (auto& p : points)
+        for (int d = 0; d < D; d++)
+            kdTree::set_coord(p, d, uniform(gen) * (d == D - 1 ? lastScale : 1.0f));
+    return points;
+}
+
+// mean distance between neighbouring points: (volume / N)^(1/D) of the points' bounds
+template<typename point_t>
+float MeanSpacing(const kdTree::box_t<point_t>& bounds, int64_t numPoints)
+{
+    enum { D = kdTree::num_dims_of<point_t>::value };
+    double volume = 1.0;
+    for (int d = 0; d < D; d++)
+        volume *= std::max(1e-6, double(kdTree::get_coord(bounds.upper, d) - kdTree::get_coord(bounds.lower, d)));
+    return float(std::pow(volume / double(std::max<int64_t>(numPoints, 1)), 1.0 / D));
+}
+
+template<typename Fn>
+double BestSeconds(int repeat, const Fn& fn)
+{
+    double best = 1e30;
+    for (int r = 0; r < std::max(1, repeat); r++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+template<int k, typename point_t>
+void BenchQueries(const std::vector<point_t>& tree, const std::vector<point_t>& queries, float radius,
+                  const kdTree::box_t<point_t>& bounds, const kdTree::BruteForcePoints<point_t>* bruteForcePoints,
+                  const kdTree::KnnCrossover& crossover, kdTree::ThreadPool& pool, const BenchOptions& options,
+                  BenchResult& result)
+{
+    using namespace kdTree;
+    using CandidateList = FixedCandidateList<k>;
+    const int64_t N = tree.size();
+    const int64_t Q = queries.size();
+    float sink = 0.0f;
+    const double singleSeconds = BestSeconds(options.repeat, [&]()
+    {
+        for (const auto& q : queries)
+        {
+            CandidateList list(radius);
+            sink += knn<CandidateList, point_t, default_data_traits<point_t>>(list, q, tree.data(), N);
+        }
+    });
+    std::vector<int> ids(Q * k);
+    std::vector<float> dist2(Q * k);
+    const double batchSeconds = BestSeconds(options.repeat, [&]()
+    {
+        knnBatch<CandidateList, point_t, default_data_traits<point_t>>(pool, queries.data(), Q, radius, tree.data(), N, ids.data(), dist2.data());
+    });
+    int64_t found = 0;
+    for (int id : ids)
+        found += id >= 0;
+    // same candidate list as the tree, so both report the same neighbours
+    const double bruteSeconds = !bruteForcePoints ? 0.0 : BestSeconds(options.repeat, [&]()
+    {
+        bruteForceKnnBatch<CandidateList>(pool, queries.data(), Q, radius, *bruteForcePoints, ids.data(), dist2.data());
+    });
+
+    result.k = k;
+    result.radius = radius;
+    result.numQueries = Q;
+    result.queriesPerSecond = Q / singleSeconds;
+    result.batchQueriesPerSecond = Q / batchSeconds;
+    result.bruteQueriesPerSecond = bruteForcePoints ? Q / bruteSeconds : 0.0;
+    result.autoPicksBrute = crossover.useBruteForce(N, k, radius, bounds);
+    result.numThreads = pool.numThreads();
+    result.meanFound = double(found) / double(std::max<int64_t>(Q, 1));
+    // keeps the single-thread loop from being optimized away
+    if (sink < 0.0f) std::cout << sink;
+}
+
+void PrintResult(const BenchResult& r)
+{
+    std::cout << "  " << r.dims << "D " << std::setw(11) << std::left << r.distribution << std::right
+              << " N=" << std::setw(9) << r.numPoints << std::fixed << std::setprecision(1)
+              << "  build " << std::setw(9) << r.buildMs << " ms"
+              << "  K=" << std::setw(2) << r.k << "  r=" << std::setw(9) << r.radiusLabel
+              << std::setprecision(0) << std::setw(10) << r.queriesPerSecond << " q/s  "
+              << std::setw(10) << r.batchQueriesPerSecond << " q/s (" << r.numThreads << " threads)";
+    if (r.bruteQueriesPerSecond > 0.0)
+        std::cout << "  brute " << std::setw(10) << r.bruteQueriesPerSecond << " q/s";
+    std::cout << "  auto " << (r.autoPicksBrute ? "brute" : "tree ")
+              << std::setprecision(2) << "  found " << r.meanFound
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+template<typename point_t>
+void BenchDistribution(const std::string& distribution, int64_t numPoints, const kdTree::KnnCrossover& crossover,
+                       kdTree::ThreadPool& pool, const BenchOptions& options, std::vector<BenchResult>& results)
+{
+    using namespace kdTree;
+    enum { D = num_dims_of<point_t>::value };
+    std::vector<point_t> points = MakePoints<point_t>(distribution, numPoints, 42);
+    // queries from the same distribution, so they sit where the data is
+    const std::vector<point_t> queries = MakePoints<point_t>(distribution == "lattice" ? "uniform" : distribution, options.numQueries, 4242);
+
+    std::vector<point_t> tree;
+    box_t<point_t> bounds;
+    BuildScratch<point_t> scratch;
+    const double buildSeconds = BestSeconds(options.repeat, [&]()
+    {
+        tree = points;
+        buildTree_partition<point_t, default_data_traits<point_t>>(tree.data(), tree.size(), &bounds, scratch, options.numThreads);
+    });
+    std::vector<point_t>().swap(points);
+    std::vector<point_t>().swap(scratch.buffer);
+    BruteForcePoints<point_t> bruteForcePoints;
+    const bool timeBruteForce = int64_t(tree.size()) <= options.bruteMaxN;
+    if (timeBruteForce)
+        makeBruteForcePoints<point_t>(bruteForcePoints, tree.data(), tree.size());
+    const BruteForcePoints<point_t>* brute = timeBruteForce ? &bruteForcePoints : nullptr;
+
+    // a few point spacings, and a radius covering everything
+    const float spacing = MeanSpacing(bounds, int64_t(tree.size()));
+    const struct { const char* label; float radius; } radii[] = {
+        { "1x", spacing },
+        { "4x", 4.0f * spacing },
+        { "unbounded", std::ceil(std::sqrt(float(D)) * kExtent) },
+    };
+    for (const auto& r : radii)
+    {
+        for (int k : { 1, 3, 5, 16 })
+        {
+            BenchResult result;
+            result.dims = D;
+            result.distribution = distribution;
+            result.numPoints = int64_t(tree.size());
+            result.buildMs = 1000.0 * buildSeconds;
+            result.radiusLabel = r.label;
+            switch (k)
+            {
+            case 1:  BenchQueries<1>(tree, queries, r.radius, bounds, brute, crossover, pool, options, result); break;
+            case 3:  BenchQueries<3>(tree, queries, r.radius, bounds, brute, crossover, pool, options, result); break;
+            case 5:  BenchQueries<5>(tree, queries, r.radius, bounds, brute, crossover, pool, options, result); break;
+            default: BenchQueries<16>(tree, queries, r.radius, bounds, brute, crossover, pool, options, result); break;
+            }
+            PrintResult(result);
+            results.push_back(result);
+        }
+    }
+}
+
+std::string JsonString(const std::string& s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+std::string CompilerName()
+{
+#if defined(__clang__)
+    return std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+    return std::string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+std::string UtcTimestamp()
+{
+    const std::time_t now = std::time(nullptr);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return buffer;
+}
+
+bool WriteJson(const std::string& path, const BenchOptions& options, const kdTree::KnnCrossover& crossover,
+               const std::vector<BenchResult>& results)
+{
+    std::ofstream out(path);
+    if (!out) return false;
+    out << std::setprecision(9);
+    out << "{\n  \"meta\": {\n"
+        << "    \"revision\": " << JsonString(options.revision) << ",\n"
+        << "    \"label\": " << JsonString(options.label) << ",\n"
+        << "    \"timestamp\": " << JsonString(UtcTimestamp()) << ",\n"
+        << "    \"compiler\": " << JsonString(CompilerName()) << ",\n"
+#ifdef __AVX2__
+        << "    \"avx2\": true,\n"
+#else
+        << "    \"avx2\": false,\n"
+#endif
+        << "    \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+        << "    \"repeat\": " << options.repeat << ",\n"
+        << "    \"brute_max_n\": " << options.bruteMaxN << ",\n"
+        << "    \"crossover\": {";
+    // largest N brute force is picked for, per K and radius class (sparse, medium, unbounded)
+    for (int i = 0; i < kdTree::KnnCrossover::numK; i++)
+    {
+        out << (i ? ", " : "") << "\"" << kdTree::supportedK[i] << "\": [";
+        for (int c = 0; c < kdTree::KnnCrossover::numRadiusClasses; c++)
+            out << (c ? ", " : "") << crossover.maxBruteForceN[i][c];
+        out << "]";
+    }
+    out << "}\n  },\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        out << "    {\"dims\": " << r.dims << ", \"distribution\": " << JsonString(r.distribution)
+            << ", \"n\": " << r.numPoints << ", \"build_ms\": " << r.buildMs << ", \"k\": " << r.k
+            << ", \"radius_label\": " << JsonString(r.radiusLabel) << ", \"radius\": " << r.radius
+            << ", \"queries\": " << r.numQueries << ", \"queries_per_s\": " << r.queriesPerSecond
+            << ", \"batch_queries_per_s\": " << r.batchQueriesPerSecond << ", \"brute_queries_per_s\": " << r.bruteQueriesPerSecond
+            << ", \"auto\": " << JsonString(r.autoPicksBrute ? "brute" : "tree") << ", \"threads\": " << r.numThreads
+            << ", \"mean_found\": " << r.meanFound << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return bool(out);
+}
+
+std::string CsvField(const std::string& s)
+{
+    if (s.find_first_of(",\"\n") == std::string::npos) return s;
+    std::string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    return out + "\"";
+}
+
+bool WriteCsv(const std::string& path, const BenchOptions& options, const std::vector<BenchResult>& results)
+{
+    std::ofstream out(path);
+    if (!out) return false;
+    out << std::setprecision(9);
+    out << "revision,label,dims,distribution,n,build_ms,k,radius_label,radius,queries,queries_per_s,batch_queries_per_s,brute_queries_per_s,auto,threads,mean_found\n";
+    for (const BenchResult& r : results)
+    {
+        out << CsvField(options.revision) << "," << CsvField(options.label) << "," << r.dims << "," << r.distribution << "," << r.numPoints << ","
+            << r.buildMs << "," << r.k << "," << r.radiusLabel << "," << r.radius << "," << r.numQueries << ","
+            << r.queriesPerSecond << "," << r.batchQueriesPerSecond << "," << r.bruteQueriesPerSecond << ","
+            << (r.autoPicksBrute ? "brute" : "tree") << "," << r.numThreads << "," << r.meanFound << "\n";
+    }
+    return bool(out);
+}
+
+template<typename T>
+std::vector<T> SplitList(const std::string& s)
+{
+    std::vector<T> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        std::stringstream is(item);
+        T value;
+        if (is >> value) out.push_back(value);
+    }
+    return out;
+}
+
+bool ParseOptions(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "kdtree_bench: " << arg << " needs a value" << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--min-n") options.minN = std::stoll(value);
+        else if (arg == "--max-n") options.maxN = std::stoll(value);
+        else if (arg == "--queries") options.numQueries = std::stoll(value);
+        else if (arg == "--threads") options.numThreads = std::stoi(value);
+        else if (arg == "--repeat") options.repeat = std::stoi(value);
+        else if (arg == "--dims") options.dims = SplitList<int>(value);
+        else if (arg == "--dist") options.distributions = SplitList<std::string>(value);
+        else if (arg == "--brute-max-n") options.bruteMaxN = std::stoll(value);
+        else if (arg == "--json") options.jsonPath = value;
+        else if (arg == "--csv") options.csvPath = value;
+        else if (arg == "--label") options.label = value;
+        else if (arg == "--revision") options.revision = value;
+        else
+        {
+            std::cerr << "kdtree_bench: unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    for (int d : options.dims)
+    {
+        if (d != 2 && d != 3)
+        {
+            std::cerr << "kdtree_bench: --dims takes 2 and/or 3" << std::endl;
+            return false;
+        }
+    }
+    for (const std::string& dist : options.distributions)
+    {
+        if (dist != "uniform" && dist != "clustered" && dist != "lattice" && dist != "anisotropic")
+        {
+            std::cerr << "kdtree_bench: unknown distribution " << dist << std::endl;
+            return false;
+        }
+    }
+    return options.minN >= 1 && options.minN <= options.maxN && options.numQueries >= 1;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    try
+    {
+        if (!ParseOptions(argc, argv, options)) return 1;
+    }
+    catch (const std::exception&)
+    {
+        std::cerr << "kdtree_bench: bad option value" << std::endl;
+        return 1;
+    }
+
+    kdTree::ThreadPool pool(options.numThreads);
+    std::cout << "kd-tree benchmark, revision " << options.revision << ", " << CompilerName()
+              << ", " << options.numQueries << " queries per run, best of " << options.repeat << std::endl;
+    // calibrated on uniform 3D points with one thread; the 2D runs use the same table
+    const kdTree::KnnCrossover crossover = kdTree::calibrateKnnCrossover();
+    std::cout << "brute force crossover, largest N per radius class (sparse/medium/unbounded):" << std::endl;
+    for (int i = 0; i < kdTree::KnnCrossover::numK; i++)
+    {
+        std::cout << "  K=" << std::setw(2) << kdTree::supportedK[i] << ":";
+        for (int c = 0; c < kdTree::KnnCrossover::numRadiusClasses; c++)
+            std::cout << std::setw(7) << crossover.maxBruteForceN[i][c];
+        std::cout << std::endl;
+    }
+    std::vector<BenchResult> results;
+    for (int dims : options.dims)
+    {
+        for (const std::string& distribution : options.distributions)
+        {
+            for (int64_t N = options.minN; N <= options.maxN; N *= 10)
+            {
+                if (dims == 2) BenchDistribution<kdTree::float2>(distribution, N, crossover, pool, options, results);
+                else           BenchDistribution<kdTree::float3>(distribution, N, crossover, pool, options, results);
+            }
+        }
+    }
+
+    if (!options.jsonPath.empty() && !WriteJson(options.jsonPath, options, crossover, results))
+    {
+        std::cerr << "kdtree_bench: cannot write " << options.jsonPath << std::endl;
+        return 1;
+    }
+    if (!options.csvPath.empty() && !WriteCsv(options.csvPath, options, results))
+    {
+        std::cerr << "kdtree_bench: cannot write " << options.csvPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+# Writes OUTPUT with the current git revision as KDTREE_BENCH_REVISION.
+# Run at build time (cmake -P) so the tag follows commits and checkouts made
+# after configure; the header is only rewritten when the revision changes.
+set(revision "unknown")
+if (GIT_EXECUTABLE)
+	execute_process(COMMAND ${GIT_EXECUTABLE} rev-parse --short HEAD
+	                WORKING_DIRECTORY ${SOURCE_DIR}
+	                OUTPUT_VARIABLE revision_out
+	                OUTPUT_STRIP_TRAILING_WHITESPACE ERROR_QUIET
+	                RESULT_VARIABLE revision_result)
+	if (revision_result EQUAL 0)
+		set(revision ${revision_out})
+	endif()
+endif()
+set(content "#define KDTREE_BENCH_REVISION \"${revision}\"\n")
+if (EXISTS ${OUTPUT})
+	file(READ ${OUTPUT} old_content)
+endif()
+if (NOT "${content}" STREQUAL "${old_content}")
+	file(WRITE ${OUTPUT} "${content}")
+endif()
@@ -0,0 +1,415 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "helper.hpp"
+#include "common.hpp"
+#include "box.hpp"
+#include "builder.hpp"
+#include "knn.hpp"
+#include "parallel.hpp"
+
+namespace kdTree
+{
+    /*! the points of a brute-force scan, structure-of-arrays and padded
+        with points at infinity to a multiple of simdWidth, so the scan is
+        straight vector loads. Point i is the i'th of the array it was made
+        from (see makeBruteForcePoints()), which is also the ID the scans
+        report - made from the nodes of a tree, brute force and tree
+        queries report the same IDs */
+    template<typename point_t>
+    struct BruteForcePoints
+    {
+        enum { num_dims = num_dims_of<point_t>::value };
+        enum { simdWidth = 8 };
+
+        int64_t numSlots() const { return int64_t(coord[0].size()); }
+
+        std::vector<float> coord[num_dims];
+        int64_t            numPoints = 0;
+    };
+
+    template<typename point_t, typename data_t=point_t, typename data_traits=default_data_traits<data_t>>
+    inline void makeBruteForcePoints(BruteForcePoints<point_t> &out, const data_t *points, int64_t numPoints)
+    {
+        enum { num_dims = num_dims_of<point_t>::value };
+        const int64_t numSlots = divRoundUp(numPoints,int64_t(BruteForcePoints<point_t>::simdWidth)) * BruteForcePoints<point_t>::simdWidth;
+        for (int d=0;d<num_dims;d++)
+        {
+            out.coord[d].assign(numSlots,INFINITY);
+            for (int64_t i=0;i<numPoints;i++)
+                out.coord[d][i] = get_coord(data_traits::get_point(points[i]),d);
+        }
+        out.numPoints = numPoints;
+    }
+
+    /*! feeds every point of slots [begin,end) that is closer than the
+        current cull distance into result, like scanBucket() does for a
+        bucket tree's leaf; begin and end are multiples of simdWidth */
+    template<typename CandidateList, typename point_t>
+    inline void bruteForceScan(CandidateList &result, float &cullDist, const BruteForcePoints<point_t> &points,
+                               const point_t &q, int64_t begin, int64_t end)
+    {
+        enum { num_dims = num_dims_of<point_t>::value };
+        const float *coord[num_dims];
+        for (int d=0;d<num_dims;d++) coord[d] = points.coord[d].data();
+#if defined(__AVX2__)
+        __m256 qc[num_dims];
+        for (int d=0;d<num_dims;d++) qc[d] = _mm256_set1_ps(get_coord(q,d));
+        for (int64_t i=begin;i<end;i+=8)
+        {
+            __m256 d2 = _mm256_setzero_ps();
+            for (int d=0;d<num_dims;d++)
+            {
+                const __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(coord[d]+i),qc[d]);
+                d2 = _mm256_add_ps(d2,_mm256_mul_ps(diff,diff));
+            }
+            int mask = _mm256_movemask_ps(_mm256_cmp_ps(d2,_mm256_set1_ps(cullDist),_CMP_LT_OQ));
+            if (!mask) continue;
+            alignas(32) float lane[8];
+            _mm256_store_ps(lane,d2);
+            while (mask)
+            {
+                const int l = countTrailingZeros(mask);
+                mask &= mask-1;
+                if (lane[l] < cullDist)
+                    cullDist = result.processCandidate(i+l,lane[l]);
+            }
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        __m128 qc[num_dims];
+        for (int d=0;d<num_dims;d++) qc[d] = _mm_set1_ps(get_coord(q,d));
+        for (int64_t i=begin;i<end;i+=4)
+        {
+            __m128 d2 = _mm_setzero_ps();
+            for (int d=0;d<num_dims;d++)
+            {
+                const __m128 diff = _mm_sub_ps(_mm_loadu_ps(coord[d]+i),qc[d]);
+                d2 = _mm_add_ps(d2,_mm_mul_ps(diff,diff));
+            }
+            int mask = _mm_movemask_ps(_mm_cmplt_ps(d2,_mm_set1_ps(cullDist)));
+            if (!mask) continue;
+            alignas(16) float lane[4];
+            _mm_store_ps(lane,d2);
+            while (mask)
+            {
+                const int l = countTrailingZeros(mask);
+                mask &= mask-1;
+                if (lane[l] < cullDist)
+                    cullDist = result.processCandidate(i+l,lane[l]);
+            }
+        }
+#else
+        for (int64_t i=begin;i<end;i++)
+        {
+            float d2 = 0.f;
+            for (int d=0;d<num_dims;d++)
+            {
+                const float diff = coord[d][i] - get_coord(q,d);
+                d2 += diff*diff;
+            }
+            if (d2 < cullDist)
+                cullDist = result.processCandidate(i,d2);
+        }
+#endif
+    }
+
+    /*! k-nearest neighbours of numQueries queries by scanning all points,
+        with the same candidate-list semantics and output format as
+        knnBatch() (IDs are point indices, see BruteForcePoints).
+
+        With enough queries to keep the pool busy, each task takes
+        queriesPerTask of them and walks the points in blocks of
+        pointsPerBlock, scanning every block for all of its queries while
+        it is in cache. With fewer queries than that, the points are split
+        over the pool instead: every task keeps its own candidate lists
+        for its share of the points, and the partial lists are merged
+        through processCandidate(). The packed lists order equal distances
+        by ID, so either way the result is exactly what a single scan
+        gives */
+    template<typename CandidateList, typename point_t, typename id_t>
+    inline void bruteForceKnnBatch(ThreadPool &pool,
+                                   const point_t *queries,
+                                   int64_t numQueries,
+                                   float cutOffRadius,
+                                   const BruteForcePoints<point_t> &points,
+                                   id_t *outIDs,
+                                   float *outDist2,
+                                   int64_t queriesPerTask = 64,
+                                   int64_t pointsPerBlock = 4096)
+    {
+        enum { k = CandidateList::num_k };
+        enum { simdWidth = BruteForcePoints<point_t>::simdWidth };
+        if (numQueries <= 0) return;
+        const int64_t numSlots = points.numSlots();
+        pointsPerBlock = std::max<int64_t>(simdWidth,pointsPerBlock / simdWidth * simdWidth);
+        auto writeResult = [&](int64_t q, CandidateList &result)
+        {
+            result.sort();
+            for (int i=0;i<k;i++)
+            {
+                outIDs[q*k+i]   = result.get_pointID(i);
+                outDist2[q*k+i] = result.get_dist2(i);
+            }
+        };
+
+        const int64_t numQueryTasks = (numQueries + queriesPerTask - 1) / queriesPerTask;
+        if (numQueryTasks >= pool.numThreads())
+        {
+            pool.run(numQueryTasks,[&](int64_t task)
+            {
+                const int64_t begin = task * queriesPerTask;
+                const int64_t end   = std::min(numQueries, begin + queriesPerTask);
+                std::vector<CandidateList> lists(end-begin,CandidateList(cutOffRadius));
+                std::vector<float> cull(end-begin,lists[0].initialCullDist2());
+                for (int64_t block=0;block<numSlots;block+=pointsPerBlock)
+                {
+                    const int64_t blockEnd = std::min(numSlots,block+pointsPerBlock);
+                    for (int64_t q=begin;q<end;q++)
+                        bruteForceScan(lists[q-begin],cull[q-begin],points,queries[q],block,blockEnd);
+                }
+                for (int64_t q=begin;q<end;q++)
+                    writeResult(q,lists[q-begin]);
+            });
+            return;
+        }
+
+        // few queries: split the points, a few ranges per thread
+        const int64_t numRanges = std::max<int64_t>(1,std::min<int64_t>(4*pool.numThreads(),numSlots / pointsPerBlock));
+        const int64_t rangeSize = divRoundUp(divRoundUp(numSlots,numRanges),int64_t(simdWidth)) * simdWidth;
+        std::vector<CandidateList> partial(numRanges*numQueries,CandidateList(cutOffRadius));
+        pool.run(numRanges,[&](int64_t range)
+        {
+            const int64_t begin = std::min(numSlots,range*rangeSize);
+            const int64_t end   = std::min(numSlots,begin+rangeSize);
+            for (int64_t q=0;q<numQueries;q++)
+            {
+                CandidateList &list = partial[range*numQueries+q];
+                float cull = list.initialCullDist2();
+                bruteForceScan(list,cull,points,queries[q],begin,end);
+                list.sort();
+            }
+        });
+        for (int64_t q=0;q<numQueries;q++)
+        {
+            CandidateList result(cutOffRadius);
+            for (int64_t range=0;range<numRanges;range++)
+            {
+                const CandidateList &list = partial[range*numQueries+q];
+                for (int i=0;i<k && list.get_pointID(i) >= 0;i++)
+                    result.processCandidate(list.get_pointID(i),list.get_dist2(i));
+            }
+            writeResult(q,result);
+        }
+    }
+
+    /*! when brute force beats the kd-tree, as measured on this machine by
+        calibrateKnnCrossover(): for every k of supportedK and every
+        radius class, the largest point count up to which a brute-force
+        scan was faster per query than knn() on the tree (0 = never).
+
+        The radius class says whether the search radius or k bounds the
+        search: expected points within the radius (the query's ball over
+        the bounds' volume, times N) below k/2 is class 0, up to 8k class
+        1, beyond that (including an unbounded radius) class 2. Brute force
+        does not care about the radius, the tree gets cheaper the smaller
+        it is. */
+    struct KnnCrossover
+    {
+        enum { numK = sizeof(supportedK)/sizeof(supportedK[0]) };
+        enum { numRadiusClasses = 3 };
+        static constexpr double pi = 3.14159265358979323846;
+
+        /*! index into supportedK of the smallest supported k >= k */
+        static int kIndex(int k)
+        {
+            for (int i=0;i<numK;i++)
+                if (supportedK[i] >= k) return i;
+            return numK-1;
+        }
+
+        template<typename point_t>
+        static int radiusClass(int64_t N, int k, float radius, const box_t<point_t> &bounds)
+        {
+            enum { num_dims = num_dims_of<point_t>::value };
+            // volume of the unit ball: 2, pi, 4/3 pi, ... for D = 1, 2, 3, ...
+            const double unitBall = std::pow(pi,0.5*num_dims) / std::tgamma(0.5*num_dims + 1.0);
+            double volume = 1.0;
+            for (int d=0;d<num_dims;d++)
+                volume *= std::max(double(get_coord(bounds.upper,d) - get_coord(bounds.lower,d)),1e-30);
+            const double inRange = double(N) * std::min(1.0,unitBall * std::pow(double(radius),double(num_dims)) / volume);
+            if (inRange < 0.5*k) return 0;
+            if (inRange < 8.0*k) return 1;
+            return 2;
+        }
+
+        template<typename point_t>
+        bool useBruteForce(int64_t N, int k, float radius, const box_t<point_t> &bounds) const
+        { return N <= maxBruteForceN[kIndex(k)][radiusClass(N,k,radius,bounds)]; }
+
+        /*! largest N for which any k and radius would use brute force */
+        int64_t maxN() const
+        {
+            int64_t n = 0;
+            for (int i=0;i<numK;i++)
+                for (int c=0;c<numRadiusClasses;c++)
+                    n = std::max(n,maxBruteForceN[i][c]);
+            return n;
+        }
+
+        /*! one line per k: "k n0 n1 n2", after a version line */
+        bool save(const std::string &path) const
+        {
+            std::ofstream out(path);
+            out << "kdtree-knn-crossover 1\n";
+            for (int i=0;i<numK;i++)
+            {
+                out << supportedK[i];
+                for (int c=0;c<numRadiusClasses;c++) out << " " << maxBruteForceN[i][c];
+                out << "\n";
+            }
+            return bool(out);
+        }
+
+        /*! false (and *this unchanged) if the file is missing or not a
+            crossover table for the current supportedK */
+        bool load(const std::string &path)
+        {
+            std::ifstream in(path);
+            std::string magic;
+            int version = 0;
+            if (!(in >> magic >> version) || magic != "kdtree-knn-crossover" || version != 1) return false;
+            KnnCrossover loaded;
+            for (int i=0;i<numK;i++)
+            {
+                int k = 0;
+                if (!(in >> k) || k != supportedK[i]) return false;
+                for (int c=0;c<numRadiusClasses;c++)
+                    if (!(in >> loaded.maxBruteForceN[i][c])) return false;
+            }
+            *this = loaded;
+            return true;
+        }
+
+        int64_t maxBruteForceN[numK][numRadiusClasses] = {};
+    };
+
+    /*! knnBatch() on the tree, or bruteForceKnnBatch() on bruteForcePoints
+        when crossover says that is faster for this N, k and radius (and
+        bruteForcePoints is given). bruteForcePoints has to be made from
+        d_nodes, so that both report the same IDs. Returns whether brute
+        force was used. */
+    template<typename CandidateList, typename data_t, typename data_traits=default_data_traits<data_t>, typename id_t>
+    inline bool knnBatchAuto(ThreadPool &pool,
+                             const KnnCrossover &crossover,
+                             const typename data_traits::point_t *queries,
+                             int64_t numQueries,
+                             float cutOffRadius,
+                             const box_t<typename data_traits::point_t> &worldBounds,
+                             const data_t *d_nodes,
+                             int64_t N,
+                             const BruteForcePoints<typename data_traits::point_t> *bruteForcePoints,
+                             id_t *outIDs,
+                             float *outDist2)
+    {
+        if (bruteForcePoints && bruteForcePoints->numPoints == N
+            && crossover.useBruteForce(N,CandidateList::num_k,cutOffRadius,worldBounds))
+        {
+            bruteForceKnnBatch<CandidateList>(pool,queries,numQueries,cutOffRadius,*bruteForcePoints,outIDs,outDist2);
+            return true;
+        }
+        knnBatch<CandidateList,data_t,data_traits>(pool,queries,numQueries,cutOffRadius,d_nodes,N,outIDs,outDist2);
+        return false;
+    }
+
+    namespace crossover
+    {
+        /*! fills column kIndex of 'table': for each radius class, N is
+            doubled from 16 until the tree has won twice in a row */
+        template<int k>
+        inline void calibrateK(KnnCrossover &table, int numQueries, int64_t maxN, unsigned seed)
+        {
+            using CandidateList = KnnCandidateList<k>;
+            std::mt19937 gen(seed);
+            std::uniform_real_distribution<float> dis(0.f,1.f);
+            std::vector<float3> queries(numQueries);
+            for (auto &q : queries) q = make_float3(dis(gen),dis(gen),dis(gen));
+            std::vector<int> ids(size_t(numQueries)*k);
+            std::vector<float> dist2(size_t(numQueries)*k);
+            ThreadPool serial(1);
+            box_t<float3> unitCube;
+            unitCube.lower = make_float3(0.f,0.f,0.f);
+            unitCube.upper = make_float3(1.f,1.f,1.f);
+            const int idx = KnnCrossover::kIndex(k);
+
+            auto bestOf3 = [](const auto &fn)
+            {
+                double best = 1e30;
+                for (int r=0;r<3;r++)
+                {
+                    const auto start = std::chrono::steady_clock::now();
+                    fn();
+                    best = std::min(best,std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count());
+                }
+                return best;
+            };
+
+            for (int c=0;c<KnnCrossover::numRadiusClasses;c++)
+            {
+                int treeWins = 0;
+                for (int64_t N=16;N<=maxN && treeWins<2;N*=2)
+                {
+                    std::vector<float3> tree(N);
+                    for (auto &p : tree) p = make_float3(dis(gen),dis(gen),dis(gen));
+                    BuildScratch<float3> scratch;
+                    buildTree_partition<float3,default_data_traits<float3>>(tree.data(),N,nullptr,scratch);
+                    BruteForcePoints<float3> points;
+                    makeBruteForcePoints<float3>(points,tree.data(),N);
+
+                    // a radius in the middle of the class: k/4 or 2k points expected in range, or all
+                    const double inRange = c == 0 ? 0.25*k : 2.0*k;
+                    const float radius
+                        = c == 2
+                        ? 2.f
+                        : float(std::cbrt(3.0 * std::min(1.0,inRange/double(N)) / (4.0*KnnCrossover::pi)));
+                    if (KnnCrossover::radiusClass(N,k,radius,unitCube) != c) continue;
+
+                    const double treeSeconds = bestOf3([&]()
+                    { knnBatch<CandidateList,float3,default_data_traits<float3>>(serial,queries.data(),numQueries,radius,tree.data(),N,ids.data(),dist2.data()); });
+                    const double bruteSeconds = bestOf3([&]()
+                    { bruteForceKnnBatch<CandidateList>(serial,queries.data(),numQueries,radius,points,ids.data(),dist2.data()); });
+                    if (bruteSeconds <= treeSeconds)
+                    {
+                        table.maxBruteForceN[idx][c] = N;
+                        treeWins = 0;
+                    }
+                    else
+                        treeWins++;
+                }
+            }
+        }
+    }
+
+    /*! measures the brute-force/tree crossover of this machine (single
+        threaded, uniform random 3D points and queries in a unit cube,
+        N = 16, 32, ... up to maxN) for every supported k and radius
+        class. Takes a second or so; meant to be run once and kept with
+        KnnCrossover::save() */
+    inline KnnCrossover calibrateKnnCrossover(int numQueries = 256, int64_t maxN = 1<<16)
+    {
+        KnnCrossover table;
+        unsigned seed = 1;
+        for (int k : supportedK)
+            dispatchK(k,[&](auto K) { crossover::calibrateK<decltype(K)::value>(table,numQueries,maxN,seed++); });
+        return table;
+    }
+}
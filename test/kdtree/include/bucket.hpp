@@ -0,0 +1,222 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "helper.hpp"
+#include "common.hpp"
+#include "box.hpp"
+
+namespace kdTree
+{
+    /*! a 3D k-d tree whose leaves are buckets of up to leafSize points.
+        Inner nodes only hold split planes and are stored as an implicit,
+        complete binary tree (children of node i at 2i+1/2i+2); leaves store
+        their points structure-of-arrays, padded to a multiple of
+        simdWidth with points at infinity, so a leaf is scanned with
+        straight vector loads instead of one dependent node fetch per
+        point. */
+    struct BucketTree3D
+    {
+        enum { simdWidth = 8 };
+
+        struct InnerNode
+        {
+            float split;
+            int   dim;
+        };
+
+        int numLeaves() const { return int(leafBegin.size()) - 1; }
+        int numInner()  const { return int(inner.size()); }
+
+        std::vector<InnerNode> inner;
+        /*! leaf j's points are [leafBegin[j],leafBegin[j+1]) in x/y/z/ids */
+        std::vector<int>       leafBegin;
+        std::vector<float>     x, y, z;
+        /*! index of each point in the array the tree was built from; -1
+            for padding */
+        std::vector<int>       ids;
+    };
+
+    template<typename data_t, typename data_traits>
+    inline void buildBucketTreeRec(BucketTree3D &tree, const data_t *points, int *perm,
+                                   int node, int begin, int end)
+    {
+        const int numInner = tree.numInner();
+        if (node >= numInner)
+        {
+            const int leaf = node - numInner;
+            int out = tree.leafBegin[leaf];
+            for (int i=begin;i<end;i++,out++)
+            {
+                const auto &p = data_traits::get_point(points[perm[i]]);
+                tree.x[out] = p.x;
+                tree.y[out] = p.y;
+                tree.z[out] = p.z;
+                tree.ids[out] = perm[i];
+            }
+            return;
+        }
+
+        box_t<float3> bounds;
+        bounds.setEmpty();
+        for (int i=begin;i<end;i++)
+            bounds.grow(data_traits::get_point(points[perm[i]]));
+        const int dim = end > begin ? bounds.widestDimension() : 0;
+
+        const int mid = begin + (end-begin)/2;
+        std::nth_element(perm+begin,perm+mid,perm+end,[&](int a, int b)
+        { return data_traits::get_coord(points[a],dim) < data_traits::get_coord(points[b],dim); });
+        tree.inner[node].dim   = dim;
+        tree.inner[node].split = mid < end ? data_traits::get_coord(points[perm[mid]],dim) : 0.f;
+
+        buildBucketTreeRec<data_t,data_traits>(tree,points,perm,BinaryTree::leftChildOf(node),begin,mid);
+        buildBucketTreeRec<data_t,data_traits>(tree,points,perm,BinaryTree::rightChildOf(node),mid,end);
+    }
+
+    /*! builds a bucket tree over numPoints 3D points. The number of leaves
+        is the smallest power of two that keeps every bucket at or below
+        leafSize points; splits are at the median of the widest dimension,
+        so buckets differ in size by at most one point. */
+    template<typename data_t, typename data_traits=default_data_traits<data_t>>
+    void buildBucketTree(BucketTree3D &tree, const data_t *points, int numPoints, int leafSize = 16)
+    {
+        leafSize = std::max(1,leafSize);
+        int numLeaves = 1;
+        while (numLeaves * leafSize < numPoints) numLeaves *= 2;
+
+        tree.inner.resize(numLeaves-1);
+        tree.leafBegin.resize(numLeaves+1);
+
+        // bucket sizes follow from the median splits: a range of n points
+        // splits into n/2 and n-n/2
+        std::vector<int> bucketSizes(1,numPoints);
+        while (int(bucketSizes.size()) < numLeaves)
+        {
+            std::vector<int> next;
+            next.reserve(bucketSizes.size()*2);
+            for (int n : bucketSizes) { next.push_back(n/2); next.push_back(n-n/2); }
+            bucketSizes.swap(next);
+        }
+        tree.leafBegin[0] = 0;
+        for (int j=0;j<numLeaves;j++)
+            tree.leafBegin[j+1] = tree.leafBegin[j] + int(divRoundUp(bucketSizes[j],int(BucketTree3D::simdWidth))) * BucketTree3D::simdWidth;
+
+        const int numSlots = tree.leafBegin[numLeaves];
+        tree.x.assign(numSlots,INFINITY);
+        tree.y.assign(numSlots,INFINITY);
+        tree.z.assign(numSlots,INFINITY);
+        tree.ids.assign(numSlots,-1);
+
+        std::vector<int> perm(numPoints);
+        std::iota(perm.begin(),perm.end(),0);
+        buildBucketTreeRec<data_t,data_traits>(tree,points,perm.data(),0,0,numPoints);
+    }
+
+    /*! feeds every point of [begin,end) that is closer than the current cull
+        distance into result; begin and end are multiples of simdWidth */
+    template<typename CandidateList>
+    inline void scanBucket(CandidateList &result, float &cullDist, const BucketTree3D &tree,
+                           int begin, int end, const float3 &q)
+    {
+        const float *xs = tree.x.data();
+        const float *ys = tree.y.data();
+        const float *zs = tree.z.data();
+#if defined(__AVX2__)
+        const __m256 qx = _mm256_set1_ps(q.x);
+        const __m256 qy = _mm256_set1_ps(q.y);
+        const __m256 qz = _mm256_set1_ps(q.z);
+        for (int i=begin;i<end;i+=8)
+        {
+            const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs+i),qx);
+            const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys+i),qy);
+            const __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(zs+i),qz);
+            const __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx,dx),_mm256_mul_ps(dy,dy)),_mm256_mul_ps(dz,dz));
+            int mask = _mm256_movemask_ps(_mm256_cmp_ps(d2,_mm256_set1_ps(cullDist),_CMP_LT_OQ));
+            if (!mask) continue;
+            alignas(32) float lane[8];
+            _mm256_store_ps(lane,d2);
+            while (mask)
+            {
+                const int l = countTrailingZeros(mask);
+                mask &= mask-1;
+                if (lane[l] < cullDist)
+                    cullDist = result.processCandidate(tree.ids[i+l],lane[l]);
+            }
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        const __m128 qx = _mm_set1_ps(q.x);
+        const __m128 qy = _mm_set1_ps(q.y);
+        const __m128 qz = _mm_set1_ps(q.z);
+        for (int i=begin;i<end;i+=4)
+        {
+            const __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs+i),qx);
+            const __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys+i),qy);
+            const __m128 dz = _mm_sub_ps(_mm_loadu_ps(zs+i),qz);
+            const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,dx),_mm_mul_ps(dy,dy)),_mm_mul_ps(dz,dz));
+            int mask = _mm_movemask_ps(_mm_cmplt_ps(d2,_mm_set1_ps(cullDist)));
+            if (!mask) continue;
+            alignas(16) float lane[4];
+            _mm_store_ps(lane,d2);
+            while (mask)
+            {
+                const int l = countTrailingZeros(mask);
+                mask &= mask-1;
+                if (lane[l] < cullDist)
+                    cullDist = result.processCandidate(tree.ids[i+l],lane[l]);
+            }
+        }
+#else
+        for (int i=begin;i<end;i++)
+        {
+            const float dx = xs[i]-q.x, dy = ys[i]-q.y, dz = zs[i]-q.z;
+            const float d2 = dx*dx + dy*dy + dz*dz;
+            if (d2 < cullDist)
+                cullDist = result.processCandidate(tree.ids[i],d2);
+        }
+#endif
+    }
+
+    /*! k-nearest query on a bucket tree: descends to the close child
+        first, keeps far children on a small stack together with their
+        split-plane distance, and skips them on the way back if that
+        distance is no longer within the cull radius. eps loosens that
+        test exactly like in the implicit-tree knn(). */
+    template<typename CandidateList>
+    inline float knn(CandidateList &result, const float3 &queryPoint, const BucketTree3D &tree, float eps=0.0f)
+    {
+        const float epsErr = 1.f + eps;
+        struct StackEntry { int node; float dist2; };
+        StackEntry stack[64];
+        int stackTop = 0;
+
+        const int numInner = tree.numInner();
+        float cullDist = result.initialCullDist2();
+        int node = 0;
+        while (true)
+        {
+            while (node < numInner)
+            {
+                const BucketTree3D::InnerNode &n = tree.inner[node];
+                const float d = get_coord(queryPoint,n.dim) - n.split;
+                const int side = d > 0.f;
+                if (d*d*epsErr < cullDist)
+                    stack[stackTop++] = { 2*node + 2 - side, d*d*epsErr };
+                node = 2*node + 1 + side;
+            }
+            const int leaf = node - numInner;
+            scanBucket(result,cullDist,tree,tree.leafBegin[leaf],tree.leafBegin[leaf+1],queryPoint);
+
+            do
+            {
+                if (stackTop == 0) return result.returnValue();
+                --stackTop;
+            } while (stack[stackTop].dist2 >= cullDist);
+            node = stack[stackTop].node;
+        }
+    }
+}
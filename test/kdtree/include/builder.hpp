@@ -7,19 +7,36 @@
 #include "helper.hpp"
 #include "common.hpp"
 #include "box.hpp"
+#include "parallel.hpp"
 
 namespace kdTree 
 {
     template<typename data_t, typename data_traits>
-    inline void host_computeBounds(box_t<typename data_traits::point_t> *d_bounds, const data_t *d_points, int numPoints)
+    inline void host_computeBounds(box_t<typename data_traits::point_t> *d_bounds, const data_t *d_points, int64_t numPoints, int numThreads = 1)
     {
+        using box = box_t<typename data_traits::point_t>;
+        const int numRanges = int(std::max<int64_t>(1, std::min<int64_t>(resolveNumThreads(numThreads), numPoints)));
+        std::vector<box> partial(numRanges);
+        for (auto &b : partial) b.setEmpty();
+        const int64_t rangeSize = divRoundUp(numPoints, int64_t(numRanges));
+        parallel_for_range<int>(0,numRanges,numRanges,[&](int rb, int re)
+        {
+            for (int r=rb;r<re;r++)
+                for (int64_t i=r*rangeSize;i<std::min(numPoints,(r+1)*rangeSize);i++)
+                    partial[r].grow(data_traits::get_point(d_points[i]));
+        });
         d_bounds->setEmpty();
-        for (int i=0;i<numPoints;i++)
-            d_bounds->grow(data_traits::get_point(d_points[i]));
+        for (const auto &b : partial)
+        {
+            // trailing ranges can be empty if numPoints doesn't divide evenly
+            if (get_coord(b.lower,0) > get_coord(b.upper,0)) continue;
+            d_bounds->grow(b.lower);
+            d_bounds->grow(b.upper);
+        }
     }
 
     template<typename data_t,typename data_traits>
-    inline box_t<typename data_traits::point_t> findBounds(int subtree, const box_t<typename data_traits::point_t> *d_bounds, data_t *d_nodes)
+    inline box_t<typename data_traits::point_t> findBounds(int64_t subtree, const box_t<typename data_traits::point_t> *d_bounds, data_t *d_nodes)
     {
         using point_t  = typename data_traits::point_t;
         using point_traits = kdTree::point_traits<point_t>;
@@ -27,10 +44,10 @@ namespace kdTree
         enum { num_dims = point_traits::num_dims };
         
         box_t<typename data_traits::point_t> bounds = *d_bounds;
-        int curr = subtree;
+        int64_t curr = subtree;
         while (curr > 0) 
         {
-            const int     parent = (curr+1)/2-1;
+            const int64_t parent = (curr+1)/2-1;
             const data_t &parent_node = d_nodes[parent];
             const int     parent_dim
             = if_has_dims<data_t,data_traits,data_traits::has_explicit_dim>
@@ -65,9 +82,9 @@ namespace kdTree
     };
 
     template<typename data_t,typename data_traits>
-    void host_chooseInitialDim(box_t<typename data_traits::point_t> *d_bounds, data_t *d_nodes, int numPoints)
+    void host_chooseInitialDim(box_t<typename data_traits::point_t> *d_bounds, data_t *d_nodes, int64_t numPoints)
     {
-        for (int tid=0;tid<numPoints;tid++) 
+        for (int64_t tid=0;tid<numPoints;tid++) 
         {
             int dim = d_bounds->widestDimension();//arg_max(d_bounds->size());
             if_has_dims<data_t,data_traits,data_traits::has_explicit_dim>
@@ -75,12 +92,12 @@ namespace kdTree
         }
     }
 
-    inline void updateTag(int gid, uint32_t *tag, int numPoints, int L)
+    inline void updateTag(int64_t gid, uint32_t *tag, int64_t numPoints, int L)
     {
-        const int numSettled = FullBinaryTreeOf(L).numNodes();
+        const int64_t numSettled = FullBinaryTreeOf(L).numNodes();
         if (gid < numSettled) return;
-        int subtree = tag[gid];
-        const int pivotPos = ArrayLayoutInStep(L,numPoints).pivotPosOf(subtree);
+        int64_t subtree = tag[gid];
+        const int64_t pivotPos = ArrayLayoutInStep(L,numPoints).pivotPosOf(subtree);
 
         if (gid < pivotPos)
             subtree = BinaryTree::leftChildOf(subtree);
@@ -88,30 +105,33 @@ namespace kdTree
             subtree = BinaryTree::rightChildOf(subtree);
         else
             ;
-        tag[gid] = subtree;
+        tag[gid] = uint32_t(subtree);
     }
 
 
-    inline void host_updateTags(uint32_t *tag, int numPoints, int L)
+    inline void host_updateTags(uint32_t *tag, int64_t numPoints, int L, int numThreads = 1)
     {
-        for (int gid=0;gid<numPoints;gid++) 
-            updateTag(gid,tag,numPoints,L);
+        parallel_for_range<int64_t>(0,numPoints,numThreads,[&](int64_t begin, int64_t end)
+        {
+            for (int64_t gid=begin;gid<end;gid++) 
+                updateTag(gid,tag,numPoints,L);
+        }, 1<<12);
     }
 
 
     template<typename data_t, typename data_traits>
-    inline void updateTagAndSetDim(int gid, const box_t<typename data_traits::point_t> *d_bounds, uint32_t  *tag, data_t *d_nodes, int numPoints, int L)
+    inline void updateTagAndSetDim(int64_t gid, const box_t<typename data_traits::point_t> *d_bounds, uint32_t  *tag, data_t *d_nodes, int64_t numPoints, int L)
     {
         using point_t      = typename data_traits::point_t;
         using point_traits = typename kdTree::point_traits<point_t>;
         using scalar_t     = typename point_traits::scalar_t;
         
-        const int numSettled = FullBinaryTreeOf(L).numNodes();
+        const int64_t numSettled = FullBinaryTreeOf(L).numNodes();
         if (gid < numSettled) return;
 
-        int subtree = tag[gid];
+        int64_t subtree = tag[gid];
         box_t<typename data_traits::point_t> bounds = findBounds<data_t,data_traits>(subtree,d_bounds,d_nodes);
-        const int pivotPos = ArrayLayoutInStep(L,numPoints).pivotPosOf(subtree);
+        const int64_t pivotPos = ArrayLayoutInStep(L,numPoints).pivotPosOf(subtree);
 
         const int pivotDim = if_has_dims<data_t,data_traits,data_traits::has_explicit_dim>::get_dim(d_nodes[pivotPos],-1);
         const scalar_t pivotCoord = data_traits::get_coord(d_nodes[pivotPos],pivotDim);
@@ -135,14 +155,19 @@ namespace kdTree
             if_has_dims<data_t,data_traits,data_traits::has_explicit_dim>
             ::set_dim(d_nodes[gid],bounds.widestDimension());
         }
-        tag[gid] = subtree;
+        tag[gid] = uint32_t(subtree);
     }
 
     template<typename data_t, typename data_traits>
-    void host_updateTagsAndSetDims(const box_t<typename data_traits::point_t> *d_bounds, uint32_t  *tag, data_t *d_nodes, int numPoints, int L)
+    void host_updateTagsAndSetDims(const box_t<typename data_traits::point_t> *d_bounds, uint32_t  *tag, data_t *d_nodes, int64_t numPoints, int L, int numThreads = 1)
     {
-        for (int gid=0;gid<numPoints;gid++) 
-            updateTagAndSetDim<data_t,data_traits> (gid, d_bounds, tag, d_nodes, numPoints, L);
+        // every gid only writes its own tag and dim, and only reads settled
+        // nodes and the (never written) pivot, so the ranges are independent
+        parallel_for_range<int64_t>(0,numPoints,numThreads,[&](int64_t begin, int64_t end)
+        {
+            for (int64_t gid=begin;gid<end;gid++) 
+                updateTagAndSetDim<data_t,data_traits> (gid, d_bounds, tag, d_nodes, numPoints, L);
+        }, 1<<12);
     }
 
     template<typename data_t, typename data_traits>
@@ -166,8 +191,16 @@ namespace kdTree
         return less;
     }
 
+    /*! builds a left-balanced k-d tree over d_points, in place. With
+        numThreads != 1 the per-level sort, the copies into and out of the
+        sort buffer and the tag updates are split across threads; the
+        resulting layout is the same implicit tree as the serial build
+        (points with identical split coordinates may end up in a different,
+        but equally valid, order). numThreads <= 0 uses all hardware
+        threads. The per-point subtree tags are 32 bit, which limits this
+        builder to 2^32-1 points; buildTree_partition has no such limit. */
     template<typename data_t, typename data_traits>
-    void buildTree_host(data_t *d_points, int numPoints, box_t<typename data_traits::point_t> *worldBounds)
+    void buildTree_host(data_t *d_points, int64_t numPoints, box_t<typename data_traits::point_t> *worldBounds, int numThreads = 1)
     {
         using point_t      = typename data_traits::point_t;
         using point_traits = kdTree::point_traits<point_t>;
@@ -175,6 +208,10 @@ namespace kdTree
         
         // check for invalid input, and return gracefully if so
         if (numPoints < 1) return;
+        if (numPoints > int64_t(UINT32_MAX))
+            throw std::runtime_error
+                ("builder_host: more points than fit the 32-bit subtree tags,"
+                 " use buildTree_partition");
 
         std::vector<uint32_t> tags(numPoints);
         std::fill(tags.begin(),tags.end(),0);
@@ -185,7 +222,7 @@ namespace kdTree
         if (worldBounds) 
         {
             host_computeBounds<data_t,data_traits>
-            (worldBounds,d_points,numPoints);
+            (worldBounds,d_points,numPoints,numThreads);
         }
         if (data_traits::has_explicit_dim) 
         {
@@ -203,46 +240,193 @@ namespace kdTree
         {
             // Create zip data for sorting
             std::vector<std::tuple<uint32_t, data_t>> zip_data(numPoints);
-            for (int i = 0; i < numPoints; ++i) 
+            parallel_for_range<int64_t>(0,numPoints,numThreads,[&](int64_t begin, int64_t end)
             {
-                zip_data[i] = std::make_tuple(tags[i], d_points[i]);
-            }
+                for (int64_t i = begin; i < end; ++i) 
+                    zip_data[i] = std::make_tuple(tags[i], d_points[i]);
+            }, 1<<14);
             
-            std::sort(zip_data.begin(), zip_data.end(),
+            parallel_sort(zip_data.begin(), zip_data.end(),
                     ZipCompare<data_t,data_traits>
-                    ((level)%num_dims,d_points));
+                    ((level)%num_dims,d_points),
+                    numThreads);
             
             // Extract sorted data back
-            for (int i = 0; i < numPoints; ++i) 
+            parallel_for_range<int64_t>(0,numPoints,numThreads,[&](int64_t begin, int64_t end)
             {
-                tags[i] = std::get<0>(zip_data[i]);
-                d_points[i] = std::get<1>(zip_data[i]);
-            }
+                for (int64_t i = begin; i < end; ++i) 
+                {
+                    tags[i] = std::get<0>(zip_data[i]);
+                    d_points[i] = std::get<1>(zip_data[i]);
+                }
+            }, 1<<14);
             
             if (data_traits::has_explicit_dim) 
             {
-                host_updateTagsAndSetDims<data_t,data_traits>(worldBounds,tags.data(), d_points,numPoints,level);
+                host_updateTagsAndSetDims<data_t,data_traits>(worldBounds,tags.data(), d_points,numPoints,level,numThreads);
             } 
             else 
             {
-                host_updateTags(tags.data(),numPoints,level);
+                host_updateTags(tags.data(),numPoints,level,numThreads);
             }
         }
         
         std::vector<std::tuple<uint32_t, data_t>> zip_data(numPoints);
-        for (int i = 0; i < numPoints; ++i) 
+        parallel_for_range<int64_t>(0,numPoints,numThreads,[&](int64_t begin, int64_t end)
         {
-            zip_data[i] = std::make_tuple(tags[i], d_points[i]);
-        }
+            for (int64_t i = begin; i < end; ++i) 
+                zip_data[i] = std::make_tuple(tags[i], d_points[i]);
+        }, 1<<14);
         
-        std::sort(zip_data.begin(), zip_data.end(),
+        parallel_sort(zip_data.begin(), zip_data.end(),
                 ZipCompare<data_t,data_traits>
-                ((deepestLevel)%num_dims,d_points));
+                ((deepestLevel)%num_dims,d_points),
+                numThreads);
         
-        for (int i = 0; i < numPoints; ++i) 
+        parallel_for_range<int64_t>(0,numPoints,numThreads,[&](int64_t begin, int64_t end)
         {
-            d_points[i] = std::get<1>(zip_data[i]);
+            for (int64_t i = begin; i < end; ++i) 
+                d_points[i] = std::get<1>(zip_data[i]);
+        }, 1<<14);
+    }
+
+    /*! scratch storage for buildTree_partition; keep one of these around
+        (e.g. as a member next to the points) to reuse its allocation
+        across levels and across rebuilds */
+    template<typename data_t>
+    struct BuildScratch 
+    {
+        std::vector<data_t> buffer;
+    };
+
+    template<typename data_t, typename data_traits>
+    struct CoordLess 
+    {
+        explicit CoordLess(const int dim): dim(dim) {}
+
+        inline bool operator() (const data_t &a, const data_t &b) const
+        { return data_traits::get_coord(a,dim) < data_traits::get_coord(b,dim); }
+
+        const int dim;
+    };
+
+    /*! builds the same left-balanced k-d tree as buildTree_host, but by
+        selection instead of sorting: on every level, each subtree's
+        segment (as laid out by ArrayLayoutInStep) gets its pivot placed
+        with nth_element, and the segment is then scattered into the next
+        level's layout (pivot to its settled position, left/right halves to
+        the children's segments). That's O(N) per level, O(N log N) in
+        total, and the only memory used besides d_points is the scratch
+        buffer, which ping-pongs with d_points from level to level. */
+    template<typename data_t, typename data_traits>
+    void buildTree_partition(data_t *d_points, int64_t numPoints, box_t<typename data_traits::point_t> *worldBounds, BuildScratch<data_t> &scratch, int numThreads = 1)
+    {
+        using point_t      = typename data_traits::point_t;
+        using point_traits = kdTree::point_traits<point_t>;
+        enum { num_dims   = point_traits::num_dims };
+        
+        // check for invalid input, and return gracefully if so
+        if (numPoints < 1) return;
+
+        if (worldBounds) 
+        {
+            host_computeBounds<data_t,data_traits>
+            (worldBounds,d_points,numPoints,numThreads);
         }
+        if (data_traits::has_explicit_dim && !worldBounds) 
+            throw std::runtime_error
+                ("builder_partition: asked to build k-d tree over nodes"
+                " with explicit dims, but no memory for world bounds provided");
+
+        if (scratch.buffer.size() < size_t(numPoints))
+            scratch.buffer.resize(numPoints);
+
+        const int numLevels = BinaryTree::numLevelsFor(numPoints);
+        const int deepestLevel = numLevels-1;
+
+        data_t *curr = d_points;
+        data_t *next = scratch.buffer.data();
+        for (int level=0;level<deepestLevel;level++) 
+        {
+            ArrayLayoutInStep layout(level,numPoints);
+            ArrayLayoutInStep nextLayout(level+1,numPoints);
+
+            const int64_t numSettled = layout.numSettledNodes();
+            std::copy(curr,curr+numSettled,next);
+
+            const int64_t firstSubtree = BinaryTree::firstNodeInLevel(level);
+            const int64_t endSubtree   = std::min(BinaryTree::firstNodeInLevel(level+1),numPoints);
+            parallel_for_range<int64_t>(firstSubtree,endSubtree,numThreads,[&](int64_t begin, int64_t end)
+            {
+                for (int64_t subtree=begin;subtree<end;subtree++) 
+                {
+                    const int64_t segBegin = layout.segmentBegin(subtree);
+                    const int64_t segEnd   = segBegin + layout.sizeOfSegment(subtree);
+                    const int64_t pivotPos = layout.pivotPosOf(subtree);
+
+                    int dim = level % num_dims;
+                    if (data_traits::has_explicit_dim) 
+                        // settled ancestors are already in place in curr
+                        dim = findBounds<data_t,data_traits>(subtree,worldBounds,curr).widestDimension();
+
+                    std::nth_element(curr+segBegin,curr+pivotPos,curr+segEnd,
+                                     CoordLess<data_t,data_traits>(dim));
+                    if_has_dims<data_t,data_traits,data_traits::has_explicit_dim>
+                    ::set_dim(curr[pivotPos],dim);
+
+                    next[subtree] = curr[pivotPos];
+                    const int64_t lChild = BinaryTree::leftChildOf(subtree);
+                    const int64_t rChild = BinaryTree::rightChildOf(subtree);
+                    if (pivotPos > segBegin)
+                        std::copy(curr+segBegin,curr+pivotPos,next+nextLayout.segmentBegin(lChild));
+                    if (segEnd > pivotPos+1)
+                        std::copy(curr+pivotPos+1,curr+segEnd,next+nextLayout.segmentBegin(rChild));
+                }
+            }, 16);
+            std::swap(curr,next);
+        }
+
+        // on the deepest level every segment is a single, already settled
+        // node; only the explicit dim (if any) is still missing
+        if (data_traits::has_explicit_dim) 
+        {
+            for (int64_t node=BinaryTree::firstNodeInLevel(deepestLevel);node<numPoints;node++)
+                if_has_dims<data_t,data_traits,data_traits::has_explicit_dim>
+                ::set_dim(curr[node],findBounds<data_t,data_traits>(node,worldBounds,curr).widestDimension());
+        }
+        if (curr != d_points)
+            std::copy(curr,curr+numPoints,d_points);
+    }
+
+    /*! stores level % num_dims as the explicit dim of every node of a
+        tree that was built round-robin, so traversals that read the dim
+        from the node (data_traits::has_explicit_dim) see the same splits
+        the builder made */
+    template<typename data_t, typename data_traits>
+    inline void setRoundRobinDims(data_t *d_nodes, int64_t numNodes, int numThreads = 1)
+    {
+        enum { num_dims = num_dims_of<typename data_traits::point_t>::value };
+        parallel_for_range<int64_t>(0,numNodes,numThreads,[&](int64_t begin, int64_t end)
+        {
+            for (int64_t node=begin;node<end;node++)
+                data_traits::set_dim(d_nodes[node],BinaryTree::levelOf(node) % num_dims);
+        }, 1<<16);
     }
-}
 
+    /*! brings per-input-point values into tree order: out[slot] =
+        values[slotToInput[slot]] for all numNodes slots, where
+        slotToInput is the input index each node was built from (the id
+        of a payload_point). Since a rebuild with unchanged positions
+        lands every point in the same slot, this is all a value-only
+        update needs - O(N), writes are sequential, ranges run in
+        parallel, and only the reads are random. */
+    template<typename T>
+    inline void gatherToTreeOrder(T *out, const T *values, const uint32_t *slotToInput, int64_t numNodes, int numThreads = 1)
+    {
+        parallel_for_range<int64_t>(0,numNodes,numThreads,[&](int64_t begin, int64_t end)
+        {
+            for (int64_t slot=begin;slot<end;slot++)
+                out[slot] = values[slotToInput[slot]];
+        }, 1<<16);
+    }
+}
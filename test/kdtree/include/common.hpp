@@ -1,7 +1,10 @@
 #pragma once
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <type_traits>
+#include <utility>
 
 namespace kdTree
 { 
@@ -308,27 +311,38 @@ namespace kdTree
 		v.v[d] = vv;
 	}
 
+	/*! per-dimension operations on vec_float<N> are expanded at compile
+		time (a fold over 0..N-1) instead of looping over N, so a 4..8-D
+		distance is a straight sequence of subtract/multiply-adds with no
+		loop counter - independent of how far the optimizer unrolls */
+	template <int N, typename body_t, int... d>
+	inline void unroll_dims(body_t &&body, std::integer_sequence<int, d...>)
+	{
+		(body(std::integral_constant<int, d>{}), ...);
+	}
+	template <int N, typename body_t> inline void unroll_dims(body_t &&body)
+	{
+		unroll_dims<N>(body, std::make_integer_sequence<int, N>{});
+	}
+
 	template <int N> inline vec_float<N> min(vec_float<N> a, vec_float<N> b)
 	{
 		vec_float<N> r;
-		for (int i = 0; i < N; i++)
-			r.v[i] = min(a.v[i], b.v[i]);
+		unroll_dims<N>([&](auto i) { r.v[i] = std::min(a.v[i], b.v[i]); });
 		return r;
 	}
 
 	template <int N> inline vec_float<N> max(vec_float<N> a, vec_float<N> b)
 	{
 		vec_float<N> r;
-		for (int i = 0; i < N; i++)
-			r.v[i] = max(a.v[i], b.v[i]);
+		unroll_dims<N>([&](auto i) { r.v[i] = std::max(a.v[i], b.v[i]); });
 		return r;
 	}
 
 	template <int N> inline float dot(vec_float<N> a, vec_float<N> b)
 	{
 		float sum = 0.f;
-		for (int i = 0; i < N; i++)
-			sum += a.v[i] * b.v[i];
+		unroll_dims<N>([&](auto i) { sum += a.v[i] * b.v[i]; });
 		return sum;
 	}
 
@@ -336,11 +350,32 @@ namespace kdTree
 	inline vec_float<N> operator-(const vec_float<N> &a, const vec_float<N> &b)
 	{
 		vec_float<N> r;
-		for (int i = 0; i < N; i++)
-			r.v[i] = a.v[i] - b.v[i];
+		unroll_dims<N>([&](auto i) { r.v[i] = a.v[i] - b.v[i]; });
 		return r;
 	}
 
+	/*! squared distance without the temporary difference vector */
+	template <int N>
+	inline float sqrDistance(const vec_float<N> &a, const vec_float<N> &b)
+	{
+		float sum = 0.f;
+		unroll_dims<N>([&](auto i) {
+			const float diff = a.v[i] - b.v[i];
+			sum += diff * diff;
+		});
+		return sum;
+	}
+
+	template <int N>
+	inline std::ostream &operator<<(std::ostream &o, const vec_float<N> &v)
+	{
+		o << "(";
+		for (int i = 0; i < N; i++)
+			o << (i ? "," : "") << v.v[i];
+		o << ")";
+		return o;
+	}
+
 	// ==================================================================
 	// Helper functions for type conversion
 	// ==================================================================
@@ -482,5 +517,64 @@ namespace kdTree
 		static inline int  get_dim(const data_t &) { return -1; }
 		static inline void set_dim(data_t &, int) {}
 	};
+
+	/*! a point plus the value sampled at it and its index in the original
+		input; building over these moves value and index along with the
+		point, so neither has to be looked up again after the build */
+	template<typename _point_t>
+	struct payload_point
+	{
+		_point_t point;
+		float    value;
+		uint32_t id;
+	};
+
+	template<typename _point_t, typename _point_traits=point_traits<_point_t>>
+	struct payload_data_traits
+	{
+		using point_t      = _point_t;
+		using point_traits = _point_traits;
+		using data_t = payload_point<_point_t>;
+	private:
+		using scalar_t  = typename point_traits::scalar_t;
+	public:
+		static inline const point_t &get_point(const data_t &n) { return n.point; }
+		static inline scalar_t get_coord(const data_t &n, int d) { return point_traits::get_coord(get_point(n),d); }
+		enum { has_explicit_dim = false };
+		static inline int  get_dim(const data_t &) { return -1; }
+		static inline void set_dim(data_t &, int) {}
+	};
+
+	/*! a payload_point that also stores the dimension it splits, so a
+		tree can be built with the builder's widest-dimension rule
+		(has_explicit_dim) and traversed without knowing which rule was
+		used. A round-robin build leaves 'dim' untouched; fill it with
+		setRoundRobinDims() to make it valid for explicit-dim traversal */
+	template<typename _point_t>
+	struct payload_dim_point
+	{
+		_point_t point;
+		float    value;
+		uint32_t id;
+		int32_t  dim;
+	};
+
+	/*! traits for payload_dim_point; with explicit_dim=false the stored
+		dim is ignored and the builder/traversals use level % num_dims */
+	template<typename _point_t, bool explicit_dim=true, typename _point_traits=point_traits<_point_t>>
+	struct payload_dim_traits
+	{
+		using point_t      = _point_t;
+		using point_traits = _point_traits;
+		using data_t = payload_dim_point<_point_t>;
+	private:
+		using scalar_t  = typename point_traits::scalar_t;
+	public:
+		static inline const point_t &get_point(const data_t &n) { return n.point; }
+		static inline scalar_t get_coord(const data_t &n, int d) { return point_traits::get_coord(get_point(n),d); }
+		enum { has_explicit_dim = explicit_dim };
+		static inline int  get_dim(const data_t &n) { return explicit_dim ? n.dim : -1; }
+		static inline void set_dim(data_t &n, int dim) { n.dim = dim; }
+	};
 }
 
@@ -0,0 +1,229 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "box.hpp"
+#include "builder.hpp"
+#include "traverse.hpp"
+
+namespace kdTree
+{
+    /*! result adapter for traverse_stack_free over one tree of a
+        DynamicForest: skips tombstoned nodes (they still split space,
+        they just are no candidates any more) and reports the point's
+        forest-wide id instead of its node index, so one candidate list
+        can collect the neighbours of all trees */
+    template<typename CandidateList, typename node_t>
+    struct LiveCandidates
+    {
+        float initialCullDist2() const
+        { return result.initialCullDist2(); }
+
+        float processCandidate(int64_t nodeID, float candDist2)
+        {
+            if (dead[nodeID]) return result.initialCullDist2();
+            return result.processCandidate(int64_t(nodes[nodeID].id),candDist2);
+        }
+
+        CandidateList &result;
+        const node_t  *nodes;
+        const uint8_t *dead;
+    };
+
+    /*! a dynamic point set as a logarithmic ("log-structured") forest of
+        static implicit kd-trees: tree l holds at most
+        leafCapacity<<l points. An insert rebuilds the smallest tree
+        that can take the new points together with everything in the
+        trees below it (which are emptied), so every point is moved
+        O(log n) times and the amortized insert cost is O(log^2 n).
+        Deletes only set a tombstone; a tree is compacted once more than
+        half its nodes are dead.
+
+        Points are identified by the id insert() returns (32 bits, as in
+        payload_point); queries report those ids as pointIDs, and node
+        indices within a tree are 64-bit. Every change is recorded as a node range
+        of one tree (see takeChanges()) so that a GPU copy, which packs
+        the trees at fixed offsets (firstNodeOf()), only needs to re-upload
+        what actually changed - usually one of the small trees. */
+    template<typename point_t>
+    struct DynamicForest
+    {
+        using node_t      = payload_point<point_t>;
+        using node_traits = payload_data_traits<point_t>;
+
+        struct Tree
+        {
+            std::vector<node_t>  nodes;
+            std::vector<uint8_t> dead;
+            int64_t              numDead = 0;
+            box_t<point_t>       bounds;
+
+            int64_t numLive() const { return int64_t(nodes.size()) - numDead; }
+        };
+
+        /*! nodes [begin,end) of tree 'tree' changed; a tree that got
+            rebuilt or emptied is reported as [0,nodes.size()) */
+        struct Change
+        {
+            int     tree;
+            int64_t begin;
+            int64_t end;
+        };
+
+        explicit DynamicForest(int leafCapacity = 256)
+            : leafCapacity(std::max(1,leafCapacity))
+        {}
+
+        int64_t capacity(int level) const
+        { return int64_t(leafCapacity) << level; }
+
+        /*! first node of tree 'level' when all trees are packed back to
+            back at full capacity */
+        int64_t firstNodeOf(int level) const
+        { return int64_t(leafCapacity) * ((int64_t(1) << level) - 1); }
+
+        int numTrees() const { return int(trees.size()); }
+        const Tree &tree(int level) const { return trees[level]; }
+        size_t size() const { return numLive; }
+
+        /*! adds one point, returns its id */
+        uint32_t insert(const point_t &point, float value)
+        {
+            return insertBatch(&point,&value,1);
+        }
+
+        /*! adds numPoints points with a single merge; they get the
+            consecutive ids [returned id, returned id + numPoints) */
+        uint32_t insertBatch(const point_t *points, const float *values, int numPoints)
+        {
+            const uint32_t firstID = uint32_t(locations.size());
+            std::vector<node_t> pending(numPoints);
+            for (int i=0;i<numPoints;i++)
+            {
+                pending[i].point = points[i];
+                pending[i].value = values[i];
+                pending[i].id    = firstID + i;
+                locations.push_back({-1,-1});
+            }
+            if (numPoints > 0) merge(pending);
+            return firstID;
+        }
+
+        /*! tombstones point 'id'; returns false if there is no such
+            (live) point */
+        bool erase(uint32_t id)
+        {
+            if (id >= locations.size() || locations[id].tree < 0) return false;
+            const Location loc = locations[id];
+            Tree &t = trees[loc.tree];
+            t.dead[loc.slot] = 1;
+            t.numDead++;
+            numLive--;
+            locations[id] = {-1,-1};
+            if (2*t.numDead > int64_t(t.nodes.size()))
+                compact(loc.tree);
+            else
+                erasedSlots.push_back({loc.tree,loc.slot,loc.slot+1});
+            return true;
+        }
+
+        /*! k-nearest query over all trees, sharing one candidate list (so
+            the cull distance found in one tree prunes the next); largest
+            tree first, and trees whose bounds are out of range are
+            skipped. eps as in knn(). */
+        template<typename CandidateList>
+        float knn(CandidateList &result, const point_t &queryPoint, float eps = 0.0f) const
+        {
+            const float epsErr = 1.f + eps;
+            for (int l=numTrees()-1;l>=0;--l)
+            {
+                const Tree &t = trees[l];
+                if (t.numLive() == 0) continue;
+                if (sqrDistance(t.bounds,queryPoint)*epsErr >= result.initialCullDist2()) continue;
+                LiveCandidates<CandidateList,node_t> live{result,t.nodes.data(),t.dead.data()};
+                traverse_stack_free<decltype(live),node_t,node_traits>(live,queryPoint,t.nodes.data(),int64_t(t.nodes.size()),eps);
+            }
+            return result.returnValue();
+        }
+
+        /*! moves all changes since the last call to 'out' (appended), at
+            most one range per rebuilt tree */
+        void takeChanges(std::vector<Change> &out)
+        {
+            for (int l=0;l<numTrees();l++)
+                if ((rebuiltMask >> l) & 1)
+                    out.push_back({l,0,int64_t(trees[l].nodes.size())});
+            for (const Change &c : erasedSlots)
+                if (!((rebuiltMask >> c.tree) & 1))
+                    out.push_back(c);
+            rebuiltMask = 0;
+            erasedSlots.clear();
+        }
+
+    private:
+        struct Location
+        {
+            int     tree;
+            int64_t slot;
+        };
+
+        /*! puts 'pending' plus the live points of the smallest prefix of
+            trees that fits into one tree, emptying the others */
+        void merge(std::vector<node_t> &pending)
+        {
+            int64_t total = int64_t(pending.size());
+            int level = 0;
+            for (;;level++)
+            {
+                if (level < numTrees()) total += trees[level].numLive();
+                if (total <= capacity(level)) break;
+            }
+            if (level >= numTrees()) trees.resize(level+1);
+            for (int l=0;l<=level;l++)
+                takeLive(l,pending);
+            build(level,pending);
+        }
+
+        void compact(int level)
+        {
+            std::vector<node_t> live;
+            takeLive(level,live);
+            build(level,live);
+        }
+
+        void takeLive(int level, std::vector<node_t> &out)
+        {
+            Tree &t = trees[level];
+            if (t.nodes.empty()) return;
+            for (size_t i=0;i<t.nodes.size();i++)
+                if (!t.dead[i]) out.push_back(t.nodes[i]);
+            numLive -= t.numLive();
+            t.nodes.clear();
+            t.dead.clear();
+            t.numDead = 0;
+            rebuiltMask |= uint64_t(1) << level;
+        }
+
+        void build(int level, std::vector<node_t> &points)
+        {
+            Tree &t = trees[level];
+            t.nodes.swap(points);
+            points.clear();
+            const int64_t N = int64_t(t.nodes.size());
+            buildTree_partition<node_t,node_traits>(t.nodes.data(),N,&t.bounds,scratch);
+            t.dead.assign(N,0);
+            t.numDead = 0;
+            for (int64_t i=0;i<N;i++)
+                locations[t.nodes[i].id] = {level,i};
+            numLive += N;
+            rebuiltMask |= uint64_t(1) << level;
+        }
+
+        int                   leafCapacity;
+        std::vector<Tree>     trees;
+        std::vector<Location> locations;    // by id; tree -1 once erased
+        size_t                numLive = 0;
+        uint64_t              rebuiltMask = 0;
+        std::vector<Change>   erasedSlots;
+        BuildScratch<node_t>  scratch;
+    };
+}
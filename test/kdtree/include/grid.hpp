@@ -0,0 +1,237 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#include "helper.hpp"
+#include "common.hpp"
+#include "box.hpp"
+#include "parallel.hpp"
+
+namespace kdTree
+{
+    /*! a regular 3D grid of query points, such as the voxels of a
+        resampling volume: voxel (x,y,z) sits at origin + spacing*(x,y,z)
+        and has index x + res[0]*(y + res[1]*z) */
+    struct QueryGrid3D
+    {
+        inline int64_t numVoxels() const
+        { return int64_t(res[0]) * res[1] * res[2]; }
+
+        inline int64_t indexOf(int x, int y, int z) const
+        { return x + int64_t(res[0]) * (y + int64_t(res[1]) * z); }
+
+        inline float3 voxel(int x, int y, int z) const
+        {
+            return make_float3(origin.x + spacing.x * float(x),
+                               origin.y + spacing.y * float(y),
+                               origin.z + spacing.z * float(z));
+        }
+
+        float3 origin;
+        float3 spacing;
+        int    res[3];
+    };
+
+    /*! block size for knnGrid() when none is given: a block edge of
+        about the mean point spacing of the tree. Much smaller blocks
+        share little traversal, much larger ones score every visited
+        point against voxels it is far from; clamped to [2,8] voxels */
+    inline int gridBlockSizeFor(const QueryGrid3D &grid, const box_t<float3> &worldBounds, int64_t N)
+    {
+        const float3 size = worldBounds.upper - worldBounds.lower;
+        const double spacing = std::cbrt(std::max(double(size.x) * size.y * size.z, 1e-30) / double(std::max<int64_t>(N,1)));
+        const double voxel = std::cbrt(std::max(double(grid.spacing.x) * grid.spacing.y * grid.spacing.z, 1e-30));
+        return int(std::min(8.0, std::max(2.0, std::round(spacing / voxel))));
+    }
+
+    /*! all-k-nearest-neighbours of every voxel of a QueryGrid3D, with
+        whole blocks of voxels traversing the tree together instead of
+        one query per voxel.
+
+        The grid is cut into blockSize^3 blocks. Each block walks the tree
+        once, stack-based like traverse_box_pruned(), but with the block's
+        box in place of the query point: per dimension we keep the
+        distance from the block to the current cell, so a subtree is
+        skipped for all voxels at once when it is farther from the block
+        than the largest cull radius of any of them. Every visited node is
+        then scored against all voxels of the block in one tight loop,
+        where each voxel only keeps what is inside its own radius. Blocks
+        farther than cutOffRadius from worldBounds (which has to contain
+        all N points) are done without touching the tree.
+
+        Results are exact (the same distances as one knn() per voxel) and
+        written like knnBatchWith(): voxel v's neighbours go to
+        outIDs[v*k .. v*k+k) and their squared distances to
+        outDist2[v*k .. v*k+k), closest first, ID -1 where nothing was
+        found. blockSize 0 picks gridBlockSizeFor(); blocks are spread
+        over the pool, blocksPerTask at a time. */
+    template<typename CandidateList, typename data_t, typename data_traits=default_data_traits<data_t>, typename id_t>
+    inline void knnGrid(ThreadPool &pool,
+                        const QueryGrid3D &grid,
+                        float cutOffRadius,
+                        const box_t<float3> &worldBounds,
+                        const data_t *d_nodes,
+                        int64_t N,
+                        id_t *outIDs,
+                        float *outDist2,
+                        int blockSize = 0,
+                        int64_t blocksPerTask = 16)
+    {
+        enum { k = CandidateList::num_k };
+        enum { num_dims = 3 };
+        static_assert(std::is_same<typename data_traits::point_t,float3>::value,
+                      "knnGrid: query grids are 3D, the tree has to be over float3");
+        if (grid.numVoxels() <= 0) return;
+        if (blockSize <= 0) blockSize = gridBlockSizeFor(grid,worldBounds,N);
+        int numBlocks[3];
+        for (int d=0;d<num_dims;d++)
+            numBlocks[d] = (grid.res[d] + blockSize - 1) / blockSize;
+        const int64_t totalBlocks = int64_t(numBlocks[0]) * numBlocks[1] * numBlocks[2];
+        const int64_t numTasks = (totalBlocks + blocksPerTask - 1) / blocksPerTask;
+        const int maxVoxels = blockSize * blockSize * blockSize;
+
+        pool.run(numTasks,[&](int64_t task)
+        {
+            std::vector<CandidateList> lists(maxVoxels,CandidateList(cutOffRadius));
+            std::vector<float> cull(maxVoxels);
+            std::vector<float3> voxels(maxVoxels);
+            std::vector<int64_t> voxelIDs(maxVoxels);
+
+            struct StackEntry
+            {
+                int64_t node;
+                float   dist2;
+                float   offset[num_dims];
+            };
+            StackEntry stack[64];
+
+            const int64_t end = std::min(totalBlocks,(task+1)*blocksPerTask);
+            for (int64_t block=task*blocksPerTask;block<end;block++)
+            {
+                const int bx = int(block % numBlocks[0]);
+                const int by = int((block / numBlocks[0]) % numBlocks[1]);
+                const int bz = int(block / (int64_t(numBlocks[0]) * numBlocks[1]));
+                const int x0 = bx*blockSize, x1 = std::min(grid.res[0],x0+blockSize);
+                const int y0 = by*blockSize, y1 = std::min(grid.res[1],y0+blockSize);
+                const int z0 = bz*blockSize, z1 = std::min(grid.res[2],z0+blockSize);
+
+                int numVoxels = 0;
+                box_t<float3> blockBox;
+                blockBox.setEmpty();
+                for (int z=z0;z<z1;z++)
+                    for (int y=y0;y<y1;y++)
+                        for (int x=x0;x<x1;x++)
+                        {
+                            voxels[numVoxels]   = grid.voxel(x,y,z);
+                            voxelIDs[numVoxels] = grid.indexOf(x,y,z);
+                            lists[numVoxels]    = CandidateList(cutOffRadius);
+                            cull[numVoxels]     = lists[numVoxels].initialCullDist2();
+                            blockBox.grow(voxels[numVoxels]);
+                            numVoxels++;
+                        }
+                float blockCull = cull[0];
+                float center[num_dims];
+                for (int d=0;d<num_dims;d++)
+                    center[d] = 0.5f*(get_coord(blockBox.lower,d) + get_coord(blockBox.upper,d));
+
+                // distance from the block to the current cell, per dimension
+                float offset[num_dims];
+                float dist2 = 0.f;
+                for (int d=0;d<num_dims;d++)
+                {
+                    offset[d] = std::max(std::max(get_coord(worldBounds.lower,d) - get_coord(blockBox.upper,d),
+                                                  get_coord(blockBox.lower,d) - get_coord(worldBounds.upper,d)), 0.f);
+                    dist2 += offset[d]*offset[d];
+                }
+
+                int64_t node = (N > 0 && dist2 < blockCull) ? 0 : N;
+                int stackTop = 0;
+                while (true)
+                {
+                    while (node < N)
+                    {
+                        const auto &curr_node = d_nodes[node];
+                        const float3 &p = data_traits::get_point(curr_node);
+
+                        // the point is only scored if it is in range of some voxel
+                        float pointDist2 = 0.f;
+                        for (int d=0;d<num_dims;d++)
+                        {
+                            const float c = get_coord(p,d);
+                            const float o = std::max(std::max(get_coord(blockBox.lower,d) - c, c - get_coord(blockBox.upper,d)), 0.f);
+                            pointDist2 += o*o;
+                        }
+                        if (pointDist2 < blockCull)
+                        {
+                            bool pushed = false;
+                            for (int v=0;v<numVoxels;v++)
+                            {
+                                const float d2 = sqrDistance(voxels[v],p);
+                                if (d2 < cull[v])
+                                {
+                                    cull[v] = lists[v].processCandidate(node,d2);
+                                    pushed = true;
+                                }
+                            }
+                            if (pushed)
+                                blockCull = *std::max_element(cull.begin(),cull.begin()+numVoxels);
+                        }
+
+                        const int  curr_dim
+                            = data_traits::has_explicit_dim
+                            ? data_traits::get_dim(curr_node)
+                            : (BinaryTree::levelOf(node) % num_dims);
+                        const float split = data_traits::get_coord(curr_node,curr_dim);
+                        const int curr_side = center[curr_dim] > split;
+                        const int64_t far_child = 2*node + 2 - curr_side;
+                        if (far_child < N)
+                        {
+                            // the far cell lies beyond the split plane, seen from the block's
+                            // nearest face; the sum is redone as in traverse_box_pruned()
+                            const float gap
+                                = curr_side
+                                ? get_coord(blockBox.lower,curr_dim) - split
+                                : split - get_coord(blockBox.upper,curr_dim);
+                            float far_offset[num_dims];
+                            float far_dist2 = 0.f;
+                            for (int d=0;d<num_dims;d++)
+                            {
+                                far_offset[d] = (d == curr_dim) ? std::max(offset[d],gap) : offset[d];
+                                far_dist2 += far_offset[d]*far_offset[d];
+                            }
+                            if (far_dist2 < blockCull)
+                            {
+                                StackEntry &e = stack[stackTop++];
+                                e.node  = far_child;
+                                e.dist2 = far_dist2;
+                                for (int d=0;d<num_dims;d++) e.offset[d] = far_offset[d];
+                            }
+                        }
+                        // the center is on the close side, so the block's distance to the
+                        // close cell does not grow
+                        node = 2*node + 1 + curr_side;
+                    }
+
+                    while (stackTop > 0 && stack[stackTop-1].dist2 >= blockCull) --stackTop;
+                    if (stackTop == 0) break;
+                    const StackEntry &e = stack[--stackTop];
+                    node = e.node;
+                    for (int d=0;d<num_dims;d++) offset[d] = e.offset[d];
+                }
+
+                for (int v=0;v<numVoxels;v++)
+                {
+                    lists[v].sort();
+                    const int64_t q = voxelIDs[v];
+                    for (int i=0;i<k;i++)
+                    {
+                        outIDs[q*k+i]   = lists[v].get_pointID(i);
+                        outDist2[q*k+i] = lists[v].get_dist2(i);
+                    }
+                }
+            }
+        });
+    }
+}
@@ -1,157 +1,245 @@
 #pragma once
 #include <algorithm>
 #include <assert.h>
+#include <stdint.h>
 #include <math.h>
 #include <stdio.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace kdTree
 { 
+	/*! index of the lowest set bit of a non-zero mask, e.g. the first
+		lane of a SIMD compare mask */
+	inline int countTrailingZeros(unsigned int mask)
+	{
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanForward(&idx, mask);
+		return int(idx);
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	/*! number of set bits of a mask, e.g. the active lanes of a packet */
+	inline int popCount(unsigned int mask)
+	{
+#ifdef _MSC_VER
+		// __popcnt needs the POPCNT instruction, which MSVC does not check for
+		mask = mask - ((mask >> 1) & 0x55555555u);
+		mask = (mask & 0x33333333u) + ((mask >> 2) & 0x33333333u);
+		return int((((mask + (mask >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24);
+#else
+		return __builtin_popcount(mask);
+#endif
+	}
+
+	/*! node IDs and node counts are 64-bit throughout, so trees with
+		2^31 or more points lay out correctly; levels stay int */
 	struct BinaryTree
 	{
-		static int rootNode() { return 0; }
-		static int parentOf(int nodeID) { return (nodeID - 1) / 2; }
-		static int isLeftSibling(int nodeID) { return (nodeID & 1); }
-		static int leftChildOf(int nodeID) { return 2 * nodeID + 1; }
-		static int rightChildOf(int nodeID) { return 2 * nodeID + 2; }
-		static int firstNodeInLevel(int L) { return (1 << L) - 1; }
-		static int levelOf(int nodeID)
+		static int64_t rootNode() { return 0; }
+		static int64_t parentOf(int64_t nodeID) { return (nodeID - 1) / 2; }
+		static int isLeftSibling(int64_t nodeID) { return (nodeID & 1); }
+		static int64_t leftChildOf(int64_t nodeID) { return 2 * nodeID + 1; }
+		static int64_t rightChildOf(int64_t nodeID) { return 2 * nodeID + 2; }
+		static int64_t firstNodeInLevel(int L) { return (int64_t(1) << L) - 1; }
+		static int levelOf(int64_t nodeID)
 		{
 			int k = 63 - __builtin_clzll(nodeID + 1);
 			return k;
 		}
-		static int numLevelsFor(int numPoints)
+		static int numLevelsFor(int64_t numPoints)
 		{
 			return levelOf(numPoints - 1) + 1;
 		}
-		static int numSiblingsToLeftOf(int n)
+		static int64_t numSiblingsToLeftOf(int64_t n)
 		{
 			int levelOf_n = BinaryTree::levelOf(n);
 			return n - BinaryTree::firstNodeInLevel(levelOf_n);
 		}
 	};
 
+	/*! where a node of the implicit tree is stored: traversal always
+		walks breadth-first node IDs (children of n at 2n+1/2n+2) and asks
+		the layout for the array slot of node n. This is the plain
+		breadth-first array the builders produce. */
+	struct BreadthFirstLayout
+	{
+		explicit BreadthFirstLayout(int64_t /* numNodes */) {}
+		int64_t slotOf(int64_t nodeID) const { return nodeID; }
+	};
+
+	/*! blocked-subtree layout: the complete levels of the tree are cut
+		into subtrees of blockHeight levels (2^blockHeight-1 nodes) that
+		are stored contiguously - block levels top to bottom, blocks left
+		to right within a block level, breadth-first inside a block. A
+		descent thus stays within one block (a line or two of memory) for
+		blockHeight steps instead of touching a new cache line on every
+		level. The last, incomplete level of a left-balanced tree stays in
+		breadth-first order behind the blocks, so this is a permutation of
+		[0,N) without padding; see relayout(). */
+	template<int blockHeight>
+	struct BlockedLayout
+	{
+		explicit BlockedLayout(int64_t numNodes)
+			: completeLevels(BinaryTree::levelOf(numNodes))
+		{}
+
+		int64_t slotOf(int64_t nodeID) const
+		{
+			const int L = BinaryTree::levelOf(nodeID);
+			if (L >= completeLevels) return nodeID;
+			const int rootLevel = L - L % blockHeight;
+			const int l = L - rootLevel;
+			const int h = std::min(blockHeight, completeLevels - rootLevel);
+			const int64_t root = ((nodeID + 1) >> l) - 1;
+			const int64_t block = root - BinaryTree::firstNodeInLevel(rootLevel);
+			return BinaryTree::firstNodeInLevel(rootLevel)
+				+ block * ((int64_t(1) << h) - 1)
+				+ BinaryTree::firstNodeInLevel(l)
+				+ (nodeID + 1 - ((root + 1) << l));
+		}
+
+		/*! number of levels that are completely filled, floor(log2(N+1)) */
+		const int completeLevels;
+	};
+
+	/*! copies the N nodes of a breadth-first tree into 'out' in the order
+		of layout_t; anything indexed by node (values, ids) has to be
+		moved the same way */
+	template<typename layout_t, typename data_t>
+	inline void relayout(data_t *out, const data_t *in, int64_t N)
+	{
+		const layout_t layout(N);
+		for (int64_t i = 0; i < N; i++)
+			out[layout.slotOf(i)] = in[i];
+	}
+
 	struct FullBinaryTreeOf
 	{
 		FullBinaryTreeOf(int numLevels) : numLevels(numLevels) {}
-		int numNodes() const { return (1 << numLevels) - 1; }
-		int numOnLastLevel() const { return (1 << (numLevels - 1)); }
+		int64_t numNodes() const { return (int64_t(1) << numLevels) - 1; }
+		int64_t numOnLastLevel() const { return (int64_t(1) << (numLevels - 1)); }
 		const int numLevels;
 	};
 
 	struct SubTreeInFullTreeOf
 	{
-		SubTreeInFullTreeOf(int numLevelsTree, int subtreeRoot)
+		SubTreeInFullTreeOf(int numLevelsTree, int64_t subtreeRoot)
 			: numLevelsTree(numLevelsTree), subtreeRoot(subtreeRoot),
 			levelOfSubtree(BinaryTree::levelOf(subtreeRoot)),
 			numLevelsSubtree(numLevelsTree - levelOfSubtree)
 		{
 		}
-		int lastNodeOnLastLevel() const
+		int64_t lastNodeOnLastLevel() const
 		{
 			// return ((subtreeRoot+2) << (numLevelsSubtree-1)) - 2;
-			int first = (subtreeRoot + 1) << (numLevelsSubtree - 1);
-			int onLast = (1 << (numLevelsSubtree - 1)) - 1;
+			int64_t first = (subtreeRoot + 1) << (numLevelsSubtree - 1);
+			int64_t onLast = (int64_t(1) << (numLevelsSubtree - 1)) - 1;
 			return first + onLast;
 		}
-		int numOnLastLevel() const
+		int64_t numOnLastLevel() const
 		{
 			return FullBinaryTreeOf(numLevelsSubtree).numOnLastLevel();
 		}
-		int numNodes() const
+		int64_t numNodes() const
 		{
 			return FullBinaryTreeOf(numLevelsSubtree).numNodes();
 		}
 
 		const int numLevelsTree;
-		const int subtreeRoot;
+		const int64_t subtreeRoot;
 		const int levelOfSubtree;
 		const int numLevelsSubtree;
 	};
 
-	inline int clamp(int val, int lo, int hi)
+	inline int64_t clamp(int64_t val, int64_t lo, int64_t hi)
 	{
 		return std::max(std::min(val, hi), lo);
 	}
 
 	struct ArbitraryBinaryTree
 	{
-		ArbitraryBinaryTree(int numNodes) : numNodes(numNodes) {}
-		int numNodesInSubtree(int n)
+		ArbitraryBinaryTree(int64_t numNodes) : numNodes(numNodes) {}
+		int64_t numNodesInSubtree(int64_t n)
 		{
 			auto fullSubtree =
 				SubTreeInFullTreeOf(BinaryTree::numLevelsFor(numNodes), n);
-			const int lastOnLastLevel = fullSubtree.lastNodeOnLastLevel();
-			const int numMissingOnLastLevel =
+			const int64_t lastOnLastLevel = fullSubtree.lastNodeOnLastLevel();
+			const int64_t numMissingOnLastLevel =
 				clamp(lastOnLastLevel - numNodes, 0, fullSubtree.numOnLastLevel());
-			const int result = fullSubtree.numNodes() - numMissingOnLastLevel;
+			const int64_t result = fullSubtree.numNodes() - numMissingOnLastLevel;
 			return result;
 		}
 
-		const int numNodes;
+		const int64_t numNodes;
 	};
 
 	struct ArrayLayoutInStep
 	{
-		ArrayLayoutInStep(int step, /* num nodes in three: */ int numPoints)
+		ArrayLayoutInStep(int step, /* num nodes in three: */ int64_t numPoints)
 			: numLevelsDone(step), numPoints(numPoints)
 		{
 		}
 
-		int numSettledNodes() const
+		int64_t numSettledNodes() const
 		{
 			return FullBinaryTreeOf(numLevelsDone).numNodes();
 		}
 
-		int segmentBegin(int subtreeOnLevel)
+		int64_t segmentBegin(int64_t subtreeOnLevel)
 		{
-			int numSettled = FullBinaryTreeOf(numLevelsDone).numNodes();
+			int64_t numSettled = FullBinaryTreeOf(numLevelsDone).numNodes();
 			int numLevelsTotal = BinaryTree::numLevelsFor(numPoints);
 			int numLevelsRemaining = numLevelsTotal - numLevelsDone;
 
-			int firstNodeInThisLevel = FullBinaryTreeOf(numLevelsDone).numNodes();
-			int numEarlierSubtreesOnSameLevel =
+			int64_t firstNodeInThisLevel = FullBinaryTreeOf(numLevelsDone).numNodes();
+			int64_t numEarlierSubtreesOnSameLevel =
 				subtreeOnLevel - firstNodeInThisLevel;
 
-			int numToLeftIfFull = numEarlierSubtreesOnSameLevel *
+			int64_t numToLeftIfFull = numEarlierSubtreesOnSameLevel *
 								FullBinaryTreeOf(numLevelsRemaining).numNodes();
 
-			int numToLeftOnLastIfFull =
+			int64_t numToLeftOnLastIfFull =
 				numEarlierSubtreesOnSameLevel *
 				FullBinaryTreeOf(numLevelsRemaining).numOnLastLevel();
 
-			int numTotalOnLastLevel =
+			int64_t numTotalOnLastLevel =
 				numPoints - FullBinaryTreeOf(numLevelsTotal - 1).numNodes();
 
-			int numReallyToLeftOnLast =
+			int64_t numReallyToLeftOnLast =
 				std::min(numTotalOnLastLevel, numToLeftOnLastIfFull);
-			int numMissingOnLast = numToLeftOnLastIfFull - numReallyToLeftOnLast;
+			int64_t numMissingOnLast = numToLeftOnLastIfFull - numReallyToLeftOnLast;
 
-			int result = numSettled + numToLeftIfFull - numMissingOnLast;
+			int64_t result = numSettled + numToLeftIfFull - numMissingOnLast;
 			return result;
 		}
 
-		int pivotPosOf(int subtree)
+		int64_t pivotPosOf(int64_t subtree)
 		{
-			int segBegin = segmentBegin(subtree);
-			int pivotPos = segBegin + sizeOfLeftSubtreeOf(subtree);
+			int64_t segBegin = segmentBegin(subtree);
+			int64_t pivotPos = segBegin + sizeOfLeftSubtreeOf(subtree);
 			return pivotPos;
 		}
 
-		int sizeOfLeftSubtreeOf(int subtree)
+		int64_t sizeOfLeftSubtreeOf(int64_t subtree)
 		{
-			int leftChildRoot = BinaryTree::leftChildOf(subtree);
+			int64_t leftChildRoot = BinaryTree::leftChildOf(subtree);
 			if (leftChildRoot >= numPoints)
 				return 0;
 			return ArbitraryBinaryTree(numPoints).numNodesInSubtree(leftChildRoot);
 		}
 
-		int sizeOfSegment(int n) const
+		int64_t sizeOfSegment(int64_t n) const
 		{
 			return ArbitraryBinaryTree(numPoints).numNodesInSubtree(n);
 		}
 
 		const int numLevelsDone;
-		const int numPoints;
+		const int64_t numPoints;
 	};
 }
 
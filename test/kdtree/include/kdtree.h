@@ -1,7 +1,16 @@
 #pragma once
 #include "box.hpp"
+#include "bruteforce.hpp"
+#include "bucket.hpp"
 #include "builder.hpp"
 #include "common.hpp"
+#include "dynamic.hpp"
+#include "grid.hpp"
 #include "helper.hpp"
 #include "knn.hpp"
+#include "outofcore.hpp"
+#include "packet.hpp"
+#include "parallel.hpp"
+#include "quantized.hpp"
+#include "range.hpp"
 #include "traverse.hpp"
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
+#include <type_traits>
+#include <vector>
 #include "traverse.hpp"
+#include "parallel.hpp"
 
 namespace kdTree 
 {
@@ -68,8 +71,159 @@ namespace kdTree
                 v = vmax;
             }
         }
+
+        /*! entries are always kept sorted, nothing to do */
+        void sort() {}
     };
 
+    /*! candidate list that keeps its k entries as a binary max-heap, with
+        the current k-th closest in entry[0]. A candidate that does not beat
+        the root costs one compare and one that does costs O(log k), instead
+        of the O(k) bubble FixedCandidateList does for every candidate -
+        which dominates once k gets large. It keeps exactly the same k
+        entries as FixedCandidateList, but in heap order until sort() is
+        called. */
+    template<int k>
+    struct HeapCandidateList : public CandidateList<k>
+    {
+        using CandidateList<k>::entry;
+
+        HeapCandidateList(float cutOffRadius) : CandidateList<k>(cutOffRadius)
+        {
+            for (int i=0;i<k;i++)
+                entry[i] = this->encode(cutOffRadius*cutOffRadius,-1);
+        }
+
+        float maxRadius2() const 
+        { return this->decode_dist2(entry[0]); }
+
+        float returnValue() const 
+        { return maxRadius2(); }
+
+        float processCandidate(int candPrimID, float candDist2)
+        {
+            push(candDist2,candPrimID);
+            return maxRadius2();
+        }
+
+        float initialCullDist2() const 
+        { return maxRadius2(); }
+
+        void push(float dist, int pointID)
+        {
+            const uint64_t v = this->encode(dist,pointID);
+            if (v >= entry[0]) return;
+            // replace the root and sift it down
+            int pos = 0;
+            while (true) 
+            {
+                int child = 2*pos+1;
+                if (child >= k) break;
+                if (child+1 < k && entry[child+1] > entry[child]) child++;
+                if (entry[child] <= v) break;
+                entry[pos] = entry[child];
+                pos = child;
+            }
+            entry[pos] = v;
+        }
+
+        /*! sorts the entries closest-first, so get_dist2/get_pointID(i)
+            return the i'th nearest. This destroys the heap, so it must be
+            the last thing done with the list after the query. */
+        void sort() 
+        { std::sort(entry,entry+k); }
+    };
+
+    /*! candidate list for trees with 2^31 or more nodes: the lists above
+        pack a point ID into the low 32 bits of each entry, so their IDs
+        wrap beyond that. This one keeps distances and 64-bit IDs in two
+        arrays, sorted closest-first by insertion like
+        FixedCandidateList; at the same k it moves twice the bytes per
+        shift, so only use it where the IDs need the range. */
+    template<int k>
+    struct WideCandidateList
+    {
+        WideCandidateList(float cutOffRadius)
+        {
+            for (int i=0;i<k;i++) 
+            {
+                dist2[i]   = cutOffRadius*cutOffRadius;
+                pointID[i] = -1;
+            }
+        }
+
+        float maxRadius2() const 
+        { return dist2[k-1]; }
+
+        float returnValue() const 
+        { return maxRadius2(); }
+
+        float processCandidate(int64_t candPrimID, float candDist2)
+        {
+            push(candDist2,candPrimID);
+            return maxRadius2();
+        }
+
+        float initialCullDist2() const 
+        { return maxRadius2(); }
+
+        void push(float dist, int64_t id)
+        {
+            if (!(dist < dist2[k-1])) return;
+            int pos = k-1;
+            for (;pos>0 && dist < dist2[pos-1];--pos) 
+            {
+                dist2[pos]   = dist2[pos-1];
+                pointID[pos] = pointID[pos-1];
+            }
+            dist2[pos]   = dist;
+            pointID[pos] = id;
+        }
+
+        /*! entries are always kept sorted, nothing to do */
+        void sort() {}
+
+        float   get_dist2(int i) const   { return dist2[i]; }
+        int64_t get_pointID(int i) const { return pointID[i]; }
+
+        float   dist2[k];
+        int64_t pointID[k];
+        enum { num_k = k };
+    };
+
+    /*! smallest k for which KnnCandidateList switches from the bubble list
+        to the heap (see BENCH_CANDIDATE_LISTS in test/main.cpp) */
+    enum { heapCandidateListMinK = 16 };
+
+    /*! the default candidate list for a fixed k; IDs are packed into 32
+        bits, so for trees of 2^31 nodes or more use WideCandidateList */
+    template<int k>
+    using KnnCandidateList = typename std::conditional<(k >= heapCandidateListMinK),
+                                                       HeapCandidateList<k>,
+                                                       FixedCandidateList<k>>::type;
+
+    /*! the k values that have compiled specializations for run-time k */
+    constexpr int supportedK[] = { 1, 3, 5, 8, 16, 32, 64 };
+
+    /*! calls body(std::integral_constant<int,K>()) with the compiled K
+        equal to k, so a run-time k can pick a fixed-size candidate list;
+        returns false, without calling body, for a k not in supportedK */
+    template<typename body_t>
+    inline bool dispatchK(int k, body_t &&body)
+    {
+        switch (k) 
+        {
+        case 1:  body(std::integral_constant<int,1>());  return true;
+        case 3:  body(std::integral_constant<int,3>());  return true;
+        case 5:  body(std::integral_constant<int,5>());  return true;
+        case 8:  body(std::integral_constant<int,8>());  return true;
+        case 16: body(std::integral_constant<int,16>()); return true;
+        case 32: body(std::integral_constant<int,32>()); return true;
+        case 64: body(std::integral_constant<int,64>()); return true;
+        default: return false;
+        }
+    }
+
     template<int k>
     struct BruteForceResult 
     {
@@ -96,21 +250,16 @@ namespace kdTree
             }
         }
         
+        /*! insertion into the sorted entries; a candidate no closer than
+            the k'th is dropped, equal distances keep their arrival order */
         void addCandidate(float dist2, int pointID) 
         {
-            if (count < k) 
-            {
-                entries[count].dist2 = dist2;
-                entries[count].pointID = pointID;
-                count++;
-                std::sort(entries, entries + count);
-            } 
-            else if (dist2 < entries[k-1].dist2) 
-            {
-                entries[k-1].dist2 = dist2;
-                entries[k-1].pointID = pointID;
-                std::sort(entries, entries + k);
-            }
+            if (count == k && !(dist2 < entries[k-1].dist2)) return;
+            int pos = count < k ? count++ : k-1;
+            for (;pos>0 && dist2 < entries[pos-1].dist2;--pos) 
+                entries[pos] = entries[pos-1];
+            entries[pos].dist2 = dist2;
+            entries[pos].pointID = pointID;
         }
         
         float get_dist2(int i) const 
@@ -125,14 +274,21 @@ namespace kdTree
     };
 
 
-    template<typename CandidateList, typename data_t, typename data_traits=default_data_traits<data_t>>
-    inline float knn(CandidateList &result, typename data_traits::point_t queryPoint, const data_t *d_nodes, int N);
+    template<typename CandidateList, typename data_t, typename data_traits=default_data_traits<data_t>,
+             typename layout_t=BreadthFirstLayout>
+    inline float knn(CandidateList &result, typename data_traits::point_t queryPoint, const data_t *d_nodes, int64_t N, float eps=0.0f);
     
-    template<typename CandidateList, typename data_t, typename data_traits=default_data_traits<data_t>>
-    inline float knn(CandidateList &result, typename data_traits::point_t queryPoint, const box_t<typename data_traits::point_t> worldBounds, const data_t *d_nodes, int N)
+    /*! k-nearest query with the tree's world bounds: returns right away
+        for queries out of range of the whole tree, and otherwise prunes
+        far subtrees on their full box distance (traverse_box_pruned()).
+        Same results as knn() without bounds; eps and layout_t as there. */
+    template<typename CandidateList, typename data_t, typename data_traits=default_data_traits<data_t>,
+             typename layout_t=BreadthFirstLayout>
+    inline float knn(CandidateList &result, typename data_traits::point_t queryPoint, const box_t<typename data_traits::point_t> &worldBounds, 
+                     const data_t *d_nodes, int64_t N, float eps=0.0f)
     {
-        /* TODO: add early-out if distance to worldbounds is >= max query dist */
-        return knn<CandidateList,data_t,data_traits>(result,queryPoint,worldBounds,d_nodes,N);
+        traverse_box_pruned<CandidateList,data_t,data_traits,layout_t>(result,queryPoint,worldBounds,d_nodes,N,eps);
+        return result.returnValue();
     }
 
 
@@ -176,14 +332,226 @@ namespace kdTree
     { return int(uint32_t(v)); }
 
 
-    template<typename CandidateList, typename data_t, typename data_traits>
-    inline float knn(CandidateList &result, typename data_traits::point_t queryPoint, const data_t *d_nodes, int N)
+    /*! k-nearest query on the implicit tree. With eps > 0 a far subtree is
+        only entered if its split plane is closer than the current k-th
+        distance divided by sqrt(1+eps), so every returned distance is at
+        most sqrt(1+eps) times the exact one; eps=0 is the exact query.
+        layout_t is the node order of d_nodes (see BlockedLayout); the
+        returned pointIDs are array slots either way. */
+    template<typename CandidateList, typename data_t, typename data_traits, typename layout_t>
+    inline float knn(CandidateList &result, typename data_traits::point_t queryPoint, const data_t *d_nodes, int64_t N, float eps)
     {
-        traverse_stack_free<CandidateList,data_t,data_traits>(result,queryPoint,d_nodes,N);
+        traverse_stack_free<CandidateList,data_t,data_traits,layout_t>(result,queryPoint,d_nodes,N,eps);
         return result.returnValue();
     }
 
 
+    /*! runs numQueries k-nearest-neighbour queries on the given pool,
+        with query(result,queryPoint) doing the actual search (so that any
+        tree layout can plug in). Results are written structure-of-arrays
+        into caller-owned memory: query q's neighbours go to
+        outIDs[q*k .. q*k+k) and their squared distances to
+        outDist2[q*k .. q*k+k), closest first, with ID -1 for slots that
+        found nothing within cutOffRadius (CandidateList::sort() is called
+        before reading the results). The candidate list lives on the
+        stack, so there is no allocation (and nothing that throws) per
+        query. outIDs is int for the packed candidate lists and may be
+        int64_t together with WideCandidateList. */
+    template<typename CandidateList, typename point_t, typename query_t, typename id_t>
+    inline void knnBatchWith(ThreadPool &pool,
+                             const point_t *queries,
+                             int64_t numQueries,
+                             float cutOffRadius,
+                             const query_t &query,
+                             id_t *outIDs,
+                             float *outDist2,
+                             int64_t queriesPerTask = 1024)
+    {
+        enum { k = CandidateList::num_k };
+        const int64_t numTasks = (numQueries + queriesPerTask - 1) / queriesPerTask;
+        pool.run(numTasks,[&](int64_t task)
+        {
+            const int64_t begin = task * queriesPerTask;
+            const int64_t end   = std::min(numQueries, begin + queriesPerTask);
+            for (int64_t q=begin;q<end;q++) 
+            {
+                CandidateList result(cutOffRadius);
+                query(result,queries[q]);
+                result.sort();
+                for (int i=0;i<k;i++) 
+                {
+                    outIDs[q*k+i]   = result.get_pointID(i);
+                    outDist2[q*k+i] = result.get_dist2(i);
+                }
+            }
+        });
+    }
+
+    /*! relative slack on a warm-start radius (see knnSweepBatchWith()),
+        covering the float rounding of the bound and of the distances it
+        is compared with */
+    constexpr float warmStartSlack = 1.f + 1e-5f;
+
+    /*! knnBatchWith() for coherent query sequences, such as the voxels of
+        a resampling grid in row order. All k neighbours of the previous
+        query lie within its k-th distance r of it, so by the triangle
+        inequality the current query's k nearest lie within r + |step|.
+        Each query therefore starts with that bound as its cull radius
+        (when smaller than cutOffRadius) instead of cutOffRadius, which
+        prunes from the first node on. Results are the same as
+        knnBatchWith(); the first query of every task starts cold. */
+    template<typename CandidateList, typename point_t, typename query_t, typename id_t>
+    inline void knnSweepBatchWith(ThreadPool &pool,
+                                  const point_t *queries,
+                                  int64_t numQueries,
+                                  float cutOffRadius,
+                                  const query_t &query,
+                                  id_t *outIDs,
+                                  float *outDist2,
+                                  int64_t queriesPerTask = 1024)
+    {
+        enum { k = CandidateList::num_k };
+        const int64_t numTasks = (numQueries + queriesPerTask - 1) / queriesPerTask;
+        pool.run(numTasks,[&](int64_t task)
+        {
+            const int64_t begin = task * queriesPerTask;
+            const int64_t end   = std::min(numQueries, begin + queriesPerTask);
+            float prevDist2 = 0.f;
+            for (int64_t q=begin;q<end;q++) 
+            {
+                float radius = cutOffRadius;
+                if (q > begin) 
+                {
+                    const float step = std::sqrt(float(sqrDistance(queries[q],queries[q-1])));
+                    radius = std::min(cutOffRadius,(std::sqrt(prevDist2) + step) * warmStartSlack);
+                }
+                CandidateList result(radius);
+                query(result,queries[q]);
+                result.sort();
+                for (int i=0;i<k;i++) 
+                {
+                    outIDs[q*k+i]   = result.get_pointID(i);
+                    outDist2[q*k+i] = result.get_dist2(i);
+                }
+                // with fewer than k found this is radius^2, still a bound
+                prevDist2 = result.get_dist2(k-1);
+            }
+        });
+    }
+
+    /*! knnBatchWith() over the implicit (one point per node) k-d tree;
+        eps as in knn() */
+    template<typename CandidateList, typename data_t, typename data_traits=default_data_traits<data_t>, typename id_t>
+    inline void knnBatch(ThreadPool &pool,
+                         const typename data_traits::point_t *queries,
+                         int64_t numQueries,
+                         float cutOffRadius,
+                         const data_t *d_nodes,
+                         int64_t N,
+                         id_t *outIDs,
+                         float *outDist2,
+                         int64_t queriesPerTask = 1024,
+                         float eps = 0.0f)
+    {
+        knnBatchWith<CandidateList>(pool,queries,numQueries,cutOffRadius,
+                                    [d_nodes,N,eps](CandidateList &result, const typename data_traits::point_t &queryPoint)
+                                    { knn<CandidateList,data_t,data_traits>(result,queryPoint,d_nodes,N,eps); },
+                                    outIDs,outDist2,queriesPerTask);
+    }
+
+    /*! result wrapper for querying a tree with one of its own points:
+        node 'excluded' (the query itself) is never a candidate, every
+        other node is - including duplicates at the same position */
+    template<typename CandidateList>
+    struct ExcludingCandidates
+    {
+        float initialCullDist2() const
+        { return list.initialCullDist2(); }
+
+        float processCandidate(int64_t candPrimID, float candDist2)
+        {
+            return candPrimID == excluded ? list.maxRadius2() : list.processCandidate(candPrimID,candDist2);
+        }
+
+        CandidateList &list;
+        int64_t excluded;
+    };
+
+    /*! the k-nearest-neighbour graph of the tree's own points, in CSR
+        form: row i (node i) lists its neighbours, closest first, as node
+        IDs in neighbors[offsets[i] .. offsets[i+1]) with their squared
+        distances in dist2. A node is never its own neighbour. Rows have
+        k entries unless fewer other points lie within cutOffRadius, so
+        with a radius covering the whole tree (and N > k) offsets[i] is
+        simply i*k.
+
+        Rows are queried in node order, queriesPerTask per pool task; a
+        task reuses one candidate list for all its rows, starts each row
+        with the warm-start bound of the one before (neighbouring nodes
+        on a level are neighbouring cells), and writes them into fixed
+        k-wide slots. A final pass closes the gaps of the rows that came
+        up short (none, in the common case). */
+    template<typename CandidateList, typename data_t, typename data_traits=default_data_traits<data_t>, typename id_t>
+    inline void knnGraph(ThreadPool &pool,
+                         const data_t *d_nodes,
+                         int64_t N,
+                         float cutOffRadius,
+                         std::vector<int64_t> &offsets,
+                         std::vector<id_t> &neighbors,
+                         std::vector<float> &dist2,
+                         int64_t queriesPerTask = 1024)
+    {
+        enum { k = CandidateList::num_k };
+        offsets.assign(N+1,0);
+        neighbors.resize(N*k);
+        dist2.resize(N*k);
+        const int64_t numTasks = (N + queriesPerTask - 1) / queriesPerTask;
+        pool.run(numTasks,[&](int64_t task)
+        {
+            const int64_t begin = task * queriesPerTask;
+            const int64_t end   = std::min(N, begin + queriesPerTask);
+            CandidateList result(cutOffRadius);
+            float prevDist2 = 0.f;
+            for (int64_t q=begin;q<end;q++) 
+            {
+                // warm start from the previous row as in knnSweepBatchWith()
+                float radius = cutOffRadius;
+                if (q > begin) 
+                {
+                    const float step = std::sqrt(float(sqrDistance(data_traits::get_point(d_nodes[q]),data_traits::get_point(d_nodes[q-1]))));
+                    radius = std::min(cutOffRadius,(std::sqrt(prevDist2) + step) * warmStartSlack);
+                }
+                result = CandidateList(radius);
+                ExcludingCandidates<CandidateList> excludeSelf{ result, q };
+                traverse_stack_free<decltype(excludeSelf),data_t,data_traits>
+                    (excludeSelf,data_traits::get_point(d_nodes[q]),d_nodes,N);
+                result.sort();
+                int found = 0;
+                for (;found<k && result.get_pointID(found) >= 0;found++) 
+                {
+                    neighbors[q*k+found] = id_t(result.get_pointID(found));
+                    dist2[q*k+found]     = result.get_dist2(found);
+                }
+                offsets[q+1] = found;
+                prevDist2 = result.get_dist2(k-1);
+            }
+        });
+
+        for (int64_t q=0;q<N;q++)
+            offsets[q+1] += offsets[q];
+        if (offsets[N] == N*k) return;
+        // rows only move towards the front, so this can run in place
+        for (int64_t q=0;q<N;q++) 
+        {
+            if (offsets[q] == q*k) continue;
+            const int64_t count = offsets[q+1] - offsets[q];
+            std::copy(neighbors.begin()+q*k,neighbors.begin()+q*k+count,neighbors.begin()+offsets[q]);
+            std::copy(dist2.begin()+q*k,dist2.begin()+q*k+count,dist2.begin()+offsets[q]);
+        }
+        neighbors.resize(offsets[N]);
+        dist2.resize(offsets[N]);
+    }
+
     template<int k>
     BruteForceResult<k> bruteForceKNN(const std::vector<float3>& points, const float3& queryPoint, float maxRadius = std::numeric_limits<float>::max()) 
     {
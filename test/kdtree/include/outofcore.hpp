@@ -0,0 +1,506 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "helper.hpp"
+#include "common.hpp"
+#include "box.hpp"
+#include "builder.hpp"
+#include "traverse.hpp"
+
+namespace kdTree
+{
+    /*! settings for buildTreeOutOfCore() */
+    struct OutOfCoreConfig
+    {
+        /*! bytes the builder may use for points at any time: the input
+            read buffer, the partition write buffers, and one partition
+            plus its build scratch */
+        size_t  memoryBudget = size_t(256) << 20;
+        /*! points sampled from the input to place the partition planes */
+        int64_t sampleSize = 1 << 16;
+        /*! the temporary per-partition files are <tempPrefix>.part<i>;
+            empty means next to the tree file */
+        std::string tempPrefix;
+        int numThreads = 1;
+    };
+
+    /*! what buildTreeOutOfCore() did */
+    struct OutOfCoreStats
+    {
+        int64_t numPoints     = 0;
+        int     numChunks     = 0;
+        int64_t largestChunk  = 0; /*! points in the biggest partition */
+        int64_t maxChunkSize  = 0; /*! points a partition could have had within the budget */
+    };
+
+    /*! on-disk layout of a chunked tree file: this header, numChunks-1
+        ChunkedTreeSplit (the top tree, breadth first), numChunks
+        ChunkedTreeChunk, then every chunk's nodes as a complete implicit
+        kd-tree of its own, starting at a page-aligned fileOffset */
+    struct ChunkedTreeHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t nodeBytes;
+        uint32_t numDims;
+        uint32_t numChunks;
+        uint64_t numNodes;
+    };
+
+    /*! one plane of the top tree: points with coord < value go left */
+    struct ChunkedTreeSplit
+    {
+        int32_t dim;
+        float   value;
+    };
+
+    template<typename point_t>
+    struct ChunkedTreeChunk
+    {
+        uint64_t       fileOffset;
+        uint64_t       firstNode;  /*! global ID of the chunk's node 0 */
+        uint64_t       numNodes;
+        box_t<point_t> bounds;     /*! of the chunk's points, empty if there are none */
+    };
+
+    namespace outofcore
+    {
+        static const char     magic[8]  = {'K','D','C','H','U','N','K','S'};
+        static const uint32_t version   = 1;
+        static const uint64_t alignment = 4096;
+
+        inline uint64_t alignUp(uint64_t x)
+        { return (x + alignment - 1) / alignment * alignment; }
+
+        /*! chunk a point falls into when routed through the top tree */
+        template<typename point_t>
+        inline int route(const std::vector<ChunkedTreeSplit> &splits, int numChunks, const point_t &p)
+        {
+            int64_t node = 0;
+            while (node < numChunks-1)
+            {
+                const ChunkedTreeSplit &s = splits[node];
+                node = 2*node + 1 + (get_coord(p,s.dim) >= s.value);
+            }
+            return int(node - (numChunks-1));
+        }
+
+        /*! top tree over a sample: the widest dimension of the subset's
+            bounds, split at its median, recursively, so every leaf gets
+            about the same number of sample points */
+        template<typename point_t>
+        inline void chooseSplits(std::vector<point_t> &sample, int64_t begin, int64_t end,
+                                 int64_t node, int64_t numInner,
+                                 std::vector<ChunkedTreeSplit> &splits)
+        {
+            if (node >= numInner) return;
+            box_t<point_t> bounds;
+            bounds.setEmpty();
+            for (int64_t i=begin;i<end;i++) bounds.grow(sample[i]);
+            ChunkedTreeSplit &s = splits[node];
+            s.dim   = 0;
+            s.value = 0.f;
+            int64_t mid = begin;
+            if (end > begin)
+            {
+                s.dim = bounds.widestDimension();
+                mid = begin + (end-begin)/2;
+                const int dim = s.dim;
+                std::nth_element(sample.begin()+begin,sample.begin()+mid,sample.begin()+end,
+                                 [dim](const point_t &a, const point_t &b)
+                                 { return get_coord(a,dim) < get_coord(b,dim); });
+                s.value = get_coord(sample[mid],dim);
+                // everything below 'value' is left of mid, ties may be on both sides
+                mid = std::partition(sample.begin()+begin,sample.begin()+end,
+                                     [dim,&s](const point_t &a)
+                                     { return get_coord(a,dim) < s.value; }) - sample.begin();
+            }
+            chooseSplits(sample,begin,mid,2*node+1,numInner,splits);
+            chooseSplits(sample,mid,end,2*node+2,numInner,splits);
+        }
+
+        inline std::string partPath(const std::string &prefix, int chunk)
+        { return prefix + ".part" + std::to_string(chunk); }
+
+        /*! removes its files when it goes out of scope, so a build that
+            throws leaves neither part files nor a half-written tree
+            behind; release() keeps them */
+        struct FileGuard
+        {
+            FileGuard() = default;
+            FileGuard(const FileGuard &) = delete;
+            FileGuard &operator=(const FileGuard &) = delete;
+            ~FileGuard() { for (const auto &path : paths) std::remove(path.c_str()); }
+
+            void add(const std::string &path) { paths.push_back(path); }
+            void release() { paths.clear(); }
+
+            std::vector<std::string> paths;
+        };
+
+        /*! reads the input file record by record, a block at a time */
+        template<typename record_t>
+        struct RecordReader
+        {
+            RecordReader(const std::string &path, uint64_t firstByte, size_t blockBytes)
+                : file(path,std::ios::binary),
+                  block(std::max<size_t>(1,blockBytes / sizeof(record_t)))
+            {
+                if (!file)
+                    throw std::runtime_error("buildTreeOutOfCore: cannot open input '"+path+"'");
+                file.seekg(0,std::ios::end);
+                const uint64_t size = uint64_t(file.tellg());
+                numRecords = size > firstByte ? (size - firstByte) / sizeof(record_t) : 0;
+                this->firstByte = firstByte;
+            }
+
+            /*! calls fn(record,index) for every record */
+            template<typename Fn>
+            void forEach(const Fn &fn)
+            {
+                file.clear();
+                file.seekg(std::streamoff(firstByte));
+                for (uint64_t i=0;i<numRecords;i+=block.size())
+                {
+                    const size_t n = size_t(std::min<uint64_t>(block.size(),numRecords-i));
+                    if (!file.read(reinterpret_cast<char*>(block.data()),std::streamsize(n*sizeof(record_t))))
+                        throw std::runtime_error("buildTreeOutOfCore: short read from the input");
+                    for (size_t j=0;j<n;j++) fn(block[j],int64_t(i+j));
+                }
+            }
+
+            std::ifstream         file;
+            std::vector<record_t> block;
+            uint64_t              firstByte;
+            uint64_t              numRecords;
+        };
+    }
+
+    /*! builds a kd-tree over a point set that does not have to fit into
+        memory, and writes it to a chunked tree file (see
+        ChunkedTreeHeader) that ChunkedTree pages in for queries.
+
+        The input is a file of record_t, starting at byte firstByte;
+        toNode(record,index) turns the index'th record into a data_t
+        (typically a payload_point with id = index). It is streamed three
+        times:
+        - once for a regular sample, from which a top tree of median
+          planes (widest dimension first) is chosen, with enough leaves
+          that each partition's expected share of the points, plus the
+          build scratch, fits into a quarter-slack memory budget;
+        - once to route every point through the top tree and append it to
+          its partition's temporary file, through per-partition write
+          buffers that together take a quarter of the budget;
+        - then each partition is read back on its own, built with
+          buildTree_partition(), and written as one chunk.
+        Chunk bounds are the tight bounds of the chunk's points, so a
+        query can skip chunks by box distance without the top tree.
+
+        Throws std::runtime_error on I/O errors, and if a partition turns
+        out larger than the budget allows (very clustered inputs, e.g.
+        many identical points, that the sample could not split) */
+    template<typename data_t, typename data_traits=default_data_traits<data_t>,
+             typename record_t, typename convert_t>
+    inline OutOfCoreStats buildTreeOutOfCore(const std::string &inputPath,
+                                             uint64_t firstByte,
+                                             const convert_t &toNode,
+                                             const std::string &treePath,
+                                             const OutOfCoreConfig &config = OutOfCoreConfig())
+    {
+        using point_t = typename data_traits::point_t;
+        enum { num_dims = num_dims_of<point_t>::value };
+        const size_t nodeBytes = sizeof(data_t);
+        const std::string prefix = config.tempPrefix.empty() ? treePath : config.tempPrefix;
+
+        OutOfCoreStats stats;
+        outofcore::RecordReader<record_t> reader(inputPath,firstByte,config.memoryBudget/4);
+        const int64_t N = int64_t(reader.numRecords);
+        stats.numPoints = N;
+
+        // a partition and its scratch buffer (2 nodes per point) have to fit
+        stats.maxChunkSize = int64_t(config.memoryBudget / (2*nodeBytes));
+        if (stats.maxChunkSize < 1)
+            throw std::runtime_error("buildTreeOutOfCore: memory budget is smaller than two nodes");
+        const int64_t target = std::max<int64_t>(1,stats.maxChunkSize*3/4);
+        int numChunks = 1;
+        while (int64_t(numChunks)*target < N) numChunks *= 2;
+        stats.numChunks = numChunks;
+
+        // pass 1: every stride'th point is sampled
+        std::vector<ChunkedTreeSplit> splits(numChunks-1);
+        if (numChunks > 1)
+        {
+            const int64_t sampleSize = std::max<int64_t>(config.sampleSize,4*numChunks);
+            const int64_t stride = std::max<int64_t>(1,N / sampleSize);
+            std::vector<point_t> sample;
+            sample.reserve(size_t(N / stride + 1));
+            reader.forEach([&](const record_t &r, int64_t i)
+            {
+                if (i % stride == 0)
+                    sample.push_back(data_traits::get_point(toNode(r,i)));
+            });
+            outofcore::chooseSplits(sample,0,int64_t(sample.size()),0,numChunks-1,splits);
+        }
+
+        // pass 2: scatter the points to their partitions' files
+        outofcore::FileGuard partFiles;
+        for (int c=0;c<numChunks;c++)
+            partFiles.add(outofcore::partPath(prefix,c));
+        std::vector<int64_t> partSize(numChunks,0);
+        {
+            const size_t bufferNodes = std::max<size_t>(64,config.memoryBudget/4/nodeBytes/numChunks);
+            std::vector<std::vector<data_t>> buffers(numChunks);
+            for (int c=0;c<numChunks;c++)
+                std::ofstream(outofcore::partPath(prefix,c),std::ios::binary|std::ios::trunc);
+            auto flush = [&](int c)
+            {
+                std::ofstream out(outofcore::partPath(prefix,c),std::ios::binary|std::ios::app);
+                if (!out.write(reinterpret_cast<const char*>(buffers[c].data()),std::streamsize(buffers[c].size()*nodeBytes)))
+                    throw std::runtime_error("buildTreeOutOfCore: cannot write '"+outofcore::partPath(prefix,c)+"'");
+                buffers[c].clear();
+            };
+            reader.forEach([&](const record_t &r, int64_t i)
+            {
+                const data_t node = toNode(r,i);
+                const int c = outofcore::route(splits,numChunks,data_traits::get_point(node));
+                if (buffers[c].empty()) buffers[c].reserve(bufferNodes);
+                buffers[c].push_back(node);
+                partSize[c]++;
+                if (buffers[c].size() >= bufferNodes) flush(c);
+            });
+            for (int c=0;c<numChunks;c++)
+            {
+                if (!buffers[c].empty()) flush(c);
+                std::vector<data_t>().swap(buffers[c]);
+            }
+        }
+        reader.block = std::vector<record_t>();
+
+        // pass 3: build every partition on its own and append it as a chunk;
+        // the tree file is removed again unless the build completes (the
+        // guard outlives the stream, so the file is closed first)
+        outofcore::FileGuard treeFile;
+        std::ofstream out(treePath,std::ios::binary|std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("buildTreeOutOfCore: cannot create '"+treePath+"'");
+        treeFile.add(treePath);
+        ChunkedTreeHeader header;
+        std::memcpy(header.magic,outofcore::magic,sizeof(header.magic));
+        header.version   = outofcore::version;
+        header.nodeBytes = uint32_t(nodeBytes);
+        header.numDims   = num_dims;
+        header.numChunks = uint32_t(numChunks);
+        header.numNodes  = uint64_t(N);
+        std::vector<ChunkedTreeChunk<point_t>> chunks(numChunks);
+        const uint64_t tableBytes
+            = sizeof(header) + splits.size()*sizeof(ChunkedTreeSplit) + chunks.size()*sizeof(ChunkedTreeChunk<point_t>);
+
+        std::vector<data_t> nodes;
+        BuildScratch<data_t> scratch;
+        uint64_t offset = outofcore::alignUp(tableBytes);
+        uint64_t firstNode = 0;
+        for (int c=0;c<numChunks;c++)
+        {
+            const std::string path = outofcore::partPath(prefix,c);
+            if (partSize[c] > stats.maxChunkSize)
+                throw std::runtime_error("buildTreeOutOfCore: partition "+std::to_string(c)+" has "
+                                         +std::to_string(partSize[c])+" points, the memory budget allows "
+                                         +std::to_string(stats.maxChunkSize));
+            nodes.resize(size_t(partSize[c]));
+            {
+                std::ifstream in(path,std::ios::binary);
+                if (!in.read(reinterpret_cast<char*>(nodes.data()),std::streamsize(nodes.size()*nodeBytes)))
+                    throw std::runtime_error("buildTreeOutOfCore: cannot read back '"+path+"'");
+            }
+            std::remove(path.c_str());
+
+            ChunkedTreeChunk<point_t> &chunk = chunks[c];
+            chunk.fileOffset = offset;
+            chunk.firstNode  = firstNode;
+            chunk.numNodes   = uint64_t(partSize[c]);
+            chunk.bounds.setEmpty();
+            if (!nodes.empty())
+            {
+                buildTree_partition<data_t,data_traits>(nodes.data(),int64_t(nodes.size()),&chunk.bounds,scratch,config.numThreads);
+                out.seekp(std::streamoff(offset));
+                out.write(reinterpret_cast<const char*>(nodes.data()),std::streamsize(nodes.size()*nodeBytes));
+            }
+            stats.largestChunk = std::max(stats.largestChunk,partSize[c]);
+            offset = outofcore::alignUp(offset + chunk.numNodes*nodeBytes);
+            firstNode += chunk.numNodes;
+        }
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+        out.write(reinterpret_cast<const char*>(splits.data()),std::streamsize(splits.size()*sizeof(ChunkedTreeSplit)));
+        out.write(reinterpret_cast<const char*>(chunks.data()),std::streamsize(chunks.size()*sizeof(ChunkedTreeChunk<point_t>)));
+        out.close();
+        if (!out)
+            throw std::runtime_error("buildTreeOutOfCore: cannot write '"+treePath+"'");
+        treeFile.release();
+        return stats;
+    }
+
+    /*! result adapter for traverse_stack_free over one chunk of a
+        ChunkedTree: reports chunk-local node IDs as global ones */
+    template<typename CandidateList>
+    struct OffsetCandidates
+    {
+        float initialCullDist2() const
+        { return result.initialCullDist2(); }
+
+        float processCandidate(int64_t nodeID, float candDist2)
+        { return result.processCandidate(firstNode + nodeID,candDist2); }
+
+        CandidateList &result;
+        int64_t        firstNode;
+    };
+
+    /*! a tree written by buildTreeOutOfCore(), read back a chunk at a
+        time: only the header, top tree and chunk table are kept in
+        memory, chunks are loaded when a query first needs them and
+        evicted least-recently-used once more than cacheBytes of nodes
+        are loaded (the chunk in use is always kept, so a single chunk
+        larger than cacheBytes still works).
+
+        Node IDs are global: chunk c's nodes are [firstNode, firstNode +
+        numNodes). Queries and node() load chunks, so a ChunkedTree is
+        not thread safe; open one per thread. Throws std::runtime_error
+        if the file is missing, truncated or was written for a different
+        data_t */
+    template<typename data_t, typename data_traits=default_data_traits<data_t>>
+    class ChunkedTree
+    {
+    public:
+        using point_t = typename data_traits::point_t;
+        using Chunk   = ChunkedTreeChunk<point_t>;
+        enum { num_dims = num_dims_of<point_t>::value };
+
+        ChunkedTree(const std::string &path, size_t cacheBytes)
+            : file(path,std::ios::binary), cacheBytes(cacheBytes)
+        {
+            if (!file)
+                throw std::runtime_error("ChunkedTree: cannot open '"+path+"'");
+            ChunkedTreeHeader header;
+            if (!file.read(reinterpret_cast<char*>(&header),sizeof(header))
+                || std::memcmp(header.magic,outofcore::magic,sizeof(header.magic)) != 0
+                || header.version != outofcore::version)
+                throw std::runtime_error("ChunkedTree: '"+path+"' is not a chunked tree file");
+            if (header.nodeBytes != sizeof(data_t) || header.numDims != uint32_t(num_dims) || header.numChunks == 0)
+                throw std::runtime_error("ChunkedTree: '"+path+"' was written for a different node type");
+            numTotal = int64_t(header.numNodes);
+            splits.resize(header.numChunks-1);
+            chunks.resize(header.numChunks);
+            file.read(reinterpret_cast<char*>(splits.data()),std::streamsize(splits.size()*sizeof(ChunkedTreeSplit)));
+            file.read(reinterpret_cast<char*>(chunks.data()),std::streamsize(chunks.size()*sizeof(Chunk)));
+            if (!file)
+                throw std::runtime_error("ChunkedTree: '"+path+"' is truncated");
+            loaded.resize(chunks.size());
+            lruPos.resize(chunks.size(),lru.end());
+        }
+
+        int64_t numNodes() const { return numTotal; }
+        int numChunks() const { return int(chunks.size()); }
+        const Chunk &chunk(int c) const { return chunks[c]; }
+
+        /*! chunk whose partition contains p */
+        int chunkOf(const point_t &p) const
+        { return outofcore::route(splits,numChunks(),p); }
+
+        /*! chunk c's nodes (loading them if needed); valid until the
+            next call that loads another chunk */
+        const data_t *page(int c)
+        {
+            if (lruPos[c] != lru.end())
+            {
+                lru.splice(lru.begin(),lru,lruPos[c]);
+                return loaded[c].data();
+            }
+            const size_t bytes = size_t(chunks[c].numNodes)*sizeof(data_t);
+            while (!lru.empty() && loadedBytes + bytes > cacheBytes)
+            {
+                const int victim = lru.back();
+                lru.pop_back();
+                lruPos[victim] = lru.end();
+                loadedBytes -= loaded[victim].size()*sizeof(data_t);
+                std::vector<data_t>().swap(loaded[victim]);
+            }
+            loaded[c].resize(size_t(chunks[c].numNodes));
+            file.clear();
+            file.seekg(std::streamoff(chunks[c].fileOffset));
+            if (!file.read(reinterpret_cast<char*>(loaded[c].data()),std::streamsize(bytes)))
+                throw std::runtime_error("ChunkedTree: cannot read chunk "+std::to_string(c));
+            lru.push_front(c);
+            lruPos[c] = lru.begin();
+            loadedBytes += bytes;
+            numLoads++;
+            return loaded[c].data();
+        }
+
+        const data_t &node(int64_t nodeID)
+        {
+            const auto it = std::upper_bound(chunks.begin(),chunks.end(),uint64_t(nodeID),
+                                             [](uint64_t id, const Chunk &c) { return id < c.firstNode; });
+            // empty chunks share their firstNode with the next one
+            int c = int(it - chunks.begin()) - 1;
+            while (chunks[c].numNodes == 0) --c;
+            return page(c)[nodeID - int64_t(chunks[c].firstNode)];
+        }
+
+        /*! k-nearest query over all chunks, sharing one candidate list:
+            chunks are visited closest-bounds first, and the walk stops
+            at the first one that is out of range. Candidates are
+            global node IDs. eps as in knn(). */
+        template<typename CandidateList>
+        float knn(CandidateList &result, const point_t &queryPoint, float eps = 0.0f)
+        {
+            const float epsErr = 1.f + eps;
+            order.clear();
+            const float cull = result.initialCullDist2();
+            for (int c=0;c<numChunks();c++)
+            {
+                if (chunks[c].numNodes == 0) continue;
+                const float d2 = sqrDistance(chunks[c].bounds,queryPoint);
+                if (d2*epsErr < cull) order.push_back({d2,c});
+            }
+            std::sort(order.begin(),order.end());
+            for (const auto &o : order)
+            {
+                if (o.first*epsErr >= result.initialCullDist2()) break;
+                const int c = o.second;
+                const data_t *nodes = page(c);
+                OffsetCandidates<CandidateList> offsetResult{result,int64_t(chunks[c].firstNode)};
+                traverse_stack_free<decltype(offsetResult),data_t,data_traits>
+                    (offsetResult,queryPoint,nodes,int64_t(chunks[c].numNodes),eps);
+            }
+            return result.returnValue();
+        }
+
+        /*! chunks read from disk so far */
+        int64_t numChunkLoads() const { return numLoads; }
+        size_t  bytesLoaded() const { return loadedBytes; }
+
+    private:
+        std::ifstream                      file;
+        std::vector<ChunkedTreeSplit>      splits;
+        std::vector<Chunk>                 chunks;
+        std::vector<std::vector<data_t>>   loaded;
+        std::list<int>                     lru;
+        std::vector<std::list<int>::iterator> lruPos;
+        std::vector<std::pair<float,int>>  order;
+        size_t                             cacheBytes;
+        size_t                             loadedBytes = 0;
+        int64_t                            numTotal    = 0;
+        int64_t                            numLoads    = 0;
+    };
+}
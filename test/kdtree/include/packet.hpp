@@ -0,0 +1,229 @@
+#pragma once
+#include <new>
+#include "knn.hpp"
+
+namespace kdTree
+{
+    /*! number of tree levels, starting at the root, on which all queries
+        of a packet fall on the same side of the split plane - i.e. how
+        deep the packet walks as a single path before it has to split */
+    template<typename data_t, typename data_traits=default_data_traits<data_t>>
+    inline int packetSharedLevels(const typename data_traits::point_t *queries,
+                                  int numQueries,
+                                  const data_t *d_nodes,
+                                  int64_t N)
+    {
+        using point_t = typename data_traits::point_t;
+        enum { num_dims = num_dims_of<point_t>::value };
+        int64_t node = 0;
+        int level = 0;
+        while (node < N)
+        {
+            const int dim
+                = data_traits::has_explicit_dim
+                ? data_traits::get_dim(d_nodes[node])
+                : (BinaryTree::levelOf(node) % num_dims);
+            const float split = data_traits::get_coord(d_nodes[node],dim);
+            int numRight = 0;
+            for (int l=0;l<numQueries;l++)
+                numRight += get_coord(queries[l],dim) > split;
+            if (numRight != 0 && numRight != numQueries) return level;
+            node = 2*node + 1 + (numRight != 0);
+            level++;
+        }
+        return level;
+    }
+
+    /*! k-nearest queries for a packet of up to W spatially coherent query
+        points (e.g. neighbouring voxels of a resampling grid), walked
+        together: every node is fetched once for the whole packet, and the
+        distance and split-plane tests run over all lanes at once. Each lane
+        keeps its own candidate list and cull distance; a subtree is only
+        entered by the lanes that can still find something in it, so with
+        eps == 0 the results are exactly those of knn() per query. The
+        packet descends into the side most of its active lanes are on,
+        which is not always the side knn() would take first; with eps > 0
+        the pruning depends on that order, so the results may differ from
+        knn()'s but keep the same sqrt(1+eps) bound on every distance.
+
+        If the packet's queries already split more than maxDivergentLevels
+        levels above the leaves, the paths share too little for the packet
+        to pay off, and every query runs through knn() on its own instead. */
+    template<typename CandidateList, int W, typename data_t, typename data_traits=default_data_traits<data_t>>
+    inline void knnPacket(CandidateList *results,
+                          const typename data_traits::point_t *queries,
+                          int numQueries,
+                          const data_t *d_nodes,
+                          int64_t N,
+                          float eps = 0.0f,
+                          int maxDivergentLevels = 8)
+    {
+        static_assert(W >= 1 && W <= 32, "packet width must fit a 32-bit lane mask");
+        using point_t = typename data_traits::point_t;
+        enum { num_dims = num_dims_of<point_t>::value };
+
+        const int numLanes = std::min(numQueries,W);
+        if (numLanes <= 0) return;
+        if (numLanes == 1
+            || BinaryTree::numLevelsFor(N) - packetSharedLevels<data_t,data_traits>(queries,numLanes,d_nodes,N) > maxDivergentLevels)
+        {
+            for (int l=0;l<numLanes;l++)
+                knn<CandidateList,data_t,data_traits>(results[l],queries[l],d_nodes,N,eps);
+            return;
+        }
+
+        const float epsErr = 1.f + eps;
+        // lanes past numLanes repeat lane 0 and are never in any mask
+        float q[num_dims][W];
+        float cull[W];
+        for (int l=0;l<W;l++)
+        {
+            const int src = l < numLanes ? l : 0;
+            for (int d=0;d<num_dims;d++)
+                q[d][l] = get_coord(queries[src],d);
+            cull[l] = l < numLanes ? results[l].initialCullDist2() : 0.f;
+        }
+
+        struct StackEntry
+        {
+            int64_t  node;
+            uint32_t mask;
+            float    planeDist2[W];
+        };
+        StackEntry stack[64];
+        int stackTop = 0;
+
+        int64_t  node = 0;
+        uint32_t mask = numLanes == 32 ? ~0u : ((1u << numLanes) - 1);
+        while (true)
+        {
+            while (node < N)
+            {
+                const auto &curr_node = d_nodes[node];
+                const auto &p = data_traits::get_point(curr_node);
+                float pc[num_dims];
+                for (int d=0;d<num_dims;d++)
+                    pc[d] = get_coord(p,d);
+
+                float d2[W];
+                for (int l=0;l<W;l++)
+                {
+                    float s = 0.f;
+                    for (int d=0;d<num_dims;d++)
+                    {
+                        const float diff = q[d][l] - pc[d];
+                        s += diff*diff;
+                    }
+                    d2[l] = s;
+                }
+                uint32_t hit = 0;
+                for (int l=0;l<W;l++)
+                    hit |= uint32_t(d2[l] < cull[l]) << l;
+                hit &= mask;
+                while (hit)
+                {
+                    const int l = countTrailingZeros(hit);
+                    hit &= hit-1;
+                    cull[l] = results[l].processCandidate(node,d2[l]);
+                }
+
+                const int dim
+                    = data_traits::has_explicit_dim
+                    ? data_traits::get_dim(curr_node)
+                    : (BinaryTree::levelOf(node) % num_dims);
+                const float split = pc[dim];
+                float planeDist2[W];
+                uint32_t right = 0, near = 0;
+                for (int l=0;l<W;l++)
+                {
+                    const float diff = q[dim][l] - split;
+                    planeDist2[l] = diff*diff*epsErr;
+                    right |= uint32_t(diff > 0.f) << l;
+                    near  |= uint32_t(planeDist2[l] < cull[l]) << l;
+                }
+                right &= mask;
+
+                const int goRight = 2*popCount(right) > popCount(mask);
+                const uint32_t closeSide = goRight ? right : (mask & ~right);
+                const uint32_t farSide   = mask & ~closeSide;
+                const int64_t closeChild = 2*node + 1 + goRight;
+                const int64_t farChild   = 2*node + 2 - goRight;
+
+                if (farChild < N)
+                {
+                    // lanes for which farChild is the close side always go
+                    // there; the others only if the plane is still in range
+                    // once we come back
+                    StackEntry &e = stack[stackTop++];
+                    e.node = farChild;
+                    e.mask = mask;
+                    for (int l=0;l<W;l++)
+                        e.planeDist2[l] = (farSide >> l) & 1 ? 0.f : planeDist2[l];
+                }
+                mask = closeSide | (farSide & near);
+                if (!mask) break;
+                node = closeChild;
+            }
+
+            mask = 0;
+            while (!mask)
+            {
+                if (stackTop == 0) return;
+                const StackEntry &e = stack[--stackTop];
+                for (int l=0;l<W;l++)
+                    mask |= uint32_t(e.planeDist2[l] < cull[l]) << l;
+                mask &= e.mask;
+                node = e.node;
+            }
+        }
+    }
+
+    /*! knnBatch() over packets: queries [p*W,p*W+W) form packet p, so the
+        caller should order them so that consecutive queries are close
+        (e.g. 2x2x2 voxel blocks of a grid). Output layout and id_t are the
+        same as for knnBatch(). */
+    template<typename CandidateList, int W, typename data_t, typename data_traits=default_data_traits<data_t>,
+             typename id_t>
+    inline void knnPacketBatch(ThreadPool &pool,
+                               const typename data_traits::point_t *queries,
+                               int64_t numQueries,
+                               float cutOffRadius,
+                               const data_t *d_nodes,
+                               int64_t N,
+                               id_t *outIDs,
+                               float *outDist2,
+                               int64_t packetsPerTask = 128,
+                               float eps = 0.0f)
+    {
+        enum { k = CandidateList::num_k };
+        const int64_t numPackets = (numQueries + W - 1) / W;
+        const int64_t numTasks = (numPackets + packetsPerTask - 1) / packetsPerTask;
+        pool.run(numTasks,[&](int64_t task)
+        {
+            const int64_t begin = task * packetsPerTask;
+            const int64_t end   = std::min(numPackets, begin + packetsPerTask);
+            for (int64_t p=begin;p<end;p++)
+            {
+                const int64_t first = p * W;
+                const int numLanes = int(std::min<int64_t>(W, numQueries - first));
+                // CandidateList has no default constructor, so construct
+                // the lanes in place
+                alignas(CandidateList) unsigned char storage[W * sizeof(CandidateList)];
+                CandidateList *results = reinterpret_cast<CandidateList *>(storage);
+                for (int l=0;l<numLanes;l++)
+                    new (&results[l]) CandidateList(cutOffRadius);
+                knnPacket<CandidateList,W,data_t,data_traits>(results,queries+first,numLanes,d_nodes,N,eps);
+                for (int l=0;l<numLanes;l++)
+                {
+                    results[l].sort();
+                    const int64_t q = first + l;
+                    for (int i=0;i<k;i++)
+                    {
+                        outIDs[q*k+i]   = results[l].get_pointID(i);
+                        outDist2[q*k+i] = results[l].get_dist2(i);
+                    }
+                }
+            }
+        });
+    }
+}
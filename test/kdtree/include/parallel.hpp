@@ -0,0 +1,199 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kdTree
+{
+    /*! returns the number of worker threads to use; anything <= 0 means
+        "as many as the machine has" */
+    inline int resolveNumThreads(int numThreads)
+    {
+        if (numThreads > 0) return numThreads;
+        const int hw = int(std::thread::hardware_concurrency());
+        return hw > 0 ? hw : 1;
+    }
+
+    /*! splits [begin,end) into at most numThreads contiguous ranges of at
+        least minRangeSize elements each, and calls body(rangeBegin,rangeEnd)
+        for each of them. The calling thread processes the first range
+        itself; with numThreads==1 this is a plain function call. */
+    template<typename index_t, typename body_t>
+    inline void parallel_for_range(index_t begin, index_t end, int numThreads, const body_t &body, index_t minRangeSize = 1)
+    {
+        if (end <= begin) return;
+        const index_t count = end - begin;
+        index_t numRanges = std::min<index_t>(index_t(resolveNumThreads(numThreads)),
+                                              std::max<index_t>(index_t(1), count / std::max<index_t>(minRangeSize, index_t(1))));
+        if (numRanges <= 1)
+        {
+            body(begin,end);
+            return;
+        }
+
+        const index_t rangeSize = (count + numRanges - 1) / numRanges;
+        std::vector<std::thread> workers;
+        workers.reserve(size_t(numRanges - 1));
+        for (index_t r=1;r<numRanges;r++)
+        {
+            const index_t rb = begin + r * rangeSize;
+            const index_t re = std::min(end, rb + rangeSize);
+            if (rb >= re) break;
+            workers.emplace_back([&body,rb,re]() { body(rb,re); });
+        }
+        body(begin,std::min(end,begin+rangeSize));
+        for (auto &w : workers) w.join();
+    }
+
+    /*! sorts [begin,end) by sorting numThreads chunks in parallel and then
+        merging neighbouring chunks pairwise (again in parallel) until a
+        single sorted range is left */
+    template<typename iter_t, typename compare_t>
+    inline void parallel_sort(iter_t begin, iter_t end, compare_t comp, int numThreads, int64_t minChunkSize = 1<<14)
+    {
+        const int64_t count = int64_t(end - begin);
+        int64_t numChunks = std::min<int64_t>(resolveNumThreads(numThreads), count / std::max<int64_t>(minChunkSize,1));
+        if (numChunks <= 1)
+        {
+            std::sort(begin,end,comp);
+            return;
+        }
+
+        std::vector<int64_t> bounds(size_t(numChunks+1));
+        for (int64_t c=0;c<=numChunks;c++)
+            bounds[size_t(c)] = (count * c) / numChunks;
+
+        parallel_for_range<int64_t>(0,numChunks,int(numChunks),[&](int64_t cb, int64_t ce)
+        {
+            for (int64_t c=cb;c<ce;c++)
+                std::sort(begin+bounds[size_t(c)],begin+bounds[size_t(c+1)],comp);
+        });
+
+        for (int64_t width=1;width<numChunks;width*=2)
+        {
+            const int64_t numMerges = (numChunks + 2*width - 1) / (2*width);
+            parallel_for_range<int64_t>(0,numMerges,int(numMerges),[&](int64_t mb, int64_t me)
+            {
+                for (int64_t m=mb;m<me;m++)
+                {
+                    const int64_t lo  = m * 2 * width;
+                    const int64_t mid = std::min(lo + width, numChunks);
+                    const int64_t hi  = std::min(lo + 2 * width, numChunks);
+                    if (mid >= hi) continue;
+                    std::inplace_merge(begin+bounds[size_t(lo)],begin+bounds[size_t(mid)],begin+bounds[size_t(hi)],comp);
+                }
+            });
+        }
+    }
+
+    /*! a fixed set of worker threads that stay alive between jobs, for
+        work that is issued often (e.g. query batches every frame) and where
+        spawning threads per call would show up. run() hands out task
+        indices dynamically and blocks until all of them are done; it does
+        not allocate. Concurrent calls to run() are serialized. */
+    class ThreadPool 
+    {
+    public:
+        explicit ThreadPool(int numThreads = 0)
+        {
+            const int numWorkers = resolveNumThreads(numThreads) - 1;
+            for (int i=0;i<numWorkers;i++)
+                m_workers.emplace_back([this]() { workerLoop(); });
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_wake.notify_all();
+            for (auto &w : m_workers) w.join();
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        /*! number of threads working on a job, including the caller */
+        int numThreads() const { return int(m_workers.size()) + 1; }
+
+        /*! calls body(task) for every task in [0,numTasks), spread across
+            the workers and the calling thread */
+        template<typename body_t>
+        void run(int64_t numTasks, const body_t &body)
+        {
+            if (numTasks <= 0) return;
+            std::lock_guard<std::mutex> runLock(m_runMutex);
+            if (m_workers.empty() || numTasks == 1)
+            {
+                for (int64_t t=0;t<numTasks;t++) body(t);
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_job        = &invoke<body_t>;
+                m_jobContext = &body;
+                m_numTasks   = numTasks;
+                m_nextTask.store(0);
+                m_numBusy    = int(m_workers.size());
+                m_generation++;
+            }
+            m_wake.notify_all();
+            drain();
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock,[this]() { return m_numBusy == 0; });
+        }
+
+    private:
+        template<typename body_t>
+        static void invoke(const void *context, int64_t task)
+        { (*static_cast<const body_t *>(context))(task); }
+
+        void drain()
+        {
+            while (true)
+            {
+                const int64_t task = m_nextTask.fetch_add(1);
+                if (task >= m_numTasks) return;
+                m_job(m_jobContext,task);
+            }
+        }
+
+        void workerLoop()
+        {
+            uint64_t seenGeneration = 0;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wake.wait(lock,[&]() { return m_stop || m_generation != seenGeneration; });
+                    if (m_stop) return;
+                    seenGeneration = m_generation;
+                }
+                drain();
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (--m_numBusy == 0) m_done.notify_one();
+                }
+            }
+        }
+
+        std::vector<std::thread> m_workers;
+        std::mutex               m_runMutex;
+        std::mutex               m_mutex;
+        std::condition_variable  m_wake;
+        std::condition_variable  m_done;
+        void                   (*m_job)(const void *, int64_t) = nullptr;
+        const void              *m_jobContext = nullptr;
+        int64_t                  m_numTasks = 0;
+        std::atomic<int64_t>     m_nextTask { 0 };
+        int                      m_numBusy = 0;
+        uint64_t                 m_generation = 0;
+        bool                     m_stop = false;
+    };
+}
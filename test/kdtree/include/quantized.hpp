@@ -0,0 +1,236 @@
+#pragma once
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "helper.hpp"
+#include "common.hpp"
+#include "box.hpp"
+
+namespace kdTree
+{
+    /*! maps the coordinates of a world-space box and a value range to
+        16-bit unsigned integers (per-axis step, round to nearest).
+        Rounding is monotonic, so a tree built on the exact coordinates is
+        still a valid kd-tree over the decoded ones; maxErr is a per-axis
+        bound on |exact - decoded| (half a step, plus float rounding of
+        the decode) */
+    template<typename point_t>
+    struct Quantizer
+    {
+        enum { num_dims = num_dims_of<point_t>::value };
+        enum { maxCode = 65535 };
+
+        static Quantizer make(const box_t<point_t> &bounds, float minValue, float maxValue)
+        {
+            Quantizer q;
+            for (int d=0;d<num_dims;d++)
+            {
+                const float lo = get_coord(bounds.lower,d);
+                const float hi = get_coord(bounds.upper,d);
+                const float step = hi > lo ? (hi-lo)/maxCode : 1.f;
+                set_coord(q.lower,d,lo);
+                set_coord(q.step,d,step);
+                set_coord(q.maxErr,d,0.5f*step + 4.f*FLT_EPSILON*std::max(std::fabs(lo),std::fabs(hi)));
+            }
+            q.valueLower = minValue;
+            q.valueStep  = maxValue > minValue ? (maxValue-minValue)/maxCode : 1.f;
+            return q;
+        }
+
+        inline uint16_t encodeCoord(float x, int d) const
+        { return encode(x,get_coord(lower,d),get_coord(step,d)); }
+
+        inline float decodeCoord(uint16_t c, int d) const
+        { return get_coord(lower,d) + float(c)*get_coord(step,d); }
+
+        inline uint16_t encodeValue(float v) const
+        { return encode(v,valueLower,valueStep); }
+
+        inline float decodeValue(uint16_t c) const
+        { return valueLower + float(c)*valueStep; }
+
+        /*! bound on the distance between a point and its decoded position */
+        inline float maxPointError() const
+        { return std::sqrt(dot(maxErr,maxErr)); }
+
+        /*! bound on |value - decoded value|: half a step, plus float
+            rounding of the encode and decode, as for maxErr */
+        inline float maxValueError() const
+        {
+            const float valueUpper = valueLower + float(maxCode)*valueStep;
+            return 0.5f*valueStep + 4.f*FLT_EPSILON*std::max(std::fabs(valueLower),std::fabs(valueUpper));
+        }
+
+        point_t lower;
+        point_t step;
+        point_t maxErr;
+        float   valueLower;
+        float   valueStep;
+
+    private:
+        static inline uint16_t encode(float x, float lo, float s)
+        {
+            const float c = std::round((x-lo)/s);
+            return uint16_t(std::min(std::max(c,0.f),float(maxCode)));
+        }
+    };
+
+    /*! a kd-tree node with 16-bit coordinates and a 16-bit normalized
+        value: 8 bytes in 3D instead of the 20 of a payload_point. The
+        node's position in the array is unchanged, so node IDs (and the
+        original-index map of the tree it was made from) stay valid */
+    template<typename point_t>
+    struct quantized_node
+    {
+        uint16_t coord[num_dims_of<point_t>::value];
+        uint16_t value;
+    };
+
+    /*! a quantized copy of an implicit kd-tree, see quantizeTree() */
+    template<typename point_t>
+    struct QuantizedTree
+    {
+        inline point_t decodePoint(int64_t nodeID) const
+        {
+            point_t p;
+            for (int d=0;d<num_dims_of<point_t>::value;d++)
+                set_coord(p,d,quant.decodeCoord(nodes[nodeID].coord[d],d));
+            return p;
+        }
+
+        inline float decodeValue(int64_t nodeID) const
+        { return quant.decodeValue(nodes[nodeID].value); }
+
+        /*! split dimension of each node for trees built with explicit
+            dims (e.g. widest-dimension splits); empty for trees that
+            split by level % num_dims */
+        inline int splitDim(int64_t nodeID) const
+        { return dims.empty() ? BinaryTree::levelOf(nodeID) % num_dims_of<point_t>::value : dims[nodeID]; }
+
+        Quantizer<point_t>                  quant;
+        std::vector<quantized_node<point_t>> nodes;
+        std::vector<uint8_t>                dims;
+    };
+
+    /*! quantizes the N nodes of a built tree relative to 'bounds' (which
+        must contain all of them, e.g. the bounds the builder returned),
+        values relative to their own min/max. If data_traits has explicit
+        dims, the nodes' split dims are kept alongside the compact nodes */
+    template<typename point_t,
+             typename data_t=payload_point<point_t>, typename data_traits=payload_data_traits<point_t>>
+    inline void quantizeTree(QuantizedTree<point_t> &out,
+                             const data_t *nodes, int64_t N,
+                             const box_t<point_t> &bounds)
+    {
+        float minValue = +INFINITY, maxValue = -INFINITY;
+        for (int64_t i=0;i<N;i++)
+        {
+            minValue = std::min(minValue,nodes[i].value);
+            maxValue = std::max(maxValue,nodes[i].value);
+        }
+        out.quant = Quantizer<point_t>::make(bounds,minValue,maxValue);
+        out.nodes.resize(N);
+        for (int64_t i=0;i<N;i++)
+        {
+            for (int d=0;d<num_dims_of<point_t>::value;d++)
+                out.nodes[i].coord[d] = out.quant.encodeCoord(get_coord(data_traits::get_point(nodes[i]),d),d);
+            out.nodes[i].value = out.quant.encodeValue(nodes[i].value);
+        }
+        out.dims.clear();
+        if (data_traits::has_explicit_dim)
+        {
+            out.dims.resize(N);
+            for (int64_t i=0;i<N;i++)
+                out.dims[i] = uint8_t(data_traits::get_dim(nodes[i]));
+        }
+    }
+
+    /*! k-nearest query on a quantized tree, same stack-free traversal as
+        traverse_stack_free() but every node is decoded on the fly.
+
+        Without exactNodes, distances are those of the decoded points and
+        the result is the exact k-nearest set of the decoded point set
+        (each point moved by at most quant.maxPointError()).
+
+        With exactNodes (the full-precision tree the quantized one was made
+        from), pruning is conservative: a far subtree is only skipped if
+        its split plane is out of range even when moved by maxErr towards
+        the query, and a node whose decoded distance minus
+        maxPointError() is already out of range is rejected without
+        touching its exact coordinates. Everything else is scored with its
+        exact distance, so results are the same as knn() on exactNodes
+        while most of the traversal only reads the compact nodes. */
+    template<typename CandidateList, typename point_t,
+             typename exact_t=payload_point<point_t>, typename exact_traits=payload_data_traits<point_t>>
+    inline float knn(CandidateList &result, const point_t &queryPoint,
+                     const QuantizedTree<point_t> &tree,
+                     const exact_t *exactNodes = nullptr, float eps = 0.0f)
+    {
+        const float epsErr = 1.f + eps;
+        const int64_t N = int64_t(tree.nodes.size());
+        const float pointErr = exactNodes ? tree.quant.maxPointError() : 0.f;
+        float cullDist = result.initialCullDist2();
+        // decoded distance below which a node may still be in range:
+        // (sqrt(cullDist) + pointErr)^2, updated whenever cullDist shrinks
+        auto acceptBound = [pointErr](float cull)
+        { const float r = std::sqrt(cull) + pointErr; return r*r; };
+        float acceptDist2 = acceptBound(cullDist);
+
+        int64_t prev = -1;
+        int64_t curr = 0;
+        while (true)
+        {
+            const int64_t parent = (curr+1)/2-1;
+            if (curr >= N)
+            {
+                prev = curr;
+                curr = parent;
+                continue;
+            }
+            const point_t currPoint = tree.decodePoint(curr);
+            const int64_t child = 2*curr+1;
+            const bool from_child = (prev >= child);
+            if (!from_child)
+            {
+                const float sqrDist = sqrDistance(queryPoint,currPoint);
+                if (!exactNodes)
+                    cullDist = result.processCandidate(curr,sqrDist);
+                else if (sqrDist < acceptDist2)
+                {
+                    cullDist = result.processCandidate(curr,sqrDistance(queryPoint,exact_traits::get_point(exactNodes[curr])));
+                    acceptDist2 = acceptBound(cullDist);
+                }
+            }
+            const int   curr_dim = tree.splitDim(curr);
+            const float curr_dim_dist = get_coord(queryPoint,curr_dim) - get_coord(currPoint,curr_dim);
+            const int   curr_side = curr_dim_dist > 0.f;
+            const int64_t curr_close_child = 2*curr + 1 + curr_side;
+            const int64_t curr_far_child   = 2*curr + 2 - curr_side;
+            // the exact split plane can be up to maxErr closer to the query
+            const float planeDist
+                = exactNodes
+                ? std::max(0.f,std::fabs(curr_dim_dist) - get_coord(tree.quant.maxErr,curr_dim))
+                : curr_dim_dist;
+            int64_t next = -1;
+            if (prev == curr_close_child)
+                next
+                = ((curr_far_child<N) && (planeDist * planeDist * epsErr < cullDist))
+                ? curr_far_child
+                : parent;
+            else if (prev == curr_far_child)
+                next = parent;
+            else
+                next
+                = (child<N)
+                ? curr_close_child
+                : parent;
+            if (next == -1)
+                return result.returnValue();
+            prev = curr;
+            curr = next;
+        }
+    }
+}
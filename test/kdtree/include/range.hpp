@@ -0,0 +1,75 @@
+#pragma once
+#include <type_traits>
+#include <vector>
+#include "traverse.hpp"
+
+namespace kdTree
+{
+    /*! result type for traverse_stack_free that hands every point strictly
+        inside a fixed radius to a visitor. The cull distance never shrinks,
+        so the traversal prunes by split-plane distance against the radius
+        only - a far child is entered iff its plane is closer than radius. */
+    template<typename visitor_t>
+    struct RangeResult
+    {
+        RangeResult(float radius, visitor_t &visitor) : radius2(radius*radius), visitor(visitor) {}
+
+        float initialCullDist2() const
+        { return radius2; }
+
+        float processCandidate(int64_t candPrimID, float candDist2)
+        {
+            if (candDist2 < radius2) visitor(candPrimID,candDist2);
+            return radius2;
+        }
+
+        const float radius2;
+        visitor_t  &visitor;
+    };
+
+    /*! one hit of a range query: node index in the tree and squared distance */
+    struct RangeHit
+    {
+        int64_t pointID;
+        float dist2;
+    };
+
+    /*! calls visitor(pointID,dist2) for every node within radius of
+        queryPoint, in traversal order; pointID is an int64_t node index */
+    template<typename data_t, typename data_traits=default_data_traits<data_t>, typename visitor_t>
+    inline void rangeQuery(typename data_traits::point_t queryPoint,
+                           float radius,
+                           const data_t *d_nodes,
+                           int64_t N,
+                           visitor_t &&visitor)
+    {
+        RangeResult<typename std::remove_reference<visitor_t>::type> result(radius,visitor);
+        traverse_stack_free<decltype(result),data_t,data_traits>(result,queryPoint,d_nodes,N);
+    }
+
+    /*! bulk variant: appends all hits to 'hits' without clearing it, so a
+        caller that reuses the vector across queries stops allocating once
+        its capacity has grown. Returns the number of hits appended. */
+    template<typename data_t, typename data_traits=default_data_traits<data_t>>
+    inline size_t rangeQueryAppend(std::vector<RangeHit> &hits,
+                                   typename data_traits::point_t queryPoint,
+                                   float radius,
+                                   const data_t *d_nodes,
+                                   int64_t N)
+    {
+        const size_t before = hits.size();
+        rangeQuery<data_t,data_traits>(queryPoint,radius,d_nodes,N,
+                                       [&hits](int64_t pointID, float dist2) { hits.push_back({pointID,dist2}); });
+        return hits.size() - before;
+    }
+
+    /*! Wendland C2 kernel with support radius h: (1-r/h)^4 (4r/h+1) for
+        r<h, 0 beyond */
+    inline float wendlandC2(float dist, float h)
+    {
+        const float q = dist / h;
+        if (q >= 1.f) return 0.f;
+        const float t = 1.f - q;
+        return t*t*t*t * (4.f*q + 1.f);
+    }
+}
@@ -5,24 +5,75 @@
 
 namespace kdTree 
 {
-    template<typename result_t, typename data_t, typename data_traits=default_data_traits<data_t>>
+    /*! what a traversal did: node records read (the stack-free walk
+        reads a node again on every return from a child), point distances
+        evaluated, far children descended into, and candidates that made
+        it into the result list. Pass one to the stats overloads of
+        traverse_stack_free()/traverse_box_pruned(), per query or shared
+        by a whole batch; per-query stats add up with +=. */
+    struct TraversalStats
+    {
+        inline void beginQuery()    { numQueries++; }
+        inline void visitNode()     { nodesVisited++; }
+        inline void evalDistance()  { distanceEvals++; }
+        inline void descendFar()    { farChildDescents++; }
+        inline void pushCandidate() { candidatePushes++; }
+
+        inline TraversalStats &operator+=(const TraversalStats &other)
+        {
+            numQueries       += other.numQueries;
+            nodesVisited     += other.nodesVisited;
+            distanceEvals    += other.distanceEvals;
+            farChildDescents += other.farChildDescents;
+            candidatePushes  += other.candidatePushes;
+            return *this;
+        }
+
+        uint64_t numQueries       = 0;
+        uint64_t nodesVisited     = 0;
+        uint64_t distanceEvals    = 0;
+        uint64_t farChildDescents = 0;
+        uint64_t candidatePushes  = 0;
+    };
+
+    /*! the stats policy the traversals use unless given one: counts
+        nothing, and compiles away entirely */
+    struct NoTraversalStats
+    {
+        inline void beginQuery()    {}
+        inline void visitNode()     {}
+        inline void evalDistance()  {}
+        inline void descendFar()    {}
+        inline void pushCandidate() {}
+    };
+
+    /*! stack-free traversal of an implicit tree; the walk is over
+        breadth-first node IDs, layout_t maps them to array slots (see
+        BlockedLayout). Candidates are reported by slot, so they index
+        d_nodes directly whatever the layout. stats (e.g. a
+        TraversalStats) counts what the traversal does. */
+    template<typename result_t, typename data_t, typename data_traits=default_data_traits<data_t>,
+             typename layout_t=BreadthFirstLayout, typename stats_t>
     inline void traverse_stack_free(result_t &result,
                             typename data_traits::point_t queryPoint,
                             const data_t *d_nodes,
-                            int N,
-                            float eps=0.0f)
+                            int64_t N,
+                            float eps,
+                            stats_t &stats)
     {
         using point_t  = typename data_traits::point_t;
         using scalar_t = typename scalar_type_of<point_t>::type;
         enum { num_dims = num_dims_of<point_t>::value };
         const auto epsErr = 1 + eps;
         scalar_t cullDist = result.initialCullDist2();
+        const layout_t layout(N);
+        stats.beginQuery();
         
-        int prev = -1;
-        int curr = 0;
+        int64_t prev = -1;
+        int64_t curr = 0;
         while (true) 
         {
-            const int parent = (curr+1)/2-1;
+            const int64_t parent = (curr+1)/2-1;
             if (curr >= N) 
             {
                 // in some (rare) cases it's possible that below traversal
@@ -35,26 +86,30 @@ namespace kdTree
                 curr = parent;
                 continue;
             }
-            const auto &curr_node = d_nodes[curr];
-            const int  child = 2*curr+1;
+            const int64_t curr_slot = layout.slotOf(curr);
+            const auto &curr_node = d_nodes[curr_slot];
+            stats.visitNode();
+            const int64_t child = 2*curr+1;
             const bool from_child = (prev >= child);
             if (!from_child) 
             {
                 const auto sqrDist =
                 sqrDistance(queryPoint,data_traits::get_point(curr_node));
-                cullDist = result.processCandidate(curr,sqrDist);
+                stats.evalDistance();
+                if (sqrDist < cullDist) stats.pushCandidate();
+                cullDist = result.processCandidate(curr_slot,sqrDist);
             }
             const int  curr_dim
                 = data_traits::has_explicit_dim
-                ? data_traits::get_dim(d_nodes[curr])
+                ? data_traits::get_dim(curr_node)
                 : (BinaryTree::levelOf(curr) % num_dims);
             const float curr_dim_dist
                 = get_coord(queryPoint,curr_dim)
                 - data_traits::get_coord(curr_node,curr_dim);
             const int curr_side = curr_dim_dist > 0.f;
-            const int curr_close_child = 2*curr + 1 + curr_side;
-            const int curr_far_child   = 2*curr + 2 - curr_side;
-            int next = -1;
+            const int64_t curr_close_child = 2*curr + 1 + curr_side;
+            const int64_t curr_far_child   = 2*curr + 2 - curr_side;
+            int64_t next = -1;
             if (prev == curr_close_child)
                 // if we came from the close child, we may still have to check
                 // the far side - but only if this exists, and if far half of
@@ -87,9 +142,146 @@ namespace kdTree
                 // child, arrive at the root, and decide to go to the parent of
                 // the root ... while means we're done.
                 return;
+            if (next == curr_far_child) stats.descendFar();
             prev = curr;
             curr = next;
         }
     }
+
+    template<typename result_t, typename data_t, typename data_traits=default_data_traits<data_t>,
+             typename layout_t=BreadthFirstLayout>
+    inline void traverse_stack_free(result_t &result,
+                            typename data_traits::point_t queryPoint,
+                            const data_t *d_nodes,
+                            int64_t N,
+                            float eps=0.0f)
+    {
+        NoTraversalStats stats;
+        traverse_stack_free<result_t,data_t,data_traits,layout_t>(result,queryPoint,d_nodes,N,eps,stats);
+    }
+
+    /*! stack-based traversal that prunes on the full distance from the
+        query to a subtree's box, not just to its split plane. The box is
+        never stored: per dimension we keep the query's distance to the
+        current cell (worldBounds narrowed by the splits on the path, as
+        findBounds() would compute it), and going to a far child only
+        replaces the entry for the split dimension. Far children go on a
+        stack of at most one entry per level, together with their box
+        distance, and are skipped on the way back once that is out of
+        range.
+
+        Queries farther than the cull radius from worldBounds return
+        without touching a node - for voxel grids around sparse data this
+        is most of them. worldBounds has to contain all N points (e.g. the
+        bounds the builder returned); eps, layout_t and stats as in
+        traverse_stack_free(). */
+    template<typename result_t, typename data_t, typename data_traits=default_data_traits<data_t>,
+             typename layout_t=BreadthFirstLayout, typename stats_t>
+    inline void traverse_box_pruned(result_t &result,
+                            typename data_traits::point_t queryPoint,
+                            const box_t<typename data_traits::point_t> &worldBounds,
+                            const data_t *d_nodes,
+                            int64_t N,
+                            float eps,
+                            stats_t &stats)
+    {
+        using point_t  = typename data_traits::point_t;
+        using scalar_t = typename scalar_type_of<point_t>::type;
+        enum { num_dims = num_dims_of<point_t>::value };
+        const auto epsErr = 1 + eps;
+        scalar_t cullDist = result.initialCullDist2();
+        const layout_t layout(N);
+        stats.beginQuery();
+
+        struct StackEntry 
+        { 
+            int64_t  node; 
+            scalar_t dist2; 
+            scalar_t offset[num_dims]; 
+        };
+        StackEntry stack[64];
+        int stackTop = 0;
+
+        // distance from the query to the current cell, per dimension
+        scalar_t offset[num_dims];
+        scalar_t dist2 = 0;
+        for (int d=0;d<num_dims;d++) 
+        {
+            const scalar_t q = get_coord(queryPoint,d);
+            offset[d] = std::max(std::max(get_coord(worldBounds.lower,d) - q, q - get_coord(worldBounds.upper,d)), scalar_t(0));
+            dist2 += offset[d]*offset[d];
+        }
+        if (N <= 0 || dist2 * epsErr >= cullDist) return;
+
+        int64_t node = 0;
+        while (true) 
+        {
+            while (node < N) 
+            {
+                const int64_t slot = layout.slotOf(node);
+                const auto &curr_node = d_nodes[slot];
+                const scalar_t sqrDist = sqrDistance(queryPoint,data_traits::get_point(curr_node));
+                stats.visitNode();
+                stats.evalDistance();
+                if (sqrDist < cullDist) stats.pushCandidate();
+                cullDist = result.processCandidate(slot,sqrDist);
+
+                const int  curr_dim
+                    = data_traits::has_explicit_dim
+                    ? data_traits::get_dim(curr_node)
+                    : (BinaryTree::levelOf(node) % num_dims);
+                const scalar_t curr_dim_dist
+                    = get_coord(queryPoint,curr_dim)
+                    - data_traits::get_coord(curr_node,curr_dim);
+                const int curr_side = curr_dim_dist > 0;
+                const int64_t far_child = 2*node + 2 - curr_side;
+                if (far_child < N) 
+                {
+                    // the far cell lies entirely beyond the split plane. The sum is
+                    // redone rather than updated, so that it is exactly the distance
+                    // to a point on the box surface and ties are never pruned
+                    scalar_t far_offset[num_dims];
+                    scalar_t far_dist2 = 0;
+                    for (int d=0;d<num_dims;d++) 
+                    {
+                        far_offset[d] = (d == curr_dim) ? std::max(offset[d],std::abs(curr_dim_dist)) : offset[d];
+                        far_dist2 += far_offset[d]*far_offset[d];
+                    }
+                    if (far_dist2 * epsErr < cullDist) 
+                    {
+                        StackEntry &e = stack[stackTop++];
+                        e.node  = far_child;
+                        e.dist2 = far_dist2;
+                        for (int d=0;d<num_dims;d++) e.offset[d] = far_offset[d];
+                    }
+                }
+                // the close cell is no farther than the current one
+                node = 2*node + 1 + curr_side;
+            }
+
+            do 
+            {
+                if (stackTop == 0) return;
+                --stackTop;
+            } while (stack[stackTop].dist2 * epsErr >= cullDist);
+            const StackEntry &e = stack[stackTop];
+            node  = e.node;
+            for (int d=0;d<num_dims;d++) offset[d] = e.offset[d];
+            stats.descendFar();
+        }
+    }
+
+    template<typename result_t, typename data_t, typename data_traits=default_data_traits<data_t>,
+             typename layout_t=BreadthFirstLayout>
+    inline void traverse_box_pruned(result_t &result,
+                            typename data_traits::point_t queryPoint,
+                            const box_t<typename data_traits::point_t> &worldBounds,
+                            const data_t *d_nodes,
+                            int64_t N,
+                            float eps=0.0f)
+    {
+        NoTraversalStats stats;
+        traverse_box_pruned<result_t,data_t,data_traits,layout_t>(result,queryPoint,worldBounds,d_nodes,N,eps,stats);
+    }
 }
 
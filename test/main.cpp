@@ -3,6 +3,10 @@
 #include <random>
 #include <chrono>
 #include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <string>
 
 #include "kdtree.h"
 
@@ -169,12 +173,2588 @@ void TEST()
 }
 
 
-int main() 
+std::vector<kdTree::float3> RandomPoints3D(int numPoints, float extent, unsigned seed)
 {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dis(0.0f, extent);
+    std::vector<kdTree::float3> points(numPoints);
+    for (auto &p : points)
+        p = kdTree::make_float3(dis(gen), dis(gen), dis(gen));
+    return points;
+}
+
+void TEST_PARALLEL_BUILD(int numPoints, int numThreads)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Parallel build: " << numPoints << " random 3D points, "
+              << resolveNumThreads(numThreads) << " threads ===" << std::endl;
+
+    auto serial = RandomPoints3D(numPoints, 100.0f, 42);
+    auto parallel = serial;
+
+    box_t<float3> serialBounds, parallelBounds;
+    auto start = std::chrono::high_resolution_clock::now();
+    buildTree_host<float3, default_data_traits<float3>>(serial.data(), numPoints, &serialBounds, 1);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto serial_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    start = std::chrono::high_resolution_clock::now();
+    buildTree_host<float3, default_data_traits<float3>>(parallel.data(), numPoints, &parallelBounds, numThreads);
+    end = std::chrono::high_resolution_clock::now();
+    auto parallel_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    std::cout << "  serial build:   " << serial_ms.count() << " ms" << std::endl;
+    std::cout << "  parallel build: " << parallel_ms.count() << " ms" << std::endl;
+
+    // points with equal split coordinates may be ordered differently, so
+    // compare query results rather than the raw layouts
+    const int k = 5;
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> dis(0.0f, 100.0f);
+    bool resultsMatch = true;
+    for (int q = 0; q < 1000 && resultsMatch; q++) 
+    {
+        float3 queryPoint = make_float3(dis(gen), dis(gen), dis(gen));
+        FixedCandidateList<k> serialList(50.0f), parallelList(50.0f);
+        knn<FixedCandidateList<k>, float3, default_data_traits<float3>>(serialList, queryPoint, serial.data(), numPoints);
+        knn<FixedCandidateList<k>, float3, default_data_traits<float3>>(parallelList, queryPoint, parallel.data(), numPoints);
+        for (int i = 0; i < k; i++) 
+            resultsMatch = resultsMatch && serialList.get_dist2(i) == parallelList.get_dist2(i);
+    }
+
+    if (resultsMatch) 
+        std::cout << "  ✓ Parallel tree returns the same neighbors as the serial tree" << std::endl;
+    else 
+        std::cout << "  ✗ Parallel tree returns different neighbors" << std::endl;
+}
+
+std::vector<kdTree::float3> IntegerLattice(int dataSize)
+{
+    // the sample positions of a dataSize^3 volume such as data.raw: the integer lattice
+    std::vector<kdTree::float3> points;
+    points.reserve(size_t(dataSize) * dataSize * dataSize);
+    for (int z = 0; z < dataSize; ++z)
+        for (int y = 0; y < dataSize; ++y)
+            for (int x = 0; x < dataSize; ++x)
+                points.push_back(kdTree::make_float3(float(x), float(y), float(z)));
+    return points;
+}
+
+// builds the points into a tree in place and returns the tree's bounds
+kdTree::box_t<kdTree::float3> BuildTree3D(std::vector<kdTree::float3>& points)
+{
+    using namespace kdTree;
+    box_t<float3> bounds;
+    BuildScratch<float3> scratch;
+    buildTree_partition<float3, default_data_traits<float3>>(points.data(), points.size(), &bounds, scratch);
+    return bounds;
+}
+
+// payload nodes with value 0 and the point's index as ID, built into a tree
+std::vector<kdTree::payload_point<kdTree::float3>> PayloadTree3D(const std::vector<kdTree::float3>& points, kdTree::box_t<kdTree::float3>& bounds)
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::vector<node_t> nodes(points.size());
+    for (size_t i = 0; i < points.size(); i++) 
+        nodes[i] = { points[i], 0.0f, uint32_t(i) };
+    BuildScratch<node_t> scratch;
+    buildTree_partition<node_t, payload_data_traits<float3>>(nodes.data(), nodes.size(), &bounds, scratch);
+    return nodes;
+}
+
+// a point set the 3D benchmarks run on; queries are drawn from [0,extent]^3
+struct BenchPointSet
+{
+    std::string name;
+    std::vector<kdTree::float3> points;
+    float extent;
+};
+
+// most benchmarks run on both: the sample positions of a 64^3 volume, and uniform random points
+std::vector<BenchPointSet> StandardBenchPointSets(int numPoints)
+{
+    return { { "64^3 lattice", IntegerLattice(64), 64.0f }, { "uniform random", RandomPoints3D(numPoints, 100.0f, 42), 100.0f } };
+}
+
+template<typename point_t>
+bool SameKNNResults(const std::vector<point_t>& treeA, const std::vector<point_t>& treeB, const std::vector<point_t>& queries, float searchRadius)
+{
+    using namespace kdTree;
+    const int k = 5;
+    for (const auto &queryPoint : queries) 
+    {
+        FixedCandidateList<k> listA(searchRadius), listB(searchRadius);
+        knn<FixedCandidateList<k>, point_t, default_data_traits<point_t>>(listA, queryPoint, treeA.data(), treeA.size());
+        knn<FixedCandidateList<k>, point_t, default_data_traits<point_t>>(listB, queryPoint, treeB.data(), treeB.size());
+        for (int i = 0; i < k; i++) 
+            if (listA.get_dist2(i) != listB.get_dist2(i)) return false;
+    }
+    return true;
+}
+
+template<typename point_t>
+bool RangeMatchesBruteForce(const std::vector<point_t>& tree, const std::vector<point_t>& queries, float radius)
+{
+    using namespace kdTree;
+    std::vector<RangeHit> hits;
+    std::vector<int> found, expected;
+    for (const auto &queryPoint : queries) 
+    {
+        hits.clear();
+        rangeQueryAppend<point_t, default_data_traits<point_t>>(hits, queryPoint, radius, tree.data(), tree.size());
+        found.clear();
+        for (const auto &hit : hits) 
+        {
+            if (hit.dist2 != sqrDistance(queryPoint, tree[hit.pointID])) return false;
+            found.push_back(hit.pointID);
+        }
+        expected.clear();
+        for (size_t i = 0; i < tree.size(); i++) 
+            if (sqrDistance(queryPoint, tree[i]) < radius * radius) expected.push_back(int(i));
+        std::sort(found.begin(), found.end());
+        if (found != expected) return false;
+    }
+    return true;
+}
+
+void TEST_RANGE_QUERY()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Fixed-radius range query ===" << std::endl;
+
+    auto TestData = InitDataFromBinary("../../pruned_simple_data.bin");
+    std::vector<float2> points2D(TestData.size()), queries2D(500);
+    for (size_t i = 0; i < TestData.size(); i++) 
+        points2D[i] = make_float2(TestData[i].x, TestData[i].y);
+    std::mt19937 gen(13);
+    std::uniform_real_distribution<float> disX(0.0f, 150.0f), disY(0.0f, 450.0f);
+    for (auto &q : queries2D) 
+        q = make_float2(disX(gen), disY(gen));
+    box_t<float2> bounds2D;
+    BuildScratch<float2> scratch2D;
+    buildTree_partition<float2, default_data_traits<float2>>(points2D.data(), points2D.size(), &bounds2D, scratch2D);
+
+    auto points3D = RandomPoints3D(50000, 100.0f, 21);
+    auto queries3D = RandomPoints3D(500, 100.0f, 22);
+    box_t<float3> bounds3D;
+    BuildScratch<float3> scratch3D;
+    buildTree_partition<float3, default_data_traits<float3>>(points3D.data(), points3D.size(), &bounds3D, scratch3D);
+
+    bool resultsMatch = true;
+    for (float radius : { 2.0f, 10.0f, 40.0f }) 
+        resultsMatch = resultsMatch && RangeMatchesBruteForce(points2D, queries2D, radius);
+    for (float radius : { 2.0f, 8.0f, 20.0f }) 
+        resultsMatch = resultsMatch && RangeMatchesBruteForce(points3D, queries3D, radius);
+
+    // the bulk variant only grows its buffer: after a warm-up pass, the same
+    // queries must not reallocate
+    std::vector<RangeHit> hits;
+    for (const auto &q : queries3D) 
+    {
+        hits.clear();
+        rangeQueryAppend<float3, default_data_traits<float3>>(hits, q, 8.0f, points3D.data(), points3D.size());
+    }
+    const RangeHit* buffer = hits.data();
+    size_t totalHits = 0;
+    for (const auto &q : queries3D) 
+    {
+        hits.clear();
+        totalHits += rangeQueryAppend<float3, default_data_traits<float3>>(hits, q, 8.0f, points3D.data(), points3D.size());
+    }
+
+    if (resultsMatch) 
+        std::cout << "  ✓ Range query finds exactly the points within the radius (2D and 3D)" << std::endl;
+    else 
+        std::cout << "  ✗ Range query differs from brute force" << std::endl;
+    if (hits.data() == buffer) 
+        std::cout << "  ✓ Reused hit buffer did not reallocate (" << totalHits << " hits)" << std::endl;
+    else 
+        std::cout << "  ✗ Reused hit buffer reallocated" << std::endl;
+}
+
+void TEST_PARTITION_BUILD()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Partition build ===" << std::endl;
+    bool resultsMatch = true;
+    auto check = [&](const std::vector<float3>& input, float extent) 
+    {
+        auto sorted = input, partitioned = input;
+        box_t<float3> bounds;
+        buildTree_host<float3, default_data_traits<float3>>(sorted.data(), sorted.size(), &bounds);
+        BuildScratch<float3> scratch;
+        buildTree_partition<float3, default_data_traits<float3>>(partitioned.data(), partitioned.size(), &bounds, scratch, 3);
+        auto queries = RandomPoints3D(1000, extent, 11);
+        resultsMatch = resultsMatch && SameKNNResults(sorted, partitioned, queries, extent);
+        // a rebuild reuses the scratch buffer
+        partitioned = input;
+        buildTree_partition<float3, default_data_traits<float3>>(partitioned.data(), partitioned.size(), &bounds, scratch, 1);
+        resultsMatch = resultsMatch && SameKNNResults(sorted, partitioned, queries, extent);
+    };
+    check(IntegerLattice(24), 24.0f);
+    check(RandomPoints3D(50000, 100.0f, 42), 100.0f);
+
+    if (resultsMatch) 
+        std::cout << "  ✓ Partition tree returns the same neighbors as the sort tree (lattice and random, 1 and 3 threads)" << std::endl;
+    else 
+        std::cout << "  ✗ Partition tree returns different neighbors" << std::endl;
+}
+
+void BENCH_PARTITION_BUILD(const BenchPointSet& set, int numThreads)
+{
+    using namespace kdTree;
+    const int numPoints = set.points.size();
+    std::cout << "\n=== Sort vs. partition build: " << set.name << ", " << numPoints << " points ===" << std::endl;
+
+    auto sorted = set.points;
+    box_t<float3> bounds;
+    auto start = std::chrono::high_resolution_clock::now();
+    buildTree_host<float3, default_data_traits<float3>>(sorted.data(), numPoints, &bounds, numThreads);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto sort_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    BuildScratch<float3> scratch;
+    auto partitioned = set.points;
+    start = std::chrono::high_resolution_clock::now();
+    buildTree_partition<float3, default_data_traits<float3>>(partitioned.data(), numPoints, &bounds, scratch, numThreads);
+    end = std::chrono::high_resolution_clock::now();
+    auto partition_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    // a rebuild reuses the scratch buffer, so it does no allocation at all
+    partitioned = set.points;
+    start = std::chrono::high_resolution_clock::now();
+    buildTree_partition<float3, default_data_traits<float3>>(partitioned.data(), numPoints, &bounds, scratch, numThreads);
+    end = std::chrono::high_resolution_clock::now();
+    auto rebuild_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    std::cout << "  sort build (buildTree_host):           " << sort_ms.count() << " ms" << std::endl;
+    std::cout << "  partition build (buildTree_partition): " << partition_ms.count() << " ms" << std::endl;
+    std::cout << "  partition rebuild, scratch reused:     " << rebuild_ms.count() << " ms" << std::endl;
+    std::cout << "  speedup: " << (float)sort_ms.count() / std::max<long long>(1, partition_ms.count()) << "x" << std::endl;
+}
+
+void TEST_PAYLOAD_BUILD()
+{
+    using namespace kdTree;
+    using node_t = payload_point<float2>;
+    std::cout << "\n=== Payload build (value + original index travel with the points) ===" << std::endl;
+
+    auto TestData = InitDataFromBinary("../../pruned_simple_data.bin");
+    const int numPoints = TestData.size();
+    std::vector<node_t> nodes(numPoints);
+    for (int i = 0; i < numPoints; i++) 
+        nodes[i] = { make_float2(TestData[i].x, TestData[i].y), TestData[i].value, uint32_t(i) };
+
+    box_t<float2> worldBounds;
+    BuildScratch<node_t> scratch;
+    buildTree_partition<node_t, payload_data_traits<float2>>(nodes.data(), numPoints, &worldBounds, scratch);
+
+    bool payloadsMatch = true;
+    for (const auto &node : nodes) 
+    {
+        const SparsePoint &original = TestData[node.id];
+        payloadsMatch = payloadsMatch && original.x == node.point.x && original.y == node.point.y && original.value == node.value;
+    }
+
+    // the payload tree must answer queries exactly like a plain point tree
+    std::vector<float2> points(numPoints);
+    for (int i = 0; i < numPoints; i++) 
+        points[i] = make_float2(TestData[i].x, TestData[i].y);
+    buildTree_host<float2, default_data_traits<float2>>(points.data(), numPoints, &worldBounds);
+
+    const int k = 5;
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<float> dis(0.0f, 150.0f);
+    bool resultsMatch = true;
+    for (int q = 0; q < 1000; q++) 
+    {
+        float2 queryPoint = make_float2(dis(gen), dis(gen));
+        FixedCandidateList<k> plainList(50.0f), payloadList(50.0f);
+        knn<FixedCandidateList<k>, float2, default_data_traits<float2>>(plainList, queryPoint, points.data(), numPoints);
+        knn<FixedCandidateList<k>, node_t, payload_data_traits<float2>>(payloadList, queryPoint, nodes.data(), numPoints);
+        for (int i = 0; i < k; i++) 
+            resultsMatch = resultsMatch && plainList.get_dist2(i) == payloadList.get_dist2(i);
+    }
+
+    if (payloadsMatch) 
+        std::cout << "  ✓ Every node carries its own value and original index" << std::endl;
+    else 
+        std::cout << "  ✗ Node payloads got separated from their points" << std::endl;
+    if (resultsMatch) 
+        std::cout << "  ✓ Payload tree returns the same neighbors as the plain tree" << std::endl;
+    else 
+        std::cout << "  ✗ Payload tree returns different neighbors" << std::endl;
+}
+
+// the 2D points of pruned_simple_data.bin
+std::vector<kdTree::float2> PrunedPoints2D()
+{
+    auto TestData = InitDataFromBinary("../../pruned_simple_data.bin");
+    std::vector<kdTree::float2> points(TestData.size());
+    for (size_t i = 0; i < TestData.size(); i++) 
+        points[i] = kdTree::make_float2(TestData[i].x, TestData[i].y);
+    return points;
+}
+
+std::vector<kdTree::float2> PrunedQueries2D(int numQueries, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> disX(0.0f, 150.0f), disY(0.0f, 450.0f);
+    std::vector<kdTree::float2> queries(numQueries);
+    for (auto &q : queries) 
+        q = kdTree::make_float2(disX(gen), disY(gen));
+    return queries;
+}
+
+template<int k, typename point_t>
+bool BatchMatchesSingleQueries(kdTree::ThreadPool& pool, const std::vector<point_t>& tree, const std::vector<point_t>& queries, float searchRadius)
+{
+    using namespace kdTree;
+    const int64_t numQueries = queries.size();
+    std::vector<int> ids(numQueries * k);
+    std::vector<float> dist2(numQueries * k);
+    knnBatch<FixedCandidateList<k>, point_t, default_data_traits<point_t>>
+    (pool, queries.data(), numQueries, searchRadius, tree.data(), tree.size(), ids.data(), dist2.data());
+    for (int64_t q = 0; q < numQueries; q++) 
+    {
+        FixedCandidateList<k> single(searchRadius);
+        knn<FixedCandidateList<k>, point_t, default_data_traits<point_t>>(single, queries[q], tree.data(), tree.size());
+        for (int i = 0; i < k; i++) 
+            if (single.get_pointID(i) != ids[q*k+i] || single.get_dist2(i) != dist2[q*k+i]) return false;
+    }
+    return true;
+}
+
+void TEST_BATCH_KNN()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Batched KNN ===" << std::endl;
+    auto lattice = IntegerLattice(24);
+    BuildTree3D(lattice);
+    const auto queries = RandomPoints3D(3000, 24.0f, 5);
+    auto points2D = PrunedPoints2D();
+    box_t<float2> bounds2D;
+    BuildScratch<float2> scratch2D;
+    buildTree_partition<float2, default_data_traits<float2>>(points2D.data(), points2D.size(), &bounds2D, scratch2D);
+    const auto queries2D = PrunedQueries2D(3000, 5);
+
+    bool resultsMatch = true;
+    ThreadPool serial(1), parallel(3);
+    for (ThreadPool* pool : { &serial, &parallel }) 
+    {
+        resultsMatch = resultsMatch && BatchMatchesSingleQueries<1>(*pool, lattice, queries, 42.0f);
+        resultsMatch = resultsMatch && BatchMatchesSingleQueries<5>(*pool, lattice, queries, 42.0f);
+        resultsMatch = resultsMatch && BatchMatchesSingleQueries<3>(*pool, points2D, queries2D, 475.0f);
+        resultsMatch = resultsMatch && BatchMatchesSingleQueries<5>(*pool, points2D, queries2D, 20.0f);
+    }
+
+    if (resultsMatch) 
+        std::cout << "  ✓ knnBatch returns the IDs and distances of single queries (2D/3D, K=1/3/5, 1 and 3 threads)" << std::endl;
+    else 
+        std::cout << "  ✗ knnBatch results differ from single queries" << std::endl;
+}
+
+template<int k, typename point_t>
+void BenchBatchKNN(kdTree::ThreadPool& pool, const std::vector<point_t>& tree, const std::vector<point_t>& queries, float searchRadius)
+{
+    using namespace kdTree;
+    const int64_t numQueries = queries.size();
+    std::vector<int> ids(numQueries * k);
+    std::vector<float> dist2(numQueries * k);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    knnBatch<FixedCandidateList<k>, point_t, default_data_traits<point_t>>
+    (pool, queries.data(), numQueries, searchRadius, tree.data(), tree.size(), ids.data(), dist2.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "  K=" << k << ", " << pool.numThreads() << " thread(s): "
+              << std::fixed << std::setprecision(0) << numQueries / seconds << " queries/s"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+template<typename point_t>
+void BenchBatchKNNAllK(const std::string& name, std::vector<point_t> tree, const std::vector<point_t>& queries, float searchRadius, int numThreads)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Batched KNN: " << name << ", " << tree.size() << " points, " << queries.size() << " queries ===" << std::endl;
+    box_t<point_t> bounds;
+    BuildScratch<point_t> scratch;
+    buildTree_partition<point_t, default_data_traits<point_t>>(tree.data(), tree.size(), &bounds, scratch);
+
+    ThreadPool serial(1), parallel(numThreads);
+    for (ThreadPool* pool : { &serial, &parallel }) 
+    {
+        BenchBatchKNN<1>(*pool, tree, queries, searchRadius);
+        BenchBatchKNN<3>(*pool, tree, queries, searchRadius);
+        BenchBatchKNN<5>(*pool, tree, queries, searchRadius);
+    }
+}
+
+void BENCH_BATCH_KNN(int numQueries, int numThreads)
+{
+    using namespace kdTree;
+    BenchBatchKNNAllK("64^3 lattice", IntegerLattice(64), RandomPoints3D(numQueries, 64.0f, 5), 111.0f, numThreads);
+
+    BenchBatchKNNAllK("pruned_simple_data.bin", PrunedPoints2D(), PrunedQueries2D(numQueries, 5), 475.0f, numThreads);
+}
+
+template<typename CandidateList>
+double TimeKNNQueries(const std::vector<kdTree::float3>& queries, float searchRadius, std::vector<float>& dist2, 
+                      const std::function<void(CandidateList&, const kdTree::float3&)>& query)
+{
+    using namespace kdTree;
+    enum { k = CandidateList::num_k };
+    ThreadPool pool(1);
+    std::vector<int> ids(queries.size() * k);
+    dist2.resize(queries.size() * k);
+    auto start = std::chrono::high_resolution_clock::now();
+    knnBatchWith<CandidateList>(pool, queries.data(), queries.size(), searchRadius, query, ids.data(), dist2.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    return queries.size() / std::chrono::duration<double>(end - start).count();
+}
+
+// the squared distances of every query's neighbours, in knnBatch's layout
+template<typename CandidateList>
+std::vector<float> KNNDist2(const std::vector<kdTree::float3>& queries, float searchRadius, 
+                            const std::function<void(CandidateList&, const kdTree::float3&)>& query)
+{
+    using namespace kdTree;
+    enum { k = CandidateList::num_k };
+    ThreadPool pool(1);
+    std::vector<int> ids(queries.size() * k);
+    std::vector<float> dist2(queries.size() * k);
+    knnBatchWith<CandidateList>(pool, queries.data(), queries.size(), searchRadius, query, ids.data(), dist2.data());
+    return dist2;
+}
+
+template<int k>
+bool BucketMatchesPlainTree(const std::vector<kdTree::float3>& tree, const std::vector<kdTree::float3>& queries, float searchRadius)
+{
+    using namespace kdTree;
+    const auto reference = KNNDist2<FixedCandidateList<k>>(queries, searchRadius, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn<FixedCandidateList<k>, float3, default_data_traits<float3>>(result, q, tree.data(), tree.size()); });
+    for (int leafSize : { 1, 8, 16, 32 }) 
+    {
+        BucketTree3D bucketTree;
+        buildBucketTree(bucketTree, tree.data(), tree.size(), leafSize);
+        const auto bucketed = KNNDist2<FixedCandidateList<k>>(queries, searchRadius, [&](FixedCandidateList<k>& result, const float3& q) 
+        { knn(result, q, bucketTree); });
+        if (bucketed != reference) return false;
+    }
+    return true;
+}
+
+void TEST_BUCKET_KNN()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Bucket tree ===" << std::endl;
+    bool resultsMatch = true;
+    auto check = [&](std::vector<float3> tree, float extent) 
+    {
+        BuildTree3D(tree);
+        const auto queries = RandomPoints3D(2000, extent, 9);
+        resultsMatch = resultsMatch && BucketMatchesPlainTree<1>(tree, queries, 2.0f * extent);
+        resultsMatch = resultsMatch && BucketMatchesPlainTree<5>(tree, queries, 2.0f * extent);
+        resultsMatch = resultsMatch && BucketMatchesPlainTree<5>(tree, queries, extent / 16.0f);
+    };
+    check(IntegerLattice(24), 24.0f);
+    check(RandomPoints3D(50000, 100.0f, 42), 100.0f);
+
+    if (resultsMatch) 
+        std::cout << "  ✓ Bucket trees (1-32 points/leaf) return the plain tree's distances (K=1/5, lattice and random)" << std::endl;
+    else 
+        std::cout << "  ✗ Bucket tree distances differ from the plain tree" << std::endl;
+}
+
+template<int k>
+void BenchBucketKNN(const std::vector<kdTree::float3>& tree, const std::vector<kdTree::float3>& queries, float searchRadius)
+{
+    using namespace kdTree;
+    std::vector<float> reference, bucketed;
+    const double plainRate = TimeKNNQueries<FixedCandidateList<k>>(queries, searchRadius, reference, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn<FixedCandidateList<k>, float3, default_data_traits<float3>>(result, q, tree.data(), tree.size()); });
+    std::cout << "  K=" << k << " stack-free traversal: " << std::fixed << std::setprecision(0) << plainRate << " queries/s" << std::endl;
+
+    for (int leafSize : { 8, 16, 32 }) 
+    {
+        BucketTree3D bucketTree;
+        buildBucketTree(bucketTree, tree.data(), tree.size(), leafSize);
+        const double bucketRate = TimeKNNQueries<FixedCandidateList<k>>(queries, searchRadius, bucketed, [&](FixedCandidateList<k>& result, const float3& q) 
+        { knn(result, q, bucketTree); });
+        std::cout << "  K=" << k << " bucket tree, " << std::setw(2) << leafSize << " points/leaf: " << bucketRate << " queries/s ("
+                  << std::setprecision(2) << bucketRate / plainRate << "x)" << std::setprecision(0) << std::endl;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void BENCH_BUCKET_KNN(const BenchPointSet& set, int numQueries)
+{
+    using namespace kdTree;
+#if defined(__AVX2__)
+    const char* leafScan = "AVX2";
+#elif defined(__SSE2__) || defined(_M_X64)
+    const char* leafScan = "SSE2";
+#else
+    const char* leafScan = "scalar";
+#endif
+    std::cout << "\n=== Bucket tree vs. stack-free traversal: " << set.name << ", " << set.points.size() << " points, "
+              << numQueries << " queries, " << leafScan << " leaf scan ===" << std::endl;
+    auto tree = set.points;
+    BuildTree3D(tree);
+
+    auto queries = RandomPoints3D(numQueries, set.extent, 9);
+    BenchBucketKNN<1>(tree, queries, 2.0f * set.extent);
+    BenchBucketKNN<5>(tree, queries, 2.0f * set.extent);
+}
+
+template<int k>
+void BenchCandidateLists(const std::vector<kdTree::float3>& tree, const std::vector<kdTree::float3>& queries, float searchRadius)
+{
+    using namespace kdTree;
+    std::vector<float> bubbleDist2, heapDist2;
+    const double bubbleRate = TimeKNNQueries<FixedCandidateList<k>>(queries, searchRadius, bubbleDist2, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn<FixedCandidateList<k>, float3, default_data_traits<float3>>(result, q, tree.data(), tree.size()); });
+    const double heapRate = TimeKNNQueries<HeapCandidateList<k>>(queries, searchRadius, heapDist2, [&](HeapCandidateList<k>& result, const float3& q) 
+    { knn<HeapCandidateList<k>, float3, default_data_traits<float3>>(result, q, tree.data(), tree.size()); });
+    std::cout << "  K=" << std::setw(2) << k << std::fixed << std::setprecision(0)
+              << "  bubble: " << std::setw(8) << bubbleRate << " q/s"
+              << "  heap: " << std::setw(8) << heapRate << " q/s"
+              << std::setprecision(2) << "  heap/bubble: " << heapRate / bubbleRate << "x"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+void BENCH_CANDIDATE_LISTS(const BenchPointSet& set, int numQueries)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Bubble vs. heap candidate list: " << set.name << ", " << set.points.size() << " points, "
+              << numQueries << " queries ===" << std::endl;
+    auto tree = set.points;
+    BuildTree3D(tree);
+
+    auto queries = RandomPoints3D(numQueries, set.extent, 17);
+    BenchCandidateLists<1>(tree, queries, 2.0f * set.extent);
+    BenchCandidateLists<3>(tree, queries, 2.0f * set.extent);
+    BenchCandidateLists<5>(tree, queries, 2.0f * set.extent);
+    BenchCandidateLists<8>(tree, queries, 2.0f * set.extent);
+    BenchCandidateLists<16>(tree, queries, 2.0f * set.extent);
+    BenchCandidateLists<32>(tree, queries, 2.0f * set.extent);
+    BenchCandidateLists<64>(tree, queries, 2.0f * set.extent);
+}
+
+void TEST_RUNTIME_K()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Run-time K dispatch ===" << std::endl;
+    auto tree = RandomPoints3D(20000, 100.0f, 31);
+    BuildTree3D(tree);
+    const float3 queryPoint = make_float3(50.0f, 50.0f, 50.0f);
+
+    bool resultsMatch = true;
+    for (int k : supportedK) 
+    {
+        const bool dispatched = dispatchK(k, [&](auto K) 
+        {
+            KnnCandidateList<K> result(200.0f);
+            knn<KnnCandidateList<K>, float3, default_data_traits<float3>>(result, queryPoint, tree.data(), tree.size());
+            result.sort();
+            auto brute = bruteForceKNN<K>(tree, queryPoint);
+            for (int i = 0; i < K; i++) 
+                resultsMatch = resultsMatch && result.get_dist2(i) == brute.get_dist2(i);
+        });
+        resultsMatch = resultsMatch && dispatched;
+    }
+    const bool rejectsOthers = !dispatchK(7, [](auto) {});
+
+    if (resultsMatch && rejectsOthers) 
+        std::cout << "  ✓ Every supported K matches brute force; unsupported K is rejected" << std::endl;
+    else 
+        std::cout << "  ✗ Run-time K dispatch returned wrong results" << std::endl;
+}
+
+void TEST_LARGE_INDEX()
+{
+    using namespace kdTree;
+    std::cout << "\n=== 64-bit node indices ===" << std::endl;
+    // the layout of a tree far past 2^31 points: every level's segments
+    // must tile [numSettled, N) exactly, with each pivot inside its segment
+    const int64_t bigN = 3000000000ll;
+    bool layoutOK = BinaryTree::numLevelsFor(bigN) == 32;
+    for (int level : { 0, 1, 2, 7, 16 }) 
+    {
+        ArrayLayoutInStep layout(level, bigN);
+        int64_t expectedBegin = layout.numSettledNodes();
+        for (int64_t subtree = BinaryTree::firstNodeInLevel(level); subtree < BinaryTree::firstNodeInLevel(level + 1); subtree++) 
+        {
+            const int64_t segBegin = layout.segmentBegin(subtree);
+            const int64_t segSize = layout.sizeOfSegment(subtree);
+            const int64_t pivotPos = layout.pivotPosOf(subtree);
+            layoutOK = layoutOK && segBegin == expectedBegin && pivotPos >= segBegin && pivotPos < segBegin + segSize;
+            expectedBegin = segBegin + segSize;
+        }
+        layoutOK = layoutOK && expectedBegin == bigN;
+    }
+
+    // the 64-bit ID list has to find exactly what the packed one finds
+    auto tree = RandomPoints3D(50000, 100.0f, 61);
+    auto queries = RandomPoints3D(2000, 100.0f, 62);
+    box_t<float3> bounds;
+    BuildScratch<float3> scratch;
+    buildTree_partition<float3, default_data_traits<float3>>(tree.data(), int64_t(tree.size()), &bounds, scratch);
+    constexpr int k = 8;
+    ThreadPool pool(1);
+    std::vector<int> ids(queries.size() * k);
+    std::vector<int64_t> wideIDs(queries.size() * k);
+    std::vector<float> dist2(queries.size() * k), wideDist2(queries.size() * k);
+    knnBatch<FixedCandidateList<k>, float3, default_data_traits<float3>>(pool, queries.data(), queries.size(), 20.0f, tree.data(), tree.size(), ids.data(), dist2.data());
+    knnBatch<WideCandidateList<k>, float3, default_data_traits<float3>>(pool, queries.data(), queries.size(), 20.0f, tree.data(), tree.size(), wideIDs.data(), wideDist2.data());
+    bool listsMatch = true;
+    for (size_t i = 0; i < ids.size(); i++) 
+        listsMatch = listsMatch && int64_t(ids[i]) == wideIDs[i] && dist2[i] == wideDist2[i];
+
+    if (layoutOK) 
+        std::cout << "  ✓ Layout of a " << bigN << "-point tree tiles every level exactly" << std::endl;
+    else 
+        std::cout << "  ✗ Layout of a " << bigN << "-point tree is inconsistent" << std::endl;
+    if (listsMatch) 
+        std::cout << "  ✓ WideCandidateList (64-bit IDs) returns the same neighbors as FixedCandidateList" << std::endl;
+    else 
+        std::cout << "  ✗ WideCandidateList returns different neighbors" << std::endl;
+}
+
+template<int blockHeight>
+bool BlockedLayoutIsPermutation(int64_t N)
+{
+    const kdTree::BlockedLayout<blockHeight> layout(N);
+    std::vector<char> taken(N, 0);
+    for (int64_t i = 0; i < N; i++) 
+    {
+        const int64_t slot = layout.slotOf(i);
+        if (slot < 0 || slot >= N || taken[slot]) return false;
+        taken[slot] = 1;
+    }
+    return true;
+}
+
+void TEST_BLOCKED_LAYOUT()
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::cout << "\n=== Blocked-subtree node layout ===" << std::endl;
+    bool permutes = true;
+    std::vector<int64_t> sizes;
+    for (int64_t n = 1; n <= 300; n++) 
+        sizes.push_back(n);
+    for (int64_t n : { 1023, 1024, 4095, 4096, 65537, 200000 }) 
+        sizes.push_back(n);
+    for (int64_t n : sizes) 
+        permutes = permutes && BlockedLayoutIsPermutation<1>(n) && BlockedLayoutIsPermutation<2>(n) 
+                            && BlockedLayoutIsPermutation<3>(n) && BlockedLayoutIsPermutation<4>(n) && BlockedLayoutIsPermutation<5>(n);
+
+    // same neighbours (by original id) from the relaid-out tree
+    auto points = RandomPoints3D(50000, 100.0f, 71);
+    auto queries = RandomPoints3D(2000, 100.0f, 72);
+    box_t<float3> bounds;
+    auto nodes = PayloadTree3D(points, bounds);
+    std::vector<node_t> blocked(nodes.size());
+    relayout<BlockedLayout<3>>(blocked.data(), nodes.data(), nodes.size());
+
+    constexpr int k = 8;
+    bool sameResults = true;
+    for (const auto& q : queries) 
+    {
+        FixedCandidateList<k> plain(20.0f), relaid(20.0f);
+        knn<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(plain, q, nodes.data(), nodes.size());
+        knn<FixedCandidateList<k>, node_t, payload_data_traits<float3>, BlockedLayout<3>>(relaid, q, blocked.data(), blocked.size());
+        for (int i = 0; i < k; i++) 
+        {
+            const int a = plain.get_pointID(i), b = relaid.get_pointID(i);
+            sameResults = sameResults && plain.get_dist2(i) == relaid.get_dist2(i) && (a < 0) == (b < 0)
+                                      && (a < 0 || nodes[a].id == blocked[b].id);
+        }
+    }
+
+    if (permutes) 
+        std::cout << "  ✓ BlockedLayout<1..5> is a permutation of [0,N) for every tested N" << std::endl;
+    else 
+        std::cout << "  ✗ BlockedLayout maps two nodes to the same slot or out of range" << std::endl;
+    if (sameResults) 
+        std::cout << "  ✓ KNN on the blocked layout returns the same points as on the breadth-first array" << std::endl;
+    else 
+        std::cout << "  ✗ KNN on the blocked layout returns different points" << std::endl;
+}
+
+void TEST_BOX_PRUNED_KNN()
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::cout << "\n=== Box-pruned KNN traversal ===" << std::endl;
+    // a cluster in the middle of the domain, queried from all over it
+    auto points = RandomPoints3D(50000, 20.0f, 81);
+    for (auto& p : points) 
+        p = make_float3(p.x + 40.0f, p.y + 40.0f, p.z + 40.0f);
+    auto queries = RandomPoints3D(4000, 100.0f, 82);
+    box_t<float3> bounds;
+    auto nodes = PayloadTree3D(points, bounds);
+    std::vector<node_t> blocked(nodes.size());
+    relayout<BlockedLayout<3>>(blocked.data(), nodes.data(), nodes.size());
+
+    constexpr int k = 8;
+    bool sameResults = true, sameBlocked = true, approxBounded = true;
+    for (float radius : { 200.0f, 10.0f }) 
+    {
+        for (const auto& q : queries) 
+        {
+            FixedCandidateList<k> plain(radius), pruned(radius), prunedBlocked(radius);
+            knn<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(plain, q, nodes.data(), nodes.size());
+            knn<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(pruned, q, bounds, nodes.data(), nodes.size());
+            knn<FixedCandidateList<k>, node_t, payload_data_traits<float3>, BlockedLayout<3>>(prunedBlocked, q, bounds, blocked.data(), blocked.size());
+            for (int i = 0; i < k; i++) 
+            {
+                sameResults = sameResults && plain.get_dist2(i) == pruned.get_dist2(i) && plain.get_pointID(i) == pruned.get_pointID(i);
+                sameBlocked = sameBlocked && pruned.get_dist2(i) == prunedBlocked.get_dist2(i);
+            }
+
+            const float eps = 0.5f;
+            FixedCandidateList<1> approx(radius);
+            knn<FixedCandidateList<1>, node_t, payload_data_traits<float3>>(approx, q, bounds, nodes.data(), nodes.size(), eps);
+            approxBounded = approxBounded && approx.get_dist2(0) <= plain.get_dist2(0) * (1.0f + eps) * (1.0f + 1e-6f);
+        }
+    }
+
+    if (sameResults) 
+        std::cout << "  ✓ box-pruned traversal returns the same neighbours as the stack-free one (inside and outside the data, with and without early-out)" << std::endl;
+    else 
+        std::cout << "  ✗ box-pruned traversal returns different neighbours" << std::endl;
+    if (sameBlocked) 
+        std::cout << "  ✓ box-pruned traversal works on the blocked layout" << std::endl;
+    else 
+        std::cout << "  ✗ box-pruned traversal on the blocked layout returns different distances" << std::endl;
+    if (approxBounded) 
+        std::cout << "  ✓ eps=0.5 box-pruned distances stay within (1+eps) of the exact ones" << std::endl;
+    else 
+        std::cout << "  ✗ eps=0.5 box-pruned distances exceed the (1+eps) bound" << std::endl;
+}
+
+void TEST_TRAVERSAL_STATS()
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::cout << "\n=== Traversal stats ===" << std::endl;
+    auto points = RandomPoints3D(30000, 100.0f, 101);
+    auto queries = RandomPoints3D(2000, 140.0f, 102);
+    box_t<float3> bounds;
+    auto nodes = PayloadTree3D(points, bounds);
+
+    constexpr int k = 8;
+    bool sameResults = true, consistent = true;
+    TraversalStats shared, summed, boxPruned;
+    for (const auto& q : queries) 
+    {
+        FixedCandidateList<k> plain(200.0f), counted(200.0f), countedShared(200.0f), pruned(200.0f);
+        TraversalStats perQuery;
+        traverse_stack_free<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(plain, q, nodes.data(), nodes.size());
+        traverse_stack_free<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(counted, q, nodes.data(), nodes.size(), 0.0f, perQuery);
+        traverse_stack_free<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(countedShared, q, nodes.data(), nodes.size(), 0.0f, shared);
+        traverse_box_pruned<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(pruned, q, bounds, nodes.data(), nodes.size(), 0.0f, boxPruned);
+        for (int i = 0; i < k; i++) 
+            sameResults = sameResults && plain.get_dist2(i) == counted.get_dist2(i) && plain.get_pointID(i) == counted.get_pointID(i);
+        consistent = consistent && perQuery.numQueries == 1 && perQuery.candidatePushes <= perQuery.distanceEvals 
+                                && perQuery.distanceEvals <= perQuery.nodesVisited && perQuery.farChildDescents < perQuery.distanceEvals
+                                && perQuery.candidatePushes >= k;
+        summed += perQuery;
+    }
+    consistent = consistent && summed.numQueries == queries.size() && shared.numQueries == queries.size()
+                            && summed.distanceEvals == shared.distanceEvals && summed.nodesVisited == shared.nodesVisited;
+
+    // a tree smaller than k with an unbounded radius: every node is visited and pushed once
+    std::vector<float3> small(RandomPoints3D(50, 10.0f, 103));
+    BuildScratch<float3> smallScratch;
+    buildTree_partition<float3, default_data_traits<float3>>(small.data(), small.size(), nullptr, smallScratch);
+    TraversalStats all;
+    FixedCandidateList<64> everything(1e6f);
+    traverse_stack_free<FixedCandidateList<64>, float3, default_data_traits<float3>>(everything, make_float3(5.0f, 5.0f, 5.0f), small.data(), small.size(), 0.0f, all);
+    const bool exhaustive = all.distanceEvals == small.size() && all.candidatePushes == small.size();
+
+    if (sameResults) 
+        std::cout << "  ✓ counting does not change the results" << std::endl;
+    else 
+        std::cout << "  ✗ counting changes the results" << std::endl;
+    if (consistent && exhaustive) 
+        std::cout << "  ✓ per-query counters are consistent and add up to the aggregate" << std::endl;
+    else 
+        std::cout << "  ✗ counters are inconsistent" << std::endl;
+    if (boxPruned.distanceEvals <= summed.distanceEvals) 
+        std::cout << "  ✓ box-pruned traversal evaluates no more distances than stack-free (" << boxPruned.distanceEvals 
+                  << " vs. " << summed.distanceEvals << ")" << std::endl;
+    else 
+        std::cout << "  ✗ box-pruned traversal evaluates more distances than stack-free" << std::endl;
+}
+
+template<int k>
+void BenchApproxKNN(const std::vector<kdTree::float3>& tree, const std::vector<kdTree::float3>& queries, 
+                    const std::vector<kdTree::float3>& points, int numChecked, float searchRadius)
+{
+    using namespace kdTree;
+    // exact k nearest by brute force over the unsorted input, for the first numChecked queries
+    std::vector<float> exactDist2(size_t(numChecked) * k);
+    for (int q = 0; q < numChecked; q++) 
+    {
+        auto brute = bruteForceKNN<k>(points, queries[q], searchRadius);
+        for (int i = 0; i < k; i++) 
+            exactDist2[size_t(q) * k + i] = brute.get_dist2(i);
+    }
+
+    double exactRate = 0.0;
+    for (float eps : { 0.0f, 0.5f, 1.0f, 2.0f, 4.0f }) 
+    {
+        std::vector<float> dist2;
+        const double rate = TimeKNNQueries<KnnCandidateList<k>>(queries, searchRadius, dist2, [&](KnnCandidateList<k>& result, const float3& q) 
+        { knn<KnnCandidateList<k>, float3, default_data_traits<float3>>(result, q, tree.data(), tree.size(), eps); });
+        if (eps == 0.0f) exactRate = rate;
+
+        // recall: returned neighbours that really are among the k nearest
+        // (distance-based, so ties on the lattice count as hits)
+        size_t hits = 0;
+        float maxRatio = 1.0f;
+        for (int q = 0; q < numChecked; q++) 
+        {
+            const float kthExact = exactDist2[size_t(q) * k + k - 1];
+            for (int i = 0; i < k; i++) 
+            {
+                const float approx = dist2[size_t(q) * k + i];
+                const float exact = exactDist2[size_t(q) * k + i];
+                hits += approx <= kthExact;
+                if (exact > 0.0f) maxRatio = std::max(maxRatio, std::sqrt(approx / exact));
+            }
+        }
+        std::cout << "  K=" << std::setw(2) << k << " eps=" << std::fixed << std::setprecision(1) << eps
+                  << std::setprecision(0) << "  " << std::setw(8) << rate << " q/s"
+                  << std::setprecision(2) << "  speedup " << rate / exactRate << "x"
+                  << std::setprecision(4) << "  recall " << double(hits) / (double(numChecked) * k)
+                  << "  max dist ratio " << maxRatio << " (bound " << std::sqrt(1.0f + eps) << ")"
+                  << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+}
+
+void BENCH_APPROX_KNN(const BenchPointSet& set, int numQueries)
+{
+    using namespace kdTree;
+    const int numChecked = 1000;
+    std::cout << "\n=== Approximate KNN (eps): " << set.name << ", " << set.points.size() << " points, "
+              << numQueries << " queries, quality checked on " << numChecked << " ===" << std::endl;
+    auto tree = set.points;
+    BuildTree3D(tree);
+
+    auto queries = RandomPoints3D(std::max(numQueries, numChecked), set.extent, 23);
+    BenchApproxKNN<1>(tree, queries, set.points, numChecked, 2.0f * set.extent);
+    BenchApproxKNN<5>(tree, queries, set.points, numChecked, 2.0f * set.extent);
+    BenchApproxKNN<16>(tree, queries, set.points, numChecked, 2.0f * set.extent);
+}
+
+// uniform points in the box [0,ex]x[0,ey]x[0,ez]: thin slabs and long pipes for the split-dimension comparison
+std::vector<kdTree::float3> AnisotropicPoints3D(int numPoints, float ex, float ey, float ez, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+    std::vector<kdTree::float3> points(numPoints);
+    for (auto &p : points)
+        p = kdTree::make_float3(ex * dis(gen), ey * dis(gen), ez * dis(gen));
+    return points;
+}
+
+// builds dim-carrying nodes either with the widest-dimension rule or round-robin (dims filled in afterwards)
+void BuildDimNodes(std::vector<kdTree::payload_dim_point<kdTree::float3>>& nodes, const std::vector<kdTree::float3>& points, 
+                   bool widest, kdTree::box_t<kdTree::float3>& bounds)
+{
+    using namespace kdTree;
+    using node_t = payload_dim_point<float3>;
+    nodes.resize(points.size());
+    for (size_t i = 0; i < points.size(); i++) 
+        nodes[i] = { points[i], 0.0f, uint32_t(i), 0 };
+    BuildScratch<node_t> scratch;
+    if (widest) 
+        buildTree_partition<node_t, payload_dim_traits<float3>>(nodes.data(), nodes.size(), &bounds, scratch);
+    else 
+    {
+        buildTree_partition<node_t, payload_dim_traits<float3, false>>(nodes.data(), nodes.size(), &bounds, scratch);
+        setRoundRobinDims<node_t, payload_dim_traits<float3, false>>(nodes.data(), nodes.size());
+    }
+}
+
+// payload nodes with random values in [-1,1], built into a tree
+std::vector<kdTree::payload_point<kdTree::float3>> RandomValueNodes(const std::vector<kdTree::float3>& points, kdTree::box_t<kdTree::float3>& bounds)
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::mt19937 gen(53);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+    std::vector<node_t> nodes(points.size());
+    for (size_t i = 0; i < points.size(); i++) 
+        nodes[i] = { points[i], dis(gen), uint32_t(i) };
+    BuildScratch<node_t> scratch;
+    buildTree_partition<node_t, payload_data_traits<float3>>(nodes.data(), nodes.size(), &bounds, scratch);
+    return nodes;
+}
+
+template<int k, typename node_t = kdTree::payload_point<kdTree::float3>, typename node_traits = kdTree::payload_data_traits<kdTree::float3>>
+void CheckQuantizedKNN(const std::vector<node_t>& nodes, const kdTree::QuantizedTree<kdTree::float3>& qtree,
+                       const std::vector<kdTree::float3>& queries, float searchRadius, bool& exactMatches, bool& withinBound)
+{
+    using namespace kdTree;
+    const auto reference = KNNDist2<FixedCandidateList<k>>(queries, searchRadius, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn<FixedCandidateList<k>, node_t, node_traits>(result, q, nodes.data(), nodes.size()); });
+    const auto exact = KNNDist2<FixedCandidateList<k>>(queries, searchRadius, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn<FixedCandidateList<k>, float3, node_t, node_traits>(result, q, qtree, nodes.data()); });
+    const auto decoded = KNNDist2<FixedCandidateList<k>>(queries, searchRadius, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn(result, q, qtree); });
+    exactMatches = exactMatches && exact == reference;
+    // decoded points move by at most maxPointError(), so every k-th distance can only move by that much
+    for (size_t i = 0; i < reference.size(); i++) 
+        if (reference[i] != INFINITY) 
+            withinBound = withinBound && std::fabs(std::sqrt(decoded[i]) - std::sqrt(reference[i])) <= qtree.quant.maxPointError();
+}
+
+void TEST_QUANTIZED_KNN()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Quantized 16-bit nodes ===" << std::endl;
+    bool exactMatches = true, withinBound = true, valuesWithinBound = true;
+    auto check = [&](const std::vector<float3>& points, float extent) 
+    {
+        box_t<float3> bounds;
+        const auto nodes = RandomValueNodes(points, bounds);
+        QuantizedTree<float3> qtree;
+        quantizeTree(qtree, nodes.data(), nodes.size(), bounds);
+        for (size_t i = 0; i < nodes.size(); i++) 
+            valuesWithinBound = valuesWithinBound && std::fabs(qtree.decodeValue(int64_t(i)) - nodes[i].value) <= qtree.quant.maxValueError();
+        const auto queries = RandomPoints3D(2000, extent, 29);
+        CheckQuantizedKNN<1>(nodes, qtree, queries, 2.0f * extent, exactMatches, withinBound);
+        CheckQuantizedKNN<8>(nodes, qtree, queries, 2.0f * extent, exactMatches, withinBound);
+    };
+    check(IntegerLattice(24), 24.0f);
+    check(RandomPoints3D(50000, 100.0f, 42), 100.0f);
+
+    // widest-dimension splits: the quantized tree has to prune along each node's own dim, not level % 3
+    bool widestExactMatches = true, widestWithinBound = true;
+    {
+        using node_t = payload_dim_point<float3>;
+        using dim_traits = payload_dim_traits<float3>;
+        const auto points = AnisotropicPoints3D(20000, 100.0f, 100.0f, 2.0f, 131);
+        std::vector<node_t> nodes;
+        box_t<float3> bounds;
+        BuildDimNodes(nodes, points, true, bounds);
+        QuantizedTree<float3> qtree;
+        quantizeTree<float3, node_t, dim_traits>(qtree, nodes.data(), nodes.size(), bounds);
+        const auto queries = AnisotropicPoints3D(2000, 100.0f, 100.0f, 2.0f, 132);
+        CheckQuantizedKNN<1, node_t, dim_traits>(nodes, qtree, queries, 200.0f, widestExactMatches, widestWithinBound);
+        CheckQuantizedKNN<8, node_t, dim_traits>(nodes, qtree, queries, 200.0f, widestExactMatches, widestWithinBound);
+    }
+
+    if (exactMatches) 
+        std::cout << "  ✓ Quantized traversal with exact rescoring returns the full nodes' distances (K=1/8)" << std::endl;
+    else 
+        std::cout << "  ✗ Quantized+exact distances differ from the full nodes" << std::endl;
+    if (withinBound) 
+        std::cout << "  ✓ Distances on the decoded points stay within maxPointError()" << std::endl;
+    else 
+        std::cout << "  ✗ Decoded distance error above maxPointError()" << std::endl;
+    if (valuesWithinBound) 
+        std::cout << "  ✓ Decoded values stay within maxValueError()" << std::endl;
+    else 
+        std::cout << "  ✗ Decoded value error above maxValueError()" << std::endl;
+    if (widestExactMatches && widestWithinBound) 
+        std::cout << "  ✓ Quantized widest-dimension tree matches the full nodes and stays within maxPointError()" << std::endl;
+    else 
+        std::cout << "  ✗ Quantized widest-dimension tree differs from the full nodes" << std::endl;
+}
+
+template<int k>
+void BenchQuantizedKNN(const std::vector<kdTree::payload_point<kdTree::float3>>& nodes, const kdTree::QuantizedTree<kdTree::float3>& qtree,
+                       const std::vector<kdTree::float3>& queries, float searchRadius)
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::vector<float> reference, exact, decoded;
+    const double plainRate = TimeKNNQueries<FixedCandidateList<k>>(queries, searchRadius, reference, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(result, q, nodes.data(), nodes.size()); });
+    const double exactRate = TimeKNNQueries<FixedCandidateList<k>>(queries, searchRadius, exact, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn(result, q, qtree, nodes.data()); });
+    const double decodedRate = TimeKNNQueries<FixedCandidateList<k>>(queries, searchRadius, decoded, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn(result, q, qtree); });
+
+    // decoded points move by at most maxPointError(), so every k-th distance can only move by that much
+    const float maxErr = qtree.quant.maxPointError();
+    float worstErr = 0.0f;
+    for (size_t i = 0; i < reference.size(); i++) 
+        if (reference[i] != INFINITY) 
+            worstErr = std::max(worstErr, std::fabs(std::sqrt(decoded[i]) - std::sqrt(reference[i])));
+
+    std::cout << "  K=" << std::setw(2) << k << std::fixed << std::setprecision(0)
+              << "  full nodes " << std::setw(8) << plainRate << " q/s"
+              << "  quantized+exact " << std::setw(8) << exactRate << " q/s (" << std::setprecision(2) << exactRate / plainRate << "x)"
+              << std::setprecision(0) << "  quantized only " << std::setw(8) << decodedRate << " q/s (" << std::setprecision(2) << decodedRate / plainRate << "x)"
+              << std::setprecision(5) << "  max dist error " << worstErr << " (bound " << maxErr << ")"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+void BENCH_QUANTIZED_KNN(const BenchPointSet& set, int numQueries)
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::cout << "\n=== Quantized 16-bit nodes: " << set.name << ", " << set.points.size() << " points, " << numQueries << " queries ===" << std::endl;
+    box_t<float3> bounds;
+    const auto nodes = RandomValueNodes(set.points, bounds);
+
+    QuantizedTree<float3> qtree;
+    quantizeTree(qtree, nodes.data(), nodes.size(), bounds);
+    float worstValueErr = 0.0f;
+    for (size_t i = 0; i < nodes.size(); i++) 
+        worstValueErr = std::max(worstValueErr, std::fabs(qtree.decodeValue(i) - nodes[i].value));
+    std::cout << "  " << sizeof(node_t) << " -> " << sizeof(quantized_node<float3>) << " bytes/node, "
+              << std::fixed << std::setprecision(1) << nodes.size() * sizeof(node_t) / 1048576.0 << " -> " 
+              << qtree.nodes.size() * sizeof(quantized_node<float3>) / 1048576.0 << " MiB"
+              << std::setprecision(5) << ", position error <= " << qtree.quant.maxPointError()
+              << ", value error " << worstValueErr << " (bound " << qtree.quant.maxValueError() << ")"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+
+    auto queries = RandomPoints3D(numQueries, set.extent, 29);
+    BenchQuantizedKNN<1>(nodes, qtree, queries, 2.0f * set.extent);
+    BenchQuantizedKNN<8>(nodes, qtree, queries, 2.0f * set.extent);
+}
+
+// forwards to a candidate list and records the array slot of every node a query visits
+template<typename CandidateList>
+struct RecordingCandidates
+{
+    float initialCullDist2() const { return result.initialCullDist2(); }
+    float processCandidate(int64_t slot, float dist2) 
+    {
+        visited.push_back(slot);
+        return result.processCandidate(int(slot), dist2);
+    }
+
+    CandidateList& result;
+    std::vector<int64_t>& visited;
+};
+
+// average visited nodes per distinct 64-byte line touched, for nodes of nodeBytes bytes
+template<typename layout_t>
+double NodesPerCacheLine(const std::vector<kdTree::payload_point<kdTree::float3>>& nodes, 
+                         const std::vector<kdTree::float3>& queries, float searchRadius, size_t nodeBytes)
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    size_t numVisited = 0, numLines = 0;
+    std::vector<int64_t> visited, lines;
+    for (const auto& q : queries) 
+    {
+        visited.clear();
+        FixedCandidateList<8> result(searchRadius);
+        RecordingCandidates<FixedCandidateList<8>> recorder{ result, visited };
+        traverse_stack_free<decltype(recorder), node_t, payload_data_traits<float3>, layout_t>(recorder, q, nodes.data(), nodes.size());
+        lines.clear();
+        for (int64_t slot : visited) 
+            lines.push_back(slot * int64_t(nodeBytes) / 64);
+        std::sort(lines.begin(), lines.end());
+        numVisited += visited.size();
+        numLines += std::unique(lines.begin(), lines.end()) - lines.begin();
+    }
+    return double(numVisited) / double(numLines);
+}
+
+template<int k, typename layout_t>
+double BenchLayoutKNN(const std::vector<kdTree::payload_point<kdTree::float3>>& nodes, const std::vector<kdTree::float3>& queries, 
+                      float searchRadius, std::vector<float>& dist2)
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    return TimeKNNQueries<FixedCandidateList<k>>(queries, searchRadius, dist2, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn<FixedCandidateList<k>, node_t, payload_data_traits<float3>, layout_t>(result, q, nodes.data(), nodes.size()); });
+}
+
+template<typename layout_t>
+void BenchLayout(const char* name, const std::vector<kdTree::payload_point<kdTree::float3>>& bfsNodes, const std::vector<kdTree::float3>& queries, 
+                 float searchRadius, double& baseRate1, double& baseRate8)
+{
+    using namespace kdTree;
+    std::vector<payload_point<float3>> nodes(bfsNodes.size());
+    relayout<layout_t>(nodes.data(), bfsNodes.data(), bfsNodes.size());
+
+    const std::vector<float3> sample(queries.begin(), queries.begin() + std::min<size_t>(queries.size(), 5000));
+    std::vector<float> dist1, dist8;
+    const double rate1 = BenchLayoutKNN<1, layout_t>(nodes, queries, searchRadius, dist1);
+    const double rate8 = BenchLayoutKNN<8, layout_t>(nodes, queries, searchRadius, dist8);
+    if (baseRate1 == 0.0) 
+    {
+        baseRate1 = rate1;
+        baseRate8 = rate8;
+    }
+    std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+              << " nodes/line (20B/32B/8B nodes) " << NodesPerCacheLine<layout_t>(nodes, sample, searchRadius, 20)
+              << " / " << NodesPerCacheLine<layout_t>(nodes, sample, searchRadius, 32)
+              << " / " << NodesPerCacheLine<layout_t>(nodes, sample, searchRadius, 8)
+              << std::setprecision(0) << "   K=1 " << std::setw(8) << rate1 << " q/s (" << std::setprecision(2) << rate1 / baseRate1 << "x)"
+              << std::setprecision(0) << "   K=8 " << std::setw(8) << rate8 << " q/s (" << std::setprecision(2) << rate8 / baseRate8 << "x)"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+void BENCH_BLOCKED_LAYOUT(const BenchPointSet& set, int numQueries)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Node layout: " << set.name << ", " << set.points.size() << " points, " << numQueries << " queries ===" << std::endl;
+    box_t<float3> bounds;
+    auto nodes = PayloadTree3D(set.points, bounds);
+
+    auto queries = RandomPoints3D(numQueries, set.extent, 37);
+    double baseRate1 = 0.0, baseRate8 = 0.0;
+    BenchLayout<BreadthFirstLayout>("breadth-first", nodes, queries, 2.0f * set.extent, baseRate1, baseRate8);
+    BenchLayout<BlockedLayout<2>>("blocked h=2", nodes, queries, 2.0f * set.extent, baseRate1, baseRate8);
+    BenchLayout<BlockedLayout<3>>("blocked h=3", nodes, queries, 2.0f * set.extent, baseRate1, baseRate8);
+    BenchLayout<BlockedLayout<4>>("blocked h=4", nodes, queries, 2.0f * set.extent, baseRate1, baseRate8);
+}
+
+template<int k>
+void BenchBoxPrunedKNN(const std::vector<kdTree::payload_point<kdTree::float3>>& nodes, const kdTree::box_t<kdTree::float3>& bounds,
+                       const std::vector<kdTree::float3>& queries, const char* queryName, float searchRadius)
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::vector<float> plain, pruned;
+    const double plainRate = TimeKNNQueries<FixedCandidateList<k>>(queries, searchRadius, plain, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(result, q, nodes.data(), nodes.size()); });
+    const double prunedRate = TimeKNNQueries<FixedCandidateList<k>>(queries, searchRadius, pruned, [&](FixedCandidateList<k>& result, const float3& q) 
+    { knn<FixedCandidateList<k>, node_t, payload_data_traits<float3>>(result, q, bounds, nodes.data(), nodes.size()); });
+    std::cout << "  " << std::left << std::setw(8) << queryName << std::right << " r=" << std::setw(5) << searchRadius << " K=" << k 
+              << std::fixed << std::setprecision(0) << "  stack-free " << std::setw(9) << plainRate << " q/s   box-pruned " << std::setw(9) << prunedRate
+              << " q/s (" << std::setprecision(2) << prunedRate / plainRate << "x)" << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+// voxel-grid queries split into those inside and outside the data's bounding box; the
+// outside ones are what a volume grid mostly consists of when the data is sparse
+void BENCH_BOX_PRUNED_KNN(const std::string& name, const std::vector<kdTree::float3>& points, const std::vector<kdTree::float3>& grid, float domainExtent)
+{
+    using namespace kdTree;
+    box_t<float3> bounds;
+    auto nodes = PayloadTree3D(points, bounds);
+
+    std::vector<float3> inside, outside;
+    for (const auto& q : grid) 
+        (bounds.contains(q) ? inside : outside).push_back(q);
+    std::cout << "\n=== Box-pruned vs. stack-free traversal: " << name << ", " << points.size() << " points, " << grid.size() 
+              << " voxel queries (" << std::fixed << std::setprecision(1) << 100.0 * outside.size() / grid.size() << "% outside the data bounds) ===" 
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+    for (float searchRadius : { 2.0f * domainExtent, domainExtent / 16.0f }) 
+    {
+        BenchBoxPrunedKNN<1>(nodes, bounds, inside, "inside", searchRadius);
+        BenchBoxPrunedKNN<1>(nodes, bounds, outside, "outside", searchRadius);
+        BenchBoxPrunedKNN<8>(nodes, bounds, inside, "inside", searchRadius);
+        BenchBoxPrunedKNN<8>(nodes, bounds, outside, "outside", searchRadius);
+    }
+}
+
+// res^3 voxel centres over [0,extent)^3, ordered so that every bx*by*bz
+// block of voxels is contiguous (the packets of knnPacketBatch)
+std::vector<kdTree::float3> GridSweepQueries(int res, float extent, int bx, int by, int bz)
+{
+    std::vector<kdTree::float3> queries;
+    queries.reserve(size_t(res) * res * res);
+    const float voxel = extent / res;
+    for (int z0 = 0; z0 < res; z0 += bz)
+        for (int y0 = 0; y0 < res; y0 += by)
+            for (int x0 = 0; x0 < res; x0 += bx)
+                for (int z = z0; z < std::min(z0 + bz, res); ++z)
+                    for (int y = y0; y < std::min(y0 + by, res); ++y)
+                        for (int x = x0; x < std::min(x0 + bx, res); ++x)
+                            queries.push_back(kdTree::make_float3((x + 0.5f) * voxel, (y + 0.5f) * voxel, (z + 0.5f) * voxel));
+    return queries;
+}
+
+template<typename CandidateList, int W, typename id_t>
+bool PacketMatchesPerQuery(kdTree::ThreadPool& pool, const std::vector<kdTree::float3>& tree, const std::vector<kdTree::float3>& queries, float searchRadius)
+{
+    using namespace kdTree;
+    enum { k = CandidateList::num_k };
+    std::vector<id_t> singleIDs(queries.size() * k), packetIDs(queries.size() * k);
+    std::vector<float> singleDist2(queries.size() * k), packetDist2(queries.size() * k);
+    knnBatch<CandidateList, float3, default_data_traits<float3>>(pool, queries.data(), queries.size(), searchRadius, 
+                                                                  tree.data(), tree.size(), singleIDs.data(), singleDist2.data());
+    knnPacketBatch<CandidateList, W, float3, default_data_traits<float3>>(pool, queries.data(), queries.size(), searchRadius, 
+                                                                          tree.data(), tree.size(), packetIDs.data(), packetDist2.data());
+    if (packetDist2 != singleDist2) return false;
+    // on ties the IDs may differ, but each must be a point at its reported distance
+    for (size_t i = 0; i < packetIDs.size(); i++) 
+        if (packetIDs[i] >= 0 && sqrDistance(tree[packetIDs[i]], queries[i / k]) != packetDist2[i]) return false;
+    return true;
+}
+
+void TEST_PACKET_KNN()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Packet traversal ===" << std::endl;
+    ThreadPool pool(2);
+    bool resultsMatch = true;
+    auto check = [&](std::vector<float3> tree, float extent) 
+    {
+        BuildTree3D(tree);
+        const auto quads = GridSweepQueries(12, extent, 2, 2, 1);
+        const auto octs = GridSweepQueries(12, extent, 2, 2, 2);
+        const auto random = RandomPoints3D(2000, extent, 29);
+        resultsMatch = resultsMatch && PacketMatchesPerQuery<KnnCandidateList<1>, 4, int>(pool, tree, quads, 2.0f * extent);
+        resultsMatch = resultsMatch && PacketMatchesPerQuery<KnnCandidateList<5>, 8, int>(pool, tree, octs, 2.0f * extent);
+        resultsMatch = resultsMatch && PacketMatchesPerQuery<KnnCandidateList<16>, 8, int>(pool, tree, octs, extent / 8.0f);
+        // incoherent packets take the per-query fallback
+        resultsMatch = resultsMatch && PacketMatchesPerQuery<KnnCandidateList<5>, 8, int>(pool, tree, random, 2.0f * extent);
+        resultsMatch = resultsMatch && PacketMatchesPerQuery<WideCandidateList<8>, 8, int64_t>(pool, tree, octs, 2.0f * extent);
+    };
+    check(IntegerLattice(24), 24.0f);
+    check(RandomPoints3D(50000, 100.0f, 42), 100.0f);
+
+    if (resultsMatch) 
+        std::cout << "  ✓ Packet traversal returns the per-query neighbours (2x2x1/2x2x2 sweeps and random, K=1/5/8/16, 64-bit IDs)" << std::endl;
+    else 
+        std::cout << "  ✗ Packet and per-query results differ" << std::endl;
+}
+
+template<int k, int W>
+void BenchPacketKNN(const std::vector<kdTree::float3>& tree, const std::vector<kdTree::float3>& queries, 
+                    const char* packetShape, float searchRadius)
+{
+    using namespace kdTree;
+    using CandidateList = KnnCandidateList<k>;
+    ThreadPool pool(1);
+    std::vector<int> ids(queries.size() * k);
+    std::vector<float> singleDist2(queries.size() * k), packetDist2(queries.size() * k);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    knnBatch<CandidateList, float3, default_data_traits<float3>>(pool, queries.data(), queries.size(), searchRadius, 
+                                                                  tree.data(), tree.size(), ids.data(), singleDist2.data());
+    auto mid = std::chrono::high_resolution_clock::now();
+    knnPacketBatch<CandidateList, W, float3, default_data_traits<float3>>(pool, queries.data(), queries.size(), searchRadius, 
+                                                                          tree.data(), tree.size(), ids.data(), packetDist2.data());
+    auto end = std::chrono::high_resolution_clock::now();
+
+    const double singleRate = queries.size() / std::chrono::duration<double>(mid - start).count();
+    const double packetRate = queries.size() / std::chrono::duration<double>(end - mid).count();
+    std::cout << "  K=" << std::setw(2) << k << " packet " << packetShape << std::fixed << std::setprecision(0)
+              << "  per query: " << std::setw(8) << singleRate << " q/s"
+              << "  packet: " << std::setw(8) << packetRate << " q/s"
+              << std::setprecision(2) << "  (" << packetRate / singleRate << "x)"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+void BENCH_PACKET_KNN(const BenchPointSet& set, int gridRes)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Packet vs. per-query traversal, " << gridRes << "^3 grid sweep: " << set.name << ", " 
+              << set.points.size() << " points ===" << std::endl;
+    auto tree = set.points;
+    BuildTree3D(tree);
+
+    const auto quads = GridSweepQueries(gridRes, set.extent, 2, 2, 1);
+    const auto octs = GridSweepQueries(gridRes, set.extent, 2, 2, 2);
+    BenchPacketKNN<1, 4>(tree, quads, "2x2x1", 2.0f * set.extent);
+    BenchPacketKNN<1, 8>(tree, octs, "2x2x2", 2.0f * set.extent);
+    BenchPacketKNN<5, 4>(tree, quads, "2x2x1", 2.0f * set.extent);
+    BenchPacketKNN<5, 8>(tree, octs, "2x2x2", 2.0f * set.extent);
+    BenchPacketKNN<16, 4>(tree, quads, "2x2x1", 2.0f * set.extent);
+    BenchPacketKNN<16, 8>(tree, octs, "2x2x2", 2.0f * set.extent);
+    // incoherent packets take the per-query fallback
+    BenchPacketKNN<5, 8>(tree, RandomPoints3D(gridRes * gridRes * gridRes, set.extent, 29), "random", 2.0f * set.extent);
+}
+
+// forwards to a candidate list and counts the nodes a query visits
+template<typename CandidateList>
+struct CountingCandidates
+{
+    float initialCullDist2() const { return result.initialCullDist2(); }
+    float processCandidate(int64_t slot, float dist2) 
+    {
+        ++count;
+        return result.processCandidate(int(slot), dist2);
+    }
+
+    CandidateList& result;
+    size_t& count;
+};
+
+// runs queries through knnBatchWith (cold) or knnSweepBatchWith (warm), counting visited nodes
+template<typename CandidateList>
+double TimeSweep(const std::vector<kdTree::float3>& tree, const std::vector<kdTree::float3>& queries, float searchRadius, 
+                 bool warm, std::vector<float>& dist2, size_t& numVisited)
+{
+    using namespace kdTree;
+    enum { k = CandidateList::num_k };
+    ThreadPool pool(1);
+    std::vector<int> ids(queries.size() * k);
+    dist2.resize(queries.size() * k);
+    numVisited = 0;
+    auto query = [&](CandidateList& result, const float3& q) 
+    { knn<CandidateList, float3, default_data_traits<float3>>(result, q, tree.data(), tree.size()); };
+    auto counted = [&](CandidateList& result, const float3& q) 
+    {
+        CountingCandidates<CandidateList> counter{ result, numVisited };
+        traverse_stack_free<decltype(counter), float3, default_data_traits<float3>>(counter, q, tree.data(), tree.size());
+    };
+    auto run = [&](auto&& body) 
+    {
+        if (warm) 
+            knnSweepBatchWith<CandidateList>(pool, queries.data(), queries.size(), searchRadius, body, ids.data(), dist2.data());
+        else 
+            knnBatchWith<CandidateList>(pool, queries.data(), queries.size(), searchRadius, body, ids.data(), dist2.data());
+    };
+    run(counted);
+    auto start = std::chrono::high_resolution_clock::now();
+    run(query);
+    auto end = std::chrono::high_resolution_clock::now();
+    return queries.size() / std::chrono::duration<double>(end - start).count();
+}
+
+void TEST_WARM_START()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Warm-started grid sweep ===" << std::endl;
+    auto tree = RandomPoints3D(20000, 100.0f, 91);
+    BuildTree3D(tree);
+    const auto grid = GridSweepQueries(32, 100.0f, 1, 1, 1);
+    const float diagonal = std::ceil(std::sqrt(3.0f) * 100.0f);
+
+    bool same = true;
+    size_t coldVisited = 0, warmVisited = 0;
+    std::vector<float> cold, warm;
+    // a diagonal-sized radius like VIS3D, and one small enough that some voxels find fewer than k
+    for (float radius : { diagonal, 6.0f }) 
+    {
+        size_t c = 0, w = 0;
+        TimeSweep<FixedCandidateList<1>>(tree, grid, radius, false, cold, c);
+        TimeSweep<FixedCandidateList<1>>(tree, grid, radius, true, warm, w);
+        same = same && cold == warm;
+        coldVisited += c; warmVisited += w;
+        TimeSweep<FixedCandidateList<8>>(tree, grid, radius, false, cold, c);
+        TimeSweep<FixedCandidateList<8>>(tree, grid, radius, true, warm, w);
+        same = same && cold == warm;
+        coldVisited += c; warmVisited += w;
+        TimeSweep<HeapCandidateList<32>>(tree, grid, radius, false, cold, c);
+        TimeSweep<HeapCandidateList<32>>(tree, grid, radius, true, warm, w);
+        same = same && cold == warm;
+        coldVisited += c; warmVisited += w;
+    }
+
+    if (same) 
+        std::cout << "  ✓ warm-started sweep returns the same neighbours as cold queries (K=1/8/32)" << std::endl;
+    else 
+        std::cout << "  ✗ warm-started sweep returns different neighbours" << std::endl;
+    if (warmVisited < coldVisited) 
+        std::cout << "  ✓ warm start visits fewer nodes (" << warmVisited << " vs. " << coldVisited << ")" << std::endl;
+    else 
+        std::cout << "  ✗ warm start does not visit fewer nodes (" << warmVisited << " vs. " << coldVisited << ")" << std::endl;
+}
+
+template<int k>
+void BenchWarmStart(const std::vector<kdTree::float3>& tree, const std::vector<kdTree::float3>& grid, float searchRadius)
+{
+    using namespace kdTree;
+    std::vector<float> cold, warm;
+    size_t coldVisited = 0, warmVisited = 0;
+    const double coldRate = TimeSweep<KnnCandidateList<k>>(tree, grid, searchRadius, false, cold, coldVisited);
+    const double warmRate = TimeSweep<KnnCandidateList<k>>(tree, grid, searchRadius, true, warm, warmVisited);
+    std::cout << "  K=" << std::setw(2) << k << std::fixed << std::setprecision(1) 
+              << "  nodes/query cold " << std::setw(7) << double(coldVisited) / grid.size() << "  warm " << std::setw(7) << double(warmVisited) / grid.size()
+              << std::setprecision(0) << "   cold " << std::setw(9) << coldRate << " q/s  warm " << std::setw(9) << warmRate 
+              << " q/s (" << std::setprecision(2) << warmRate / coldRate << "x)"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+void BENCH_WARM_START(const BenchPointSet& set, int gridRes)
+{
+    using namespace kdTree;
+    // the radius VIS3D starts every query with: the grid diagonal
+    const float searchRadius = std::ceil(std::sqrt(3.0f) * set.extent);
+    std::cout << "\n=== Warm-started vs. cold queries, " << gridRes << "^3 grid in row order, r=" << searchRadius << ": " << set.name << ", " 
+              << set.points.size() << " points ===" << std::endl;
+    auto tree = set.points;
+    BuildTree3D(tree);
+    const auto grid = GridSweepQueries(gridRes, set.extent, 1, 1, 1);
+    BenchWarmStart<1>(tree, grid, searchRadius);
+    BenchWarmStart<5>(tree, grid, searchRadius);
+    BenchWarmStart<16>(tree, grid, searchRadius);
+    BenchWarmStart<64>(tree, grid, searchRadius);
+}
+
+template<typename Traverse>
+kdTree::TraversalStats CollectTraversalStats(const std::vector<kdTree::float3>& queries, const Traverse& traverse, uint64_t& maxVisited)
+{
+    kdTree::TraversalStats total;
+    maxVisited = 0;
+    for (const auto& q : queries) 
+    {
+        kdTree::TraversalStats perQuery;
+        traverse(q, perQuery);
+        maxVisited = std::max(maxVisited, perQuery.nodesVisited);
+        total += perQuery;
+    }
+    return total;
+}
+
+void PrintTraversalStats(const char* name, const kdTree::TraversalStats& stats, uint64_t maxVisited)
+{
+    const double n = double(stats.numQueries);
+    std::cout << "    " << std::left << std::setw(11) << name << std::right << std::fixed << std::setprecision(1)
+              << " nodes " << std::setw(7) << stats.nodesVisited / n << " (max " << std::setw(6) << maxVisited << ")"
+              << "  distances " << std::setw(7) << stats.distanceEvals / n
+              << "  far descents " << std::setw(6) << stats.farChildDescents / n
+              << "  pushes " << std::setw(6) << stats.candidatePushes / n
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+template<int k>
+void BenchTraversalStats(const std::vector<kdTree::payload_point<kdTree::float3>>& nodes, const kdTree::box_t<kdTree::float3>& bounds,
+                         const std::vector<kdTree::float3>& queries, const char* queryName, float searchRadius)
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    using list_t = FixedCandidateList<k>;
+    std::cout << "  K=" << k << ", " << queryName << " (" << queries.size() << " queries, r=" << searchRadius << "), per query:" << std::endl;
+    uint64_t maxVisited = 0;
+    auto stackFree = CollectTraversalStats(queries, [&](const float3& q, TraversalStats& stats) 
+    {
+        list_t result(searchRadius);
+        traverse_stack_free<list_t, node_t, payload_data_traits<float3>>(result, q, nodes.data(), nodes.size(), 0.0f, stats);
+    }, maxVisited);
+    PrintTraversalStats("stack-free", stackFree, maxVisited);
+    auto boxPruned = CollectTraversalStats(queries, [&](const float3& q, TraversalStats& stats) 
+    {
+        list_t result(searchRadius);
+        traverse_box_pruned<list_t, node_t, payload_data_traits<float3>>(result, q, bounds, nodes.data(), nodes.size(), 0.0f, stats);
+    }, maxVisited);
+    PrintTraversalStats("box-pruned", boxPruned, maxVisited);
+
+    // cost of counting: the default policy against TraversalStats
+    std::vector<float> plainDist, countedDist;
+    TraversalStats counted;
+    const double plainRate = TimeKNNQueries<list_t>(queries, searchRadius, plainDist, [&](list_t& result, const float3& q) 
+    { traverse_stack_free<list_t, node_t, payload_data_traits<float3>>(result, q, nodes.data(), nodes.size()); });
+    const double countedRate = TimeKNNQueries<list_t>(queries, searchRadius, countedDist, [&](list_t& result, const float3& q) 
+    { traverse_stack_free<list_t, node_t, payload_data_traits<float3>>(result, q, nodes.data(), nodes.size(), 0.0f, counted); });
+    std::cout << "    stack-free without / with counting: " << std::fixed << std::setprecision(0) << plainRate << " / " << countedRate 
+              << " queries/s (" << std::setprecision(2) << countedRate / plainRate << "x)"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+void BENCH_TRAVERSAL_STATS(const BenchPointSet& set, int numQueries)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Traversal stats: " << set.name << ", " << set.points.size() << " points ===" << std::endl;
+    box_t<float3> bounds;
+    auto nodes = PayloadTree3D(set.points, bounds);
+
+    const auto random = RandomPoints3D(numQueries, set.extent, 111);
+    BenchTraversalStats<1>(nodes, bounds, random, "random queries", 2.0f * set.extent);
+    BenchTraversalStats<8>(nodes, bounds, random, "random queries", 2.0f * set.extent);
+
+    // the queries of VIS3D's default 16^3 output texture (voxel corners, K=1, the grid
+    // diagonal as radius), to compare with the counts of its TRAVERSAL_STATS shader variant
+    const int res = 16;
+    std::vector<float3> voxels;
+    for (int z = 0; z < res; z++) 
+        for (int y = 0; y < res; y++) 
+            for (int x = 0; x < res; x++) 
+                voxels.push_back(make_float3(x * set.extent / res, y * set.extent / res, z * set.extent / res));
+    BenchTraversalStats<1>(nodes, bounds, voxels, "VIS3D 16^3 grid", std::ceil(std::sqrt(3.0f) * set.extent));
+}
+
+void TEST_WIDEST_DIM_BUILD()
+{
+    using namespace kdTree;
+    using node_t = payload_dim_point<float3>;
+    using dim_traits = payload_dim_traits<float3>;
+    using level_traits = payload_dim_traits<float3, false>;
+    std::cout << "\n=== Widest-dimension (explicit dim) build ===" << std::endl;
+    // a 100x100x2 slab, queried from inside and around it
+    const auto points = AnisotropicPoints3D(20000, 100.0f, 100.0f, 2.0f, 121);
+    auto queries = AnisotropicPoints3D(2000, 120.0f, 120.0f, 22.0f, 122);
+    for (auto& q : queries) 
+        q = make_float3(q.x - 10.0f, q.y - 10.0f, q.z - 10.0f);
+    std::vector<node_t> widest, roundRobin;
+    box_t<float3> bounds;
+    BuildDimNodes(widest, points, true, bounds);
+    BuildDimNodes(roundRobin, points, false, bounds);
+
+    constexpr int k = 8;
+    bool matchesBruteForce = true, boxPrunedSame = true, roundRobinSame = true;
+    std::vector<float> all;
+    for (float radius : { 200.0f, 3.0f }) 
+    {
+        for (const auto& q : queries) 
+        {
+            FixedCandidateList<k> plain(radius), pruned(radius), fromNodes(radius), fromLevels(radius);
+            knn<FixedCandidateList<k>, node_t, dim_traits>(plain, q, widest.data(), widest.size());
+            knn<FixedCandidateList<k>, node_t, dim_traits>(pruned, q, bounds, widest.data(), widest.size());
+            knn<FixedCandidateList<k>, node_t, dim_traits>(fromNodes, q, roundRobin.data(), roundRobin.size());
+            knn<FixedCandidateList<k>, node_t, level_traits>(fromLevels, q, roundRobin.data(), roundRobin.size());
+            all.clear();
+            for (const auto& p : points) 
+                all.push_back(sqrDistance(q, p));
+            std::sort(all.begin(), all.end());
+            for (int i = 0; i < k; i++) 
+            {
+                const float expected = all[i] < radius * radius ? all[i] : radius * radius;
+                matchesBruteForce = matchesBruteForce && plain.get_dist2(i) == expected;
+                boxPrunedSame = boxPrunedSame && pruned.get_dist2(i) == plain.get_dist2(i);
+                roundRobinSame = roundRobinSame && fromNodes.get_dist2(i) == fromLevels.get_dist2(i) && fromNodes.get_pointID(i) == fromLevels.get_pointID(i);
+            }
+        }
+    }
+
+    // the packet traversal (KDTreeBuilder3D's batch path) reads the dims from the nodes as well
+    ThreadPool pool(1);
+    std::vector<int> ids(queries.size() * k);
+    std::vector<float> dist2(queries.size() * k);
+    knnPacketBatch<FixedCandidateList<k>, 8, node_t, dim_traits>(pool, queries.data(), queries.size(), 200.0f, 
+                                                                  widest.data(), int(widest.size()), ids.data(), dist2.data());
+    bool packetSame = true;
+    for (size_t q = 0; q < queries.size(); q++) 
+    {
+        FixedCandidateList<k> single(200.0f);
+        knn<FixedCandidateList<k>, node_t, dim_traits>(single, queries[q], widest.data(), widest.size());
+        for (int i = 0; i < k; i++) 
+            packetSame = packetSame && dist2[q * k + i] == single.get_dist2(i);
+    }
+
+    // the slab is 50x thinner in z than in x and y: the top levels must not split it
+    bool topLevelsSkipZ = true;
+    for (int64_t node = 0; node < BinaryTree::firstNodeInLevel(8); node++) 
+        topLevelsSkipZ = topLevelsSkipZ && widest[node].dim != 2;
+
+    if (matchesBruteForce) 
+        std::cout << "  ✓ widest-dimension tree returns the brute-force neighbours (K=8, large and small radius)" << std::endl;
+    else 
+        std::cout << "  ✗ widest-dimension tree returns different neighbours than brute force" << std::endl;
+    if (boxPrunedSame && packetSame) 
+        std::cout << "  ✓ box-pruned and packet traversals read the explicit dims too" << std::endl;
+    else 
+        std::cout << "  ✗ box-pruned or packet traversal differs on the widest-dimension tree" << std::endl;
+    if (roundRobinSame) 
+        std::cout << "  ✓ round-robin tree with its dims written into the nodes traverses like the level-based one" << std::endl;
+    else 
+        std::cout << "  ✗ round-robin dims stored in the nodes do not match the levels" << std::endl;
+    if (topLevelsSkipZ) 
+        std::cout << "  ✓ the top 8 levels of the slab only split along x and y" << std::endl;
+    else 
+        std::cout << "  ✗ the top levels of the slab split along its thin z axis" << std::endl;
+}
+
+template<int k>
+void BenchSplitDims(const std::vector<kdTree::payload_dim_point<kdTree::float3>>& roundRobin, 
+                    const std::vector<kdTree::payload_dim_point<kdTree::float3>>& widest,
+                    const std::vector<kdTree::float3>& queries, float searchRadius)
+{
+    using namespace kdTree;
+    using node_t = payload_dim_point<float3>;
+    using list_t = FixedCandidateList<k>;
+    std::cout << "  K=" << k << ":" << std::endl;
+    std::vector<float> rrDist, widestDist;
+    uint64_t maxVisited = 0;
+    const auto rrStats = CollectTraversalStats(queries, [&](const float3& q, TraversalStats& stats) 
+    {
+        list_t result(searchRadius);
+        traverse_stack_free<list_t, node_t, payload_dim_traits<float3>>(result, q, roundRobin.data(), roundRobin.size(), 0.0f, stats);
+    }, maxVisited);
+    PrintTraversalStats("round-robin", rrStats, maxVisited);
+    const auto widestStats = CollectTraversalStats(queries, [&](const float3& q, TraversalStats& stats) 
+    {
+        list_t result(searchRadius);
+        traverse_stack_free<list_t, node_t, payload_dim_traits<float3>>(result, q, widest.data(), widest.size(), 0.0f, stats);
+    }, maxVisited);
+    PrintTraversalStats("widest", widestStats, maxVisited);
+    const double rrRate = TimeKNNQueries<list_t>(queries, searchRadius, rrDist, [&](list_t& result, const float3& q) 
+    { knn<list_t, node_t, payload_dim_traits<float3>>(result, q, roundRobin.data(), roundRobin.size()); });
+    const double widestRate = TimeKNNQueries<list_t>(queries, searchRadius, widestDist, [&](list_t& result, const float3& q) 
+    { knn<list_t, node_t, payload_dim_traits<float3>>(result, q, widest.data(), widest.size()); });
+    std::cout << "    round-robin / widest: " << std::fixed << std::setprecision(0) << rrRate << " / " << widestRate 
+              << " queries/s (" << std::setprecision(2) << widestRate / rrRate << "x)"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+void BENCH_SPLIT_DIMS(const std::string& name, const kdTree::float3& extent, int numPoints, int numQueries)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Round-robin vs. widest-dimension splits: " << name << " (" << extent.x << " x " << extent.y << " x " << extent.z
+              << "), " << numPoints << " points ===" << std::endl;
+    const auto points = AnisotropicPoints3D(numPoints, extent.x, extent.y, extent.z, 42);
+    std::vector<payload_dim_point<float3>> roundRobin, widest;
+    box_t<float3> bounds;
+    auto start = std::chrono::high_resolution_clock::now();
+    BuildDimNodes(roundRobin, points, false, bounds);
+    auto end = std::chrono::high_resolution_clock::now();
+    const auto rrMs = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    start = std::chrono::high_resolution_clock::now();
+    BuildDimNodes(widest, points, true, bounds);
+    end = std::chrono::high_resolution_clock::now();
+    const auto widestMs = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::cout << "  build: round-robin " << rrMs << " ms, widest " << widestMs << " ms" << std::endl;
+
+    // queries from the data's own distribution, with the diagonal as radius like VIS3D
+    const auto queries = AnisotropicPoints3D(numQueries, extent.x, extent.y, extent.z, 43);
+    const float diagonal = std::ceil(std::sqrt(dot(extent, extent)));
+    BenchSplitDims<1>(roundRobin, widest, queries, diagonal);
+    BenchSplitDims<8>(roundRobin, widest, queries, diagonal);
+}
+
+// the voxel positions of a query grid in voxel-index order, for per-voxel reference queries
+std::vector<kdTree::float3> GridVoxels(const kdTree::QueryGrid3D& grid)
+{
+    std::vector<kdTree::float3> voxels(grid.numVoxels());
+    for (int z = 0; z < grid.res[2]; z++) 
+        for (int y = 0; y < grid.res[1]; y++) 
+            for (int x = 0; x < grid.res[0]; x++) 
+                voxels[grid.indexOf(x, y, z)] = grid.voxel(x, y, z);
+    return voxels;
+}
+
+template<typename CandidateList, typename data_t, typename data_traits>
+bool GridMatchesPerVoxel(const std::vector<data_t>& nodes, const kdTree::box_t<kdTree::float3>& bounds, 
+                         const kdTree::QueryGrid3D& grid, float radius, int blockSize)
+{
+    using namespace kdTree;
+    enum { k = CandidateList::num_k };
+    ThreadPool pool(2);
+    const auto voxels = GridVoxels(grid);
+    std::vector<int> gridIDs(voxels.size() * k), refIDs(voxels.size() * k);
+    std::vector<float> gridDist(voxels.size() * k), refDist(voxels.size() * k);
+    knnGrid<CandidateList, data_t, data_traits>(pool, grid, radius, bounds, nodes.data(), nodes.size(), gridIDs.data(), gridDist.data(), blockSize, 3);
+    knnBatchWith<CandidateList>(pool, voxels.data(), voxels.size(), radius, [&](CandidateList& result, const float3& q) 
+    { knn<CandidateList, data_t, data_traits>(result, q, nodes.data(), nodes.size()); }, refIDs.data(), refDist.data());
+    for (size_t i = 0; i < gridDist.size(); i++) 
+    {
+        if (gridDist[i] != refDist[i]) return false;
+        // equal distances may come in a different order, but a found slot has to hold its own distance
+        if ((gridIDs[i] < 0) != (refIDs[i] < 0)) return false;
+        if (gridIDs[i] >= 0 && sqrDistance(voxels[i / k], data_traits::get_point(nodes[gridIDs[i]])) != gridDist[i]) return false;
+    }
+    return true;
+}
+
+void TEST_GRID_KNN()
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    using traits_t = payload_data_traits<float3>;
+    std::cout << "\n=== Grid-block all-KNN ===" << std::endl;
+    // a cluster in part of the grid's domain, so blocks lie inside, at the edge and far outside of it
+    auto points = RandomPoints3D(20000, 40.0f, 131);
+    for (auto& p : points) 
+        p = make_float3(p.x + 10.0f, p.y + 20.0f, p.z + 5.0f);
+    std::vector<node_t> nodes(points.size());
+    for (size_t i = 0; i < points.size(); i++) 
+        nodes[i] = { points[i], 0.0f, uint32_t(i) };
+    box_t<float3> bounds;
+    BuildScratch<node_t> scratch;
+    buildTree_partition<node_t, traits_t>(nodes.data(), nodes.size(), &bounds, scratch);
+
+    // resolutions that are not multiples of the block size, and an anisotropic spacing
+    QueryGrid3D grid;
+    grid.origin = make_float3(-5.0f, 0.0f, -3.0f);
+    grid.spacing = make_float3(3.0f, 2.5f, 4.0f);
+    grid.res[0] = 23; grid.res[1] = 30; grid.res[2] = 17;
+    bool same = true;
+    for (float radius : { 200.0f, 4.0f }) 
+        for (int blockSize : { 1, 3, 4, 8 }) 
+        {
+            same = same && GridMatchesPerVoxel<FixedCandidateList<1>, node_t, traits_t>(nodes, bounds, grid, radius, blockSize);
+            same = same && GridMatchesPerVoxel<FixedCandidateList<8>, node_t, traits_t>(nodes, bounds, grid, radius, blockSize);
+            same = same && GridMatchesPerVoxel<HeapCandidateList<32>, node_t, traits_t>(nodes, bounds, grid, radius, blockSize);
+        }
+
+    std::vector<payload_dim_point<float3>> widest;
+    BuildDimNodes(widest, points, true, bounds);
+    const bool sameWidest = GridMatchesPerVoxel<FixedCandidateList<8>, payload_dim_point<float3>, payload_dim_traits<float3>>(widest, bounds, grid, 200.0f, 4);
+
+    if (same) 
+        std::cout << "  ✓ grid-block KNN matches per-voxel queries (K=1/8/32, block sizes 1/3/4/8, partial blocks)" << std::endl;
+    else 
+        std::cout << "  ✗ grid-block KNN differs from per-voxel queries" << std::endl;
+    if (sameWidest) 
+        std::cout << "  ✓ grid-block KNN works on a widest-dimension tree" << std::endl;
+    else 
+        std::cout << "  ✗ grid-block KNN differs on a widest-dimension tree" << std::endl;
+}
+
+template<int k>
+void BenchGridKNN(const std::vector<kdTree::float3>& tree, const kdTree::box_t<kdTree::float3>& bounds, 
+                  const kdTree::QueryGrid3D& grid, float searchRadius)
+{
+    using namespace kdTree;
+    using list_t = KnnCandidateList<k>;
+    ThreadPool pool(1);
+    const auto voxels = GridVoxels(grid);
+    std::vector<int> ids(voxels.size() * k);
+    std::vector<float> perVoxel(voxels.size() * k), dist2(voxels.size() * k);
+    auto query = [&](list_t& result, const float3& q) 
+    { knn<list_t, float3, default_data_traits<float3>>(result, q, tree.data(), tree.size()); };
+    auto timed = [&](auto&& body) 
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        body();
+        auto end = std::chrono::high_resolution_clock::now();
+        return voxels.size() / std::chrono::duration<double>(end - start).count();
+    };
+
+    const double coldRate = timed([&] { knnBatchWith<list_t>(pool, voxels.data(), voxels.size(), searchRadius, query, ids.data(), perVoxel.data()); });
+    const double warmRate = timed([&] { knnSweepBatchWith<list_t>(pool, voxels.data(), voxels.size(), searchRadius, query, ids.data(), dist2.data()); });
+    std::cout << "  K=" << std::setw(2) << k << std::fixed << std::setprecision(0)
+              << "  per voxel " << std::setw(9) << coldRate << " voxels/s   warm sweep " << std::setw(9) << warmRate << " voxels/s" << std::endl;
+    for (int blockSize : { 2, 4, 8, 0 }) 
+    {
+        const double rate = timed([&] 
+        { knnGrid<list_t, float3, default_data_traits<float3>>(pool, grid, searchRadius, bounds, tree.data(), tree.size(), ids.data(), dist2.data(), blockSize); });
+        if (blockSize == 0) 
+            std::cout << "        auto (" << gridBlockSizeFor(grid, bounds, tree.size()) << "^3)   ";
+        else 
+            std::cout << "        grid blocks " << blockSize << "^3 ";
+        std::cout << std::setw(9) << rate << " voxels/s (" << std::setprecision(2) << rate / coldRate << "x)" 
+                  << std::setprecision(0) << std::endl;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void BENCH_GRID_KNN(const BenchPointSet& set, int res)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Grid-block all-KNN vs. per-voxel queries: " << set.name << ", " << set.points.size() << " points, " 
+              << res << "^3 voxels, 1 thread ===" << std::endl;
+    auto tree = set.points;
+    const box_t<float3> bounds = BuildTree3D(tree);
+    QueryGrid3D grid;
+    grid.origin = make_float3(0.5f * set.extent / res, 0.5f * set.extent / res, 0.5f * set.extent / res);
+    grid.spacing = make_float3(set.extent / res, set.extent / res, set.extent / res);
+    grid.res[0] = grid.res[1] = grid.res[2] = res;
+    // the radius VIS3D starts every query with: the grid diagonal
+    const float searchRadius = std::ceil(std::sqrt(3.0f) * set.extent);
+    BenchGridKNN<1>(tree, bounds, grid, searchRadius);
+    BenchGridKNN<8>(tree, bounds, grid, searchRadius);
+}
+
+void TEST_KNN_GRAPH()
+{
+    using namespace kdTree;
+    std::cout << "\n=== KNN graph of all points ===" << std::endl;
+    // every 10th point duplicated, so some neighbours sit at distance 0
+    auto tree = RandomPoints3D(3000, 50.0f, 141);
+    for (size_t i = 0; i < 3000; i += 10) 
+        tree.push_back(tree[i]);
+    BuildTree3D(tree);
+    const int64_t N = tree.size();
+
+    constexpr int k = 8;
+    ThreadPool pool(3);
+    bool matchesBruteForce = true, noSelf = true, csrValid = true;
+    for (float radius : { 100.0f, 3.0f }) 
+    {
+        std::vector<int64_t> offsets;
+        std::vector<int> neighbors;
+        std::vector<float> dist2;
+        knnGraph<FixedCandidateList<k>, float3, default_data_traits<float3>>(pool, tree.data(), N, radius, offsets, neighbors, dist2, 100);
+        csrValid = csrValid && offsets.size() == size_t(N + 1) && offsets[0] == 0 && offsets[N] == int64_t(neighbors.size()) && neighbors.size() == dist2.size();
+        std::vector<float> expected;
+        for (int64_t q = 0; q < N && csrValid; q++) 
+        {
+            expected.clear();
+            for (int64_t i = 0; i < N; i++) 
+            {
+                const float d2 = sqrDistance(tree[q], tree[i]);
+                if (i != q && d2 < radius * radius) expected.push_back(d2);
+            }
+            std::sort(expected.begin(), expected.end());
+            expected.resize(std::min<size_t>(expected.size(), k));
+            const int64_t count = offsets[q + 1] - offsets[q];
+            matchesBruteForce = matchesBruteForce && count == int64_t(expected.size());
+            for (int64_t i = 0; i < count && matchesBruteForce; i++) 
+            {
+                const int64_t e = offsets[q] + i;
+                matchesBruteForce = dist2[e] == expected[i] && sqrDistance(tree[q], tree[neighbors[e]]) == dist2[e];
+                noSelf = noSelf && neighbors[e] != q;
+            }
+        }
+    }
+
+    if (csrValid && matchesBruteForce) 
+        std::cout << "  ✓ KNN graph rows match brute force (full rows and short rows within a small radius, duplicates kept)" << std::endl;
+    else 
+        std::cout << "  ✗ KNN graph differs from brute force" << std::endl;
+    if (noSelf) 
+        std::cout << "  ✓ no point is its own neighbour" << std::endl;
+    else 
+        std::cout << "  ✗ a point lists itself as neighbour" << std::endl;
+}
+
+template<int k>
+void BenchKnnGraph(const std::vector<kdTree::float3>& tree, float searchRadius, int numThreads)
+{
+    using namespace kdTree;
+    const int64_t N = tree.size();
+    // what N KDTreeBuilder3D::knnSearch calls do: a query for k+1 (the point finds itself), result
+    // vectors filled per call, the self match dropped by the caller
+    std::vector<int64_t> refOffsets(N + 1, 0);
+    std::vector<int> refNeighbors;
+    std::vector<float> refDist2;
+    refNeighbors.reserve(N * k);
+    refDist2.reserve(N * k);
+    std::vector<int> indices;
+    std::vector<float> distances;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int64_t q = 0; q < N; q++) 
+    {
+        KnnCandidateList<k + 1> result(searchRadius);
+        knn<KnnCandidateList<k + 1>, float3, default_data_traits<float3>>(result, tree[q], tree.data(), N);
+        result.sort();
+        indices.clear();
+        distances.clear();
+        for (int i = 0; i < k + 1; i++) 
+        {
+            if (result.get_pointID(i) < 0) break;
+            indices.push_back(result.get_pointID(i));
+            distances.push_back(result.get_dist2(i));
+        }
+        int kept = 0;
+        for (size_t i = 0; i < indices.size() && kept < k; i++) 
+        {
+            if (indices[i] == q) continue;
+            refNeighbors.push_back(indices[i]);
+            refDist2.push_back(distances[i]);
+            kept++;
+        }
+        refOffsets[q + 1] = refOffsets[q] + kept;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    const double independentRate = N / std::chrono::duration<double>(end - start).count();
+
+    std::vector<int64_t> offsets;
+    std::vector<int> neighbors;
+    std::vector<float> dist2;
+    auto timeGraph = [&](ThreadPool& pool) 
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        knnGraph<KnnCandidateList<k>, float3, default_data_traits<float3>>(pool, tree.data(), N, searchRadius, offsets, neighbors, dist2);
+        auto end = std::chrono::high_resolution_clock::now();
+        return N / std::chrono::duration<double>(end - start).count();
+    };
+    ThreadPool serial(1), parallel(numThreads);
+    const double serialRate = timeGraph(serial);
+    const double parallelRate = timeGraph(parallel);
+    std::cout << "  K=" << std::setw(2) << k << std::fixed << std::setprecision(0) 
+              << "  independent queries " << std::setw(8) << independentRate << " points/s   knnGraph 1 thread " << std::setw(8) << serialRate 
+              << " (" << std::setprecision(2) << serialRate / independentRate << "x), " << parallel.numThreads() << " threads " 
+              << std::setprecision(0) << std::setw(8) << parallelRate << " (" << std::setprecision(2) << parallelRate / independentRate << "x)" 
+              << "  CSR " << (offsets.size() * sizeof(int64_t) + neighbors.size() * (sizeof(int) + sizeof(float))) / (1024 * 1024) << " MiB" 
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+void BENCH_KNN_GRAPH(const BenchPointSet& set, int numThreads)
+{
+    using namespace kdTree;
+    std::cout << "\n=== KNN graph vs. independent queries: " << set.name << ", " << set.points.size() << " points ===" << std::endl;
+    auto tree = set.points;
+    BuildTree3D(tree);
+    const float searchRadius = std::ceil(std::sqrt(3.0f) * set.extent);
+    BenchKnnGraph<5>(tree, searchRadius, numThreads);
+    BenchKnnGraph<16>(tree, searchRadius, numThreads);
+}
+
+// the record layout of an out-of-core input file, behind a small header
+struct OutOfCoreRecord
+{
+    float x, y, z, value;
+};
+
+using OutOfCoreNode = kdTree::payload_dim_point<kdTree::float3>;
+using OutOfCoreTraits = kdTree::payload_dim_traits<kdTree::float3>;
+
+bool WriteOutOfCoreInput(const std::string& path, const std::vector<kdTree::float3>& points, uint64_t headerBytes)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    const std::vector<char> header(headerBytes, 0);
+    out.write(header.data(), header.size());
+    for (size_t i = 0; i < points.size(); i++) 
+    {
+        const OutOfCoreRecord r = { points[i].x, points[i].y, points[i].z, float(i) };
+        out.write(reinterpret_cast<const char*>(&r), sizeof(r));
+    }
+    return bool(out);
+}
+
+OutOfCoreNode OutOfCoreToNode(const OutOfCoreRecord& r, int64_t index)
+{
+    OutOfCoreNode node;
+    node.point = kdTree::make_float3(r.x, r.y, r.z);
+    node.value = r.value;
+    node.id = uint32_t(index);
+    node.dim = 0;
+    return node;
+}
+
+void TEST_OUT_OF_CORE()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Out-of-core build: partitioned chunk file, paged queries ===" << std::endl;
+    const std::string inputPath = "ooc_test.points", treePath = "ooc_test.kdchunks";
+    const auto points = RandomPoints3D(40000, 100.0f, 151);
+    WriteOutOfCoreInput(inputPath, points, 16);
+
+    // 256 KiB allow about 5400 of the 24-byte nodes per partition (plus scratch)
+    OutOfCoreConfig config;
+    config.memoryBudget = 256 << 10;
+    config.sampleSize = 4096;
+    const OutOfCoreStats stats = buildTreeOutOfCore<OutOfCoreNode, OutOfCoreTraits, OutOfCoreRecord>(inputPath, 16, OutOfCoreToNode, treePath, config);
+    if (stats.numChunks > 1 && stats.largestChunk <= stats.maxChunkSize && stats.numPoints == int64_t(points.size())) 
+        std::cout << "  ✓ " << stats.numChunks << " partitions, largest " << stats.largestChunk << " points (budget allows " << stats.maxChunkSize << ")" << std::endl;
+    else 
+        std::cout << "  ✗ partitions do not fit the budget: " << stats.numChunks << " chunks, largest " << stats.largestChunk << std::endl;
+
+    // two chunks' worth of cache, so queries keep evicting
+    const size_t cacheBytes = 2 * stats.largestChunk * sizeof(OutOfCoreNode);
+    ChunkedTree<OutOfCoreNode, OutOfCoreTraits> chunked(treePath, cacheBytes);
+    std::vector<int> seen(points.size(), 0);
+    bool nodesValid = chunked.numNodes() == int64_t(points.size());
+    for (int64_t i = 0; i < chunked.numNodes() && nodesValid; i++) 
+    {
+        const OutOfCoreNode& n = chunked.node(i);
+        nodesValid = n.id < points.size() && seen[n.id]++ == 0 && n.point.x == points[n.id].x && n.point.y == points[n.id].y && n.point.z == points[n.id].z && n.value == float(n.id);
+    }
+    for (int c = 0; c < chunked.numChunks() && nodesValid; c++) 
+    {
+        // every chunk is a kd-tree in its own right, inside its bounds and its top-tree partition
+        const auto& chunk = chunked.chunk(c);
+        const OutOfCoreNode* nodes = chunked.page(c);
+        for (uint64_t i = 0; i < chunk.numNodes && nodesValid; i++) 
+            nodesValid = chunk.bounds.contains(nodes[i].point) && chunked.chunkOf(nodes[i].point) == c;
+    }
+    if (nodesValid) 
+        std::cout << "  ✓ every input point is in exactly one chunk, with its id, value and partition" << std::endl;
+    else 
+        std::cout << "  ✗ chunk nodes do not match the input" << std::endl;
+
+    std::vector<float3> tree = points;
+    BuildTree3D(tree);
+    const auto queries = RandomPoints3D(1000, 110.0f, 152);
+    bool matches = true;
+    for (float radius : { 200.0f, 4.0f }) 
+    {
+        for (size_t q = 0; q < queries.size() && matches; q++) 
+        {
+            FixedCandidateList<8> expected(radius), result(radius);
+            knn<FixedCandidateList<8>, float3, default_data_traits<float3>>(expected, queries[q], tree.data(), tree.size());
+            chunked.knn(result, queries[q]);
+            for (int i = 0; i < 8 && matches; i++) 
+            {
+                matches = result.get_dist2(i) == expected.get_dist2(i);
+                if (matches && result.get_pointID(i) >= 0) 
+                    matches = sqrDistance(chunked.node(result.get_pointID(i)).point, queries[q]) == result.get_dist2(i);
+            }
+        }
+    }
+    if (matches && chunked.numChunkLoads() > chunked.numChunks() && chunked.bytesLoaded() <= cacheBytes) 
+        std::cout << "  ✓ paged KNN matches the in-memory tree (" << chunked.numChunkLoads() << " chunk loads within a " << cacheBytes / 1024 << " KiB cache)" << std::endl;
+    else 
+        std::cout << "  ✗ paged KNN differs from the in-memory tree, or the cache overran" << std::endl;
+
+    // identical points cannot be split, the one partition they land in is over budget
+    WriteOutOfCoreInput(inputPath, std::vector<float3>(40000, make_float3(1.0f, 2.0f, 3.0f)), 16);
+    bool threw = false;
+    try { buildTreeOutOfCore<OutOfCoreNode, OutOfCoreTraits, OutOfCoreRecord>(inputPath, 16, OutOfCoreToNode, treePath, config); }
+    catch (const std::runtime_error&) { threw = true; }
+    if (threw) 
+        std::cout << "  ✓ an input the partitions cannot split below the budget is reported" << std::endl;
+    else 
+        std::cout << "  ✗ over-budget partition was not reported" << std::endl;
+    // neither the half-written tree file nor any partition file is left behind
+    bool leftovers = bool(std::ifstream(treePath));
+    for (int c = 0; c < stats.numChunks; c++) 
+        leftovers = leftovers || bool(std::ifstream(outofcore::partPath(treePath, c)));
+    if (!leftovers) 
+        std::cout << "  ✓ a failed build removes the tree file and its partition files" << std::endl;
+    else 
+        std::cout << "  ✗ a failed build left the tree file or partition files behind" << std::endl;
+    std::remove(inputPath.c_str());
+    std::remove(treePath.c_str());
+}
+
+void BENCH_OUT_OF_CORE(int numPoints, int numThreads)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Out-of-core build: uniform random, " << numPoints << " points, budget 1/8 of the nodes ===" << std::endl;
+    const std::string inputPath = "ooc_bench.points", treePath = "ooc_bench.kdchunks";
+    const auto points = RandomPoints3D(numPoints, 100.0f, 42);
+    WriteOutOfCoreInput(inputPath, points, 0);
+    const size_t dataBytes = points.size() * sizeof(OutOfCoreNode);
+
+    // in memory: all nodes plus the build scratch
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<OutOfCoreNode> nodes(points.size());
+    for (size_t i = 0; i < points.size(); i++) 
+        nodes[i] = OutOfCoreToNode({ points[i].x, points[i].y, points[i].z, float(i) }, i);
+    box_t<float3> bounds;
+    BuildScratch<OutOfCoreNode> scratch;
+    buildTree_partition<OutOfCoreNode, OutOfCoreTraits>(nodes.data(), nodes.size(), &bounds, scratch, numThreads);
+    auto end = std::chrono::high_resolution_clock::now();
+    const double inMemoryMs = std::chrono::duration<double, std::milli>(end - start).count();
+    std::vector<OutOfCoreNode>().swap(nodes);
+    std::vector<OutOfCoreNode>().swap(scratch.buffer);
+
+    OutOfCoreConfig config;
+    config.memoryBudget = dataBytes / 8;
+    config.numThreads = numThreads;
+    start = std::chrono::high_resolution_clock::now();
+    const OutOfCoreStats stats = buildTreeOutOfCore<OutOfCoreNode, OutOfCoreTraits, OutOfCoreRecord>(inputPath, 0, OutOfCoreToNode, treePath, config);
+    end = std::chrono::high_resolution_clock::now();
+    const double outOfCoreMs = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << std::fixed << std::setprecision(1) << "  in memory " << inMemoryMs << " ms using " << 2 * dataBytes / (1 << 20) << " MiB"
+              << "   out of core " << outOfCoreMs << " ms within " << config.memoryBudget / (1 << 20) << " MiB (" 
+              << stats.numChunks << " chunks, largest " << stats.largestChunk << " of " << stats.maxChunkSize << " points)"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+
+    // blocked grid sweep (coherent) vs. the same queries shuffled, with a cache of a quarter of the chunks
+    auto coherent = GridSweepQueries(32, 100.0f, 8, 8, 8);
+    auto shuffled = coherent;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(7));
+    const float searchRadius = 100.0f;
+    auto timeQueries = [&](const std::vector<float3>& queries, size_t cacheBytes, const char* label) 
+    {
+        ChunkedTree<OutOfCoreNode, OutOfCoreTraits> chunked(treePath, cacheBytes);
+        float sum = 0.0f;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const auto& q : queries) 
+        {
+            FixedCandidateList<8> result(searchRadius);
+            sum += chunked.knn(result, q);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "  " << std::setw(22) << std::left << label << std::right << std::fixed << std::setprecision(0) 
+                  << std::setw(9) << queries.size() / std::chrono::duration<double>(end - start).count() << " queries/s, " 
+                  << std::setw(6) << chunked.numChunkLoads() << " chunk loads" << std::defaultfloat << std::setprecision(6) << std::endl;
+        if (sum < 0.0f) std::cout << sum;
+    };
+    timeQueries(coherent, dataBytes, "all chunks cached");
+    timeQueries(coherent, dataBytes / 4, "1/4 cached, coherent");
+    timeQueries(shuffled, dataBytes / 4, "1/4 cached, shuffled");
+    std::remove(inputPath.c_str());
+    std::remove(treePath.c_str());
+}
+
+template<typename CandidateList, typename point_t>
+bool BruteForceMatchesTree(kdTree::ThreadPool& pool, const std::vector<point_t>& tree, const std::vector<point_t>& queries, float radius)
+{
+    using namespace kdTree;
+    enum { k = CandidateList::num_k };
+    BruteForcePoints<point_t> points;
+    makeBruteForcePoints<point_t>(points, tree.data(), tree.size());
+    const size_t numResults = queries.size() * k;
+    std::vector<int> treeIDs(numResults), bruteIDs(numResults);
+    std::vector<float> treeDist2(numResults), bruteDist2(numResults);
+    knnBatch<CandidateList, point_t, default_data_traits<point_t>>(pool, queries.data(), queries.size(), radius, tree.data(), tree.size(), treeIDs.data(), treeDist2.data());
+    bruteForceKnnBatch<CandidateList>(pool, queries.data(), queries.size(), radius, points, bruteIDs.data(), bruteDist2.data());
+    return treeIDs == bruteIDs && treeDist2 == bruteDist2;
+}
+
+void TEST_SIMD_BRUTE_FORCE()
+{
+    using namespace kdTree;
+    std::cout << "\n=== SIMD brute-force KNN and brute-force/tree crossover ===" << std::endl;
+    // 5003 points: not a multiple of the SIMD width, so the padding is scanned too
+    auto tree3 = RandomPoints3D(5003, 100.0f, 161);
+    for (int i = 0; i < 50; i++) 
+        tree3.push_back(tree3[i]);
+    std::vector<float2> tree2(tree3.size());
+    for (size_t i = 0; i < tree3.size(); i++) 
+        tree2[i] = make_float2(tree3[i].x, tree3[i].y);
+    box_t<float3> bounds3;
+    box_t<float2> bounds2;
+    BuildScratch<float3> scratch3;
+    BuildScratch<float2> scratch2;
+    buildTree_partition<float3, default_data_traits<float3>>(tree3.data(), tree3.size(), &bounds3, scratch3);
+    buildTree_partition<float2, default_data_traits<float2>>(tree2.data(), tree2.size(), &bounds2, scratch2);
+    const auto queries3 = RandomPoints3D(500, 110.0f, 162);
+    std::vector<float2> queries2(queries3.size());
+    for (size_t i = 0; i < queries3.size(); i++) 
+        queries2[i] = make_float2(queries3[i].x, queries3[i].y);
+    // a few queries with several threads split the points instead of the queries
+    const std::vector<float3> fewQueries(queries3.begin(), queries3.begin() + 3);
+
+    ThreadPool serial(1), parallel(3);
+    bool matches = true;
+    for (float radius : { 500.0f, 5.0f }) 
+    {
+        for (ThreadPool* pool : { &serial, &parallel }) 
+        {
+            matches = matches && BruteForceMatchesTree<FixedCandidateList<1>>(*pool, tree3, queries3, radius);
+            matches = matches && BruteForceMatchesTree<FixedCandidateList<8>>(*pool, tree3, queries3, radius);
+            matches = matches && BruteForceMatchesTree<HeapCandidateList<32>>(*pool, tree3, queries3, radius);
+            matches = matches && BruteForceMatchesTree<FixedCandidateList<8>>(*pool, tree2, queries2, radius);
+            matches = matches && BruteForceMatchesTree<FixedCandidateList<8>>(*pool, tree3, fewQueries, radius);
+            matches = matches && BruteForceMatchesTree<HeapCandidateList<32>>(*pool, tree3, fewQueries, radius);
+        }
+    }
+    if (matches) 
+        std::cout << "  ✓ brute force gives the tree's IDs and distances (2D/3D, K=1/8/32, 1 and 3 threads, split over queries and over points)" << std::endl;
+    else 
+        std::cout << "  ✗ brute force differs from the tree" << std::endl;
+
+    // the oracle's insertion keeps the k smallest, closest first
+    bool oracleSorted = true;
+    for (size_t q = 0; q < 50; q++) 
+    {
+        auto brute = bruteForceKNN<8>(tree3, queries3[q]);
+        FixedCandidateList<8> result(1e6f);
+        knn<FixedCandidateList<8>, float3, default_data_traits<float3>>(result, queries3[q], tree3.data(), tree3.size());
+        for (int i = 0; i < 8; i++) 
+            oracleSorted = oracleSorted && brute.get_dist2(i) == result.get_dist2(i);
+    }
+    if (oracleSorted) 
+        std::cout << "  ✓ bruteForceKNN oracle still matches the tree" << std::endl;
+    else 
+        std::cout << "  ✗ bruteForceKNN oracle differs from the tree" << std::endl;
+
+    // a hand-made table: brute force up to 8192 points for K=8 with a large radius only
+    KnnCrossover crossover;
+    crossover.maxBruteForceN[KnnCrossover::kIndex(8)][2] = 8192;
+    BruteForcePoints<float3> points;
+    makeBruteForcePoints<float3>(points, tree3.data(), tree3.size());
+    std::vector<int> ids(queries3.size() * 8), refIDs(ids.size());
+    std::vector<float> dist2(ids.size()), refDist2(ids.size());
+    knnBatch<FixedCandidateList<8>, float3, default_data_traits<float3>>(parallel, queries3.data(), queries3.size(), 500.0f, tree3.data(), tree3.size(), refIDs.data(), refDist2.data());
+    const bool bigRadius = knnBatchAuto<FixedCandidateList<8>, float3>(parallel, crossover, queries3.data(), queries3.size(), 500.0f, bounds3, tree3.data(), tree3.size(), &points, ids.data(), dist2.data());
+    const bool sameResults = ids == refIDs && dist2 == refDist2;
+    const bool smallRadius = knnBatchAuto<FixedCandidateList<8>, float3>(parallel, crossover, queries3.data(), queries3.size(), 2.0f, bounds3, tree3.data(), tree3.size(), &points, ids.data(), dist2.data());
+    const bool otherK = knnBatchAuto<FixedCandidateList<1>, float3>(parallel, crossover, queries3.data(), queries3.size(), 500.0f, bounds3, tree3.data(), tree3.size(), &points, ids.data(), dist2.data());
+    if (bigRadius && sameResults && !smallRadius && !otherK) 
+        std::cout << "  ✓ knnBatchAuto picks brute force by N, K and radius class, with the tree's results" << std::endl;
+    else 
+        std::cout << "  ✗ knnBatchAuto picked the wrong method or changed results" << std::endl;
+
+    const std::string path = "crossover_test.txt";
+    KnnCrossover loaded;
+    const bool roundTrip = crossover.save(path) && loaded.load(path)
+        && std::equal(&crossover.maxBruteForceN[0][0], &crossover.maxBruteForceN[0][0] + KnnCrossover::numK * KnnCrossover::numRadiusClasses, &loaded.maxBruteForceN[0][0]);
+    std::remove(path.c_str());
+    if (roundTrip && !loaded.load(path)) 
+        std::cout << "  ✓ crossover table saves and loads, a missing file is rejected" << std::endl;
+    else 
+        std::cout << "  ✗ crossover table save/load failed" << std::endl;
+}
+
+void TEST_DYNAMIC_FOREST()
+{
+    using namespace kdTree;
+    std::cout << "\n=== Dynamic forest: inserts, tombstone deletes, merged KNN ===" << std::endl;
+    auto points = RandomPoints3D(30000, 100.0f, 37);
+    auto queries = RandomPoints3D(300, 100.0f, 38);
+    std::vector<uint8_t> alive(points.size(), 0);
+    DynamicForest<float3> forest(64);
+
+    // the live set, re-indexed by forest id, for brute force
+    auto matchesBruteForce = [&]() 
+    {
+        std::vector<float3> live;
+        for (size_t i = 0; i < points.size(); i++) 
+            live.push_back(alive[i] ? points[i] : make_float3(1e6f, 1e6f, 1e6f));
+        for (const auto& q : queries) 
+        {
+            FixedCandidateList<8> result(200.0f);
+            forest.knn(result, q);
+            result.sort();
+            auto brute = bruteForceKNN<8>(live, q, 200.0f);
+            for (int i = 0; i < 8; i++) 
+            {
+                if (result.get_dist2(i) != brute.get_dist2(i)) return false;
+                if (result.get_pointID(i) >= 0 && !alive[result.get_pointID(i)]) return false;
+            }
+        }
+        return true;
+    };
+
+    bool resultsMatch = true;
+    size_t next = 0;
+    // one at a time, then in batches
+    for (; next < 10000; next++) 
+    {
+        forest.insert(points[next], float(next));
+        alive[next] = 1;
+    }
+    resultsMatch = resultsMatch && matchesBruteForce();
+    for (size_t i = 0; i < next; i += 3) 
+    {
+        forest.erase(uint32_t(i));
+        alive[i] = 0;
+    }
+    resultsMatch = resultsMatch && matchesBruteForce();
+    std::vector<float> values(1000);
+    for (; next < points.size(); next += 1000) 
+    {
+        forest.insertBatch(points.data() + next, values.data(), 1000);
+        std::fill(alive.begin() + next, alive.begin() + next + 1000, 1);
+    }
+    // delete most of the first half so that trees get compacted
+    for (size_t i = 0; i < points.size() / 2; i++) 
+    {
+        if (i % 5 != 0 && alive[i]) 
+        {
+            forest.erase(uint32_t(i));
+            alive[i] = 0;
+        }
+    }
+    resultsMatch = resultsMatch && matchesBruteForce();
+    const bool rejectsDead = !forest.erase(0) && !forest.erase(uint32_t(points.size()));
+    const size_t numAlive = std::count(alive.begin(), alive.end(), 1);
+
+    if (resultsMatch && rejectsDead && forest.size() == numAlive) 
+        std::cout << "  ✓ KNN over " << forest.numTrees() << " trees matches brute force on the " << numAlive << " live points" << std::endl;
+    else 
+        std::cout << "  ✗ Dynamic forest disagrees with brute force" << std::endl;
+}
+
+void BENCH_DYNAMIC_INSERT(int numPoints, int batchSize)
+{
+    using namespace kdTree;
+    std::cout << "\n=== Streaming inserts: " << numPoints << " points in batches of " << batchSize 
+              << ", forest vs. full rebuild per batch ===" << std::endl;
+    auto points = RandomPoints3D(numPoints, 100.0f, 41);
+    std::vector<float> values(numPoints, 0.0f);
+
+    DynamicForest<float3> forest;
+    std::vector<typename DynamicForest<float3>::Change> changes;
+    size_t uploadedNodes = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int first = 0; first < numPoints; first += batchSize) 
+    {
+        forest.insertBatch(points.data() + first, values.data() + first, std::min(batchSize, numPoints - first));
+        changes.clear();
+        forest.takeChanges(changes);
+        for (const auto& c : changes) 
+            uploadedNodes += c.end - c.begin;
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+
+    std::vector<float3> tree;
+    BuildScratch<float3> scratch;
+    box_t<float3> bounds;
+    for (int first = 0; first < numPoints; first += batchSize) 
+    {
+        tree.insert(tree.end(), points.begin() + first, points.begin() + std::min(numPoints, first + batchSize));
+        buildTree_partition<float3, default_data_traits<float3>>(tree.data(), tree.size(), &bounds, scratch);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    const double forestRate = numPoints / std::chrono::duration<double>(mid - start).count();
+    const double rebuildRate = numPoints / std::chrono::duration<double>(end - mid).count();
+    const int numBatches = (numPoints + batchSize - 1) / batchSize;
+    std::cout << std::fixed << std::setprecision(0) 
+              << "  forest:  " << std::setw(9) << forestRate << " inserts/s, " << forest.numTrees() << " trees, "
+              << std::setprecision(1) << double(uploadedNodes) / numBatches << " nodes re-uploaded per batch" << std::endl
+              << std::setprecision(0)
+              << "  rebuild: " << std::setw(9) << rebuildRate << " inserts/s, " 
+              << std::setprecision(1) << double(numPoints) / 2 << " nodes re-uploaded per batch (average)" << std::endl;
+
+    auto queries = RandomPoints3D(100000, 100.0f, 43);
+    std::vector<float> forestDist2, staticDist2;
+    const double forestQueryRate = TimeKNNQueries<FixedCandidateList<5>>(queries, 200.0f, forestDist2, [&](FixedCandidateList<5>& result, const float3& q) 
+    { forest.knn(result, q); });
+    const double staticQueryRate = TimeKNNQueries<FixedCandidateList<5>>(queries, 200.0f, staticDist2, [&](FixedCandidateList<5>& result, const float3& q) 
+    { knn<FixedCandidateList<5>, float3, default_data_traits<float3>>(result, q, tree.data(), tree.size()); });
+    std::cout << std::setprecision(0) << "  K=5 queries: forest " << forestQueryRate << " q/s, single tree " << staticQueryRate << " q/s"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+void TEST_VALUE_UPDATE()
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::cout << "\n=== Value-only update ===" << std::endl;
+    bool valuesMatch = true;
+    auto check = [&](const std::vector<float3>& positions, int numThreads) 
+    {
+        const int numPoints = positions.size();
+        std::vector<node_t> nodes(numPoints);
+        for (int i = 0; i < numPoints; i++) 
+            nodes[i] = { positions[i], 0.0f, uint32_t(i) };
+        box_t<float3> bounds;
+        BuildScratch<node_t> scratch;
+        buildTree_partition<node_t, payload_data_traits<float3>>(nodes.data(), numPoints, &bounds, scratch, numThreads);
+        std::vector<uint32_t> slotToInput(numPoints);
+        for (int i = 0; i < numPoints; i++) 
+            slotToInput[i] = nodes[i].id;
+
+        // next timestep: new values, same positions
+        std::mt19937 gen(47);
+        std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+        std::vector<float> values(numPoints);
+        for (auto& v : values) 
+            v = dis(gen);
+        std::vector<float> treeOrder(numPoints);
+        gatherToTreeOrder(treeOrder.data(), values.data(), slotToInput.data(), numPoints, numThreads);
+        std::vector<node_t> rebuilt(numPoints);
+        for (int i = 0; i < numPoints; i++) 
+            rebuilt[i] = { positions[i], values[i], uint32_t(i) };
+        buildTree_partition<node_t, payload_data_traits<float3>>(rebuilt.data(), numPoints, &bounds, scratch, numThreads);
+        for (int i = 0; i < numPoints; i++) 
+            valuesMatch = valuesMatch && rebuilt[i].id == slotToInput[i] && rebuilt[i].value == treeOrder[i];
+    };
+    check(IntegerLattice(24), 1);
+    check(RandomPoints3D(50000, 100.0f, 42), 3);
+
+    if (valuesMatch) 
+        std::cout << "  ✓ Gathered values equal the rebuilt tree's payloads slot by slot (1 and 3 threads)" << std::endl;
+    else 
+        std::cout << "  ✗ Gathered values differ from a rebuild" << std::endl;
+}
+
+void BENCH_VALUE_UPDATE(const BenchPointSet& set, int numThreads)
+{
+    using namespace kdTree;
+    using node_t = payload_point<float3>;
+    std::cout << "\n=== Value-only update vs. rebuild: " << set.name << ", " << set.points.size() << " points ===" << std::endl;
+    const int numPoints = set.points.size();
+    std::mt19937 gen(47);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+    std::vector<float> values(numPoints);
+    for (auto& v : values) 
+        v = dis(gen);
+
+    std::vector<node_t> nodes(numPoints);
+    for (int i = 0; i < numPoints; i++) 
+        nodes[i] = { set.points[i], 0.0f, uint32_t(i) };
+    box_t<float3> bounds;
+    BuildScratch<node_t> scratch;
+    buildTree_partition<node_t, payload_data_traits<float3>>(nodes.data(), numPoints, &bounds, scratch, numThreads);
+    std::vector<uint32_t> slotToInput(numPoints);
+    for (int i = 0; i < numPoints; i++) 
+        slotToInput[i] = nodes[i].id;
+
+    // next timestep: new values, same positions
+    for (auto& v : values) 
+        v = dis(gen);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<float> treeOrder(numPoints);
+    gatherToTreeOrder(treeOrder.data(), values.data(), slotToInput.data(), numPoints, numThreads);
+    auto mid = std::chrono::high_resolution_clock::now();
+    std::vector<node_t> rebuilt(numPoints);
+    for (int i = 0; i < numPoints; i++) 
+        rebuilt[i] = { set.points[i], values[i], uint32_t(i) };
+    buildTree_partition<node_t, payload_data_traits<float3>>(rebuilt.data(), numPoints, &bounds, scratch, numThreads);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    const double gatherMs = std::chrono::duration<double, std::milli>(mid - start).count();
+    const double rebuildMs = std::chrono::duration<double, std::milli>(end - mid).count();
+    std::cout << std::fixed << std::setprecision(2) 
+              << "  gather into tree order: " << gatherMs << " ms, rebuild with new values: " << rebuildMs << " ms ("
+              << std::setprecision(0) << rebuildMs / gatherMs << "x)" << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+template<int N>
+std::vector<kdTree::payload_point<kdTree::vec_float<N>>> RandomNodesND(int numPoints, std::mt19937& gen)
+{
+    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+    std::vector<kdTree::payload_point<kdTree::vec_float<N>>> nodes(numPoints);
+    for (int i = 0; i < numPoints; i++) 
+    {
+        for (int d = 0; d < N; d++) 
+            nodes[i].point.v[d] = dis(gen);
+        nodes[i].value = float(i);
+        nodes[i].id = uint32_t(i);
+    }
+    return nodes;
+}
+
+template<int N>
+bool NDMatchesBruteForce(int numPoints, int numQueries)
+{
+    using namespace kdTree;
+    using point_t = vec_float<N>;
+    using node_t = payload_point<point_t>;
+    using traits_t = payload_data_traits<point_t>;
+    constexpr int k = 8;
+    std::mt19937 gen(100 + N);
+    auto nodes = RandomNodesND<N>(numPoints, gen);
+    const auto queryNodes = RandomNodesND<N>(numQueries, gen);
+    std::vector<point_t> queries(numQueries);
+    for (int q = 0; q < numQueries; q++) 
+        queries[q] = queryNodes[q].point;
+
+    box_t<point_t> bounds;
+    BuildScratch<node_t> scratch;
+    buildTree_partition<node_t, traits_t>(nodes.data(), numPoints, &bounds, scratch, 2);
+    ThreadPool pool(2);
+    std::vector<int> ids(numQueries * k);
+    std::vector<float> dist2(numQueries * k);
+    knnPacketBatch<KnnCandidateList<k>, 8, node_t, traits_t>(pool, queries.data(), numQueries, INFINITY, nodes.data(), numPoints, ids.data(), dist2.data());
+
+    for (int q = 0; q < numQueries; q++) 
+    {
+        KnnCandidateList<k> single(INFINITY);
+        knn<KnnCandidateList<k>, node_t, traits_t>(single, queries[q], nodes.data(), numPoints);
+        std::vector<float> bruteDist2(numPoints);
+        for (int i = 0; i < numPoints; i++) 
+            bruteDist2[i] = sqrDistance(queries[q], nodes[i].point);
+        std::nth_element(bruteDist2.begin(), bruteDist2.begin() + k, bruteDist2.end());
+        std::sort(bruteDist2.begin(), bruteDist2.begin() + k);
+        if (single.returnValue() != bruteDist2[k - 1]) return false;
+        for (int i = 0; i < k; i++) 
+            if (dist2[q*k+i] != bruteDist2[i] || nodes[ids[q*k+i]].value != float(nodes[ids[q*k+i]].id)) return false;
+    }
+    return true;
+}
+
+void TEST_ND_KNN()
+{
+    std::cout << "\n=== N-dimensional KNN ===" << std::endl;
+    const bool resultsMatch = NDMatchesBruteForce<2>(5000, 300) && NDMatchesBruteForce<3>(5000, 300) && NDMatchesBruteForce<4>(5000, 300)
+                           && NDMatchesBruteForce<5>(5000, 300) && NDMatchesBruteForce<6>(5000, 300) && NDMatchesBruteForce<7>(5000, 300)
+                           && NDMatchesBruteForce<8>(5000, 300);
+    if (resultsMatch) 
+        std::cout << "  ✓ KNN over vec_float<2..8> matches brute force (single and packet batch, K=8), payloads intact" << std::endl;
+    else 
+        std::cout << "  ✗ N-dimensional KNN differs from brute force" << std::endl;
+}
+
+template<int N>
+void BenchNDKNN(int numPoints, int numQueries, int numThreads)
+{
+    using namespace kdTree;
+    using point_t = vec_float<N>;
+    using node_t = payload_point<point_t>;
+    using traits_t = payload_data_traits<point_t>;
+    constexpr int k = 8;
+    std::mt19937 gen(100 + N);
+    auto nodes = RandomNodesND<N>(numPoints, gen);
+    const auto queryNodes = RandomNodesND<N>(numQueries, gen);
+    std::vector<point_t> queries(numQueries);
+    for (int q = 0; q < numQueries; q++) 
+        queries[q] = queryNodes[q].point;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    box_t<point_t> bounds;
+    BuildScratch<node_t> scratch;
+    buildTree_partition<node_t, traits_t>(nodes.data(), numPoints, &bounds, scratch, numThreads);
+    auto built = std::chrono::high_resolution_clock::now();
+    float sumDist2 = 0.0f;
+    for (const point_t& q : queries) 
+    {
+        KnnCandidateList<k> result(INFINITY);
+        sumDist2 += knn<KnnCandidateList<k>, node_t, traits_t>(result, q, nodes.data(), numPoints);
+    }
+    auto single = std::chrono::high_resolution_clock::now();
+    ThreadPool pool(numThreads);
+    std::vector<int> ids(numQueries * k);
+    std::vector<float> dist2(numQueries * k);
+    knnPacketBatch<KnnCandidateList<k>, 8, node_t, traits_t>(pool, queries.data(), numQueries, INFINITY, nodes.data(), numPoints, ids.data(), dist2.data());
+    auto end = std::chrono::high_resolution_clock::now();
+
+    const double buildMs = std::chrono::duration<double, std::milli>(built - start).count();
+    const double singleSeconds = std::chrono::duration<double>(single - built).count();
+    const double batchSeconds = std::chrono::duration<double>(end - single).count();
+    std::cout << "  N=" << N << ": build " << std::fixed << std::setprecision(1) << buildMs << " ms, "
+              << std::setprecision(0) << numQueries / singleSeconds << " queries/s (1 thread), "
+              << numQueries / batchSeconds << " queries/s (batch, " << pool.numThreads() << " threads)"
+              << std::defaultfloat << std::setprecision(6) << std::endl;
+    if (sumDist2 < 0.0f) std::cout << sumDist2;
+}
+
+void BENCH_ND_KNN(int numPoints, int numQueries, int numThreads)
+{
+    std::cout << "\n=== N-dimensional KNN (K=8): uniform random in [0,1]^N, " << numPoints << " points, " << numQueries << " queries ===" << std::endl;
+    BenchNDKNN<2>(numPoints, numQueries, numThreads);
+    BenchNDKNN<3>(numPoints, numQueries, numThreads);
+    BenchNDKNN<4>(numPoints, numQueries, numThreads);
+    BenchNDKNN<5>(numPoints, numQueries, numThreads);
+    BenchNDKNN<6>(numPoints, numQueries, numThreads);
+    BenchNDKNN<7>(numPoints, numQueries, numThreads);
+    BenchNDKNN<8>(numPoints, numQueries, numThreads);
+}
+
+
+// app [numPoints] [numThreads] [--bench]
+// runs the correctness tests; the benchmarks only run with --bench
+int main(int argc, char** argv) 
+{
+    std::vector<std::string> args;
+    bool runBenchmarks = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--bench") runBenchmarks = true;
+        else args.push_back(argv[i]);
+    }
+    const int numPoints = args.size() > 0 ? std::atoi(args[0].c_str()) : 1000000;
+    const int numThreads = args.size() > 1 ? std::atoi(args[1].c_str()) : 0;
 
     TEST();
-    
-   
+    TEST_PARALLEL_BUILD(numPoints, numThreads);
+    TEST_PARTITION_BUILD();
+    TEST_PAYLOAD_BUILD();
+    TEST_BATCH_KNN();
+    TEST_BUCKET_KNN();
+    TEST_RANGE_QUERY();
+    TEST_RUNTIME_K();
+    TEST_PACKET_KNN();
+    TEST_DYNAMIC_FOREST();
+    TEST_VALUE_UPDATE();
+    TEST_ND_KNN();
+    TEST_LARGE_INDEX();
+    TEST_QUANTIZED_KNN();
+    TEST_BLOCKED_LAYOUT();
+    TEST_BOX_PRUNED_KNN();
+    TEST_WARM_START();
+    TEST_TRAVERSAL_STATS();
+    TEST_WIDEST_DIM_BUILD();
+    TEST_GRID_KNN();
+    TEST_KNN_GRAPH();
+    TEST_OUT_OF_CORE();
+    TEST_SIMD_BRUTE_FORCE();
+    if (!runBenchmarks)
+        return 0;
+
+    const auto pointSets = StandardBenchPointSets(numPoints);
+    for (const auto& set : pointSets) 
+        BENCH_PARTITION_BUILD(set, numThreads);
+    BENCH_BATCH_KNN(numPoints, numThreads);
+    for (const auto& set : pointSets) 
+        BENCH_BUCKET_KNN(set, numPoints);
+    for (const auto& set : pointSets) 
+        BENCH_CANDIDATE_LISTS(set, numPoints);
+    for (const auto& set : pointSets) 
+        BENCH_APPROX_KNN(set, numPoints);
+    for (const auto& set : pointSets) 
+        BENCH_PACKET_KNN(set, 96);
+    const BenchPointSet sparse = { "sparse random", RandomPoints3D(numPoints / 10, 100.0f, 42), 100.0f };
+    BENCH_WARM_START(pointSets[0], 64);
+    BENCH_WARM_START(sparse, 64);
+    for (const auto& set : pointSets) 
+        BENCH_TRAVERSAL_STATS(set, numPoints);
+    BENCH_SPLIT_DIMS("thin slab", kdTree::make_float3(100.0f, 100.0f, 1.0f), numPoints, numPoints);
+    BENCH_SPLIT_DIMS("long pipe", kdTree::make_float3(400.0f, 2.0f, 2.0f), numPoints, numPoints);
+    for (const auto& set : pointSets) 
+        BENCH_GRID_KNN(set, 64);
+    BENCH_GRID_KNN({ "sparse random", RandomPoints3D(numPoints / 100, 100.0f, 42), 100.0f }, 64);
+    for (const auto& set : pointSets) 
+        BENCH_KNN_GRAPH(set, numThreads);
+    BENCH_OUT_OF_CORE(10 * numPoints, numThreads);
+    BENCH_DYNAMIC_INSERT(std::min(numPoints, 100000), 1000);
+    for (const auto& set : pointSets) 
+        BENCH_VALUE_UPDATE(set, numThreads);
+    BENCH_ND_KNN(numPoints, 20000, numThreads);
+    for (const auto& set : pointSets) 
+        BENCH_QUANTIZED_KNN(set, numPoints);
+    BENCH_BLOCKED_LAYOUT(pointSets[0], numPoints);
+    BENCH_BLOCKED_LAYOUT({ "uniform random", RandomPoints3D(4 * numPoints, 100.0f, 42), 100.0f }, numPoints);
+    {
+        // the lattice queried from a grid twice its size, and a small cluster inside a large grid
+        auto latticeGrid = GridSweepQueries(48, 128.0f, 1, 1, 1);
+        for (auto& q : latticeGrid) 
+            q = q - kdTree::make_float3(32.0f, 32.0f, 32.0f);
+        BENCH_BOX_PRUNED_KNN("64^3 lattice", IntegerLattice(64), latticeGrid, 128.0f);
+        auto cluster = RandomPoints3D(numPoints, 30.0f, 42);
+        for (auto& p : cluster) 
+            p = kdTree::make_float3(p.x + 35.0f, p.y + 35.0f, p.z + 35.0f);
+        BENCH_BOX_PRUNED_KNN("sparse cluster", cluster, GridSweepQueries(48, 100.0f, 1, 1, 1), 100.0f);
+    }
     
     return 0;
 }
\ No newline at end of file